@@ -0,0 +1,75 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_bench_bench_client_h_
+#define jchat_bench_bench_client_h_
+
+// Required libraries
+#include "chat_client.h"
+#include "components/system_component.h"
+#include "components/user_component.h"
+#include "components/channel_component.h"
+#include "latency_recorder.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace jchat {
+// One simulated user, built from the same client and components as
+// jchat_client. Messages it sends carry the time they were sent at, so the
+// receiving clients can measure the end-to-end latency.
+class BenchClient {
+  std::string username_;
+  ChatClient chat_client_;
+  std::shared_ptr<SystemComponent> system_component_;
+  std::shared_ptr<UserComponent> user_component_;
+  std::shared_ptr<ChannelComponent> channel_component_;
+  size_t message_size_;
+
+  std::atomic<bool> is_connected_;
+  std::atomic<bool> is_hello_completed_;
+  std::atomic<bool> is_identified_;
+  std::atomic<size_t> joined_channel_count_;
+  std::atomic<size_t> failure_count_;
+  std::atomic<uint64_t> sent_message_count_;
+  std::atomic<uint64_t> received_message_count_;
+  LatencyRecorder latencies_;
+
+  std::string createMessage();
+  void onMessageReceived(const std::string &message);
+
+public:
+  BenchClient(const std::string &username, const char *hostname,
+    uint16_t port, const std::string &protocol_version, bool is_compressed,
+    std::chrono::microseconds batch_window, size_t message_size,
+    ClientReactor *reactor);
+  ~BenchClient();
+
+  bool Connect();
+  bool Disconnect();
+
+  // These only queue the request, completion is seen through the getters
+  bool Identify();
+  bool JoinChannel(const std::string &channel_name);
+  bool SendChannelMessage(const std::string &channel_name);
+  bool SendUserMessage(const std::string &username);
+
+  const std::string &GetUsername();
+  bool IsConnected();
+  bool IsHelloCompleted();
+  bool IsIdentified();
+  size_t GetJoinedChannelCount();
+  // Requests the server refused
+  size_t GetFailureCount();
+  uint64_t GetSentMessageCount();
+  uint64_t GetReceivedMessageCount();
+  LatencyRecorder &GetLatencies();
+};
+}
+
+#endif // jchat_bench_bench_client_h_
@@ -0,0 +1,40 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_bench_latency_recorder_h_
+#define jchat_bench_latency_recorder_h_
+
+// Required libraries
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+namespace jchat {
+// Keeps every recorded latency so percentiles are exact. Each simulated
+// client records into its own recorder, they are merged for the report.
+class LatencyRecorder {
+  std::vector<uint64_t> samples_;
+  std::mutex samples_mutex_;
+  bool is_sorted_;
+
+public:
+  LatencyRecorder();
+
+  void Record(uint64_t nanoseconds);
+  void Merge(LatencyRecorder &other);
+  void Clear();
+
+  size_t GetCount();
+  // Fraction from 0 to 1, e.g. 0.99 for the 99th percentile
+  uint64_t GetPercentile(double fraction);
+  uint64_t GetMax();
+  uint64_t GetMean();
+};
+}
+
+#endif // jchat_bench_latency_recorder_h_
@@ -0,0 +1,212 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#include "bench_client.h"
+#include <chrono>
+#include <stdlib.h>
+
+// Every benchmark message starts with this, followed by the time it was
+// sent at in nanoseconds on the steady clock
+#define JCHAT_BENCH_MESSAGE_PREFIX "bench:"
+
+namespace jchat {
+static uint64_t GetTime() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+BenchClient::BenchClient(const std::string &username, const char *hostname,
+  uint16_t port, const std::string &protocol_version, bool is_compressed,
+  std::chrono::microseconds batch_window, size_t message_size,
+  ClientReactor *reactor) : username_(username),
+  chat_client_(hostname, port),
+  system_component_(std::make_shared<SystemComponent>()),
+  user_component_(std::make_shared<UserComponent>()),
+  channel_component_(std::make_shared<ChannelComponent>()),
+  message_size_(message_size), is_connected_(false),
+  is_hello_completed_(false), is_identified_(false),
+  joined_channel_count_(0), failure_count_(0), sent_message_count_(0),
+  received_message_count_(0) {
+  chat_client_.SetReactor(reactor);
+  system_component_->SetProtocolVersion(protocol_version);
+  system_component_->SetPresenceChangesEnabled(true);
+  if (is_compressed) {
+    system_component_->SetCompressionType(kCompressionType_Deflate);
+  }
+  if (batch_window.count() > 0) {
+    system_component_->SetBatchingEnabled(true);
+    chat_client_.SetBatchLimits(batch_window, JCHAT_CHAT_BATCH_MAX_SIZE);
+  }
+
+  chat_client_.OnDisconnected.Add([this]() {
+    is_connected_ = false;
+    return true;
+  });
+  system_component_->OnHelloCompleted.Add([this](SystemMessageResult result) {
+    if (result == kSystemMessageResult_Ok) {
+      is_hello_completed_ = true;
+    } else {
+      failure_count_++;
+    }
+    return true;
+  });
+  user_component_->OnIdentifyCompleted.Add([this](UserMessageResult result,
+    std::string &username) {
+    if (result == kUserMessageResult_Ok) {
+      is_identified_ = true;
+    } else {
+      failure_count_++;
+    }
+    return true;
+  });
+  user_component_->OnSendMessageCompleted.Add([this](
+    UserMessageResult result, std::string &username, std::string &message) {
+    if (result != kUserMessageResult_Ok) {
+      failure_count_++;
+    }
+    return true;
+  });
+  user_component_->OnMessage.Add([this](std::string &source_username,
+    std::string &source_hostname, std::string &target, std::string &message) {
+    // Also raised for the messages this client sent
+    if (target == username_) {
+      onMessageReceived(message);
+    }
+    return true;
+  });
+  channel_component_->OnJoinCompleted.Add([this](ChannelMessageResult result,
+    std::string &channel_name) {
+    if (result == kChannelMessageResult_Ok
+      || result == kChannelMessageResult_ChannelCreated) {
+      joined_channel_count_++;
+    } else {
+      failure_count_++;
+    }
+    return true;
+  });
+  channel_component_->OnSendMessageCompleted.Add([this](
+    ChannelMessageResult result, std::string &channel_name,
+    std::string &message) {
+    if (result != kChannelMessageResult_Ok) {
+      failure_count_++;
+    }
+    return true;
+  });
+  channel_component_->OnChannelMessage.Add([this](ChatChannel &channel,
+    ChatUser &user, std::string &message) {
+    // Also raised for the messages this client sent
+    if (user.Username != username_) {
+      onMessageReceived(message);
+    }
+    return true;
+  });
+
+  chat_client_.AddComponent(system_component_);
+  chat_client_.AddComponent(user_component_);
+  chat_client_.AddComponent(channel_component_);
+}
+
+BenchClient::~BenchClient() {
+  Disconnect();
+}
+
+std::string BenchClient::createMessage() {
+  std::string message = JCHAT_BENCH_MESSAGE_PREFIX + std::to_string(GetTime())
+    + " ";
+  if (message.size() < message_size_) {
+    message.append(message_size_ - message.size(), 'x');
+  }
+  return message;
+}
+
+void BenchClient::onMessageReceived(const std::string &message) {
+  uint64_t now = GetTime();
+  size_t prefix_size = sizeof(JCHAT_BENCH_MESSAGE_PREFIX) - 1;
+  if (message.compare(0, prefix_size, JCHAT_BENCH_MESSAGE_PREFIX) != 0) {
+    return;
+  }
+  uint64_t sent_time = strtoull(message.c_str() + prefix_size, NULL, 10);
+  received_message_count_++;
+  latencies_.Record(now > sent_time ? now - sent_time : 0);
+}
+
+bool BenchClient::Connect() {
+  if (!chat_client_.Connect()) {
+    return false;
+  }
+  is_connected_ = true;
+  return true;
+}
+
+bool BenchClient::Disconnect() {
+  if (!is_connected_) {
+    return false;
+  }
+  return chat_client_.Disconnect();
+}
+
+bool BenchClient::Identify() {
+  return user_component_->Identify(username_);
+}
+
+bool BenchClient::JoinChannel(const std::string &channel_name) {
+  return channel_component_->JoinChannel(channel_name);
+}
+
+bool BenchClient::SendChannelMessage(const std::string &channel_name) {
+  if (!channel_component_->SendMessage(channel_name, createMessage())) {
+    return false;
+  }
+  sent_message_count_++;
+  return true;
+}
+
+bool BenchClient::SendUserMessage(const std::string &username) {
+  if (!user_component_->SendMessage(username, createMessage())) {
+    return false;
+  }
+  sent_message_count_++;
+  return true;
+}
+
+const std::string &BenchClient::GetUsername() {
+  return username_;
+}
+
+bool BenchClient::IsConnected() {
+  return is_connected_;
+}
+
+bool BenchClient::IsHelloCompleted() {
+  return is_hello_completed_;
+}
+
+bool BenchClient::IsIdentified() {
+  return is_identified_;
+}
+
+size_t BenchClient::GetJoinedChannelCount() {
+  return joined_channel_count_;
+}
+
+size_t BenchClient::GetFailureCount() {
+  return failure_count_;
+}
+
+uint64_t BenchClient::GetSentMessageCount() {
+  return sent_message_count_;
+}
+
+uint64_t BenchClient::GetReceivedMessageCount() {
+  return received_message_count_;
+}
+
+LatencyRecorder &BenchClient::GetLatencies() {
+  return latencies_;
+}
+}
@@ -0,0 +1,82 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#include "latency_recorder.h"
+#include <algorithm>
+
+namespace jchat {
+LatencyRecorder::LatencyRecorder() : is_sorted_(true) {
+}
+
+void LatencyRecorder::Record(uint64_t nanoseconds) {
+  samples_mutex_.lock();
+  samples_.push_back(nanoseconds);
+  is_sorted_ = false;
+  samples_mutex_.unlock();
+}
+
+void LatencyRecorder::Merge(LatencyRecorder &other) {
+  other.samples_mutex_.lock();
+  std::vector<uint64_t> samples = other.samples_;
+  other.samples_mutex_.unlock();
+
+  samples_mutex_.lock();
+  samples_.insert(samples_.end(), samples.begin(), samples.end());
+  is_sorted_ = false;
+  samples_mutex_.unlock();
+}
+
+void LatencyRecorder::Clear() {
+  samples_mutex_.lock();
+  samples_.clear();
+  is_sorted_ = true;
+  samples_mutex_.unlock();
+}
+
+size_t LatencyRecorder::GetCount() {
+  samples_mutex_.lock();
+  size_t count = samples_.size();
+  samples_mutex_.unlock();
+  return count;
+}
+
+uint64_t LatencyRecorder::GetPercentile(double fraction) {
+  samples_mutex_.lock();
+  if (samples_.empty()) {
+    samples_mutex_.unlock();
+    return 0;
+  }
+  if (!is_sorted_) {
+    std::sort(samples_.begin(), samples_.end());
+    is_sorted_ = true;
+  }
+  size_t index = static_cast<size_t>(fraction * (samples_.size() - 1));
+  uint64_t value = samples_[index];
+  samples_mutex_.unlock();
+  return value;
+}
+
+uint64_t LatencyRecorder::GetMax() {
+  return GetPercentile(1.0);
+}
+
+uint64_t LatencyRecorder::GetMean() {
+  samples_mutex_.lock();
+  if (samples_.empty()) {
+    samples_mutex_.unlock();
+    return 0;
+  }
+  uint64_t sum = 0;
+  for (uint64_t sample : samples_) {
+    sum += sample;
+  }
+  uint64_t mean = sum / samples_.size();
+  samples_mutex_.unlock();
+  return mean;
+}
+}
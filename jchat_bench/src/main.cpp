@@ -0,0 +1,277 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+// Required libraries
+#include "command_line.hpp"
+#include "bench_client.h"
+#include "latency_recorder.h"
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+enum Workload {
+  // Every client is in one channel and every message goes to all of them
+  kWorkload_Channel,
+  // Clients are split into channels of -channelsize clients
+  kWorkload_Channels,
+  // Clients only message other clients directly
+  kWorkload_DirectMessages,
+};
+
+typedef std::chrono::steady_clock Clock;
+typedef std::vector<std::unique_ptr<jchat::BenchClient>> BenchClients;
+
+static double GetElapsedSeconds(Clock::time_point start_time) {
+  return std::chrono::duration<double>(Clock::now() - start_time).count();
+}
+
+// Waits until every connected client passed the check, or the timeout ran
+// out. Returns the number of clients that passed.
+static size_t WaitForClients(BenchClients &clients,
+  std::function<bool(jchat::BenchClient &)> check, double timeout) {
+  Clock::time_point start_time = Clock::now();
+  while (true) {
+    size_t passed_count = 0;
+    size_t connected_count = 0;
+    for (auto &client : clients) {
+      if (client->IsConnected()) {
+        connected_count++;
+        if (check(*client)) {
+          passed_count++;
+        }
+      }
+    }
+    if (passed_count == connected_count
+      || GetElapsedSeconds(start_time) > timeout) {
+      return passed_count;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+static std::string GetChannelName(Workload workload, size_t client_index,
+  size_t channel_size) {
+  if (workload == kWorkload_Channel) {
+    return "#bench";
+  }
+  return "#bench" + std::to_string(client_index / channel_size);
+}
+
+static void PrintPhase(const char *name, size_t count, size_t total,
+  Clock::time_point start_time) {
+  std::cout << std::left << std::setw(12) << name << count << "/" << total
+            << " clients in " << std::fixed << std::setprecision(3)
+            << GetElapsedSeconds(start_time) << "s" << std::endl;
+}
+
+// Program entrypoint
+int main(int argc, char **argv) {
+  std::cout << "jChatSystem - Benchmark" << std::endl;
+
+  jchat::CommandLine command_line(argc, argv);
+  if (argc > 1) {
+    std::cout << "Starting with arguments..." << std::endl;
+    std::cout << command_line << std::endl;
+  }
+
+  std::string hostname = command_line.GetString("ipaddress", "127.0.0.1");
+  uint16_t port = static_cast<uint16_t>(command_line.GetInt32("port", 9998));
+  std::string protocol_version = command_line.GetString("protocol",
+    JCHAT_CHAT_PROTOCOL_VERSION);
+  bool is_compressed = command_line.GetString("compression", "none")
+    == "deflate";
+  // Microseconds messages wait to be batched, 0 sends them one by one
+  int32_t batch_window = command_line.GetInt32("batchwindow", 0);
+  int32_t client_count = command_line.GetInt32("clients", 100);
+  int32_t channel_size = command_line.GetInt32("channelsize", 10);
+  int32_t message_size = command_line.GetInt32("messagesize", 64);
+  int32_t sender_count = command_line.GetInt32("senders", 4);
+  double duration = command_line.GetInt32("duration", 10);
+  // Messages per second sent by every client
+  double message_rate = command_line.GetInt32("rate", 1);
+  double timeout = command_line.GetInt32("timeout", 30);
+  // Threads the connections are read on, 0 gives every client its own
+  int32_t io_thread_count = command_line.GetInt32("iothreads", 4);
+
+  Workload workload;
+  std::string workload_name = command_line.GetString("workload", "channel");
+  if (workload_name == "channel") {
+    workload = kWorkload_Channel;
+  } else if (workload_name == "channels") {
+    workload = kWorkload_Channels;
+  } else if (workload_name == "dm") {
+    workload = kWorkload_DirectMessages;
+  } else {
+    std::cout << "Unknown workload, use channel, channels or dm" << std::endl;
+    return 1;
+  }
+  if (client_count < 2 || channel_size < 2 || sender_count < 1
+    || message_size < 1 || duration <= 0 || message_rate <= 0
+    || io_thread_count < 0) {
+    std::cout << "Invalid arguments" << std::endl;
+    return 1;
+  }
+
+  // Declared before the clients, which it has to outlive
+  jchat::ClientReactor reactor;
+  if (io_thread_count > 0 && !reactor.Start(io_thread_count)) {
+    std::cout << "Failed to start the reactor" << std::endl;
+    return 1;
+  }
+
+  // Connect, which also sends the Hello
+  BenchClients clients;
+  Clock::time_point start_time = Clock::now();
+  for (int32_t i = 0; i < client_count; i++) {
+    std::unique_ptr<jchat::BenchClient> client(new jchat::BenchClient(
+      "bench" + std::to_string(i), hostname.c_str(), port, protocol_version,
+      is_compressed, std::chrono::microseconds(batch_window),
+      static_cast<size_t>(message_size),
+      io_thread_count > 0 ? &reactor : nullptr));
+    if (!client->Connect()) {
+      std::cout << "Failed to connect client " << i << std::endl;
+      return 1;
+    }
+    clients.push_back(std::move(client));
+  }
+  size_t ready_count = WaitForClients(clients, [](jchat::BenchClient &client) {
+    return client.IsHelloCompleted();
+  }, timeout);
+  PrintPhase("Hello", ready_count, clients.size(), start_time);
+
+  start_time = Clock::now();
+  for (auto &client : clients) {
+    client->Identify();
+  }
+  size_t identified_count = WaitForClients(clients,
+    [](jchat::BenchClient &client) {
+    return client.IsIdentified();
+  }, timeout);
+  PrintPhase("Identify", identified_count, clients.size(), start_time);
+
+  if (workload != kWorkload_DirectMessages) {
+    start_time = Clock::now();
+    for (size_t i = 0; i < clients.size(); i++) {
+      clients[i]->JoinChannel(GetChannelName(workload, i, channel_size));
+    }
+    size_t joined_count = WaitForClients(clients,
+      [](jchat::BenchClient &client) {
+      return client.GetJoinedChannelCount() > 0;
+    }, timeout);
+    PrintPhase("Join", joined_count, clients.size(), start_time);
+  }
+
+  // Every sender thread paces the messages of its share of the clients, so
+  // the clients send at the requested rate on average
+  std::cout << "Running " << workload_name << " for " << duration << "s"
+            << std::endl;
+  std::vector<std::thread> senders;
+  start_time = Clock::now();
+  for (int32_t sender = 0; sender < sender_count; sender++) {
+    senders.push_back(std::thread([&, sender]() {
+      std::vector<size_t> indexes;
+      for (size_t i = sender; i < clients.size(); i += sender_count) {
+        indexes.push_back(i);
+      }
+      if (indexes.empty()) {
+        return;
+      }
+      std::chrono::nanoseconds interval(static_cast<int64_t>(
+        1000000000.0 / (message_rate * indexes.size())));
+      Clock::time_point next_time = Clock::now();
+      size_t round = 0;
+      while (GetElapsedSeconds(start_time) < duration) {
+        for (size_t i : indexes) {
+          jchat::BenchClient &client = *clients[i];
+          if (!client.IsConnected()) {
+            continue;
+          }
+          if (workload == kWorkload_DirectMessages) {
+            // Walk through the other clients one round at a time
+            size_t target = (i + 1 + round % (clients.size() - 1))
+              % clients.size();
+            client.SendUserMessage(clients[target]->GetUsername());
+          } else {
+            client.SendChannelMessage(GetChannelName(workload, i,
+              channel_size));
+          }
+
+          next_time += interval;
+          std::this_thread::sleep_until(next_time);
+          if (GetElapsedSeconds(start_time) >= duration) {
+            break;
+          }
+        }
+        round++;
+      }
+    }));
+  }
+  for (auto &sender : senders) {
+    sender.join();
+  }
+  double send_seconds = GetElapsedSeconds(start_time);
+
+  // Give the last messages time to arrive
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+
+  uint64_t sent_count = 0;
+  uint64_t received_count = 0;
+  uint64_t expected_count = 0;
+  size_t failure_count = 0;
+  size_t connected_count = 0;
+  jchat::LatencyRecorder latencies;
+  for (size_t i = 0; i < clients.size(); i++) {
+    jchat::BenchClient &client = *clients[i];
+    sent_count += client.GetSentMessageCount();
+    received_count += client.GetReceivedMessageCount();
+    failure_count += client.GetFailureCount();
+    if (client.IsConnected()) {
+      connected_count++;
+    }
+    latencies.Merge(client.GetLatencies());
+
+    // Every message reaches the other members of the sender's channel
+    size_t recipient_count = 1;
+    if (workload == kWorkload_Channel) {
+      recipient_count = clients.size() - 1;
+    } else if (workload == kWorkload_Channels) {
+      size_t first = i / channel_size * channel_size;
+      size_t last = std::min(first + channel_size, clients.size());
+      recipient_count = last - first - 1;
+    }
+    expected_count += client.GetSentMessageCount() * recipient_count;
+  }
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "Sent:       " << sent_count << " messages ("
+            << sent_count / send_seconds << "/s)" << std::endl;
+  std::cout << "Delivered:  " << received_count << "/" << expected_count
+            << " messages (" << received_count / send_seconds << "/s)"
+            << std::endl;
+  std::cout << "Failures:   " << failure_count << ", "
+            << clients.size() - connected_count << " clients disconnected"
+            << std::endl;
+  std::cout << "Latency:    mean " << latencies.GetMean() / 1000.0
+            << "us, p50 " << latencies.GetPercentile(0.5) / 1000.0
+            << "us, p90 " << latencies.GetPercentile(0.9) / 1000.0
+            << "us, p99 " << latencies.GetPercentile(0.99) / 1000.0
+            << "us, p99.9 " << latencies.GetPercentile(0.999) / 1000.0
+            << "us, max " << latencies.GetMax() / 1000.0 << "us"
+            << std::endl;
+
+  for (auto &client : clients) {
+    client->Disconnect();
+  }
+
+  return received_count == expected_count ? 0 : 2;
+}
@@ -10,19 +10,28 @@
 #define jchat_client_chat_channel_h_
 
 #include "chat_user.h"
-#include <vector>
+#include <deque>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace jchat {
 struct ChatChannel {
   bool Enabled;
   std::string Name;
-  std::vector<std::shared_ptr<ChatUser>> Operators;
+  uint64_t MemberCount; // Other members, as last reported by the server
+  // Members and the operators among them by ChatUser::Username, which the
+  // server keeps unique in a channel
+  std::unordered_map<std::string, std::shared_ptr<ChatUser>> Operators;
   std::mutex OperatorsMutex;
-  std::vector<std::shared_ptr<ChatUser>> Clients;
+  std::unordered_map<std::string, std::shared_ptr<ChatUser>> Clients;
   std::mutex ClientsMutex;
-  std::vector<std::string> BannedUsers; // Format: username@hostname
+  std::unordered_set<std::string> BannedUsers; // Format: username@hostname
   std::mutex BannedUsersMutex;
+  // Milliseconds ago each of the history messages that are still to come
+  // was sent, oldest first
+  std::deque<uint64_t> HistoryAges;
 };
 }
 
@@ -13,20 +13,81 @@
 #include "tcp_client.hpp"
 #include "chat_component.h"
 #include "chat_channel.h"
+#include "chat_request.h"
+#include "wire_format.hpp"
+#include "deflate_stream.hpp"
+#include "delay_queue.hpp"
+#include "frame_batch.hpp"
 #include "protocol/protocol.h"
 #include "protocol/component_type.h"
+#include <unordered_map>
 
 namespace jchat {
 class ChatClient {
+  // A request that waits for its reply
+  struct PendingRequest {
+    uint8_t ComponentType;
+    uint16_t ReplyType;
+    std::function<void(RequestStatus, uint16_t)> OnCompleted;
+    // Only set for requests with a timeout
+    std::chrono::steady_clock::time_point Deadline;
+    bool IsTimed;
+  };
+
   bool is_connected_;
   TcpClient tcp_client_;
   bool is_little_endian_;
   std::vector<std::shared_ptr<ChatComponent>> components_;
+  // Only one component can handle each component type, received messages
+  // are routed by indexing this table
+  std::shared_ptr<ChatComponent> components_by_type_[kComponentType_Max];
+  // Chosen by the system component during the Hello handshake
+  std::atomic<WireFormat> send_format_;
+  WireFormat receive_format_;
+  // Set once the server accepted compression. Compressed frames have to be
+  // sent in the order they were compressed in.
+  std::shared_ptr<DeflateStream> compression_;
+  std::mutex compression_mutex_;
+  std::vector<uint8_t> receive_buffer_;
+  // Set once the server accepted batching, messages then wait in the batch
+  // until the batch window runs out or the batch is full
+  std::atomic<bool> is_batching_;
+  FrameBatch batch_;
+  bool is_batch_scheduled_;
+  std::mutex batch_mutex_;
+  DelayQueue batch_queue_;
+  std::chrono::microseconds batch_window_;
+  size_t batch_max_size_;
+  // Set once the server accepted request ids. Requests by id, the timer
+  // checks them for timeouts while any of them has one.
+  std::atomic<bool> is_request_id_enabled_;
+  std::unordered_map<uint32_t, PendingRequest> pending_requests_;
+  uint32_t next_request_id_;
+  size_t timed_request_count_;
+  bool is_request_timer_scheduled_;
+  std::mutex requests_mutex_;
+  DelayQueue request_timer_;
 
   // Internal events
   bool onConnected();
   bool onDisconnected();
-  bool onDataReceived(Buffer &buffer);
+  bool onDataReceived(StreamBuffer &stream);
+
+  // Internal functions
+  bool handleMessage(uint8_t component_type, uint16_t message_type,
+    const uint8_t *body, size_t size);
+  // Completes the request if the message is its reply
+  void completeRequest(uint32_t request_id, uint8_t component_type,
+    uint16_t message_type, const uint8_t *body, size_t size);
+  void expireRequests();
+  void failRequests();
+  // A request id of 0 sends the message without one
+  bool sendMessage(ComponentType component_type, uint8_t message_type,
+    TypedBuffer &buffer, uint32_t request_id);
+  bool sendFrame(uint8_t component_type, uint16_t message_type,
+    const uint8_t *body, size_t body_size, uint32_t request_id);
+  // NOTE: batch_mutex_ has to be held
+  bool sendBatch();
 
 public:
   ChatClient(const char *hostname, uint16_t port);
@@ -35,6 +96,15 @@ public:
   bool Connect();
   bool Disconnect();
 
+  // Runs the connection on a worker of a reactor shared with other clients
+  // instead of a thread of its own. Only while disconnected, the reactor has
+  // to outlive the client.
+  bool SetReactor(ClientReactor *reactor);
+
+  // Connects through the Unix domain socket of a server on the same host
+  // instead, only while disconnected. See TcpClient::SetLocalPath.
+  bool SetLocalPath(const std::string &local_path);
+
   bool AddComponent(std::shared_ptr<ChatComponent> component);
   bool RemoveComponent(std::shared_ptr<ChatComponent> component);
 
@@ -50,6 +120,43 @@ public:
   TypedBuffer CreateBuffer();
   bool Send(ComponentType component_type, uint8_t message_type,
     TypedBuffer &buffer);
+  // Sends the message with a request id if the request has a handler, which
+  // is called with the reply. Fails without sending anything if the server
+  // didn't accept request ids. Any number of requests may wait at once.
+  bool Send(ComponentType component_type, uint8_t message_type,
+    TypedBuffer &buffer, const ChatRequest &request);
+
+  void SetSendFormat(WireFormat send_format);
+  WireFormat GetSendFormat();
+  void SetReceiveFormat(WireFormat receive_format);
+  WireFormat GetReceiveFormat();
+
+  // Starts compressing frames in both directions, see SystemComponent
+  bool EnableCompression();
+  bool IsCompressionEnabled();
+  bool GetCompressionStats(DeflateStats &out_stats);
+
+  // Messages wait up to the window for others to share a frame with, or
+  // until this many bytes are waiting. A window of 0 sends every message
+  // right away. Takes effect the next time batching is enabled.
+  void SetBatchLimits(std::chrono::microseconds batch_window,
+    size_t batch_max_size);
+  // Starts batching sent messages, see SystemComponent
+  bool EnableBatching();
+  bool IsBatchingEnabled();
+  // Sends the waiting messages without waiting for the window
+  bool Flush();
+
+  // Handles frames that came from elsewhere than a connection, such as the
+  // tap of a server on this host (see SharedRingReader), like received
+  // ones. A partial frame is left in the stream. Only while disconnected.
+  bool HandleFrames(StreamBuffer &stream);
+
+  // Lets requests carry ids, see SystemComponent
+  bool EnableRequestIds();
+  bool IsRequestIdEnabled();
+  // Requests that wait for their reply
+  size_t GetPendingRequestCount();
 
   IPEndpoint GetLocalEndpoint();
   IPEndpoint GetRemoteEndpoint();
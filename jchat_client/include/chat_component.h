@@ -12,6 +12,7 @@
 #include "protocol/component_type.h"
 #include "remote_chat_client.h"
 #include "typed_buffer.hpp"
+#include "typed_buffer_view.hpp"
 
 namespace jchat {
 class ChatClient;
@@ -27,7 +28,7 @@ public:
 
   // Handler functions
   virtual ComponentType GetType() = 0;
-  virtual bool Handle(uint16_t message_type, TypedBuffer &buffer) = 0;
+  virtual bool Handle(uint16_t message_type, TypedBufferView &buffer) = 0;
 };
 }
 
@@ -0,0 +1,49 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_client_chat_request_h_
+#define jchat_client_chat_request_h_
+
+#include <chrono>
+#include <functional>
+#include <stdint.h>
+
+namespace jchat {
+enum RequestStatus : uint8_t {
+  // The server answered, the result is the result of the reply
+  kRequestStatus_Completed,
+  kRequestStatus_TimedOut,
+  // The connection closed before the server answered
+  kRequestStatus_Disconnected,
+  // The server dropped the request because the client sent too many
+  // messages, the result is 0. See SystemComponent::OnThrottled.
+  kRequestStatus_Throttled,
+};
+
+// Completion of a request sent through ChatClient::Send. A request without
+// a handler is sent without an id, like any other message. The handler runs
+// after the reply was handled by its component and raised its events, the
+// result is the first field of the reply, the ChannelMessageResult,
+// UserMessageResult or SystemMessageResult. Replies answer the request of
+// the same component with the message type that follows the request's.
+struct ChatRequest {
+  std::function<void(RequestStatus, uint16_t)> OnCompleted;
+  // 0 waits for as long as the connection lasts
+  std::chrono::milliseconds Timeout;
+
+  ChatRequest() : Timeout(0) {
+  }
+
+  ChatRequest(std::function<void(RequestStatus, uint16_t)> on_completed,
+    std::chrono::milliseconds timeout = std::chrono::milliseconds(0))
+    : OnCompleted(on_completed), Timeout(timeout) {
+  }
+};
+}
+
+#endif // jchat_client_chat_request_h_
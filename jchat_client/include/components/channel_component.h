@@ -10,16 +10,66 @@
 #define jchat_client_channel_component_h_
 
 #include "chat_component.h"
+#include "message_dispatcher.hpp"
+#include "protocol/components/channel_message_type.h"
 #include "chat_channel.h"
+#include "chat_request.h"
 #include "protocol/components/channel_message_result.h"
 #include "event.hpp"
+#include <set>
 
 namespace jchat {
 class ChannelComponent : public ChatComponent {
 private:
   ChatClient *client_;
-  std::vector<std::shared_ptr<ChatChannel>> channels_;
+  // Joined channels by name
+  std::unordered_map<std::string, std::shared_ptr<ChatChannel>> channels_;
   std::mutex channels_mutex_;
+  // Patterns the server confirmed, guarded by the channels mutex
+  std::set<std::string> subscriptions_;
+  bool is_tailing_;
+
+  // Has to be called with the channels mutex held
+  std::shared_ptr<ChatChannel> findChannel(const std::string &channel_name);
+
+  // Adds a page of members sent by the server to the channel, members that
+  // are already known are skipped
+  bool readMembers(ChatChannel &chat_channel, TypedBufferView &buffer);
+  // Both raise the event unless the member was already known or unknown
+  void addMember(ChatChannel &chat_channel, const std::string &username,
+    const std::string &hostname);
+  void removeMember(ChatChannel &chat_channel, const std::string &username,
+    const std::string &hostname);
+  // Removes the member from the members and operators, returns null if it was
+  // unknown
+  std::shared_ptr<ChatUser> takeMember(ChatChannel &chat_channel,
+    const std::string &username, const std::string &hostname);
+
+  MessageDispatcher<ChannelComponent, kChannelMessageType_Max,
+    TypedBufferView &> dispatcher_;
+
+  // Message handlers
+  bool handleJoinChannelComplete(TypedBufferView &buffer);
+  bool handleLeaveChannelComplete(TypedBufferView &buffer);
+  bool handleSendMessageComplete(TypedBufferView &buffer);
+  bool handleOpUserComplete(TypedBufferView &buffer);
+  bool handleDeopUserComplete(TypedBufferView &buffer);
+  bool handleKickUserComplete(TypedBufferView &buffer);
+  bool handleBanUserComplete(TypedBufferView &buffer);
+  bool handleUnbanUserComplete(TypedBufferView &buffer);
+  bool handleGetMembersComplete(TypedBufferView &buffer);
+  bool handleSubscribeComplete(TypedBufferView &buffer);
+  bool handleUnsubscribeComplete(TypedBufferView &buffer);
+  bool handleJoinChannel(TypedBufferView &buffer);
+  bool handleLeaveChannel(TypedBufferView &buffer);
+  bool handleSendMessage(TypedBufferView &buffer);
+  bool handleOpUser(TypedBufferView &buffer);
+  bool handleDeopUser(TypedBufferView &buffer);
+  bool handleKickUser(TypedBufferView &buffer);
+  bool handleBanUser(TypedBufferView &buffer);
+  bool handleUnbanUser(TypedBufferView &buffer);
+  bool handlePresenceChanged(TypedBufferView &buffer);
+  bool handleHistory(TypedBufferView &buffer);
 
 public:
   ChannelComponent();
@@ -35,17 +85,52 @@ public:
 
   // Handler functions
   virtual ComponentType GetType() override;
-  virtual bool Handle(uint16_t message_type, TypedBuffer &buffer) override;
+  virtual bool Handle(uint16_t message_type, TypedBufferView &buffer) override;
 
   // API functions
-  bool JoinChannel(std::string channel_name);
-  bool LeaveChannel(std::string channel_name);
-  bool SendMessage(std::string channel_name, std::string message);
-  bool OpUser(std::string channel_name, std::string username);
-  bool DeopUser(std::string channel_name, std::string username);
-  bool KickUser(std::string channel_name, std::string username);
-  bool BanUser(std::string channel_name, std::string username);
-  bool UnbanUser(std::string channel_name, std::string username);
+  // Forgets every channel and subscription without raising any events, for
+  // sessions that ended while the client was disconnected
+  void ClearChannels();
+
+  // Raises OnChannelMessage for messages of channels the client isn't in as
+  // well, with a channel and sender that aren't kept. For clients that
+  // tail the tap of a server, see ChatClient::HandleFrames.
+  void SetTailing(bool is_tailing);
+  bool IsTailing();
+
+  // A request with a handler is completed with the ChannelMessageResult of
+  // the reply, after the reply raised its event, see ChatClient::Send.
+  // The ban list of the channel is only sent if include_bans is set. Up to
+  // history_count of the channel's last messages are raised as
+  // OnChannelHistory after the join.
+  bool JoinChannel(std::string channel_name, bool include_bans = false,
+    uint64_t history_count = 0, const ChatRequest &request = ChatRequest());
+  bool LeaveChannel(std::string channel_name,
+    const ChatRequest &request = ChatRequest());
+  bool SendMessage(std::string channel_name, std::string message,
+    const ChatRequest &request = ChatRequest());
+  bool OpUser(std::string channel_name, std::string username,
+    const ChatRequest &request = ChatRequest());
+  bool DeopUser(std::string channel_name, std::string username,
+    const ChatRequest &request = ChatRequest());
+  bool KickUser(std::string channel_name, std::string username,
+    const ChatRequest &request = ChatRequest());
+  bool BanUser(std::string channel_name, std::string username,
+    const ChatRequest &request = ChatRequest());
+  bool UnbanUser(std::string channel_name, std::string username,
+    const ChatRequest &request = ChatRequest());
+  // Requests the page of members that starts at the cursor. The pages after
+  // the one sent with the join are requested automatically.
+  bool GetMembers(std::string channel_name, uint64_t cursor,
+    const ChatRequest &request = ChatRequest());
+  // Gets the messages of every channel whose name matches the pattern, with
+  // '*' and '?' as wildcards, without joining them. Only messages of the
+  // sender are sent if one is given. They are raised as OnChannelMessage
+  // with a channel and sender that aren't kept, like when tailing.
+  bool Subscribe(std::string pattern, std::string sender = std::string(),
+    const ChatRequest &request = ChatRequest());
+  bool Unsubscribe(std::string pattern,
+    const ChatRequest &request = ChatRequest());
 
   // API events
   Event<ChannelMessageResult, std::string &> OnJoinCompleted;
@@ -58,11 +143,19 @@ public:
   Event<ChannelMessageResult, std::string &, std::string &> OnBanUserCompleted;
   Event<ChannelMessageResult, std::string &,
     std::string &> OnUnbanUserCompleted;
+  Event<ChannelMessageResult, std::string &> OnGetMembersCompleted;
+  // The pattern and the sender
+  Event<ChannelMessageResult, std::string &,
+    std::string &> OnSubscribeCompleted;
+  Event<ChannelMessageResult, std::string &> OnUnsubscribeCompleted;
 
   Event<ChatChannel &, ChatUser &> OnChannelCreated;
   Event<ChatChannel &, ChatUser &> OnChannelJoined;
   Event<ChatChannel &, ChatUser &> OnChannelLeft;
   Event<ChatChannel &, ChatUser &, std::string &> OnChannelMessage;
+  // The sender may have left, the user is only its name
+  Event<ChatChannel &, ChatUser &, std::string &,
+    std::chrono::milliseconds> OnChannelHistory;
   Event<ChatChannel &, ChatUser &> OnChannelUserOpped;
   Event<ChatChannel &, ChatUser &> OnChannelUserDeopped;
   Event<ChatChannel &, ChatUser &> OnChannelUserKicked;
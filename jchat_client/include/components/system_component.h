@@ -10,13 +10,54 @@
 #define jchat_client_system_component_h_
 
 #include "chat_component.h"
+#include "message_dispatcher.hpp"
+#include "protocol/components/system_message_type.h"
 #include "protocol/components/system_message_result.h"
+#include "protocol/compression_type.h"
+#include "chat_request.h"
 #include "event.hpp"
+#include <chrono>
+#include <string>
+#include <vector>
 
 namespace jchat {
+struct StatsHistogram {
+  std::string Name;
+  uint64_t Count;
+  uint64_t Sum;
+  // Upper bounds, the server keeps histograms in power of two buckets
+  uint64_t Median;
+  uint64_t Percentile99;
+  uint64_t Max;
+};
+
+// The metrics of a server, as sent in reply to GetStats
+struct ServerStats {
+  std::vector<std::pair<std::string, uint64_t>> Counters;
+  std::vector<StatsHistogram> Histograms;
+};
+
 class SystemComponent : public ChatComponent {
 private:
   ChatClient *client_;
+  std::string protocol_version_;
+  CompressionType compression_type_;
+  bool is_batching_enabled_;
+  bool is_presence_changes_enabled_;
+  bool is_heartbeat_enabled_;
+  bool is_request_id_enabled_;
+  bool is_resume_enabled_;
+  bool is_throttle_enabled_;
+
+  MessageDispatcher<SystemComponent, kSystemMessageType_Max,
+    TypedBufferView &> dispatcher_;
+
+  // Message handlers
+  bool handleHelloComplete(TypedBufferView &buffer);
+  bool handleGetStatsComplete(TypedBufferView &buffer);
+  bool handlePing(TypedBufferView &buffer);
+  bool handlePong(TypedBufferView &buffer);
+  bool handleThrottled(TypedBufferView &buffer);
 
 public:
   SystemComponent();
@@ -32,13 +73,67 @@ public:
 
   // Handler functions
   virtual ComponentType GetType() override;
-  virtual bool Handle(uint16_t message_type, TypedBuffer &buffer) override;
+  virtual bool Handle(uint16_t message_type, TypedBufferView &buffer) override;
 
   // API functions
   bool SendHello();
+  // Asks for the server's metrics, the key has to match the server's
+  bool GetStats(const std::string &stats_key,
+    const ChatRequest &request = ChatRequest());
+  // Only answered by servers that negotiated heartbeats
+  bool SendPing(uint64_t ping_id);
+
+  // Defaults to JCHAT_CHAT_PROTOCOL_VERSION, JCHAT_CHAT_LEGACY_PROTOCOL_VERSION
+  // talks to the server in the tagged wire format
+  bool SetProtocolVersion(const std::string &protocol_version);
+  std::string GetProtocolVersion();
+
+  // Asks the server to compress the connection, only deflate is supported
+  // and only when built with JCHAT_USE_ZLIB
+  bool SetCompressionType(CompressionType compression_type);
+  CompressionType GetCompressionType();
+
+  // Asks the server to batch messages in both directions, see
+  // ChatClient::SetBatchLimits
+  void SetBatchingEnabled(bool is_batching_enabled);
+  bool IsBatchingEnabled();
+
+  // Asks the server to send the joins and leaves of a channel together, which
+  // the ChannelComponent reads like single ones
+  void SetPresenceChangesEnabled(bool is_presence_changes_enabled);
+  bool IsPresenceChangesEnabled();
+
+  // Tells the server this client answers its pings, servers drop clients
+  // that don't once they were quiet for twice the server's idle timeout.
+  // Enabled by default.
+  void SetHeartbeatEnabled(bool is_heartbeat_enabled);
+  bool IsHeartbeatEnabled();
+
+  // Asks the server to accept request ids, which requests with a handler
+  // need. Enabled by default.
+  void SetRequestIdEnabled(bool is_request_id_enabled);
+  bool IsRequestIdEnabled();
+
+  // Asks the server for a session token at identify, which lets the client
+  // resume after reconnecting, see UserComponent::Resume. Disabled by
+  // default.
+  void SetResumeEnabled(bool is_resume_enabled);
+  bool IsResumeEnabled();
+
+  // Tells the server this client understands Throttled, otherwise messages
+  // over the server's rate limit are dropped without a word. Enabled by
+  // default.
+  void SetThrottleEnabled(bool is_throttle_enabled);
+  bool IsThrottleEnabled();
 
   // API events
   Event<SystemMessageResult> OnHelloCompleted;
+  Event<SystemMessageResult, ServerStats &> OnGetStatsCompleted;
+  Event<uint64_t> OnPongReceived;
+  // A message was dropped by the server's rate limit, with the time until
+  // it accepts the next one. Requests with a handler also complete with
+  // kRequestStatus_Throttled.
+  Event<ComponentType, uint16_t, std::chrono::milliseconds> OnThrottled;
 };
 }
 
@@ -10,10 +10,15 @@
 #define jchat_client_user_component_h_
 
 #include "chat_component.h"
+#include "message_dispatcher.hpp"
+#include "protocol/components/user_message_type.h"
 #include "chat_user.h"
+#include "chat_request.h"
 #include "protocol/components/user_message_result.h"
 #include "event.hpp"
 #include <memory>
+#include <mutex>
+#include <string>
 #include <map>
 
 namespace jchat {
@@ -23,6 +28,21 @@ private:
 
   // Local user
   std::shared_ptr<ChatUser> user_;
+  // Given at identify if resume was asked for in the Hello
+  std::string resume_token_;
+  std::mutex resume_token_mutex_;
+
+  MessageDispatcher<UserComponent, kUserMessageType_Max,
+    TypedBufferView &> dispatcher_;
+
+  // Message handlers
+  bool handleIdentifyComplete(TypedBufferView &buffer);
+  bool handleSendMessageComplete(TypedBufferView &buffer);
+  bool handleSendMessage(TypedBufferView &buffer);
+  bool handleResumeComplete(TypedBufferView &buffer);
+
+  // Forgets the session along with the channels that were kept for it
+  void endSession();
 
 public:
   UserComponent();
@@ -38,17 +58,33 @@ public:
 
   // Handler functions
   virtual ComponentType GetType() override;
-  virtual bool Handle(uint16_t message_type, TypedBuffer &buffer) override;
+  virtual bool Handle(uint16_t message_type, TypedBufferView &buffer) override;
 
   // API functions
   bool GetChatUser(std::shared_ptr<ChatUser> &out_user);
 
-  bool Identify(std::string username);
-  bool SendMessage(std::string username, std::string message);
+  // Requests with a handler are completed with the UserMessageResult of the
+  // reply, see ChatClient::Send
+  bool Identify(std::string username,
+    const ChatRequest &request = ChatRequest());
+  bool SendMessage(std::string username, std::string message,
+    const ChatRequest &request = ChatRequest());
+
+  // After reconnecting, takes the session back instead of identifying again.
+  // The channels and username stay as they were, and the messages sent to
+  // the session since the connection dropped follow the reply. Fails if
+  // there is no session, see SystemComponent::SetResumeEnabled.
+  bool Resume(const ChatRequest &request = ChatRequest());
+  // Whether the client has a session it may resume, which keeps the
+  // channels across disconnects until the session is resumed or ends
+  bool IsResumable();
 
   // API events
   Event<UserMessageResult, std::string &> OnIdentifyCompleted;
   Event<UserMessageResult, std::string &, std::string &> OnSendMessageCompleted;
+  // The session is gone unless the result is Ok or SessionInUse, which can be
+  // tried again shortly after
+  Event<UserMessageResult> OnResumeCompleted;
 
   Event<> OnIdentified;
   Event<std::string &, std::string &, std::string &, std::string &> OnMessage;
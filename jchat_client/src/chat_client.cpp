@@ -7,10 +7,17 @@
 */
 
 #include "chat_client.h"
+#include "protocol/components/system_message_type.h"
 
 namespace jchat {
 ChatClient::ChatClient(const char *hostname, uint16_t port)
-  : tcp_client_(hostname, port), is_connected_(false) {
+  : tcp_client_(hostname, port), is_connected_(false),
+  send_format_(kWireFormat_Tagged), receive_format_(kWireFormat_Tagged),
+  is_batching_(false), is_batch_scheduled_(false),
+  batch_window_(JCHAT_CHAT_BATCH_WINDOW),
+  batch_max_size_(JCHAT_CHAT_BATCH_MAX_SIZE), is_request_id_enabled_(false),
+  next_request_id_(1), timed_request_count_(0),
+  is_request_timer_scheduled_(false) {
   int16_t number = 0x00FF;
   is_little_endian_ = ((uint8_t *)&number)[0] == 0xFF;
 
@@ -20,12 +27,14 @@ ChatClient::ChatClient(const char *hostname, uint16_t port)
   tcp_client_.OnDisconnected.Add([this]() {
     return onDisconnected();
   });
-  tcp_client_.OnDataReceived.Add([this](Buffer &buffer) {
-    return onDataReceived(buffer);
+  tcp_client_.OnDataReceived.Add([this](StreamBuffer &stream) {
+    return onDataReceived(stream);
   });
 }
 
 ChatClient::~ChatClient() {
+  batch_queue_.Stop();
+  request_timer_.Stop();
 }
 
 bool ChatClient::Connect() {
@@ -50,26 +59,48 @@ bool ChatClient::Disconnect() {
   if (!tcp_client_.Disconnect()) {
     return false;
   }
+  batch_queue_.Stop();
+  request_timer_.Stop();
+  requests_mutex_.lock();
+  is_request_timer_scheduled_ = false;
+  requests_mutex_.unlock();
 
   is_connected_ = false;
 
   return true;
 }
 
+bool ChatClient::SetReactor(ClientReactor *reactor) {
+  if (is_connected_) {
+    return false;
+  }
+
+  return tcp_client_.SetReactor(reactor);
+}
+
+bool ChatClient::SetLocalPath(const std::string &local_path) {
+  if (is_connected_) {
+    return false;
+  }
+
+  return tcp_client_.SetLocalPath(local_path);
+}
+
 bool ChatClient::AddComponent(std::shared_ptr<ChatComponent> component) {
   if (is_connected_) {
     return false;
   }
 
-  for (auto it = components_.begin(); it != components_.end(); ++it) {
-    if (*it == component) {
-      return false;
-    }
+  ComponentType component_type = component->GetType();
+  if (component_type >= kComponentType_Max
+    || components_by_type_[component_type]) {
+    return false;
   }
   if (!component->Initialize(*this)) {
     return false;
   }
   components_.push_back(component);
+  components_by_type_[component_type] = component;
 
   return true;
 }
@@ -85,6 +116,7 @@ bool ChatClient::RemoveComponent(std::shared_ptr<ChatComponent> component) {
         return false;
       }
       components_.erase(it);
+      components_by_type_[component->GetType()].reset();
       return true;
     }
   }
@@ -94,13 +126,12 @@ bool ChatClient::RemoveComponent(std::shared_ptr<ChatComponent> component) {
 
 bool ChatClient::GetComponent(ComponentType component_type,
   std::shared_ptr<ChatComponent> &out_component) {
-  for (auto component : components_) {
-    if (component->GetType() == component_type) {
-      out_component = component;
-      return true;
-    }
+  if (component_type >= kComponentType_Max
+    || !components_by_type_[component_type]) {
+    return false;
   }
-  return false;
+  out_component = components_by_type_[component_type];
+  return true;
 }
 
 TypedBuffer ChatClient::CreateBuffer() {
@@ -109,17 +140,204 @@ TypedBuffer ChatClient::CreateBuffer() {
 
 bool ChatClient::Send(ComponentType component_type, uint8_t message_type,
   TypedBuffer &buffer) {
-  Buffer temp_buffer(!is_little_endian_);
+  return sendMessage(component_type, message_type, buffer, 0);
+}
 
-  // Write header
-  temp_buffer.Write<uint8_t>(component_type);
-  temp_buffer.Write<uint16_t>(message_type);
-  temp_buffer.Write<uint32_t>(buffer.GetSize());
+bool ChatClient::Send(ComponentType component_type, uint8_t message_type,
+  TypedBuffer &buffer, const ChatRequest &request) {
+  if (!request.OnCompleted) {
+    return sendMessage(component_type, message_type, buffer, 0);
+  }
+  if (!is_request_id_enabled_) {
+    return false;
+  }
 
-  // Write body
-  temp_buffer.WriteArray<uint8_t>(buffer.GetBuffer(), buffer.GetSize());
+  requests_mutex_.lock();
+  // Ids wrap around, 0 is never used and ids still waiting are skipped
+  uint32_t request_id = next_request_id_++;
+  while (request_id == 0 || pending_requests_.count(request_id) > 0) {
+    request_id = next_request_id_++;
+  }
+  PendingRequest &pending_request = pending_requests_[request_id];
+  pending_request.ComponentType = component_type;
+  pending_request.ReplyType = message_type + 1;
+  pending_request.OnCompleted = request.OnCompleted;
+  pending_request.IsTimed = request.Timeout.count() > 0;
+  if (pending_request.IsTimed) {
+    pending_request.Deadline = std::chrono::steady_clock::now()
+      + request.Timeout;
+    timed_request_count_++;
+    // The timer only runs while a request has a timeout
+    if (!is_request_timer_scheduled_) {
+      if (!request_timer_.IsRunning()) {
+        request_timer_.Start(std::chrono::milliseconds(
+          JCHAT_CHAT_REQUEST_TIMER_INTERVAL), [this](uint64_t key) {
+          expireRequests();
+        });
+      }
+      is_request_timer_scheduled_ = request_timer_.Push(0);
+    }
+  }
+  requests_mutex_.unlock();
+
+  if (sendMessage(component_type, message_type, buffer, request_id)) {
+    return true;
+  }
 
-  return tcp_client_.Send(temp_buffer);
+  // The reply could only have come for a message that was sent
+  requests_mutex_.lock();
+  auto failed_request = pending_requests_.find(request_id);
+  if (failed_request != pending_requests_.end()) {
+    if (failed_request->second.IsTimed) {
+      timed_request_count_--;
+    }
+    pending_requests_.erase(failed_request);
+  }
+  requests_mutex_.unlock();
+  return false;
+}
+
+bool ChatClient::sendMessage(ComponentType component_type,
+  uint8_t message_type, TypedBuffer &buffer, uint32_t request_id) {
+  const uint8_t *body = buffer.GetBuffer();
+  size_t body_size = buffer.GetSize();
+
+  // Components always write the tagged format, convert it once the server
+  // agreed on the compact one
+  Buffer compact_body(!is_little_endian_);
+  if (send_format_ == kWireFormat_Compact) {
+    compact_body.Reserve(body_size);
+    if (!WireFormatConverter::ToCompact(body, body_size, !is_little_endian_,
+      compact_body)) {
+      return false;
+    }
+    body = compact_body.GetBuffer();
+    body_size = compact_body.GetSize();
+  }
+
+  if (!is_batching_) {
+    return sendFrame(component_type, message_type, body, body_size,
+      request_id);
+  }
+
+  batch_mutex_.lock();
+  bool result = true;
+  if (!batch_.Add(component_type, message_type, body, body_size,
+    request_id)) {
+    // Make room, a message too big for any batch is sent on its own
+    result = sendBatch();
+    if (result && !batch_.Add(component_type, message_type, body,
+      body_size, request_id)) {
+      result = sendFrame(component_type, message_type, body, body_size,
+        request_id);
+      batch_mutex_.unlock();
+      return result;
+    }
+  }
+  if (result && (batch_.GetSize() >= batch_max_size_
+    || (!is_batch_scheduled_ && !batch_queue_.Push(0)))) {
+    result = sendBatch();
+  } else if (result) {
+    is_batch_scheduled_ = true;
+  }
+  batch_mutex_.unlock();
+  return result;
+}
+
+void ChatClient::SetSendFormat(WireFormat send_format) {
+  send_format_ = send_format;
+}
+
+WireFormat ChatClient::GetSendFormat() {
+  return send_format_;
+}
+
+void ChatClient::SetReceiveFormat(WireFormat receive_format) {
+  receive_format_ = receive_format;
+}
+
+WireFormat ChatClient::GetReceiveFormat() {
+  return receive_format_;
+}
+
+bool ChatClient::EnableCompression() {
+  std::shared_ptr<DeflateStream> compression =
+    std::make_shared<DeflateStream>();
+  if (!compression->Initialize()) {
+    return false;
+  }
+
+  compression_mutex_.lock();
+  compression_ = compression;
+  compression_mutex_.unlock();
+  return true;
+}
+
+bool ChatClient::IsCompressionEnabled() {
+  compression_mutex_.lock();
+  bool is_compression_enabled = compression_ != nullptr;
+  compression_mutex_.unlock();
+  return is_compression_enabled;
+}
+
+bool ChatClient::GetCompressionStats(DeflateStats &out_stats) {
+  compression_mutex_.lock();
+  std::shared_ptr<DeflateStream> compression = compression_;
+  compression_mutex_.unlock();
+  if (!compression) {
+    return false;
+  }
+  out_stats = compression->GetStats();
+  return true;
+}
+
+void ChatClient::SetBatchLimits(std::chrono::microseconds batch_window,
+  size_t batch_max_size) {
+  batch_mutex_.lock();
+  batch_window_ = batch_window;
+  batch_max_size_ = batch_max_size;
+  batch_mutex_.unlock();
+}
+
+bool ChatClient::EnableBatching() {
+  batch_mutex_.lock();
+  std::chrono::microseconds batch_window = batch_window_;
+  batch_mutex_.unlock();
+  if (batch_window.count() > 0 && !batch_queue_.IsRunning()) {
+    batch_queue_.Start(batch_window, [this](uint64_t key) {
+      Flush();
+    });
+  }
+  is_batching_ = true;
+  return true;
+}
+
+bool ChatClient::IsBatchingEnabled() {
+  return is_batching_;
+}
+
+bool ChatClient::Flush() {
+  batch_mutex_.lock();
+  is_batch_scheduled_ = false;
+  bool result = sendBatch();
+  batch_mutex_.unlock();
+  return result;
+}
+
+bool ChatClient::EnableRequestIds() {
+  is_request_id_enabled_ = true;
+  return true;
+}
+
+bool ChatClient::IsRequestIdEnabled() {
+  return is_request_id_enabled_;
+}
+
+size_t ChatClient::GetPendingRequestCount() {
+  requests_mutex_.lock();
+  size_t pending_request_count = pending_requests_.size();
+  requests_mutex_.unlock();
+  return pending_request_count;
 }
 
 IPEndpoint ChatClient::GetLocalEndpoint() {
@@ -130,7 +348,68 @@ IPEndpoint ChatClient::GetRemoteEndpoint() {
   return tcp_client_.GetRemoteEndpoint();
 }
 
+bool ChatClient::sendFrame(uint8_t component_type, uint16_t message_type,
+  const uint8_t *body, size_t body_size, uint32_t request_id) {
+  uint8_t frame_component_type = component_type;
+  if (request_id != 0) {
+    frame_component_type |= JCHAT_CHAT_FRAME_REQUEST;
+  }
+  std::vector<uint8_t> compressed_body;
+  compression_mutex_.lock();
+  if (compression_ && body_size >= JCHAT_CHAT_COMPRESSION_MIN_SIZE) {
+    if (!compression_->Compress(body, body_size, compressed_body)) {
+      compression_mutex_.unlock();
+      return false;
+    }
+    frame_component_type |= JCHAT_CHAT_FRAME_COMPRESSED;
+    body = compressed_body.data();
+    body_size = compressed_body.size();
+  }
+
+  Buffer temp_buffer(!is_little_endian_);
+  temp_buffer.Reserve(sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint32_t)
+    + sizeof(request_id) + body_size);
+
+  // Write header
+  temp_buffer.Write<uint8_t>(frame_component_type);
+  temp_buffer.Write<uint16_t>(message_type);
+  temp_buffer.Write<uint32_t>(body_size);
+  if (request_id != 0) {
+    temp_buffer.Write<uint32_t>(request_id);
+  }
+
+  // Write body
+  temp_buffer.WriteArray<uint8_t>(body, body_size);
+
+  bool result = tcp_client_.Send(temp_buffer);
+  compression_mutex_.unlock();
+  return result;
+}
+
+bool ChatClient::sendBatch() {
+  if (batch_.IsEmpty()) {
+    return true;
+  }
+  bool result = sendFrame(JCHAT_CHAT_FRAME_BATCH, batch_.GetCount(),
+    batch_.GetBuffer(), batch_.GetSize(), 0);
+  batch_.Clear();
+  return result;
+}
+
 bool ChatClient::onConnected() {
+  // Every connection starts with a tagged Hello
+  send_format_ = kWireFormat_Tagged;
+  receive_format_ = kWireFormat_Tagged;
+  compression_mutex_.lock();
+  compression_.reset();
+  compression_mutex_.unlock();
+  is_batching_ = false;
+  batch_mutex_.lock();
+  batch_.Clear();
+  is_batch_scheduled_ = false;
+  batch_mutex_.unlock();
+  is_request_id_enabled_ = false;
+
   for (auto component : components_) {
     component->OnConnected();
   }
@@ -142,11 +421,20 @@ bool ChatClient::onDisconnected() {
   for (auto component : components_) {
     component->OnDisconnected();
   }
+  failRequests();
 
   return OnDisconnected();
 }
 
-bool ChatClient::onDataReceived(Buffer &buffer) {
+bool ChatClient::HandleFrames(StreamBuffer &stream) {
+  if (is_connected_) {
+    return false;
+  }
+
+  return onDataReceived(stream);
+}
+
+bool ChatClient::onDataReceived(StreamBuffer &stream) {
   uint8_t component_type = 0;
   uint16_t message_type = 0;
   uint32_t size = 0;
@@ -155,39 +443,180 @@ bool ChatClient::onDataReceived(Buffer &buffer) {
   size_t header_size = sizeof(component_type) + sizeof(message_type)
     + sizeof(size);
 
-  // Try to handle the requests, if any are unhandled, drop the connection
-  bool handled = false;
-
-  // Keep reading the buffer till the end
-  while (buffer.GetSize() - buffer.GetPosition() >= header_size) {
-    // Flip data endian order if needed
-    buffer.SetFlipEndian(!is_little_endian_);
-
-    // Check if the packet is valid
-    if (!buffer.Read(&component_type) || !buffer.Read(&message_type)
-      || !buffer.Read(&size) || buffer.GetSize() - buffer.GetPosition() < size
-      || component_type >= kComponentType_Max) {
+  // Handle every complete packet, a partial one stays in the stream until the
+  // rest of it has been received
+  while (stream.GetSize() >= header_size) {
+    // Read the header, flipping the data endian order if needed
+    BufferView header(stream.GetReadPointer(header_size), header_size,
+      !is_little_endian_);
+    header.Read(&component_type);
+    header.Read(&message_type);
+    header.Read(&size);
+
+    bool is_compressed = (component_type & JCHAT_CHAT_FRAME_COMPRESSED) != 0;
+    bool is_batch = (component_type & JCHAT_CHAT_FRAME_BATCH) != 0;
+    bool is_request = (component_type & JCHAT_CHAT_FRAME_REQUEST) != 0;
+    component_type &= ~(JCHAT_CHAT_FRAME_COMPRESSED | JCHAT_CHAT_FRAME_BATCH
+      | JCHAT_CHAT_FRAME_REQUEST);
+
+    // Check if the packet is valid, compression, batching and request ids
+    // are only turned on by this thread so they can be checked without the
+    // lock. The messages of a batch carry their own request ids.
+    if ((is_batch ? component_type != 0 || !is_batching_ || is_request
+      : component_type >= kComponentType_Max)
+      || size > JCHAT_CHAT_MAX_FRAME_SIZE
+      || (is_compressed && !compression_)
+      || (is_request && !is_request_id_enabled_)) {
       // Drop connection
       return false;
     }
 
-    // Read the packet into a typed buffer
-    TypedBuffer typed_buffer(buffer.GetBuffer() + buffer.GetPosition(),
-      size, !is_little_endian_);
-
-    // Increase the position of the buffer
-    buffer.SetPosition(buffer.GetPosition() + size);
+    // Wait for the rest of the packet, and then read the request id
+    size_t frame_header_size = header_size
+      + (is_request ? sizeof(uint32_t) : 0);
+    if (stream.GetSize() < frame_header_size + size) {
+      break;
+    }
+    uint32_t request_id = 0;
+    if (is_request) {
+      BufferView request_header(stream.GetReadPointer(frame_header_size)
+        + header_size, sizeof(request_id), !is_little_endian_);
+      request_header.Read(&request_id);
+    }
+    stream.Skip(frame_header_size);
+
+    // Read the packet in place, it is consumed once it has been handled.
+    // Compressed packets are read from the receive buffer.
+    const uint8_t *body = stream.GetReadPointer(size);
+    size_t body_size = size;
+    if (is_compressed) {
+      if (!compression_->Decompress(body, size, JCHAT_CHAT_MAX_FRAME_SIZE,
+        receive_buffer_)) {
+        return false;
+      }
+      body = receive_buffer_.data();
+      body_size = receive_buffer_.size();
+    }
 
-    for (auto component : components_) {
-      if (component->GetType() == static_cast<ComponentType>(component_type)) {
-        if (component->Handle(message_type, typed_buffer)) {
-          handled = true;
-          break;
+    if (is_batch) {
+      FrameBatchReader batch(body, body_size, message_type);
+      uint8_t batch_component_type = 0;
+      uint16_t batch_message_type = 0;
+      const uint8_t *message = nullptr;
+      size_t message_size = 0;
+      uint32_t batch_request_id = 0;
+      while (batch.Next(batch_component_type, batch_message_type, message,
+        message_size, batch_request_id)) {
+        if ((batch_request_id != 0 && !is_request_id_enabled_)
+          || !handleMessage(batch_component_type, batch_message_type,
+          message, message_size)) {
+          return false;
+        }
+        if (batch_request_id != 0) {
+          completeRequest(batch_request_id, batch_component_type,
+            batch_message_type, message, message_size);
         }
       }
+      if (!batch.IsComplete()) {
+        return false;
+      }
+    } else {
+      if (!handleMessage(component_type, message_type, body, body_size)) {
+        return false;
+      }
+      if (request_id != 0) {
+        completeRequest(request_id, component_type, message_type, body,
+          body_size);
+      }
+    }
+    stream.Skip(size);
+  }
+
+  return true;
+}
+
+bool ChatClient::handleMessage(uint8_t component_type, uint16_t message_type,
+  const uint8_t *body, size_t size) {
+  // Try to handle the request, if it is unhandled, drop the connection
+  if (component_type >= kComponentType_Max) {
+    return false;
+  }
+  ChatComponent *component = components_by_type_[component_type].get();
+  if (component == nullptr) {
+    return false;
+  }
+  TypedBufferView typed_buffer(body, size, !is_little_endian_,
+    receive_format_);
+  return component->Handle(message_type, typed_buffer);
+}
+
+void ChatClient::completeRequest(uint32_t request_id, uint8_t component_type,
+  uint16_t message_type, const uint8_t *body, size_t size) {
+  // Other messages sent while the request was handled carry its id as well.
+  // A request that the server dropped is answered by a Throttled instead.
+  bool is_throttled = component_type == kComponentType_System
+    && message_type == kSystemMessageType_Throttled;
+  requests_mutex_.lock();
+  auto pending_request = pending_requests_.find(request_id);
+  if (pending_request == pending_requests_.end() || (!is_throttled
+    && (pending_request->second.ComponentType != component_type
+    || pending_request->second.ReplyType != message_type))) {
+    requests_mutex_.unlock();
+    return;
+  }
+  std::function<void(RequestStatus, uint16_t)> on_completed =
+    pending_request->second.OnCompleted;
+  if (pending_request->second.IsTimed) {
+    timed_request_count_--;
+  }
+  pending_requests_.erase(pending_request);
+  requests_mutex_.unlock();
+
+  if (is_throttled) {
+    on_completed(kRequestStatus_Throttled, 0);
+    return;
+  }
+
+  // Every reply starts with its result
+  TypedBufferView typed_buffer(body, size, !is_little_endian_,
+    receive_format_);
+  uint16_t result = 0;
+  typed_buffer.ReadUInt16(result);
+  on_completed(kRequestStatus_Completed, result);
+}
+
+void ChatClient::expireRequests() {
+  std::vector<std::function<void(RequestStatus, uint16_t)>> expired;
+  std::chrono::steady_clock::time_point now =
+    std::chrono::steady_clock::now();
+  requests_mutex_.lock();
+  for (auto it = pending_requests_.begin(); it != pending_requests_.end();) {
+    if (it->second.IsTimed && it->second.Deadline <= now) {
+      expired.push_back(it->second.OnCompleted);
+      timed_request_count_--;
+      it = pending_requests_.erase(it);
+    } else {
+      ++it;
     }
   }
+  is_request_timer_scheduled_ = timed_request_count_ > 0
+    && request_timer_.Push(0);
+  requests_mutex_.unlock();
 
-  return handled;
+  for (auto &on_completed : expired) {
+    on_completed(kRequestStatus_TimedOut, 0);
+  }
+}
+
+void ChatClient::failRequests() {
+  std::unordered_map<uint32_t, PendingRequest> failed;
+  requests_mutex_.lock();
+  failed.swap(pending_requests_);
+  timed_request_count_ = 0;
+  requests_mutex_.unlock();
+
+  for (auto &pending_request : failed) {
+    pending_request.second.OnCompleted(kRequestStatus_Disconnected, 0);
+  }
 }
 }
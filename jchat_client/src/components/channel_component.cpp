@@ -12,7 +12,49 @@
 #include "protocol/components/channel_message_type.h"
 
 namespace jchat {
-ChannelComponent::ChannelComponent() {
+ChannelComponent::ChannelComponent() : is_tailing_(false) {
+  dispatcher_.Register(kChannelMessageType_JoinChannel_Complete,
+    &ChannelComponent::handleJoinChannelComplete);
+  dispatcher_.Register(kChannelMessageType_LeaveChannel_Complete,
+    &ChannelComponent::handleLeaveChannelComplete);
+  dispatcher_.Register(kChannelMessageType_SendMessage_Complete,
+    &ChannelComponent::handleSendMessageComplete);
+  dispatcher_.Register(kChannelMessageType_OpUser_Complete,
+    &ChannelComponent::handleOpUserComplete);
+  dispatcher_.Register(kChannelMessageType_DeopUser_Complete,
+    &ChannelComponent::handleDeopUserComplete);
+  dispatcher_.Register(kChannelMessageType_KickUser_Complete,
+    &ChannelComponent::handleKickUserComplete);
+  dispatcher_.Register(kChannelMessageType_BanUser_Complete,
+    &ChannelComponent::handleBanUserComplete);
+  dispatcher_.Register(kChannelMessageType_UnbanUser_Complete,
+    &ChannelComponent::handleUnbanUserComplete);
+  dispatcher_.Register(kChannelMessageType_GetMembers_Complete,
+    &ChannelComponent::handleGetMembersComplete);
+  dispatcher_.Register(kChannelMessageType_JoinChannel,
+    &ChannelComponent::handleJoinChannel);
+  dispatcher_.Register(kChannelMessageType_LeaveChannel,
+    &ChannelComponent::handleLeaveChannel);
+  dispatcher_.Register(kChannelMessageType_SendMessage,
+    &ChannelComponent::handleSendMessage);
+  dispatcher_.Register(kChannelMessageType_OpUser,
+    &ChannelComponent::handleOpUser);
+  dispatcher_.Register(kChannelMessageType_DeopUser,
+    &ChannelComponent::handleDeopUser);
+  dispatcher_.Register(kChannelMessageType_KickUser,
+    &ChannelComponent::handleKickUser);
+  dispatcher_.Register(kChannelMessageType_BanUser,
+    &ChannelComponent::handleBanUser);
+  dispatcher_.Register(kChannelMessageType_UnbanUser,
+    &ChannelComponent::handleUnbanUser);
+  dispatcher_.Register(kChannelMessageType_PresenceChanged,
+    &ChannelComponent::handlePresenceChanged);
+  dispatcher_.Register(kChannelMessageType_History,
+    &ChannelComponent::handleHistory);
+  dispatcher_.Register(kChannelMessageType_Subscribe_Complete,
+    &ChannelComponent::handleSubscribeComplete);
+  dispatcher_.Register(kChannelMessageType_Unsubscribe_Complete,
+    &ChannelComponent::handleUnsubscribeComplete);
 }
 
 ChannelComponent::~ChannelComponent() {
@@ -43,737 +85,977 @@ void ChannelComponent::OnConnected() {
 }
 
 void ChannelComponent::OnDisconnected() {
+  // The channels of a session that can be resumed are kept for it
+  std::shared_ptr<UserComponent> user_component;
+  if (client_->GetComponent(kComponentType_User, user_component)
+    && user_component->IsResumable()) {
+    return;
+  }
+  ClearChannels();
+}
+
+void ChannelComponent::ClearChannels() {
   // Remove channels
   channels_mutex_.lock();
   if (!channels_.empty()) {
     channels_.clear();
   }
+  subscriptions_.clear();
   channels_mutex_.unlock();
 }
 
+void ChannelComponent::SetTailing(bool is_tailing) {
+  is_tailing_ = is_tailing;
+}
+
+bool ChannelComponent::IsTailing() {
+  return is_tailing_;
+}
+
 ComponentType ChannelComponent::GetType() {
   return kComponentType_Channel;
 }
 
-bool ChannelComponent::Handle(uint16_t message_type, TypedBuffer &buffer) {
-  if (message_type == kChannelMessageType_JoinChannel_Complete) {
-    uint16_t message_result = 0;
-    if (!buffer.ReadUInt16(message_result)) {
-      return false;
-    }
-    std::string channel_name;
-    if (!buffer.ReadString(channel_name)) {
-      return false;
-    }
-    OnJoinCompleted(static_cast<ChannelMessageResult>(message_result),
-      channel_name);
-    if (message_result != kChannelMessageResult_Ok
-      && message_result != kChannelMessageResult_ChannelCreated) {
-      return true;
-    }
+bool ChannelComponent::Handle(uint16_t message_type, TypedBufferView &buffer) {
+  return dispatcher_.Dispatch(this, message_type, buffer);
+}
 
-    // Create the ChatChannel and do necessary actions
-    auto chat_channel = std::make_shared<ChatChannel>();
-    chat_channel->Name = channel_name;
-    chat_channel->Enabled = true;
+std::shared_ptr<ChatChannel> ChannelComponent::findChannel(
+  const std::string &channel_name) {
+  auto chat_channel = channels_.find(channel_name);
+  if (chat_channel == channels_.end()) {
+    return nullptr;
+  }
+  return chat_channel->second;
+}
 
-    // Add the channel to the channel list
-    channels_mutex_.lock();
-    channels_.push_back(chat_channel);
-    channels_mutex_.unlock();
+bool ChannelComponent::handleJoinChannelComplete(TypedBufferView &buffer) {
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
+  OnJoinCompleted(static_cast<ChannelMessageResult>(message_result),
+    channel_name);
+  if (message_result != kChannelMessageResult_Ok
+    && message_result != kChannelMessageResult_ChannelCreated) {
+    return true;
+  }
 
-    // Get user component
-    std::shared_ptr<UserComponent> user_component;
-    if (!client_->GetComponent(kComponentType_User, user_component)) {
-      // Internal error, disconnect client
-      return false;
-    }
+  // Create the ChatChannel and do necessary actions
+  auto chat_channel = std::make_shared<ChatChannel>();
+  chat_channel->Name = channel_name;
+  chat_channel->MemberCount = 0;
+  chat_channel->Enabled = true;
 
-    // Get the chat client
-    std::shared_ptr<ChatUser> chat_user;
-    if (!user_component->GetChatUser(chat_user)) {
-      // Internal error, disconnect client
-      return false;
-    }
+  // Add the channel to the channel list
+  channels_mutex_.lock();
+  channels_[channel_name] = chat_channel;
+  channels_mutex_.unlock();
 
-    // Add the local user
-    chat_channel->ClientsMutex.lock();
-    chat_channel->Clients.push_back(chat_user);
-    chat_channel->ClientsMutex.unlock();
+  // Get user component
+  std::shared_ptr<UserComponent> user_component;
+  if (!client_->GetComponent(kComponentType_User, user_component)) {
+    // Internal error, disconnect client
+    return false;
+  }
 
-    if (message_result == kChannelMessageResult_ChannelCreated) {
-      chat_channel->OperatorsMutex.lock();
-      chat_channel->Operators.push_back(chat_user);
-      chat_channel->OperatorsMutex.unlock();
+  // Get the chat client
+  std::shared_ptr<ChatUser> chat_user;
+  if (!user_component->GetChatUser(chat_user)) {
+    // Internal error, disconnect client
+    return false;
+  }
 
-      OnChannelCreated(*chat_channel, *chat_user);
-      OnChannelJoined(*chat_channel, *chat_user);
+  // Add the local user
+  chat_channel->ClientsMutex.lock();
+  chat_channel->Clients[chat_user->Username] = chat_user;
+  chat_channel->ClientsMutex.unlock();
 
-      return true;
-    }
+  if (message_result == kChannelMessageResult_ChannelCreated) {
+    chat_channel->OperatorsMutex.lock();
+    chat_channel->Operators[chat_user->Username] = chat_user;
+    chat_channel->OperatorsMutex.unlock();
 
-    uint64_t users_count = 0;
-    if (!buffer.ReadUInt64(users_count)) {
-      return false;
-    }
+    OnChannelCreated(*chat_channel, *chat_user);
+    OnChannelJoined(*chat_channel, *chat_user);
 
-    for (size_t i = 0; i < users_count; i++) {
-      auto user = std::make_shared<ChatUser>();
-      user->Enabled = true;
-      user->Identified = true;
+    return true;
+  }
 
-      if (!buffer.ReadString(user->Username)) {
-        return false;
-      }
-      if (!buffer.ReadString(user->Hostname)) {
-        return false;
-      }
-      bool is_operator = false;
-      if (!buffer.ReadBoolean(is_operator)) {
-        return false;
-      }
+  // Read the first page of users
+  if (!readMembers(*chat_channel, buffer)) {
+    return false;
+  }
 
-      chat_channel->ClientsMutex.lock();
-      chat_channel->Clients.push_back(user);
-      chat_channel->ClientsMutex.unlock();
-      if (is_operator) {
-        chat_channel->OperatorsMutex.lock();
-        chat_channel->Operators.push_back(user);
-        chat_channel->OperatorsMutex.unlock();
-      }
-    }
+  // Read bans
+  uint64_t bans_count = 0;
+  if (!buffer.ReadUInt64(bans_count)) {
+    return false;
+  }
 
-    // Read bans
-    uint64_t bans_count = 0;
-    if (!buffer.ReadUInt64(bans_count)) {
+  chat_channel->BannedUsersMutex.lock();
+  for (size_t i = 0; i < bans_count; i++) {
+    std::string banned_user;
+    if (!buffer.ReadString(banned_user)) {
+      chat_channel->BannedUsersMutex.unlock();
       return false;
     }
+    chat_channel->BannedUsers.insert(banned_user);
+  }
+  chat_channel->BannedUsersMutex.unlock();
 
-    chat_channel->BannedUsersMutex.lock();
-    for (size_t i = 0; i < bans_count; i++) {
-      std::string banned_user;
-      if (!buffer.ReadString(banned_user)) {
-        chat_channel->BannedUsersMutex.unlock();
-        return false;
-      }
-      chat_channel->BannedUsers.push_back(banned_user);
-    }
-    chat_channel->BannedUsersMutex.unlock();
+  // Servers that send the member list in pages say how to continue it
+  uint64_t member_count = chat_channel->Clients.size() - 1;
+  uint64_t next_cursor = 0;
+  if (buffer.ReadUInt64(member_count) && !buffer.ReadUInt64(next_cursor)) {
+    return false;
+  }
+  chat_channel->MemberCount = member_count;
 
-    // Trigger events
-    OnChannelJoined(*chat_channel, *chat_user);
+  // Trigger events
+  OnChannelJoined(*chat_channel, *chat_user);
 
-    return true;
-  } else if (message_type == kChannelMessageType_LeaveChannel_Complete) {
-    uint16_t message_result = 0;
-    if (!buffer.ReadUInt16(message_result)) {
-      return false;
-    }
-    std::string channel_name;
-    if (!buffer.ReadString(channel_name)) {
-      return false;
-    }
-    OnLeaveCompleted(static_cast<ChannelMessageResult>(message_result),
-      channel_name);
-    if (message_result != kChannelMessageResult_Ok
-      && message_result != kChannelMessageResult_ChannelDestroyed) {
-      return true;
-    }
+  if (next_cursor != 0) {
+    GetMembers(channel_name, next_cursor);
+  }
 
-    // Get user component
-    std::shared_ptr<UserComponent> user_component;
-    if (!client_->GetComponent(kComponentType_User, user_component)) {
-      // Internal error, disconnect client
-      return false;
-    }
+  return true;
+}
 
-    // Get the chat client
-    std::shared_ptr<ChatUser> chat_user;
-    if (!user_component->GetChatUser(chat_user)) {
-      // Internal error, disconnect client
-      return false;
-    }
+bool ChannelComponent::readMembers(ChatChannel &chat_channel,
+  TypedBufferView &buffer) {
+  uint64_t users_count = 0;
+  if (!buffer.ReadUInt64(users_count)) {
+    return false;
+  }
 
-    // Remove the ChatChannel and do necessary actions
-    channels_mutex_.lock();
-    for (auto it = channels_.begin(); it != channels_.end(); ++it) {
-      std::shared_ptr<ChatChannel> &chat_channel = *it;
-      if (chat_channel->Enabled && chat_channel->Name == channel_name) {
-        OnChannelLeft(*chat_channel, *chat_user);
-
-        // Disable the channel
-        chat_channel->Enabled = false;
-
-        // Clear all information
-        chat_channel->OperatorsMutex.lock();
-        chat_channel->Operators.clear();
-        chat_channel->OperatorsMutex.unlock();
-
-        chat_channel->ClientsMutex.lock();
-        chat_channel->Clients.clear();
-        chat_channel->ClientsMutex.unlock();
-
-        chat_channel->BannedUsersMutex.lock();
-        chat_channel->BannedUsers.clear();
-        chat_channel->BannedUsersMutex.unlock();
-
-        // Remove the channel
-        channels_.erase(it);
-        break;
-      }
-    }
-    channels_mutex_.unlock();
+  for (size_t i = 0; i < users_count; i++) {
+    auto user = std::make_shared<ChatUser>();
+    user->Enabled = true;
+    user->Identified = true;
 
-    return true;
-  } else if (message_type == kChannelMessageType_SendMessage_Complete) {
-    uint16_t message_result = 0;
-    if (!buffer.ReadUInt16(message_result)) {
+    if (!buffer.ReadString(user->Username)) {
       return false;
     }
-    std::string channel_name;
-    if (!buffer.ReadString(channel_name)) {
+    if (!buffer.ReadString(user->Hostname)) {
       return false;
     }
-    std::string message;
-    if (!buffer.ReadString(message)) {
+    bool is_operator = false;
+    if (!buffer.ReadBoolean(is_operator)) {
       return false;
     }
-    OnSendMessageCompleted(static_cast<ChannelMessageResult>(message_result),
-      channel_name, message);
+    user->Identity = user->Username + "@" + user->Hostname;
 
-    // Get user component
-    std::shared_ptr<UserComponent> user_component;
-    if (!client_->GetComponent(kComponentType_User, user_component)) {
-      // Internal error, disconnect client
-      return false;
+    // Users that joined while the list was sent are already known
+    chat_channel.ClientsMutex.lock();
+    bool is_known = !chat_channel.Clients.emplace(user->Username,
+      user).second;
+    chat_channel.ClientsMutex.unlock();
+    if (is_operator && !is_known) {
+      chat_channel.OperatorsMutex.lock();
+      chat_channel.Operators[user->Username] = user;
+      chat_channel.OperatorsMutex.unlock();
     }
+  }
 
-    // Get the chat client
-    std::shared_ptr<ChatUser> chat_user;
-    if (!user_component->GetChatUser(chat_user)) {
-      // Internal error, disconnect client
-      return false;
-    }
+  return true;
+}
 
-    channels_mutex_.lock();
-    for (auto it = channels_.begin(); it != channels_.end(); ++it) {
-      std::shared_ptr<ChatChannel> &chat_channel = *it;
-      if (chat_channel->Enabled && chat_channel->Name == channel_name) {
-        OnChannelMessage(*chat_channel, *chat_user, message);
-        break;
-      }
-    }
-    channels_mutex_.unlock();
+void ChannelComponent::addMember(ChatChannel &chat_channel,
+  const std::string &username, const std::string &hostname) {
+  chat_channel.ClientsMutex.lock();
+  std::shared_ptr<ChatUser> &user = chat_channel.Clients[username];
+  if (user) {
+    chat_channel.ClientsMutex.unlock();
+    return;
+  }
 
-    return true;
-  } else if (message_type == kChannelMessageType_OpUser_Complete) {
-    // TODO: Implement
+  // Create ChatUser
+  user = std::make_shared<ChatUser>();
+  user->Enabled = true;
+  user->Identified = true;
+  user->Username = username;
+  user->Hostname = hostname;
+  user->Identity = username + "@" + hostname;
+  std::shared_ptr<ChatUser> new_user = user;
+  chat_channel.ClientsMutex.unlock();
+
+  // Trigger events
+  OnChannelJoined(chat_channel, *new_user);
+}
+
+void ChannelComponent::removeMember(ChatChannel &chat_channel,
+  const std::string &username, const std::string &hostname) {
+  std::shared_ptr<ChatUser> user = takeMember(chat_channel, username,
+    hostname);
+  if (user) {
+    // Trigger events
+    OnChannelLeft(chat_channel, *user);
+  }
+}
+
+std::shared_ptr<ChatUser> ChannelComponent::takeMember(
+  ChatChannel &chat_channel, const std::string &username,
+  const std::string &hostname) {
+  // Remove from clients
+  std::shared_ptr<ChatUser> user;
+  chat_channel.ClientsMutex.lock();
+  auto client = chat_channel.Clients.find(username);
+  if (client != chat_channel.Clients.end()
+    && client->second->Hostname == hostname) {
+    user = std::move(client->second);
+    chat_channel.Clients.erase(client);
+  }
+  chat_channel.ClientsMutex.unlock();
+  if (!user) {
+    return nullptr;
+  }
+
+  // Remove from operators
+  chat_channel.OperatorsMutex.lock();
+  chat_channel.Operators.erase(username);
+  chat_channel.OperatorsMutex.unlock();
 
+  return user;
+}
+
+bool ChannelComponent::handleLeaveChannelComplete(TypedBufferView &buffer) {
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
+  OnLeaveCompleted(static_cast<ChannelMessageResult>(message_result),
+    channel_name);
+  if (message_result != kChannelMessageResult_Ok
+    && message_result != kChannelMessageResult_ChannelDestroyed) {
     return true;
-  } else if (message_type == kChannelMessageType_DeopUser_Complete) {
-    // TODO: Implement
+  }
+
+  // Get user component
+  std::shared_ptr<UserComponent> user_component;
+  if (!client_->GetComponent(kComponentType_User, user_component)) {
+    // Internal error, disconnect client
+    return false;
+  }
+
+  // Get the chat client
+  std::shared_ptr<ChatUser> chat_user;
+  if (!user_component->GetChatUser(chat_user)) {
+    // Internal error, disconnect client
+    return false;
+  }
+
+  // Remove the ChatChannel and do necessary actions
+  channels_mutex_.lock();
+  std::shared_ptr<ChatChannel> chat_channel = findChannel(channel_name);
+  if (chat_channel) {
+    OnChannelLeft(*chat_channel, *chat_user);
+
+    // Disable the channel
+    chat_channel->Enabled = false;
+
+    // Clear all information
+    chat_channel->OperatorsMutex.lock();
+    chat_channel->Operators.clear();
+    chat_channel->OperatorsMutex.unlock();
 
+    chat_channel->ClientsMutex.lock();
+    chat_channel->Clients.clear();
+    chat_channel->ClientsMutex.unlock();
+
+    chat_channel->BannedUsersMutex.lock();
+    chat_channel->BannedUsers.clear();
+    chat_channel->BannedUsersMutex.unlock();
+
+    // Remove the channel
+    channels_.erase(channel_name);
+  }
+  channels_mutex_.unlock();
+
+  return true;
+}
+
+bool ChannelComponent::handleSendMessageComplete(TypedBufferView &buffer) {
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
+  std::string message;
+  if (!buffer.ReadString(message)) {
+    return false;
+  }
+  OnSendMessageCompleted(static_cast<ChannelMessageResult>(message_result),
+    channel_name, message);
+
+  // Get user component
+  std::shared_ptr<UserComponent> user_component;
+  if (!client_->GetComponent(kComponentType_User, user_component)) {
+    // Internal error, disconnect client
+    return false;
+  }
+
+  // Get the chat client
+  std::shared_ptr<ChatUser> chat_user;
+  if (!user_component->GetChatUser(chat_user)) {
+    // Internal error, disconnect client
+    return false;
+  }
+
+  channels_mutex_.lock();
+  std::shared_ptr<ChatChannel> chat_channel = findChannel(channel_name);
+  if (chat_channel) {
+    OnChannelMessage(*chat_channel, *chat_user, message);
+  }
+  channels_mutex_.unlock();
+
+  return true;
+}
+
+bool ChannelComponent::handleOpUserComplete(TypedBufferView &buffer) {
+  // TODO: Implement
+
+  return true;
+}
+
+bool ChannelComponent::handleDeopUserComplete(TypedBufferView &buffer) {
+  // TODO: Implement
+
+  return true;
+}
+
+bool ChannelComponent::handleKickUserComplete(TypedBufferView &buffer) {
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
+  std::string target;
+  if (!buffer.ReadString(target)) {
+    return false;
+  }
+  OnKickUserCompleted(static_cast<ChannelMessageResult>(message_result),
+    channel_name, target);
+
+  if (message_result != kChannelMessageResult_Ok) {
     return true;
-  } else if (message_type == kChannelMessageType_KickUser_Complete) {
-    uint16_t message_result = 0;
-    if (!buffer.ReadUInt16(message_result)) {
-      return false;
-    }
-    std::string channel_name;
-    if (!buffer.ReadString(channel_name)) {
-      return false;
-    }
-    std::string target;
-    if (!buffer.ReadString(target)) {
-      return false;
-    }
-    OnKickUserCompleted(static_cast<ChannelMessageResult>(message_result),
-      channel_name, target);
+  }
 
-    if (message_result != kChannelMessageResult_Ok) {
-      return true;
-    }
+  std::string username;
+  if (!buffer.ReadString(username)) {
+    return false;
+  }
+  std::string hostname;
+  if (!buffer.ReadString(hostname)) {
+    return false;
+  }
 
-    std::string username;
-    if (!buffer.ReadString(username)) {
-      return false;
-    }
-    std::string hostname;
-    if (!buffer.ReadString(hostname)) {
-      return false;
+  channels_mutex_.lock();
+  std::shared_ptr<ChatChannel> chat_channel = findChannel(channel_name);
+  if (chat_channel) {
+    std::shared_ptr<ChatUser> chat_user = takeMember(*chat_channel, username,
+      hostname);
+    if (chat_user) {
+      OnChannelUserKicked(*chat_channel, *chat_user);
     }
+  }
+  channels_mutex_.unlock();
 
-    channels_mutex_.lock();
-    for (auto it = channels_.begin(); it != channels_.end(); ++it) {
-      std::shared_ptr<ChatChannel> &chat_channel = *it;
-      if (chat_channel->Enabled && chat_channel->Name == channel_name) {
-        chat_channel->ClientsMutex.lock();
-        for (auto it = chat_channel->Clients.begin();
-          it != chat_channel->Clients.end(); ++it) {
-          std::shared_ptr<ChatUser> &chat_user = *it;
-          if (chat_user->Username == username
-            && chat_user->Hostname == hostname) {
-            OnChannelUserKicked(*chat_channel, *chat_user);
-            chat_channel->Clients.erase(it);
-            break;
-          }
-        }
-        chat_channel->ClientsMutex.unlock();
-
-        chat_channel->OperatorsMutex.lock();
-        for (auto it = chat_channel->Operators.begin();
-          it != chat_channel->Operators.end(); ++it) {
-          std::shared_ptr<ChatUser> &chat_user = *it;
-          if (chat_user->Username == username
-            && chat_user->Hostname == hostname) {
-            chat_channel->Operators.erase(it);
-            break;
-          }
-        }
-        chat_channel->OperatorsMutex.unlock();
-
-        break;
-      }
-    }
-    channels_mutex_.unlock();
+  return true;
+}
 
+bool ChannelComponent::handleBanUserComplete(TypedBufferView &buffer) {
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
+  std::string target;
+  if (!buffer.ReadString(target)) {
+    return false;
+  }
+  OnBanUserCompleted(static_cast<ChannelMessageResult>(message_result),
+    channel_name, target);
+
+  if (message_result != kChannelMessageResult_Ok) {
     return true;
-  } else if (message_type == kChannelMessageType_BanUser_Complete) {
-    uint16_t message_result = 0;
-    if (!buffer.ReadUInt16(message_result)) {
-      return false;
-    }
-    std::string channel_name;
-    if (!buffer.ReadString(channel_name)) {
-      return false;
-    }
-    std::string target;
-    if (!buffer.ReadString(target)) {
-      return false;
-    }
-    OnBanUserCompleted(static_cast<ChannelMessageResult>(message_result),
-      channel_name, target);
+  }
 
-    if (message_result != kChannelMessageResult_Ok) {
-      return true;
-    }
+  std::string username;
+  if (!buffer.ReadString(username)) {
+    return false;
+  }
+  std::string hostname;
+  if (!buffer.ReadString(hostname)) {
+    return false;
+  }
 
-    std::string username;
-    if (!buffer.ReadString(username)) {
-      return false;
-    }
-    std::string hostname;
-    if (!buffer.ReadString(hostname)) {
-      return false;
+  channels_mutex_.lock();
+  std::shared_ptr<ChatChannel> chat_channel = findChannel(channel_name);
+  if (chat_channel) {
+    std::shared_ptr<ChatUser> chat_user = takeMember(*chat_channel, username,
+      hostname);
+    if (chat_user) {
+      OnChannelUserBanned(*chat_channel, *chat_user);
     }
 
-    channels_mutex_.lock();
-    for (auto it = channels_.begin(); it != channels_.end(); ++it) {
-      std::shared_ptr<ChatChannel> &chat_channel = *it;
-      if (chat_channel->Enabled && chat_channel->Name == channel_name) {
-        chat_channel->ClientsMutex.lock();
-        for (auto it = chat_channel->Clients.begin();
-          it != chat_channel->Clients.end(); ++it) {
-          std::shared_ptr<ChatUser> &chat_user = *it;
-          if (chat_user->Username == username
-            && chat_user->Hostname == hostname) {
-            OnChannelUserBanned(*chat_channel, *chat_user);
-            chat_channel->Clients.erase(it);
-            break;
-          }
-        }
-        chat_channel->ClientsMutex.unlock();
-
-        chat_channel->OperatorsMutex.lock();
-        for (auto it = chat_channel->Operators.begin();
-          it != chat_channel->Operators.end(); ++it) {
-          std::shared_ptr<ChatUser> &chat_user = *it;
-          if (chat_user->Username == username
-            && chat_user->Hostname == hostname) {
-            chat_channel->Operators.erase(it);
-            break;
-          }
-        }
-        chat_channel->OperatorsMutex.unlock();
-
-        chat_channel->BannedUsersMutex.lock();
-        chat_channel->BannedUsers.push_back(username + "@" + hostname);
-        chat_channel->BannedUsersMutex.unlock();
-
-        break;
-      }
-    }
-    channels_mutex_.unlock();
+    chat_channel->BannedUsersMutex.lock();
+    chat_channel->BannedUsers.insert(username + "@" + hostname);
+    chat_channel->BannedUsersMutex.unlock();
+  }
+  channels_mutex_.unlock();
+
+  return true;
+}
+
+bool ChannelComponent::handleUnbanUserComplete(TypedBufferView &buffer) {
+  // TODO: Implement
+
+  return true;
+}
 
+bool ChannelComponent::handleGetMembersComplete(TypedBufferView &buffer) {
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
+  OnGetMembersCompleted(static_cast<ChannelMessageResult>(message_result),
+    channel_name);
+  if (message_result != kChannelMessageResult_Ok) {
     return true;
-  } else if (message_type == kChannelMessageType_UnbanUser_Complete) {
-    // TODO: Implement
+  }
 
+  // Find the channel, it may have been left since the page was requested
+  channels_mutex_.lock();
+  std::shared_ptr<ChatChannel> chat_channel = findChannel(channel_name);
+  channels_mutex_.unlock();
+  if (!chat_channel) {
     return true;
-  } else if (message_type == kChannelMessageType_JoinChannel) {
-    // Read buffer
-    uint16_t message_result = 0;
-    if (!buffer.ReadUInt16(message_result)) {
-      return false;
-    }
+  }
 
-    std::string channel_name;
-    if (!buffer.ReadString(channel_name)) {
-      return false;
-    }
+  if (!readMembers(*chat_channel, buffer)) {
+    return false;
+  }
 
-    std::string username;
-    if (!buffer.ReadString(username)) {
-      return false;
-    }
+  uint64_t member_count = 0;
+  if (!buffer.ReadUInt64(member_count)) {
+    return false;
+  }
+  uint64_t next_cursor = 0;
+  if (!buffer.ReadUInt64(next_cursor)) {
+    return false;
+  }
+  chat_channel->MemberCount = member_count;
 
-    std::string hostname;
-    if (!buffer.ReadString(hostname)) {
-      return false;
-    }
+  if (next_cursor != 0) {
+    GetMembers(channel_name, next_cursor);
+  }
 
-    if (message_result != kChannelMessageResult_UserJoined) {
-      return false;
-    }
+  return true;
+}
 
-    // Find the channel and add the user
-    channels_mutex_.lock();
-    for (auto &chat_channel : channels_) {
-      if (chat_channel->Enabled && chat_channel->Name == channel_name) {
-        // Create ChatUser
-        auto user = std::make_shared<ChatUser>();
-        user->Enabled = true;
-        user->Identified = true;
-        user->Username = username;
-        user->Hostname = hostname;
-
-        chat_channel->ClientsMutex.lock();
-        chat_channel->Clients.push_back(user);
-        chat_channel->ClientsMutex.unlock();
-
-        // Trigger events
-        OnChannelJoined(*chat_channel, *user);
-
-        break;
-      }
-    }
-    channels_mutex_.unlock();
+bool ChannelComponent::handleJoinChannel(TypedBufferView &buffer) {
+  // Read buffer
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
 
-    return true;
-  } else if (message_type == kChannelMessageType_LeaveChannel) {
-    // Read buffer
-    uint16_t message_result = 0;
-    if (!buffer.ReadUInt16(message_result)) {
-      return false;
-    }
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
 
-    std::string channel_name;
-    if (!buffer.ReadString(channel_name)) {
-      return false;
-    }
+  std::string username;
+  if (!buffer.ReadString(username)) {
+    return false;
+  }
 
-    std::string username;
-    if (!buffer.ReadString(username)) {
-      return false;
-    }
+  std::string hostname;
+  if (!buffer.ReadString(hostname)) {
+    return false;
+  }
 
-    std::string hostname;
-    if (!buffer.ReadString(hostname)) {
-      return false;
-    }
+  if (message_result != kChannelMessageResult_UserJoined) {
+    return false;
+  }
 
-    if (message_result != kChannelMessageResult_UserLeft) {
-      return false;
-    }
+  // Find the channel and add the user
+  channels_mutex_.lock();
+  std::shared_ptr<ChatChannel> chat_channel = findChannel(channel_name);
+  if (chat_channel) {
+    addMember(*chat_channel, username, hostname);
+  }
+  channels_mutex_.unlock();
 
-    // Find the channel and remove the user
-    channels_mutex_.lock();
-    for (auto &chat_channel : channels_) {
-      if (chat_channel->Enabled && chat_channel->Name == channel_name) {
-        // Remove from clients
-        chat_channel->ClientsMutex.lock();
-        for (auto it = chat_channel->Clients.begin();
-          it != chat_channel->Clients.end(); ++it) {
-          std::shared_ptr<ChatUser> &user = *it;
-          if (user->Username == username && user->Hostname == hostname) {
-            // Trigger events
-            OnChannelLeft(*chat_channel, *user);
-            chat_channel->Clients.erase(it);
-            break;
-          }
-        }
-        chat_channel->ClientsMutex.unlock();
-
-        // Remove from operators
-        chat_channel->OperatorsMutex.lock();
-        for (auto it = chat_channel->Operators.begin();
-          it != chat_channel->Operators.end(); ++it) {
-          std::shared_ptr<ChatUser> &user = *it;
-          if (user->Username == username && user->Hostname == hostname) {
-            chat_channel->Operators.erase(it);
-            break;
-          }
-        }
-        chat_channel->OperatorsMutex.unlock();
-
-        break;
-      }
-    }
-    channels_mutex_.unlock();
+  return true;
+}
 
-    return true;
-  } else if (message_type == kChannelMessageType_SendMessage) {
-    // Read buffer
-    uint16_t message_result = 0;
-    if (!buffer.ReadUInt16(message_result)) {
-      return false;
-    }
+bool ChannelComponent::handleLeaveChannel(TypedBufferView &buffer) {
+  // Read buffer
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
 
-    std::string channel_name;
-    if (!buffer.ReadString(channel_name)) {
-      return false;
-    }
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
 
-    std::string username;
-    if (!buffer.ReadString(username)) {
-      return false;
-    }
+  std::string username;
+  if (!buffer.ReadString(username)) {
+    return false;
+  }
 
-    std::string hostname;
-    if (!buffer.ReadString(hostname)) {
-      return false;
-    }
+  std::string hostname;
+  if (!buffer.ReadString(hostname)) {
+    return false;
+  }
 
-    std::string message;
-    if (!buffer.ReadString(message)) {
-      return false;
-    }
+  if (message_result != kChannelMessageResult_UserLeft) {
+    return false;
+  }
 
-    if (message_result != kChannelMessageResult_MessageSent) {
-      return false;
-    }
+  // Find the channel and remove the user
+  channels_mutex_.lock();
+  std::shared_ptr<ChatChannel> chat_channel = findChannel(channel_name);
+  if (chat_channel) {
+    removeMember(*chat_channel, username, hostname);
+  }
+  channels_mutex_.unlock();
 
-    // Find the channel
-    channels_mutex_.lock();
-    for (auto &chat_channel : channels_) {
-      if (chat_channel->Enabled && chat_channel->Name == channel_name) {
-        // Find the user
-        chat_channel->ClientsMutex.lock();
-        for (auto it = chat_channel->Clients.begin();
-          it != chat_channel->Clients.end(); ++it) {
-          std::shared_ptr<ChatUser> &user = *it;
-          if (user->Username == username && user->Hostname == hostname) {
-            // Trigger events
-            OnChannelMessage(*chat_channel, *user, message);
-            break;
-          }
-        }
-        chat_channel->ClientsMutex.unlock();
-        break;
-      }
-    }
-    channels_mutex_.unlock();
+  return true;
+}
 
-    return true;
-  } else if (message_type == kChannelMessageType_OpUser) {
-    // TODO: Implement
+bool ChannelComponent::handlePresenceChanged(TypedBufferView &buffer) {
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
 
-    return true;
-  } else if (message_type == kChannelMessageType_DeopUser) {
-    // TODO: Implement
+  // Get user component
+  std::shared_ptr<UserComponent> user_component;
+  if (!client_->GetComponent(kComponentType_User, user_component)) {
+    // Internal error, disconnect client
+    return false;
+  }
 
-    return true;
-  } else if (message_type == kChannelMessageType_KickUser) {
-    uint16_t message_result = 0;
-    if (!buffer.ReadUInt16(message_result)) {
-      return false;
-    }
-    std::string channel_name;
-    if (!buffer.ReadString(channel_name)) {
+  // Get the chat client
+  std::shared_ptr<ChatUser> chat_user;
+  if (!user_component->GetChatUser(chat_user)) {
+    // Internal error, disconnect client
+    return false;
+  }
+
+  // The leaves come first, then the joins. Both can include members that
+  // are already known from the member list, and the client itself.
+  channels_mutex_.lock();
+  std::shared_ptr<ChatChannel> chat_channel = findChannel(channel_name);
+  for (int i = 0; i < 2; i++) {
+    uint64_t users_count = 0;
+    if (!buffer.ReadUInt64(users_count)) {
+      channels_mutex_.unlock();
       return false;
     }
+
     std::string username;
-    if (!buffer.ReadString(username)) {
-      return false;
-    }
     std::string hostname;
-    if (!buffer.ReadString(hostname)) {
-      return false;
+    for (uint64_t j = 0; j < users_count; j++) {
+      if (!buffer.ReadString(username) || !buffer.ReadString(hostname)) {
+        channels_mutex_.unlock();
+        return false;
+      }
+      if (!chat_channel || username == chat_user->Username) {
+        continue;
+      }
+      if (i == 0) {
+        removeMember(*chat_channel, username, hostname);
+      } else {
+        addMember(*chat_channel, username, hostname);
+      }
     }
+  }
+  channels_mutex_.unlock();
+
+  return true;
+}
+
+bool ChannelComponent::handleHistory(TypedBufferView &buffer) {
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
 
-    if (message_result != kChannelMessageResult_UserKicked) {
+  uint64_t history_count = 0;
+  if (!buffer.ReadUInt64(history_count)) {
+    return false;
+  }
+
+  std::deque<uint64_t> history_ages;
+  for (uint64_t i = 0; i < history_count; i++) {
+    uint64_t age = 0;
+    if (!buffer.ReadUInt64(age)) {
       return false;
     }
+    history_ages.push_back(age);
+  }
 
-    channels_mutex_.lock();
-    for (auto it = channels_.begin(); it != channels_.end(); ++it) {
-      std::shared_ptr<ChatChannel> &chat_channel = *it;
-      if (chat_channel->Enabled && chat_channel->Name == channel_name) {
-        chat_channel->ClientsMutex.lock();
-        for (auto it = chat_channel->Clients.begin();
-          it != chat_channel->Clients.end(); ++it) {
-          std::shared_ptr<ChatUser> &chat_user = *it;
-          if (chat_user->Username == username
-            && chat_user->Hostname == hostname) {
-            OnChannelUserKicked(*chat_channel, *chat_user);
-            chat_channel->Clients.erase(it);
-            break;
-          }
-        }
-        chat_channel->ClientsMutex.unlock();
-
-        chat_channel->OperatorsMutex.lock();
-        for (auto it = chat_channel->Operators.begin();
-          it != chat_channel->Operators.end(); ++it) {
-          std::shared_ptr<ChatUser> &chat_user = *it;
-          if (chat_user->Username == username
-            && chat_user->Hostname == hostname) {
-            chat_channel->Operators.erase(it);
-            break;
-          }
-        }
-        chat_channel->OperatorsMutex.unlock();
-
-        break;
-      }
-    }
+  // The next SendMessages of the channel are its history
+  channels_mutex_.lock();
+  std::shared_ptr<ChatChannel> chat_channel = findChannel(channel_name);
+  if (chat_channel) {
+    chat_channel->HistoryAges = std::move(history_ages);
+  }
+  channels_mutex_.unlock();
+
+  return true;
+}
+
+bool ChannelComponent::handleSendMessage(TypedBufferView &buffer) {
+  // Read buffer
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
+
+  std::string username;
+  if (!buffer.ReadString(username)) {
+    return false;
+  }
+
+  std::string hostname;
+  if (!buffer.ReadString(hostname)) {
+    return false;
+  }
+
+  std::string message;
+  if (!buffer.ReadString(message)) {
+    return false;
+  }
+
+  if (message_result != kChannelMessageResult_MessageSent) {
+    return false;
+  }
+
+  // Find the channel
+  channels_mutex_.lock();
+  std::shared_ptr<ChatChannel> chat_channel = findChannel(channel_name);
+  if (!chat_channel) {
+    bool is_subscribed = !subscriptions_.empty();
     channels_mutex_.unlock();
+    if (is_tailing_ || is_subscribed) {
+      ChatChannel tailed_channel;
+      tailed_channel.Enabled = false;
+      tailed_channel.Name = channel_name;
+      tailed_channel.MemberCount = 0;
+
+      ChatUser user;
+      user.Enabled = false;
+      user.Username = username;
+      user.Hostname = hostname;
+      user.Identity = username + "@" + hostname;
+      user.Identified = true;
+      user.PresenceChanges = false;
+
+      // Trigger events
+      OnChannelMessage(tailed_channel, user, message);
+    }
+    return true;
+  }
+
+  if (!chat_channel->HistoryAges.empty()) {
+    std::chrono::milliseconds age(chat_channel->HistoryAges.front());
+    chat_channel->HistoryAges.pop_front();
+
+    ChatUser user;
+    user.Enabled = false;
+    user.Username = username;
+    user.Hostname = hostname;
+    user.Identity = username + "@" + hostname;
+    user.Identified = true;
+    user.PresenceChanges = false;
 
+    // Trigger events
+    OnChannelHistory(*chat_channel, user, message, age);
+    channels_mutex_.unlock();
     return true;
-  } else if (message_type == kChannelMessageType_BanUser) {
-    uint16_t message_result = 0;
-    if (!buffer.ReadUInt16(message_result)) {
-      return false;
-    }
-    std::string channel_name;
-    if (!buffer.ReadString(channel_name)) {
-      return false;
-    }
-    std::string username;
-    if (!buffer.ReadString(username)) {
-      return false;
-    }
-    std::string hostname;
-    if (!buffer.ReadString(hostname)) {
-      return false;
-    }
+  }
 
-    if (message_result != kChannelMessageResult_UserBanned) {
-      return false;
-    }
+  // Find the user
+  chat_channel->ClientsMutex.lock();
+  auto user = chat_channel->Clients.find(username);
+  if (user != chat_channel->Clients.end()
+    && user->second->Hostname == hostname) {
+    // Trigger events
+    OnChannelMessage(*chat_channel, *user->second, message);
+  }
+  chat_channel->ClientsMutex.unlock();
+  channels_mutex_.unlock();
 
-    channels_mutex_.lock();
-    for (auto it = channels_.begin(); it != channels_.end(); ++it) {
-      std::shared_ptr<ChatChannel> &chat_channel = *it;
-      if (chat_channel->Enabled && chat_channel->Name == channel_name) {
-        chat_channel->ClientsMutex.lock();
-        for (auto it = chat_channel->Clients.begin();
-          it != chat_channel->Clients.end(); ++it) {
-          std::shared_ptr<ChatUser> &chat_user = *it;
-          if (chat_user->Username == username
-            && chat_user->Hostname == hostname) {
-            OnChannelUserBanned(*chat_channel, *chat_user);
-            chat_channel->Clients.erase(it);
-            break;
-          }
-        }
-        chat_channel->ClientsMutex.unlock();
-
-        chat_channel->OperatorsMutex.lock();
-        for (auto it = chat_channel->Operators.begin();
-          it != chat_channel->Operators.end(); ++it) {
-          std::shared_ptr<ChatUser> &chat_user = *it;
-          if (chat_user->Username == username
-            && chat_user->Hostname == hostname) {
-            chat_channel->Operators.erase(it);
-            break;
-          }
-        }
-        chat_channel->OperatorsMutex.unlock();
-
-        chat_channel->BannedUsersMutex.lock();
-        chat_channel->BannedUsers.push_back(username + "@" + hostname);
-        chat_channel->BannedUsersMutex.unlock();
-
-        break;
-      }
+  return true;
+}
+
+bool ChannelComponent::handleOpUser(TypedBufferView &buffer) {
+  // TODO: Implement
+
+  return true;
+}
+
+bool ChannelComponent::handleDeopUser(TypedBufferView &buffer) {
+  // TODO: Implement
+
+  return true;
+}
+
+bool ChannelComponent::handleKickUser(TypedBufferView &buffer) {
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
+  std::string username;
+  if (!buffer.ReadString(username)) {
+    return false;
+  }
+  std::string hostname;
+  if (!buffer.ReadString(hostname)) {
+    return false;
+  }
+
+  if (message_result != kChannelMessageResult_UserKicked) {
+    return false;
+  }
+
+  channels_mutex_.lock();
+  std::shared_ptr<ChatChannel> chat_channel = findChannel(channel_name);
+  if (chat_channel) {
+    std::shared_ptr<ChatUser> chat_user = takeMember(*chat_channel, username,
+      hostname);
+    if (chat_user) {
+      OnChannelUserKicked(*chat_channel, *chat_user);
     }
-    channels_mutex_.unlock();
+  }
+  channels_mutex_.unlock();
 
-    return true;
-  } else if (message_type == kChannelMessageType_UnbanUser) {
-    // TODO: Implement
+  return true;
+}
 
-    return true;
+bool ChannelComponent::handleBanUser(TypedBufferView &buffer) {
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
+  std::string username;
+  if (!buffer.ReadString(username)) {
+    return false;
+  }
+  std::string hostname;
+  if (!buffer.ReadString(hostname)) {
+    return false;
+  }
+
+  if (message_result != kChannelMessageResult_UserBanned) {
+    return false;
   }
 
-  return false;
+  channels_mutex_.lock();
+  std::shared_ptr<ChatChannel> chat_channel = findChannel(channel_name);
+  if (chat_channel) {
+    std::shared_ptr<ChatUser> chat_user = takeMember(*chat_channel, username,
+      hostname);
+    if (chat_user) {
+      OnChannelUserBanned(*chat_channel, *chat_user);
+    }
+
+    chat_channel->BannedUsersMutex.lock();
+    chat_channel->BannedUsers.insert(username + "@" + hostname);
+    chat_channel->BannedUsersMutex.unlock();
+  }
+  channels_mutex_.unlock();
+
+  return true;
 }
 
-bool ChannelComponent::JoinChannel(std::string channel_name) {
+bool ChannelComponent::handleUnbanUser(TypedBufferView &buffer) {
+  // TODO: Implement
+
+  return true;
+}
+
+bool ChannelComponent::JoinChannel(std::string channel_name,
+  bool include_bans, uint64_t history_count, const ChatRequest &request) {
   TypedBuffer buffer = client_->CreateBuffer();
   buffer.WriteString(channel_name);
+  buffer.WriteBoolean(include_bans);
+  // Older servers stop reading before this
+  if (history_count > 0) {
+    buffer.WriteUInt64(history_count);
+  }
   return client_->Send(kComponentType_Channel, kChannelMessageType_JoinChannel,
-    buffer);
+    buffer, request);
 }
 
-bool ChannelComponent::LeaveChannel(std::string channel_name) {
+bool ChannelComponent::LeaveChannel(std::string channel_name,
+  const ChatRequest &request) {
   TypedBuffer buffer = client_->CreateBuffer();
   buffer.WriteString(channel_name);
   return client_->Send(kComponentType_Channel, kChannelMessageType_LeaveChannel,
-    buffer);
+    buffer, request);
 }
 
 bool ChannelComponent::SendMessage(std::string channel_name,
-  std::string message) {
+  std::string message, const ChatRequest &request) {
   TypedBuffer buffer = client_->CreateBuffer();
   buffer.WriteString(channel_name);
   buffer.WriteString(message);
   return client_->Send(kComponentType_Channel, kChannelMessageType_SendMessage,
-    buffer);
+    buffer, request);
 }
 
-bool ChannelComponent::OpUser(std::string channel_name, std::string username) {
+bool ChannelComponent::OpUser(std::string channel_name, std::string username,
+  const ChatRequest &request) {
   TypedBuffer buffer = client_->CreateBuffer();
   buffer.WriteString(channel_name);
   buffer.WriteString(username);
   return client_->Send(kComponentType_Channel, kChannelMessageType_OpUser,
-    buffer);
+    buffer, request);
 }
 
 bool ChannelComponent::DeopUser(std::string channel_name,
-  std::string username) {
+  std::string username, const ChatRequest &request) {
   TypedBuffer buffer = client_->CreateBuffer();
   buffer.WriteString(channel_name);
   buffer.WriteString(username);
   return client_->Send(kComponentType_Channel, kChannelMessageType_DeopUser,
-    buffer);
+    buffer, request);
 }
 
 bool ChannelComponent::KickUser(std::string channel_name,
-  std::string username) {
+  std::string username, const ChatRequest &request) {
   TypedBuffer buffer = client_->CreateBuffer();
   buffer.WriteString(channel_name);
   buffer.WriteString(username);
   return client_->Send(kComponentType_Channel, kChannelMessageType_KickUser,
-    buffer);
+    buffer, request);
 }
 
 bool ChannelComponent::BanUser(std::string channel_name,
-  std::string username) {
+  std::string username, const ChatRequest &request) {
   TypedBuffer buffer = client_->CreateBuffer();
   buffer.WriteString(channel_name);
   buffer.WriteString(username);
   return client_->Send(kComponentType_Channel, kChannelMessageType_BanUser,
-    buffer);
+    buffer, request);
 }
 
 bool ChannelComponent::UnbanUser(std::string channel_name,
-  std::string username) {
+  std::string username, const ChatRequest &request) {
   TypedBuffer buffer = client_->CreateBuffer();
   buffer.WriteString(channel_name);
   buffer.WriteString(username);
   return client_->Send(kComponentType_Channel, kChannelMessageType_UnbanUser,
-    buffer);
+    buffer, request);
+}
+
+bool ChannelComponent::handleSubscribeComplete(TypedBufferView &buffer) {
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+  std::string pattern;
+  if (!buffer.ReadString(pattern)) {
+    return false;
+  }
+  std::string sender;
+  if (!buffer.ReadString(sender)) {
+    return false;
+  }
+  if (message_result == kChannelMessageResult_Ok) {
+    channels_mutex_.lock();
+    subscriptions_.insert(pattern);
+    channels_mutex_.unlock();
+  }
+  OnSubscribeCompleted(static_cast<ChannelMessageResult>(message_result),
+    pattern, sender);
+  return true;
+}
+
+bool ChannelComponent::handleUnsubscribeComplete(TypedBufferView &buffer) {
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+  std::string pattern;
+  if (!buffer.ReadString(pattern)) {
+    return false;
+  }
+  if (message_result == kChannelMessageResult_Ok) {
+    channels_mutex_.lock();
+    subscriptions_.erase(pattern);
+    channels_mutex_.unlock();
+  }
+  OnUnsubscribeCompleted(static_cast<ChannelMessageResult>(message_result),
+    pattern);
+  return true;
+}
+
+bool ChannelComponent::GetMembers(std::string channel_name, uint64_t cursor,
+  const ChatRequest &request) {
+  TypedBuffer buffer = client_->CreateBuffer();
+  buffer.WriteString(channel_name);
+  buffer.WriteUInt64(cursor);
+  return client_->Send(kComponentType_Channel, kChannelMessageType_GetMembers,
+    buffer, request);
+}
+
+bool ChannelComponent::Subscribe(std::string pattern, std::string sender,
+  const ChatRequest &request) {
+  TypedBuffer buffer = client_->CreateBuffer();
+  buffer.WriteString(pattern);
+  buffer.WriteString(sender);
+  return client_->Send(kComponentType_Channel, kChannelMessageType_Subscribe,
+    buffer, request);
+}
+
+bool ChannelComponent::Unsubscribe(std::string pattern,
+  const ChatRequest &request) {
+  TypedBuffer buffer = client_->CreateBuffer();
+  buffer.WriteString(pattern);
+  return client_->Send(kComponentType_Channel,
+    kChannelMessageType_Unsubscribe, buffer, request);
 }
 }
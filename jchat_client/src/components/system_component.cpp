@@ -12,7 +12,22 @@
 #include "protocol/components/system_message_type.h"
 
 namespace jchat {
-SystemComponent::SystemComponent() {
+SystemComponent::SystemComponent()
+  : client_(0), protocol_version_(JCHAT_CHAT_PROTOCOL_VERSION),
+  compression_type_(kCompressionType_None), is_batching_enabled_(false),
+  is_presence_changes_enabled_(false), is_heartbeat_enabled_(true),
+  is_request_id_enabled_(true), is_resume_enabled_(false),
+  is_throttle_enabled_(true) {
+  dispatcher_.Register(kSystemMessageType_Hello_Complete,
+    &SystemComponent::handleHelloComplete);
+  dispatcher_.Register(kSystemMessageType_GetStats_Complete,
+    &SystemComponent::handleGetStatsComplete);
+  dispatcher_.Register(kSystemMessageType_Ping,
+    &SystemComponent::handlePing);
+  dispatcher_.Register(kSystemMessageType_Pong,
+    &SystemComponent::handlePong);
+  dispatcher_.Register(kSystemMessageType_Throttled,
+    &SystemComponent::handleThrottled);
 }
 
 SystemComponent::~SystemComponent() {
@@ -43,25 +58,269 @@ ComponentType SystemComponent::GetType() {
   return kComponentType_System;
 }
 
-bool SystemComponent::Handle(uint16_t message_type, TypedBuffer &buffer) {
-  if (message_type == kSystemMessageType_Hello_Complete) {
-    uint16_t message_result = 0;
-    if (!buffer.ReadUInt16(message_result)) {
+bool SystemComponent::Handle(uint16_t message_type, TypedBufferView &buffer) {
+  return dispatcher_.Dispatch(this, message_type, buffer);
+}
+
+bool SystemComponent::handleHelloComplete(TypedBufferView &buffer) {
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+
+  // Servers that don't know about compression, batching or the other
+  // options leave them out
+  uint8_t compression_type = kCompressionType_None;
+  buffer.ReadUInt8(compression_type);
+  bool is_batching = false;
+  buffer.ReadBoolean(is_batching);
+  bool is_presence_changes = false;
+  buffer.ReadBoolean(is_presence_changes);
+  bool is_heartbeat = false;
+  buffer.ReadBoolean(is_heartbeat);
+  bool is_request_id = false;
+  buffer.ReadBoolean(is_request_id);
+  if (message_result == kSystemMessageResult_Ok
+    && compression_type == kCompressionType_Deflate
+    && (compression_type_ != kCompressionType_Deflate
+    || !client_->EnableCompression())) {
+    // The server compresses from now on, we would not be able to read it
+    return false;
+  }
+  if (message_result == kSystemMessageResult_Ok && is_batching
+    && !client_->EnableBatching()) {
+    return false;
+  }
+  if (message_result == kSystemMessageResult_Ok && is_request_id
+    && !client_->EnableRequestIds()) {
+    return false;
+  }
+  if (message_result == kSystemMessageResult_Ok
+    && protocol_version_ == JCHAT_CHAT_PROTOCOL_VERSION) {
+    // Everything after the Hello_Complete is sent in the compact format
+    client_->SetReceiveFormat(kWireFormat_Compact);
+  }
+  OnHelloCompleted(static_cast<SystemMessageResult>(message_result));
+  if (message_result != kSystemMessageResult_Ok) {
+    return false;
+  }
+  return true;
+}
+
+bool SystemComponent::SendHello() {
+  TypedBuffer buffer = client_->CreateBuffer();
+  buffer.WriteString(protocol_version_);
+  // The compression type is followed by batching, presence changes,
+  // heartbeats, request ids, resume and throttle in that order. They are
+  // only left out when nothing after them is asked for.
+  bool has_resume = is_resume_enabled_ || is_throttle_enabled_;
+  bool has_request_id = is_request_id_enabled_ || has_resume;
+  bool has_heartbeat = is_heartbeat_enabled_ || has_request_id;
+  bool has_presence_changes = is_presence_changes_enabled_ || has_heartbeat;
+  bool has_batching = is_batching_enabled_ || has_presence_changes;
+  if (compression_type_ != kCompressionType_None || has_batching) {
+    buffer.WriteUInt8(compression_type_);
+  }
+  if (has_batching) {
+    buffer.WriteBoolean(is_batching_enabled_);
+  }
+  if (has_presence_changes) {
+    buffer.WriteBoolean(is_presence_changes_enabled_);
+  }
+  if (has_heartbeat) {
+    buffer.WriteBoolean(is_heartbeat_enabled_);
+  }
+  if (has_request_id) {
+    buffer.WriteBoolean(is_request_id_enabled_);
+  }
+  if (has_resume) {
+    buffer.WriteBoolean(is_resume_enabled_);
+  }
+  if (is_throttle_enabled_) {
+    buffer.WriteBoolean(true);
+  }
+  if (!client_->Send(kComponentType_System, kSystemMessageType_Hello,
+    buffer)) {
+    return false;
+  }
+
+  // The server reads everything after the Hello in the format of the
+  // requested version
+  if (protocol_version_ == JCHAT_CHAT_PROTOCOL_VERSION) {
+    client_->SetSendFormat(kWireFormat_Compact);
+  }
+  return true;
+}
+
+bool SystemComponent::handleGetStatsComplete(TypedBufferView &buffer) {
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+
+  ServerStats stats;
+  if (message_result != kSystemMessageResult_Ok) {
+    OnGetStatsCompleted(static_cast<SystemMessageResult>(message_result),
+      stats);
+    return true;
+  }
+
+  uint64_t counter_count = 0;
+  if (!buffer.ReadUInt64(counter_count)) {
+    return false;
+  }
+  for (uint64_t i = 0; i < counter_count; i++) {
+    std::pair<std::string, uint64_t> counter;
+    if (!buffer.ReadString(counter.first)
+      || !buffer.ReadUInt64(counter.second)) {
       return false;
     }
-    OnHelloCompleted(static_cast<SystemMessageResult>(message_result));
-    if (message_result != kSystemMessageResult_Ok) {
+    stats.Counters.push_back(counter);
+  }
+
+  uint64_t histogram_count = 0;
+  if (!buffer.ReadUInt64(histogram_count)) {
+    return false;
+  }
+  for (uint64_t i = 0; i < histogram_count; i++) {
+    StatsHistogram histogram;
+    if (!buffer.ReadString(histogram.Name)
+      || !buffer.ReadUInt64(histogram.Count)
+      || !buffer.ReadUInt64(histogram.Sum)
+      || !buffer.ReadUInt64(histogram.Median)
+      || !buffer.ReadUInt64(histogram.Percentile99)
+      || !buffer.ReadUInt64(histogram.Max)) {
       return false;
     }
-    return true;
+    stats.Histograms.push_back(histogram);
   }
 
-  return false;
+  OnGetStatsCompleted(kSystemMessageResult_Ok, stats);
+  return true;
 }
 
-bool SystemComponent::SendHello() {
+bool SystemComponent::handlePing(TypedBufferView &buffer) {
+  uint64_t ping_id = 0;
+  if (!buffer.ReadUInt64(ping_id)) {
+    return false;
+  }
+
+  TypedBuffer send_buffer = client_->CreateBuffer();
+  send_buffer.WriteUInt64(ping_id);
+  return client_->Send(kComponentType_System, kSystemMessageType_Pong,
+    send_buffer);
+}
+
+bool SystemComponent::handlePong(TypedBufferView &buffer) {
+  uint64_t ping_id = 0;
+  if (!buffer.ReadUInt64(ping_id)) {
+    return false;
+  }
+  OnPongReceived(ping_id);
+  return true;
+}
+
+bool SystemComponent::handleThrottled(TypedBufferView &buffer) {
+  uint8_t component_type = 0;
+  uint16_t message_type = 0;
+  uint32_t retry_after = 0;
+  if (!buffer.ReadUInt8(component_type) || !buffer.ReadUInt16(message_type)
+    || !buffer.ReadUInt32(retry_after)) {
+    return false;
+  }
+  OnThrottled(static_cast<ComponentType>(component_type), message_type,
+    std::chrono::milliseconds(retry_after));
+  return true;
+}
+
+bool SystemComponent::SendPing(uint64_t ping_id) {
   TypedBuffer buffer = client_->CreateBuffer();
-  buffer.WriteString(JCHAT_CHAT_PROTOCOL_VERSION);
-  return client_->Send(kComponentType_System, kSystemMessageType_Hello, buffer);
+  buffer.WriteUInt64(ping_id);
+  return client_->Send(kComponentType_System, kSystemMessageType_Ping,
+    buffer);
+}
+
+bool SystemComponent::GetStats(const std::string &stats_key,
+  const ChatRequest &request) {
+  TypedBuffer buffer = client_->CreateBuffer();
+  buffer.WriteString(stats_key);
+  return client_->Send(kComponentType_System, kSystemMessageType_GetStats,
+    buffer, request);
+}
+
+bool SystemComponent::SetProtocolVersion(const std::string &protocol_version) {
+  if (protocol_version != JCHAT_CHAT_PROTOCOL_VERSION
+    && protocol_version != JCHAT_CHAT_LEGACY_PROTOCOL_VERSION) {
+    return false;
+  }
+  protocol_version_ = protocol_version;
+  return true;
+}
+
+std::string SystemComponent::GetProtocolVersion() {
+  return protocol_version_;
+}
+
+bool SystemComponent::SetCompressionType(CompressionType compression_type) {
+  if (compression_type >= kCompressionType_Max
+    || (compression_type == kCompressionType_Deflate
+    && !DeflateStream::IsSupported())) {
+    return false;
+  }
+  compression_type_ = compression_type;
+  return true;
+}
+
+CompressionType SystemComponent::GetCompressionType() {
+  return compression_type_;
+}
+
+void SystemComponent::SetBatchingEnabled(bool is_batching_enabled) {
+  is_batching_enabled_ = is_batching_enabled;
+}
+
+bool SystemComponent::IsBatchingEnabled() {
+  return is_batching_enabled_;
+}
+
+void SystemComponent::SetPresenceChangesEnabled(
+  bool is_presence_changes_enabled) {
+  is_presence_changes_enabled_ = is_presence_changes_enabled;
+}
+
+bool SystemComponent::IsPresenceChangesEnabled() {
+  return is_presence_changes_enabled_;
+}
+
+void SystemComponent::SetHeartbeatEnabled(bool is_heartbeat_enabled) {
+  is_heartbeat_enabled_ = is_heartbeat_enabled;
+}
+
+bool SystemComponent::IsHeartbeatEnabled() {
+  return is_heartbeat_enabled_;
+}
+
+void SystemComponent::SetRequestIdEnabled(bool is_request_id_enabled) {
+  is_request_id_enabled_ = is_request_id_enabled;
+}
+
+bool SystemComponent::IsRequestIdEnabled() {
+  return is_request_id_enabled_;
+}
+
+void SystemComponent::SetResumeEnabled(bool is_resume_enabled) {
+  is_resume_enabled_ = is_resume_enabled;
+}
+
+bool SystemComponent::IsResumeEnabled() {
+  return is_resume_enabled_;
+}
+
+void SystemComponent::SetThrottleEnabled(bool is_throttle_enabled) {
+  is_throttle_enabled_ = is_throttle_enabled;
+}
+
+bool SystemComponent::IsThrottleEnabled() {
+  return is_throttle_enabled_;
 }
 }
@@ -8,10 +8,19 @@
 
 #include "components/user_component.h"
 #include "chat_client.h"
+#include "components/channel_component.h"
 #include "protocol/components/user_message_type.h"
 
 namespace jchat {
 UserComponent::UserComponent() {
+  dispatcher_.Register(kUserMessageType_Identify_Complete,
+    &UserComponent::handleIdentifyComplete);
+  dispatcher_.Register(kUserMessageType_SendMessage_Complete,
+    &UserComponent::handleSendMessageComplete);
+  dispatcher_.Register(kUserMessageType_SendMessage,
+    &UserComponent::handleSendMessage);
+  dispatcher_.Register(kUserMessageType_Resume_Complete,
+    &UserComponent::handleResumeComplete);
 }
 
 UserComponent::~UserComponent() {
@@ -44,76 +53,124 @@ ComponentType UserComponent::GetType() {
   return kComponentType_User;
 }
 
-bool UserComponent::Handle(uint16_t message_type, TypedBuffer &buffer) {
-  if (message_type == kUserMessageType_Identify_Complete) {
-    uint16_t message_result = 0;
-    if (!buffer.ReadUInt16(message_result)) {
-      return false;
-    }
-    std::string username;
-    if (!buffer.ReadString(username)) {
-      return false;
-    }
-    OnIdentifyCompleted(static_cast<UserMessageResult>(message_result),
-      username);
-    if (message_result == kUserMessageResult_Ok) {
-      std::string hostname;
-      if (!buffer.ReadString(hostname)) {
-        return false;
-      }
-      user_->Username = username;
-      user_->Hostname = hostname;
-      user_->Identified = true;
-
-      OnIdentified();
-    }
+bool UserComponent::Handle(uint16_t message_type, TypedBufferView &buffer) {
+  return dispatcher_.Dispatch(this, message_type, buffer);
+}
 
-    return true;
-  } else if (message_type == kUserMessageType_SendMessage_Complete) {
-    uint16_t message_result = 0;
-    if (!buffer.ReadUInt16(message_result)) {
-      return false;
-    }
-    std::string username;
-    if (!buffer.ReadString(username)) {
-      return false;
-    }
-    std::string message;
-    if (!buffer.ReadString(message)) {
+bool UserComponent::handleIdentifyComplete(TypedBufferView &buffer) {
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+  std::string username;
+  if (!buffer.ReadString(username)) {
+    return false;
+  }
+  OnIdentifyCompleted(static_cast<UserMessageResult>(message_result),
+    username);
+  if (message_result == kUserMessageResult_Ok) {
+    std::string hostname;
+    if (!buffer.ReadString(hostname)) {
       return false;
     }
-    OnSendMessageCompleted(static_cast<UserMessageResult>(message_result),
-      username, message);
-    if (message_result == kUserMessageResult_Ok) {
-      OnMessage(user_->Username, user_->Hostname, username, message);
-    }
+    user_->Username = username;
+    user_->Hostname = hostname;
+    user_->Identified = true;
+
+    // Servers only send a token to clients that asked for resume
+    std::string resume_token;
+    buffer.ReadString(resume_token);
+    resume_token_mutex_.lock();
+    resume_token_ = resume_token;
+    resume_token_mutex_.unlock();
+
+    OnIdentified();
+  }
 
-    return true;
-  } else if (message_type == kUserMessageType_SendMessage) {
-    uint16_t message_result = 0;
-    if (!buffer.ReadUInt16(message_result)) {
-      return false;
-    }
+  return true;
+}
+
+bool UserComponent::handleSendMessageComplete(TypedBufferView &buffer) {
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+  std::string username;
+  if (!buffer.ReadString(username)) {
+    return false;
+  }
+  std::string message;
+  if (!buffer.ReadString(message)) {
+    return false;
+  }
+  OnSendMessageCompleted(static_cast<UserMessageResult>(message_result),
+    username, message);
+  if (message_result == kUserMessageResult_Ok) {
+    OnMessage(user_->Username, user_->Hostname, username, message);
+  }
+
+  return true;
+}
+
+bool UserComponent::handleSendMessage(TypedBufferView &buffer) {
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+  std::string username;
+  if (!buffer.ReadString(username)) {
+    return false;
+  }
+  std::string hostname;
+  if (!buffer.ReadString(hostname)) {
+    return false;
+  }
+  std::string message;
+  if (!buffer.ReadString(message)) {
+    return false;
+  }
+  if (message_result != kUserMessageResult_MessageSent) {
+    return false;
+  }
+  OnMessage(username, hostname, user_->Username, message);
+  return true;
+}
+
+bool UserComponent::handleResumeComplete(TypedBufferView &buffer) {
+  uint16_t message_result = 0;
+  if (!buffer.ReadUInt16(message_result)) {
+    return false;
+  }
+  if (message_result == kUserMessageResult_Ok) {
     std::string username;
-    if (!buffer.ReadString(username)) {
-      return false;
-    }
     std::string hostname;
-    if (!buffer.ReadString(hostname)) {
-      return false;
-    }
-    std::string message;
-    if (!buffer.ReadString(message)) {
+    if (!buffer.ReadString(username) || !buffer.ReadString(hostname)) {
       return false;
     }
-    if (message_result != kUserMessageResult_MessageSent) {
-      return false;
-    }
-    OnMessage(username, hostname, user_->Username, message);
-    return true;
+    user_->Username = username;
+    user_->Hostname = hostname;
+    user_->Identified = true;
+  } else if (message_result != kUserMessageResult_SessionInUse
+    && message_result != kUserMessageResult_AlreadyIdentified) {
+    endSession();
   }
+  OnResumeCompleted(static_cast<UserMessageResult>(message_result));
+  return true;
+}
 
-  return false;
+void UserComponent::endSession() {
+  resume_token_mutex_.lock();
+  bool is_resumable = !resume_token_.empty();
+  resume_token_.clear();
+  resume_token_mutex_.unlock();
+  if (!is_resumable) {
+    return;
+  }
+  user_->Identified = false;
+  std::shared_ptr<ChannelComponent> channel_component;
+  if (client_->GetComponent(kComponentType_Channel, channel_component)) {
+    channel_component->ClearChannels();
+  }
 }
 
 bool UserComponent::GetChatUser(std::shared_ptr<ChatUser> &out_user) {
@@ -124,17 +181,44 @@ bool UserComponent::GetChatUser(std::shared_ptr<ChatUser> &out_user) {
   return false;
 }
 
-bool UserComponent::Identify(std::string username) {
+bool UserComponent::Identify(std::string username,
+  const ChatRequest &request) {
+  // Identifying again starts a new session
+  endSession();
+
   TypedBuffer buffer = client_->CreateBuffer();
   buffer.WriteString(username);
-  return client_->Send(kComponentType_User, kUserMessageType_Identify, buffer);
+  return client_->Send(kComponentType_User, kUserMessageType_Identify, buffer,
+    request);
 }
 
-bool UserComponent::SendMessage(std::string username, std::string message) {
+bool UserComponent::SendMessage(std::string username, std::string message,
+  const ChatRequest &request) {
   TypedBuffer buffer = client_->CreateBuffer();
   buffer.WriteString(username);
   buffer.WriteString(message);
   return client_->Send(kComponentType_User, kUserMessageType_SendMessage,
-    buffer);
+    buffer, request);
+}
+
+bool UserComponent::Resume(const ChatRequest &request) {
+  resume_token_mutex_.lock();
+  std::string resume_token = resume_token_;
+  resume_token_mutex_.unlock();
+  if (resume_token.empty()) {
+    return false;
+  }
+
+  TypedBuffer buffer = client_->CreateBuffer();
+  buffer.WriteString(resume_token);
+  return client_->Send(kComponentType_User, kUserMessageType_Resume, buffer,
+    request);
+}
+
+bool UserComponent::IsResumable() {
+  resume_token_mutex_.lock();
+  bool is_resumable = !resume_token_.empty();
+  resume_token_mutex_.unlock();
+  return is_resumable;
 }
 }
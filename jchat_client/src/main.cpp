@@ -13,6 +13,7 @@
 #include "components/user_component.h"
 #include "components/channel_component.h"
 #include "string.hpp"
+#include "shared_ring.hpp"
 #include <iostream>
 #include <chrono>
 #include <thread>
@@ -31,10 +32,25 @@ int main(int argc, char **argv) {
   jchat::ChatClient chat_client(
     command_line.GetString("ipaddress", "127.0.0.1").c_str(),
     command_line.GetInt32("port", 9998));
+  // Servers on this host may also be reached through their Unix domain
+  // socket
+  std::string local_path = command_line.GetString("localsocket", "");
+  chat_client.SetLocalPath(local_path);
 
   // Handle client events
-  chat_client.OnDisconnected.Add([]() {
+  chat_client.OnDisconnected.Add([&chat_client]() {
     std::cout << "Disconnected from server" << std::endl;
+    jchat::DeflateStats stats;
+    if (chat_client.GetCompressionStats(stats)) {
+      std::cout << "Compression: sent "
+                << stats.CompressInputBytes << " -> "
+                << stats.CompressOutputBytes << " bytes in "
+                << stats.CompressNanoseconds / 1000 << "us, received "
+                << stats.DecompressInputBytes << " -> "
+                << stats.DecompressOutputBytes << " bytes in "
+                << stats.DecompressNanoseconds / 1000 << "us"
+                << std::endl;
+    }
     exit(0);
     return true;
   });
@@ -44,6 +60,32 @@ int main(int argc, char **argv) {
   auto user_component = std::make_shared<jchat::UserComponent>();
   auto channel_component = std::make_shared<jchat::ChannelComponent>();
 
+  // Old servers only understand the legacy protocol version
+  if (!system_component->SetProtocolVersion(command_line.GetString("protocol",
+    JCHAT_CHAT_PROTOCOL_VERSION))) {
+    std::cout << "Unsupported protocol version" << std::endl;
+    return 1;
+  }
+  if (command_line.GetString("compression", "none") == "deflate"
+    && !system_component->SetCompressionType(
+    jchat::kCompressionType_Deflate)) {
+    std::cout << "Compression is not supported by this build" << std::endl;
+    return 1;
+  }
+  system_component->SetPresenceChangesEnabled(true);
+  // Last messages of a channel that are shown when joining it
+  int32_t history_count = command_line.GetInt32("history", 20);
+  if (history_count < 0) {
+    history_count = 0;
+  }
+  // Messages wait up to this many microseconds to be sent in one frame
+  int32_t batch_window = command_line.GetInt32("batchwindow", 0);
+  if (batch_window > 0) {
+    system_component->SetBatchingEnabled(true);
+    chat_client.SetBatchLimits(std::chrono::microseconds(batch_window),
+      JCHAT_CHAT_BATCH_MAX_SIZE);
+  }
+
   // Handle any API events
   system_component->OnHelloCompleted.Add([](jchat::SystemMessageResult result) {
     if (result == jchat::kSystemMessageResult_Ok) {
@@ -54,6 +96,26 @@ int main(int argc, char **argv) {
     }
     return true;
   });
+  system_component->OnGetStatsCompleted.Add([](
+    jchat::SystemMessageResult result, jchat::ServerStats &stats) {
+    if (result == jchat::kSystemMessageResult_NotPermitted) {
+      std::cout << "System: Not permitted to read stats!" << std::endl;
+      return true;
+    }
+    std::cout << "System: Server stats" << std::endl;
+    for (auto &counter : stats.Counters) {
+      std::cout << "  " << counter.first << " = " << counter.second
+        << std::endl;
+    }
+    for (auto &histogram : stats.Histograms) {
+      std::cout << "  " << histogram.Name << ": count " << histogram.Count
+        << ", avg " << (histogram.Count ? histogram.Sum / histogram.Count : 0)
+        << ", p50 <= " << histogram.Median
+        << ", p99 <= " << histogram.Percentile99
+        << ", max " << histogram.Max << std::endl;
+    }
+    return true;
+  });
   user_component->OnIdentifyCompleted.Add([](jchat::UserMessageResult result,
 	  std::string &username) {
     if (result == jchat::kUserMessageResult_Ok) {
@@ -310,6 +372,48 @@ int main(int argc, char **argv) {
     }
     return true;
   });
+  channel_component->OnSubscribeCompleted.Add([](
+    jchat::ChannelMessageResult result, std::string &pattern,
+    std::string &sender) {
+    std::string target = sender.empty() ? pattern : pattern + ", " + sender;
+    if (result == jchat::kChannelMessageResult_Ok) {
+      std::cout << "Channel: Successfully subscribed! (" << target << ")"
+        << std::endl;
+    } else if (result == jchat::kChannelMessageResult_AlreadySubscribed) {
+      std::cout << "Channel: Already subscribed! (" << target << ")"
+        << std::endl;
+    } else if (result == jchat::kChannelMessageResult_TooManySubscriptions) {
+      std::cout << "Channel: Too many subscriptions! (" << target << ")"
+        << std::endl;
+    } else if (result == jchat::kChannelMessageResult_InvalidUsername) {
+      std::cout << "Channel: Invalid username! (" << target << ")"
+        << std::endl;
+    } else if (result == jchat::kChannelMessageResult_ChannelNameTooLong) {
+      std::cout << "Channel: Pattern too long! (" << target << ")"
+        << std::endl;
+    } else if (result == jchat::kChannelMessageResult_NotIdentified) {
+      std::cout << "Channel: Not identified! (" << target << ")"
+        << std::endl;
+    } else if (result == jchat::kChannelMessageResult_InvalidChannelName) {
+      std::cout << "Channel: Invalid pattern! (" << target << ")"
+        << std::endl;
+    }
+    return true;
+  });
+  channel_component->OnUnsubscribeCompleted.Add([](
+    jchat::ChannelMessageResult result, std::string &pattern) {
+    if (result == jchat::kChannelMessageResult_Ok) {
+      std::cout << "Channel: Successfully unsubscribed! (" << pattern << ")"
+        << std::endl;
+    } else if (result == jchat::kChannelMessageResult_NotSubscribed) {
+      std::cout << "Channel: Not subscribed! (" << pattern << ")"
+        << std::endl;
+    } else if (result == jchat::kChannelMessageResult_NotIdentified) {
+      std::cout << "Channel: Not identified! (" << pattern << ")"
+        << std::endl;
+    }
+    return true;
+  });
   channel_component->OnChannelJoined.Add([=](jchat::ChatChannel &channel,
     jchat::ChatUser &user) {
     std::shared_ptr<jchat::ChatUser> local_user;
@@ -338,12 +442,20 @@ int main(int argc, char **argv) {
 
     return true;
   });
+  channel_component->OnChannelHistory.Add([](jchat::ChatChannel &channel,
+    jchat::ChatUser &user, std::string &message,
+    std::chrono::milliseconds age) {
+    std::cout << "Channel: [" << age.count() / 1000 << "s ago] "
+      << user.Username << " => " << channel.Name << ": " << message
+      << std::endl;
+
+    return true;
+  });
   channel_component->OnChannelMessage.Add([=](jchat::ChatChannel &channel,
     jchat::ChatUser &user, std::string &message) {
+    // Tailing clients aren't identified
     std::shared_ptr<jchat::ChatUser> local_user;
-    if (!user_component->GetChatUser(local_user)) {
-      return false;
-    }
+    user_component->GetChatUser(local_user);
 
     if (&user != local_user.get()) {
       std::cout << "Channel: " << user.Username << " => " << channel.Name
@@ -440,10 +552,36 @@ int main(int argc, char **argv) {
   chat_client.AddComponent(user_component);
   chat_client.AddComponent(channel_component);
 
+  // Tail the tap of a server on this host instead of connecting, its
+  // channel messages are shown like received ones
+  std::string tap_path = command_line.GetString("tap", "");
+  if (!tap_path.empty()) {
+    jchat::SharedRingReader tap;
+    if (!tap.Open(tap_path)) {
+      std::cout << "Failed to open the tap " << tap_path << std::endl;
+      return -1;
+    }
+    std::cout << "Tailing " << tap_path << std::endl;
+    channel_component->SetTailing(true);
+    jchat::StreamBuffer stream;
+    std::vector<uint8_t> frame;
+    while (true) {
+      if (!tap.Read(frame)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+      stream.Write(frame.data(), frame.size());
+      if (!chat_client.HandleFrames(stream)) {
+        std::cout << "Invalid frame in the tap" << std::endl;
+        return -1;
+      }
+    }
+  }
+
   // Connect to the server and read input
   if (chat_client.Connect()) {
-    std::cout << "Connected to "
-              << chat_client.GetRemoteEndpoint().ToString()
+    std::cout << "Connected to " << (local_path.empty()
+                 ? chat_client.GetRemoteEndpoint().ToString() : local_path)
               << std::endl;
     while (true) {
       std::string input;
@@ -478,15 +616,23 @@ int main(int argc, char **argv) {
         user_component->Identify(username);
       } else if (command == "join" && arguments.size() == 1) {
         std::string &target = arguments[0];
-        channel_component->JoinChannel(target);
+        channel_component->JoinChannel(target, false, history_count);
+      } else if (command == "stats" && arguments.size() == 1) {
+        system_component->GetStats(arguments[0]);
       } else if (command == "leave" && arguments.size() == 1) {
         std::string &target = arguments[0];
         channel_component->LeaveChannel(target);
+      } else if (command == "subscribe" && (arguments.size() == 1
+        || arguments.size() == 2)) {
+        channel_component->Subscribe(arguments[0],
+          arguments.size() == 2 ? arguments[1] : std::string());
+      } else if (command == "unsubscribe" && arguments.size() == 1) {
+        channel_component->Unsubscribe(arguments[0]);
       } else if (command == "msg" && arguments.size() >= 2) {
         std::string &target = arguments[0];
-        std::string message = jchat::String::Join(
-          std::vector<std::string>(arguments.begin() + 1, arguments.end()),
-          " ");
+        // The rest of the input as it was typed, Split keeps every space
+        std::string message = input.substr(command.size() + target.size()
+          + 3);
         if (!target.empty() && target[0] == '#') {
           channel_component->SendMessage(target, message);
         } else {
@@ -0,0 +1,70 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_common_chat_identity_hpp_
+#define jchat_common_chat_identity_hpp_
+
+// Required libraries
+#include "typed_buffer.hpp"
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace jchat {
+// A username and hostname that never change once made, a user that is
+// renamed is given a new one. Everything messages need of them is worked
+// out up front, so they are shared by every message that names the user.
+class ChatIdentity {
+  std::string username_;
+  std::string hostname_;
+  std::string identity_; // Format: username@hostname, used for bans
+  // The username and hostname as tagged strings, one after the other, in
+  // the endian order of flip_endian_
+  std::vector<uint8_t> encoded_;
+  bool flip_endian_;
+
+public:
+  // The strings are encoded like a buffer that flips the endian order as
+  // given would
+  ChatIdentity(const std::string &username, const std::string &hostname,
+    bool flip_endian) : username_(username), hostname_(hostname),
+    identity_(username + "@" + hostname), flip_endian_(flip_endian) {
+    TypedBuffer buffer(flip_endian);
+    buffer.WriteString(username_);
+    buffer.WriteString(hostname_);
+    encoded_.assign(buffer.GetBuffer(), buffer.GetBuffer() + buffer.GetSize());
+  }
+
+  ChatIdentity(const ChatIdentity &) = delete;
+  ChatIdentity &operator=(const ChatIdentity &) = delete;
+
+  // Writes the username and then the hostname, as WriteString would
+  void WriteName(TypedBuffer &buffer) const {
+    if (buffer.IsFlippingEndian() != flip_endian_) {
+      buffer.WriteString(username_);
+      buffer.WriteString(hostname_);
+      return;
+    }
+    buffer.WriteEncoded(encoded_.data(), encoded_.size());
+  }
+
+  const std::string &GetUsername() const {
+    return username_;
+  }
+
+  const std::string &GetHostname() const {
+    return hostname_;
+  }
+
+  const std::string &GetIdentity() const {
+    return identity_;
+  }
+};
+}
+
+#endif // jchat_common_chat_identity_hpp_
@@ -9,12 +9,25 @@
 #ifndef jchat_common_chat_user_h_
 #define jchat_common_chat_user_h_
 
+#include "chat_identity.hpp"
+#include <atomic>
+#include <memory>
+#include <string>
+
 namespace jchat {
 struct ChatUser {
   bool Enabled;
   std::string Username;
   std::string Hostname;
-  bool Identified;
+  std::string Identity; // Format: username@hostname, used for bans
+  // The three strings above, only set on the server, see
+  // ChatServer::SetIdentity
+  std::shared_ptr<const ChatIdentity> Interned;
+  // Set after the identity, so whoever sees it set also sees the strings
+  std::atomic<bool> Identified;
+  // Asked for in the Hello, joins and leaves of the channels the user is in
+  // are sent as PresenceChanged
+  bool PresenceChanges;
 };
 }
 
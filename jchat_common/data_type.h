@@ -0,0 +1,33 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_common_data_type_h_
+#define jchat_common_data_type_h_
+
+#include <stdint.h>
+
+namespace jchat {
+// Tag written in front of every value of a typed buffer
+enum DataType : uint8_t {
+  kDataType_Bool,
+  kDataType_Char,
+  kDataType_Int8,
+  kDataType_UInt8,
+  kDataType_Int16,
+  kDataType_UInt16,
+  kDataType_Int32,
+  kDataType_UInt32,
+  kDataType_Int64,
+  kDataType_UInt64,
+  kDataType_Float,
+  kDataType_String,
+  kDataType_Blob,
+};
+}
+
+#endif // jchat_common_data_type_h_
@@ -0,0 +1,142 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_common_frame_batch_hpp_
+#define jchat_common_frame_batch_hpp_
+
+// Required libraries
+#include "buffer_view.hpp"
+#include "protocol/protocol.h"
+#include <limits>
+#include <vector>
+#include <stdint.h>
+
+namespace jchat {
+// The body of a batch frame, the frame's message type is the number of
+// messages in it. Every message is
+//  - the component type as a byte
+//  - the message type and the body size as variable length integers
+//  - the request id as a variable length integer, only if the component
+//    type has JCHAT_CHAT_FRAME_REQUEST set
+//  - the body, in the wire format of the connection
+// None of it depends on the endian order.
+class FrameBatch {
+  std::vector<uint8_t> buffer_;
+  uint16_t count_;
+
+  void writeVarInt(uint64_t value) {
+    while (value >= 0x80) {
+      buffer_.push_back(static_cast<uint8_t>(value | 0x80));
+      value >>= 7;
+    }
+    buffer_.push_back(static_cast<uint8_t>(value));
+  }
+
+public:
+  // Largest overhead a message adds to the batch
+  static const size_t kMaxMessageHeaderSize = 1 + 3 + 5 + 5;
+
+  FrameBatch() : count_(0) {
+  }
+
+  // Returns false if the message would not fit in a single frame anymore,
+  // the batch is left as it was. A request id of 0 is left out.
+  bool Add(uint8_t component_type, uint16_t message_type, const uint8_t *body,
+    size_t size, uint32_t request_id = 0) {
+    if (count_ == std::numeric_limits<uint16_t>::max()
+      || buffer_.size() + kMaxMessageHeaderSize + size
+      > JCHAT_CHAT_MAX_FRAME_SIZE) {
+      return false;
+    }
+    buffer_.push_back(request_id != 0
+      ? component_type | JCHAT_CHAT_FRAME_REQUEST : component_type);
+    writeVarInt(message_type);
+    writeVarInt(size);
+    if (request_id != 0) {
+      writeVarInt(request_id);
+    }
+    buffer_.insert(buffer_.end(), body, body + size);
+    count_++;
+    return true;
+  }
+
+  // Keeps the storage for the next batch
+  void Clear() {
+    buffer_.clear();
+    count_ = 0;
+  }
+
+  bool IsEmpty() {
+    return count_ == 0;
+  }
+
+  uint16_t GetCount() {
+    return count_;
+  }
+
+  size_t GetSize() {
+    return buffer_.size();
+  }
+
+  const uint8_t *GetBuffer() {
+    return buffer_.data();
+  }
+};
+
+// Walks the messages of a received batch in place
+class FrameBatchReader {
+  BufferView view_;
+  uint16_t remaining_count_;
+
+public:
+  FrameBatchReader(const uint8_t *body, size_t size, uint16_t count)
+    : view_(body, size), remaining_count_(count) {
+  }
+
+  // Returns false once every message has been read, or if the batch is
+  // malformed, check IsComplete to tell them apart. The request id is 0 for
+  // messages without one.
+  bool Next(uint8_t &out_component_type, uint16_t &out_message_type,
+    const uint8_t *&out_body, size_t &out_size, uint32_t &out_request_id) {
+    if (remaining_count_ == 0) {
+      return false;
+    }
+    uint64_t message_type = 0;
+    uint64_t size = 0;
+    if (!view_.Read(&out_component_type) || !view_.ReadVarInt(message_type)
+      || message_type > std::numeric_limits<uint16_t>::max()
+      || !view_.ReadVarInt(size)) {
+      return false;
+    }
+    uint64_t request_id = 0;
+    if ((out_component_type & JCHAT_CHAT_FRAME_REQUEST) != 0) {
+      out_component_type &= ~JCHAT_CHAT_FRAME_REQUEST;
+      if (!view_.ReadVarInt(request_id) || request_id == 0
+        || request_id > std::numeric_limits<uint32_t>::max()) {
+        return false;
+      }
+    }
+    if (size > view_.GetSize() - view_.GetPosition()) {
+      return false;
+    }
+    out_request_id = static_cast<uint32_t>(request_id);
+    out_message_type = static_cast<uint16_t>(message_type);
+    out_size = static_cast<size_t>(size);
+    out_body = view_.ReadPointer(out_size);
+    remaining_count_--;
+    return true;
+  }
+
+  // Every message was read and nothing follows them
+  bool IsComplete() {
+    return remaining_count_ == 0 && view_.GetPosition() == view_.GetSize();
+  }
+};
+}
+
+#endif // jchat_common_frame_batch_hpp_
@@ -0,0 +1,60 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_common_message_dispatcher_hpp_
+#define jchat_common_message_dispatcher_hpp_
+
+// Required libraries
+#include <stdint.h>
+
+namespace jchat {
+// Maps the message types of a component to its handler functions, so a
+// message is handled with one indexed lookup instead of comparing it to every
+// known type. Unregistered types are reported as unhandled.
+// Example:
+//    MessageDispatcher<UserComponent, kUserMessageType_Max,
+//      RemoteChatClient &, TypedBufferView &> dispatcher_;
+//    dispatcher_.Register(kUserMessageType_Identify,
+//      &UserComponent::handleIdentify);
+//    return dispatcher_.Dispatch(this, message_type, client, buffer);
+template<typename _TComponent, uint16_t _MessageTypeCount,
+  typename... _TArgs>
+class MessageDispatcher {
+public:
+  typedef bool (_TComponent::*Handler)(_TArgs...);
+
+private:
+  Handler handlers_[_MessageTypeCount];
+
+public:
+  MessageDispatcher() {
+    for (uint16_t i = 0; i < _MessageTypeCount; i++) {
+      handlers_[i] = nullptr;
+    }
+  }
+
+  bool Register(uint16_t message_type, Handler handler) {
+    if (message_type >= _MessageTypeCount) {
+      return false;
+    }
+    handlers_[message_type] = handler;
+    return true;
+  }
+
+  bool Dispatch(_TComponent *component, uint16_t message_type,
+    _TArgs... arguments) {
+    if (message_type >= _MessageTypeCount
+      || handlers_[message_type] == nullptr) {
+      return false;
+    }
+    return (component->*handlers_[message_type])(arguments...);
+  }
+};
+}
+
+#endif // jchat_common_message_dispatcher_hpp_
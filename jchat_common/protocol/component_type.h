@@ -17,6 +17,8 @@ enum ComponentType : uint8_t {
   kComponentType_System,
   kComponentType_User,
   kComponentType_Channel,
+  // Only spoken between the servers of a cluster
+  kComponentType_Cluster,
   kComponentType_Max,
 };
 }
@@ -64,6 +64,13 @@ enum ChannelMessageResult : uint16_t {
   kChannelMessageResult_CannotUnbanSelf,
   kChannelMessageResult_UserUnbanned,
 
+  // Subscribe
+  kChannelMessageResult_AlreadySubscribed,
+  kChannelMessageResult_TooManySubscriptions,
+
+  // Unsubscribe
+  kChannelMessageResult_NotSubscribed,
+
   kChannelMessageResult_Max
 };
 }
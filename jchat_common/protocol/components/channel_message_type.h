@@ -30,6 +30,21 @@ enum ChannelMessageType : uint16_t {
   kChannelMessageType_BanUser_Complete,
   kChannelMessageType_UnbanUser,
   kChannelMessageType_UnbanUser_Complete,
+  kChannelMessageType_GetMembers,
+  kChannelMessageType_GetMembers_Complete,
+  // Sent by the server to clients that asked for it in their Hello, instead
+  // of a UserJoined or UserLeft for every member that joined or left
+  kChannelMessageType_PresenceChanged,
+  // Sent by the server after a JoinChannel_Complete to clients that asked for
+  // history in the join, the SendMessages that follow are that many of the
+  // channel's last messages
+  kChannelMessageType_History,
+  // Clients that only read channels subscribe to the messages of those that
+  // match a pattern instead of joining them, see ChannelComponent
+  kChannelMessageType_Subscribe,
+  kChannelMessageType_Subscribe_Complete,
+  kChannelMessageType_Unsubscribe,
+  kChannelMessageType_Unsubscribe_Complete,
 
   kChannelMessageType_Max,
 };
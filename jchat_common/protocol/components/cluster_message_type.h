@@ -0,0 +1,38 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_common_cluster_message_type_h_
+#define jchat_common_cluster_message_type_h_
+
+// Required libraries
+#include <stdint.h>
+
+namespace jchat {
+// Every node sends to the others over a connection of its own, so there are
+// no replies on the same connection. Messages are always tagged.
+enum ClusterMessageType : uint16_t {
+  // The shared key and the id of the node that opened the connection
+  kClusterMessageType_Hello,
+  // Asks the node that owns a username whether a client may identify with it
+  kClusterMessageType_ClaimUsername,
+  kClusterMessageType_ClaimUsername_Complete,
+  // Sent to every node when a client identifies or disconnects
+  kClusterMessageType_UserOnline,
+  kClusterMessageType_UserOffline,
+  // A channel request of a client, sent to the node that owns the channel
+  kClusterMessageType_ChannelRequest,
+  // A message for clients of the node it is sent to
+  kClusterMessageType_Relay,
+  // Sent over links that had nothing else to send for a while, so the node
+  // doesn't take them for idle connections
+  kClusterMessageType_Heartbeat,
+  kClusterMessageType_Max,
+};
+}
+
+#endif // jchat_common_cluster_message_type_h_
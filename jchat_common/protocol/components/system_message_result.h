@@ -21,6 +21,9 @@ enum SystemMessageResult : uint16_t {
   // Hello
   kSystemMessageResult_InvalidProtocolVersion,
 
+  // GetStats
+  kSystemMessageResult_NotPermitted,
+
   kSystemMessageResult_Max
 };
 }
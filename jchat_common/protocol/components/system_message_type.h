@@ -16,6 +16,18 @@ namespace jchat {
 enum SystemMessageType : uint16_t {
   kSystemMessageType_Hello,
   kSystemMessageType_Hello_Complete,
+  kSystemMessageType_GetStats,
+  kSystemMessageType_GetStats_Complete,
+  // Either side may send a Ping once heartbeats were negotiated in the
+  // Hello, the other side answers with a Pong carrying the same id
+  kSystemMessageType_Ping,
+  kSystemMessageType_Pong,
+  // Sent instead of handling a message of a client that is over the
+  // server's message rate limit, to clients that asked for it in the Hello.
+  // Carries the message's component and message type and the milliseconds
+  // until the next one is accepted. It carries the request id of the message,
+  // untagged messages are only answered once until one is accepted again.
+  kSystemMessageType_Throttled,
   kSystemMessageType_Max,
 };
 }
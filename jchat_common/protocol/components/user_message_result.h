@@ -33,6 +33,12 @@ enum UserMessageResult : uint16_t {
   kUserMessageResult_CannotMessageSelf,
   kUserMessageResult_MessageSent,
 
+  // Resume
+  kUserMessageResult_InvalidSession,
+  // The connection of the session is still open, the server closes it and
+  // the resume can be tried again
+  kUserMessageResult_SessionInUse,
+
   kUserMessageResult_Max
 };
 }
@@ -18,6 +18,8 @@ enum UserMessageType : uint16_t {
   kUserMessageType_Identify_Complete,
   kUserMessageType_SendMessage,
   kUserMessageType_SendMessage_Complete,
+  kUserMessageType_Resume,
+  kUserMessageType_Resume_Complete,
   kUserMessageType_Max,
 };
 }
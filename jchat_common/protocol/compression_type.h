@@ -0,0 +1,25 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_common_compression_type_h_
+#define jchat_common_compression_type_h_
+
+// Required libraries
+#include <stdint.h>
+
+namespace jchat {
+// Requested by the client in its Hello, the server answers with the one it
+// picked in the Hello_Complete
+enum CompressionType : uint8_t {
+  kCompressionType_None,
+  kCompressionType_Deflate,
+  kCompressionType_Max,
+};
+}
+
+#endif // jchat_common_compression_type_h_
@@ -10,9 +10,15 @@
 #define jchat_common_protocol_h_
 
 #ifndef JCHAT_CHAT_PROTOCOL_VERSION
-#define JCHAT_CHAT_PROTOCOL_VERSION "1.2.6"
+#define JCHAT_CHAT_PROTOCOL_VERSION "2.0.0"
 #endif // JCHAT_CHAT_PROTOCOL_VERSION
 
+// Still accepted by the server, messages to and from these clients use the
+// tagged wire format
+#ifndef JCHAT_CHAT_LEGACY_PROTOCOL_VERSION
+#define JCHAT_CHAT_LEGACY_PROTOCOL_VERSION "1.2.6"
+#endif // JCHAT_CHAT_LEGACY_PROTOCOL_VERSION
+
 #ifndef JCHAT_CHAT_USERNAME_LENGTH
 #define JCHAT_CHAT_USERNAME_LENGTH 24
 #endif // JCHAT_CHAT_USERNAME_LENGTH
@@ -25,4 +31,125 @@
 #define JCHAT_CHAT_MESSAGE_LENGTH 1024
 #endif // JCHAT_CHAT_MESSAGE_LENGTH
 
+#ifndef JCHAT_CHAT_MAX_FRAME_SIZE
+#define JCHAT_CHAT_MAX_FRAME_SIZE (256 * 1024)
+#endif // JCHAT_CHAT_MAX_FRAME_SIZE
+
+// Most members sent in the reply to a join or in one page of the member list,
+// bigger channels are listed with GetMembers
+#ifndef JCHAT_CHAT_MEMBERS_PAGE_SIZE
+#define JCHAT_CHAT_MEMBERS_PAGE_SIZE 256
+#endif // JCHAT_CHAT_MEMBERS_PAGE_SIZE
+
+// The channel name patterns a client can be subscribed to at once
+#ifndef JCHAT_CHAT_MAX_SUBSCRIPTIONS
+#define JCHAT_CHAT_MAX_SUBSCRIPTIONS 64
+#endif // JCHAT_CHAT_MAX_SUBSCRIPTIONS
+
+// Set on the component type of a frame whose body is compressed with the
+// connection's compression stream
+#ifndef JCHAT_CHAT_FRAME_COMPRESSED
+#define JCHAT_CHAT_FRAME_COMPRESSED 0x80
+#endif // JCHAT_CHAT_FRAME_COMPRESSED
+
+// Set on the component type of a frame that carries several messages, see
+// FrameBatch. The rest of the component type is 0 and the message type is
+// the number of messages.
+#ifndef JCHAT_CHAT_FRAME_BATCH
+#define JCHAT_CHAT_FRAME_BATCH 0x40
+#endif // JCHAT_CHAT_FRAME_BATCH
+
+// Set on the component type of a message that carries a request id, only
+// used by connections that negotiated request ids in their Hello. The id is
+// a uint32 that follows the header of a frame, or a variable length integer
+// that follows the body size of a message in a batch. Replies of the server
+// carry the id of the request they answer.
+#ifndef JCHAT_CHAT_FRAME_REQUEST
+#define JCHAT_CHAT_FRAME_REQUEST 0x20
+#endif // JCHAT_CHAT_FRAME_REQUEST
+
+// Milliseconds between checks of a client for requests that timed out
+#ifndef JCHAT_CHAT_REQUEST_TIMER_INTERVAL
+#define JCHAT_CHAT_REQUEST_TIMER_INTERVAL 50
+#endif // JCHAT_CHAT_REQUEST_TIMER_INTERVAL
+
+// Pending messages of a connection that negotiated batching are sent once
+// this many bytes are waiting, or once they waited JCHAT_CHAT_BATCH_WINDOW
+// microseconds
+#ifndef JCHAT_CHAT_BATCH_MAX_SIZE
+#define JCHAT_CHAT_BATCH_MAX_SIZE (16 * 1024)
+#endif // JCHAT_CHAT_BATCH_MAX_SIZE
+
+#ifndef JCHAT_CHAT_BATCH_WINDOW
+#define JCHAT_CHAT_BATCH_WINDOW 1000
+#endif // JCHAT_CHAT_BATCH_WINDOW
+
+// Joins and leaves of a channel are collected for this many milliseconds and
+// then sent to its members together, see ChannelComponent
+#ifndef JCHAT_CHAT_PRESENCE_INTERVAL
+#define JCHAT_CHAT_PRESENCE_INTERVAL 50
+#endif // JCHAT_CHAT_PRESENCE_INTERVAL
+
+// Every channel keeps its last messages for clients that ask for them when
+// they join, at most this many and this many bytes of them. The server keeps
+// at most JCHAT_CHAT_HISTORY_SERVER_SIZE bytes of all channels together and
+// drops messages older than JCHAT_CHAT_HISTORY_MAX_AGE seconds, 0 keeps them.
+#ifndef JCHAT_CHAT_HISTORY_MESSAGES
+#define JCHAT_CHAT_HISTORY_MESSAGES 50
+#endif // JCHAT_CHAT_HISTORY_MESSAGES
+
+#ifndef JCHAT_CHAT_HISTORY_CHANNEL_SIZE
+#define JCHAT_CHAT_HISTORY_CHANNEL_SIZE (64 * 1024)
+#endif // JCHAT_CHAT_HISTORY_CHANNEL_SIZE
+
+#ifndef JCHAT_CHAT_HISTORY_SERVER_SIZE
+#define JCHAT_CHAT_HISTORY_SERVER_SIZE (64 * 1024 * 1024)
+#endif // JCHAT_CHAT_HISTORY_SERVER_SIZE
+
+#ifndef JCHAT_CHAT_HISTORY_MAX_AGE
+#define JCHAT_CHAT_HISTORY_MAX_AGE 3600
+#endif // JCHAT_CHAT_HISTORY_MAX_AGE
+
+// Milliseconds between drops of messages that got too old
+#ifndef JCHAT_CHAT_HISTORY_PRUNE_INTERVAL
+#define JCHAT_CHAT_HISTORY_PRUNE_INTERVAL 1000
+#endif // JCHAT_CHAT_HISTORY_PRUNE_INTERVAL
+
+// Milliseconds a client may send nothing for before the server pings it,
+// it is disconnected if it still sent nothing after as long again
+#ifndef JCHAT_CHAT_IDLE_TIMEOUT
+#define JCHAT_CHAT_IDLE_TIMEOUT 60000
+#endif // JCHAT_CHAT_IDLE_TIMEOUT
+
+// Seconds the session of an identified client that asked for resume in its
+// Hello is kept for after its connection dropped, see
+// ChatServer::ResumeSession. Messages sent to it in the meantime are kept
+// for it, up to JCHAT_CHAT_RESUME_MAX_MISSED_SIZE bytes of them.
+#ifndef JCHAT_CHAT_RESUME_GRACE_PERIOD
+#define JCHAT_CHAT_RESUME_GRACE_PERIOD 30
+#endif // JCHAT_CHAT_RESUME_GRACE_PERIOD
+
+#ifndef JCHAT_CHAT_RESUME_MAX_MISSED_SIZE
+#define JCHAT_CHAT_RESUME_MAX_MISSED_SIZE (256 * 1024)
+#endif // JCHAT_CHAT_RESUME_MAX_MISSED_SIZE
+
+// Messages of a connection the server handles before it lets the other
+// connections of its reactor have a turn, the rest are handled on the next
+// one. A batch is counted by its messages but never split.
+#ifndef JCHAT_CHAT_RECEIVE_BUDGET
+#define JCHAT_CHAT_RECEIVE_BUDGET 64
+#endif // JCHAT_CHAT_RECEIVE_BUDGET
+
+// Client ids carry the id of the cluster node the client is connected to in
+// the bits above this, so they are unique across the whole cluster
+#ifndef JCHAT_CHAT_NODE_ID_SHIFT
+#define JCHAT_CHAT_NODE_ID_SHIFT 48
+#endif // JCHAT_CHAT_NODE_ID_SHIFT
+
+// Bodies smaller than this are sent as they are on compressed connections,
+// compressing them costs more time than it saves bandwidth
+#ifndef JCHAT_CHAT_COMPRESSION_MIN_SIZE
+#define JCHAT_CHAT_COMPRESSION_MIN_SIZE 128
+#endif // JCHAT_CHAT_COMPRESSION_MIN_SIZE
+
 #endif // jchat_common_protocol_h_
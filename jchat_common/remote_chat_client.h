@@ -10,13 +10,88 @@
 #define jchat_common_remote_chat_client_h_
 
 #include "ip_endpoint.hpp"
+#include "tcp_client.hpp"
+#include "wire_format.hpp"
+#include "deflate_stream.hpp"
+#include "frame_batch.hpp"
+#include "token_bucket.hpp"
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 #include <mutex>
 
 namespace jchat {
+// Compression state of a connection that negotiated it in its Hello
+struct ConnectionCompression {
+  DeflateStream Stream;
+  // Compressed frames have to be queued in the order they were compressed
+  std::mutex SendMutex;
+  // Decompressed bodies of received frames, only used by the connection's
+  // thread
+  std::vector<uint8_t> ReceiveBuffer;
+};
+
+// Messages waiting to be sent to a connection that negotiated batching
+struct ConnectionBatch {
+  uint64_t ClientId;
+  // Held while a batch is added to or sent, so batches are queued in the
+  // order their messages were added in
+  std::mutex Mutex;
+  FrameBatch Messages;
+  // Set while the batch waits for the batch window to run out
+  bool IsScheduled;
+
+  ConnectionBatch(uint64_t client_id) : ClientId(client_id),
+    IsScheduled(false) {
+  }
+};
+
 struct RemoteChatClient {
+  // Unique for the lifetime of the server, unlike the address of this object.
+  // A client that resumes a session takes over the session's id, see
+  // ChatServer::ResumeSession.
+  uint64_t Id;
   IPEndpoint Endpoint;
+
+  // The connection is kept alive for as long as the client exists
+  std::shared_ptr<TcpClient> Connection;
+
+  // Both start as the tagged format until the Hello handshake agrees on the
+  // protocol version. Only the connection's thread reads received packets,
+  // messages can be sent to the client from any thread.
+  WireFormat ReceiveFormat;
+  std::atomic<WireFormat> SendFormat;
+
+  // Set once compression has been negotiated, use std::atomic_load to read
+  // it from other threads
+  std::shared_ptr<ConnectionCompression> Compression;
+  // Set once batching has been negotiated, also read with std::atomic_load
+  std::shared_ptr<ConnectionBatch> Batch;
+
+  // Idle clients that never completed a Hello are dropped, the ones that
+  // negotiated heartbeats are pinged
+  std::atomic<bool> IsHandshakeCompleted;
+  std::atomic<bool> IsHeartbeatEnabled;
+  // Frames of clients that didn't negotiate request ids may not carry any
+  std::atomic<bool> IsRequestIdEnabled;
+  // Identified clients that asked for it are given a session to resume
+  std::atomic<bool> IsResumeEnabled;
+  // The messages of clients that don't understand Throttled are dropped
+  // without one
+  std::atomic<bool> IsThrottleEnabled;
+
+  // Taken from for every message the client sends while the server limits
+  // them, see ChatServer::SetMessageRateLimit. Both are only used by the
+  // connection's thread, the flag is set while its messages are dropped.
+  TokenBucket MessageTokens;
+  bool IsThrottled;
+
+  RemoteChatClient() : Id(0), ReceiveFormat(kWireFormat_Tagged),
+    SendFormat(kWireFormat_Tagged), IsHandshakeCompleted(false),
+    IsHeartbeatEnabled(false), IsRequestIdEnabled(false),
+    IsResumeEnabled(false), IsThrottleEnabled(false), IsThrottled(false) {
+  }
 };
 }
 
@@ -11,25 +11,10 @@
 
 // Required libraries
 #include "buffer.hpp"
+#include "data_type.h"
 
 namespace jchat {
 class TypedBuffer : Buffer {
-  enum DataType : uint8_t {
-    kDataType_Bool,
-    kDataType_Char,
-    kDataType_Int8,
-    kDataType_UInt8,
-    kDataType_Int16,
-    kDataType_UInt16,
-    kDataType_Int32,
-    kDataType_UInt32,
-    kDataType_Int64,
-    kDataType_UInt64,
-    kDataType_Float,
-    kDataType_String,
-    kDataType_Blob,
-  };
-
   bool verifyDataType(DataType expected_type) {
     // Check to see if we're not going to be reading past the end of the buffer
     if (Buffer::GetPosition() == Buffer::GetSize()) {
@@ -155,8 +140,12 @@ public:
     if (!Buffer::Read(&length)) {
       return false;
     }
-    obj.resize(length);
-    return Buffer::ReadArray<char>(const_cast<char *>(obj.c_str()), length);
+    if (Buffer::GetPosition() + length > Buffer::GetSize()) {
+      return false;
+    }
+    obj.assign(reinterpret_cast<const char *>(Buffer::GetBuffer())
+      + Buffer::GetPosition(), length);
+    return Buffer::SetPosition(Buffer::GetPosition() + length);
   }
 
   bool ReadBlob(std::basic_string<uint8_t> &obj) {
@@ -168,9 +157,11 @@ public:
     if (!Buffer::Read(&length)) {
       return false;
     }
-    obj.resize(length);
-    return Buffer::ReadArray<uint8_t>(const_cast<uint8_t *>(obj.c_str()),
-      length);
+    if (Buffer::GetPosition() + length > Buffer::GetSize()) {
+      return false;
+    }
+    obj.assign(Buffer::GetBuffer() + Buffer::GetPosition(), length);
+    return Buffer::SetPosition(Buffer::GetPosition() + length);
   }
 
   void WriteBoolean(bool obj) {
@@ -228,18 +219,24 @@ public:
     Buffer::Write<float>(obj);
   }
 
-  void WriteString(std::string obj) {
+  void WriteString(const std::string &obj) {
     Buffer::Write<uint8_t>(kDataType_String);
     uint32_t length = obj.size();
     Buffer::Write(length);
-    Buffer::WriteArray<char>(obj.c_str(), length);
+    Buffer::WriteArray<char>(obj.data(), length);
   }
 
-  void WriteBlob(std::basic_string<uint8_t> obj) {
+  void WriteBlob(const std::basic_string<uint8_t> &obj) {
     Buffer::Write<uint8_t>(kDataType_Blob);
     uint32_t length = obj.size();
     Buffer::Write(length);
-    Buffer::WriteArray<uint8_t>(obj.c_str(), length);
+    Buffer::WriteArray<uint8_t>(obj.data(), length);
+  }
+
+  // Appends values another buffer wrote, which has to have used the same
+  // endian order
+  void WriteEncoded(const uint8_t *data, size_t size) {
+    Buffer::WriteArray<uint8_t>(data, size);
   }
 
   bool IsFlippingEndian() {
@@ -254,6 +251,18 @@ public:
     Buffer::Rewind();
   }
 
+  void Reserve(size_t size) {
+    Buffer::Reserve(size);
+  }
+
+  bool IsSecureWiping() {
+    return Buffer::IsSecureWiping();
+  }
+
+  void SetSecureWipe(bool secure_wipe) {
+    Buffer::SetSecureWipe(secure_wipe);
+  }
+
   const uint8_t *GetBuffer() {
     return Buffer::GetBuffer();
   }
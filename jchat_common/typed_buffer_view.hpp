@@ -0,0 +1,245 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_common_typed_buffer_view_hpp_
+#define jchat_common_typed_buffer_view_hpp_
+
+// Required libraries
+#include "buffer_view.hpp"
+#include "string_view.hpp"
+#include "data_type.h"
+#include "wire_format.hpp"
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace jchat {
+// Reads the values of a TypedBuffer straight from a received packet without
+// copying it first. Packets in the compact wire format are read the same way,
+// the read functions then follow the schema instead of checking tags.
+class TypedBufferView : BufferView {
+  WireFormat format_;
+
+  // Strings of a compact buffer that later strings may refer back to
+  std::vector<StringView> interned_strings_;
+
+  bool verifyDataType(DataType expected_type) {
+    // Check to see if we're not going to be reading past the end of the buffer
+    if (BufferView::GetPosition() == BufferView::GetSize()) {
+      return false;
+    }
+
+    // Peek ahead instead of reading
+    uint8_t type = BufferView::GetBuffer()[BufferView::GetPosition()];
+
+    // Verify the data type
+    if (type != (uint8_t)expected_type) {
+      return false;
+    }
+
+    // Increase the current position if the read was successful
+    BufferView::SetPosition(BufferView::GetPosition() + sizeof(type));
+
+    return true;
+  }
+
+  template<typename _TData>
+  bool readValue(DataType expected_type, _TData &obj) {
+    if (format_ == kWireFormat_Tagged && !verifyDataType(expected_type)) {
+      return false;
+    }
+
+    return BufferView::Read(&obj);
+  }
+
+  template<typename _TData>
+  bool readUnsigned(DataType expected_type, _TData &obj) {
+    if (format_ == kWireFormat_Tagged) {
+      return readValue(expected_type, obj);
+    }
+
+    uint64_t value = 0;
+    if (!BufferView::ReadVarInt(value)
+      || value > std::numeric_limits<_TData>::max()) {
+      return false;
+    }
+    obj = static_cast<_TData>(value);
+    return true;
+  }
+
+  template<typename _TData>
+  bool readSigned(DataType expected_type, _TData &obj) {
+    if (format_ == kWireFormat_Tagged) {
+      return readValue(expected_type, obj);
+    }
+
+    uint64_t encoded_value = 0;
+    if (!BufferView::ReadVarInt(encoded_value)) {
+      return false;
+    }
+    int64_t value = Buffer::ZigZagDecode(encoded_value);
+    if (value < std::numeric_limits<_TData>::min()
+      || value > std::numeric_limits<_TData>::max()) {
+      return false;
+    }
+    obj = static_cast<_TData>(value);
+    return true;
+  }
+
+  const uint8_t *readBytes(DataType expected_type, uint32_t &out_length) {
+    if (format_ == kWireFormat_Tagged) {
+      if (!verifyDataType(expected_type)
+        || !BufferView::Read(&out_length)) {
+        return NULL;
+      }
+
+      return BufferView::ReadPointer(out_length);
+    }
+
+    uint64_t prefix = 0;
+    if (!BufferView::ReadVarInt(prefix)) {
+      return NULL;
+    }
+
+    // A reference to an earlier string
+    if (prefix & 1) {
+      uint64_t index = prefix >> 1;
+      if (index >= interned_strings_.size()) {
+        return NULL;
+      }
+      const StringView &string = interned_strings_[(size_t)index];
+      out_length = static_cast<uint32_t>(string.GetSize());
+      return reinterpret_cast<const uint8_t *>(string.GetData());
+    }
+
+    uint64_t length = prefix >> 2;
+    if (length > std::numeric_limits<uint32_t>::max()) {
+      return NULL;
+    }
+    out_length = static_cast<uint32_t>(length);
+    const uint8_t *data = BufferView::ReadPointer(out_length);
+    if (data != NULL && (prefix & 2)) {
+      if (interned_strings_.size() >= JCHAT_WIRE_MAX_INTERNED_STRINGS) {
+        return NULL;
+      }
+      interned_strings_.push_back(
+        StringView(reinterpret_cast<const char *>(data), out_length));
+    }
+    return data;
+  }
+
+public:
+  TypedBufferView(const uint8_t *buffer, size_t size, bool flip_endian = false,
+    WireFormat format = kWireFormat_Tagged)
+    : BufferView(buffer, size, flip_endian), format_(format) {
+  }
+
+  bool ReadBoolean(bool &obj) {
+    return readValue(kDataType_Bool, obj);
+  }
+
+  bool ReadChar(char &obj) {
+    return readValue(kDataType_Char, obj);
+  }
+
+  bool ReadInt8(int8_t &obj) {
+    return readValue(kDataType_Int8, obj);
+  }
+
+  bool ReadUInt8(uint8_t &obj) {
+    return readValue(kDataType_UInt8, obj);
+  }
+
+  bool ReadInt16(int16_t &obj) {
+    return readSigned(kDataType_Int16, obj);
+  }
+
+  bool ReadUInt16(uint16_t &obj) {
+    return readUnsigned(kDataType_UInt16, obj);
+  }
+
+  bool ReadInt32(int32_t &obj) {
+    return readSigned(kDataType_Int32, obj);
+  }
+
+  bool ReadUInt32(uint32_t &obj) {
+    return readUnsigned(kDataType_UInt32, obj);
+  }
+
+  bool ReadInt64(int64_t &obj) {
+    return readSigned(kDataType_Int64, obj);
+  }
+
+  bool ReadUInt64(uint64_t &obj) {
+    return readUnsigned(kDataType_UInt64, obj);
+  }
+
+  bool ReadFloat(float &obj) {
+    return readValue(kDataType_Float, obj);
+  }
+
+  bool ReadString(std::string &obj) {
+    uint32_t length = 0;
+    const uint8_t *data = readBytes(kDataType_String, length);
+    if (data == NULL) {
+      return false;
+    }
+    obj.assign(reinterpret_cast<const char *>(data), length);
+    return true;
+  }
+
+  // Points the view at the characters inside of the packet, it is only valid
+  // while the packet is being handled
+  bool ReadString(StringView &obj) {
+    uint32_t length = 0;
+    const uint8_t *data = readBytes(kDataType_String, length);
+    if (data == NULL) {
+      return false;
+    }
+    obj = StringView(reinterpret_cast<const char *>(data), length);
+    return true;
+  }
+
+  bool ReadBlob(std::basic_string<uint8_t> &obj) {
+    uint32_t length = 0;
+    const uint8_t *data = readBytes(kDataType_Blob, length);
+    if (data == NULL) {
+      return false;
+    }
+    obj.assign(data, length);
+    return true;
+  }
+
+  bool IsFlippingEndian() {
+    return BufferView::IsFlippingEndian();
+  }
+
+  void SetFlipEndian(bool flip_endian) {
+    BufferView::SetFlipEndian(flip_endian);
+  }
+
+  void Rewind() {
+    BufferView::Rewind();
+    interned_strings_.clear();
+  }
+
+  WireFormat GetFormat() {
+    return format_;
+  }
+
+  const uint8_t *GetBuffer() {
+    return BufferView::GetBuffer();
+  }
+
+  size_t GetSize() {
+    return BufferView::GetSize();
+  }
+};
+}
+
+#endif // jchat_common_typed_buffer_view_hpp_
@@ -0,0 +1,185 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_common_wire_format_hpp_
+#define jchat_common_wire_format_hpp_
+
+// Required libraries
+#include "buffer.hpp"
+#include "buffer_view.hpp"
+#include "string_view.hpp"
+#include "utility.hpp"
+#include "data_type.h"
+#include <unordered_map>
+
+// Strings shorter than this are always sent as they are, a reference to them
+// would not be much smaller
+#ifndef JCHAT_WIRE_MIN_INTERNED_LENGTH
+#define JCHAT_WIRE_MIN_INTERNED_LENGTH 8
+#endif // JCHAT_WIRE_MIN_INTERNED_LENGTH
+
+// Most strings a single compact buffer can ask the reader to remember
+#ifndef JCHAT_WIRE_MAX_INTERNED_STRINGS
+#define JCHAT_WIRE_MAX_INTERNED_STRINGS 4096
+#endif // JCHAT_WIRE_MAX_INTERNED_STRINGS
+
+namespace jchat {
+// The encoding of the body of a packet, agreed on in the Hello handshake
+enum WireFormat : uint8_t {
+  // Every value is preceded by its DataType, strings and blobs carry a
+  // 32 bit length. Used by protocol version 1 clients.
+  kWireFormat_Tagged,
+  // Values follow each other without tags in the order the schema of the
+  // message defines. Used by protocol version 2 clients.
+  //  - Booleans, chars and 8 bit integers are a single byte
+  //  - Wider unsigned integers are variable length integers, signed ones are
+  //    zigzag encoded first
+  //  - Floats are 4 bytes
+  //  - Strings and blobs start with a variable length prefix. If the lowest
+  //    bit is set, the rest is the index of an earlier string to repeat.
+  //    Otherwise the prefix is (length << 2) and the literal bytes follow,
+  //    with bit 1 set if the string is remembered for later references.
+  kWireFormat_Compact,
+};
+
+// Converts the body of a tagged buffer to the compact format. It is driven
+// by the tags of the tagged buffer, so components keep writing TypedBuffers
+// and only connections that negotiated the compact format pay for it.
+class WireFormatConverter {
+  // The strings come from clients, keyed like Utility::StringHash so they
+  // can't pick ones that all collide
+  struct StringViewHash {
+    size_t operator()(const StringView &string) const {
+      return static_cast<size_t>(Utility::Hash(string.GetData(),
+        string.GetSize(), Utility::GetProcessKey()));
+    }
+  };
+
+public:
+  // NOTE: out_buffer has to use the same endian order as the tagged buffer
+  static bool ToCompact(const uint8_t *tagged_data, size_t size,
+    bool flip_endian, Buffer &out_buffer) {
+    BufferView tagged(tagged_data, size, flip_endian);
+
+    // Strings are only looked up while the tagged buffer is alive, so the
+    // table can point into it
+    std::unordered_map<StringView, uint32_t, StringViewHash> interned_strings;
+
+    while (tagged.GetPosition() < tagged.GetSize()) {
+      uint8_t type = 0;
+      if (!tagged.Read(&type)) {
+        return false;
+      }
+
+      switch (type) {
+      case kDataType_Bool:
+      case kDataType_Char:
+      case kDataType_Int8:
+      case kDataType_UInt8: {
+        uint8_t value = 0;
+        if (!tagged.Read(&value)) {
+          return false;
+        }
+        out_buffer.Write(value);
+        break;
+      }
+      case kDataType_Int16: {
+        int16_t value = 0;
+        if (!tagged.Read(&value)) {
+          return false;
+        }
+        out_buffer.WriteVarInt(Buffer::ZigZagEncode(value));
+        break;
+      }
+      case kDataType_UInt16: {
+        uint16_t value = 0;
+        if (!tagged.Read(&value)) {
+          return false;
+        }
+        out_buffer.WriteVarInt(value);
+        break;
+      }
+      case kDataType_Int32: {
+        int32_t value = 0;
+        if (!tagged.Read(&value)) {
+          return false;
+        }
+        out_buffer.WriteVarInt(Buffer::ZigZagEncode(value));
+        break;
+      }
+      case kDataType_UInt32: {
+        uint32_t value = 0;
+        if (!tagged.Read(&value)) {
+          return false;
+        }
+        out_buffer.WriteVarInt(value);
+        break;
+      }
+      case kDataType_Int64: {
+        int64_t value = 0;
+        if (!tagged.Read(&value)) {
+          return false;
+        }
+        out_buffer.WriteVarInt(Buffer::ZigZagEncode(value));
+        break;
+      }
+      case kDataType_UInt64: {
+        uint64_t value = 0;
+        if (!tagged.Read(&value)) {
+          return false;
+        }
+        out_buffer.WriteVarInt(value);
+        break;
+      }
+      case kDataType_Float: {
+        float value = 0;
+        if (!tagged.Read(&value)) {
+          return false;
+        }
+        out_buffer.Write(value);
+        break;
+      }
+      case kDataType_String:
+      case kDataType_Blob: {
+        uint32_t length = 0;
+        const uint8_t *data = NULL;
+        if (!tagged.Read(&length)
+          || (data = tagged.ReadPointer(length)) == NULL) {
+          return false;
+        }
+
+        StringView string(reinterpret_cast<const char *>(data), length);
+        bool is_remembered = false;
+        if (length >= JCHAT_WIRE_MIN_INTERNED_LENGTH) {
+          auto interned_string = interned_strings.find(string);
+          if (interned_string != interned_strings.end()) {
+            out_buffer.WriteVarInt(
+              (static_cast<uint64_t>(interned_string->second) << 1) | 1);
+            break;
+          }
+          if (interned_strings.size() < JCHAT_WIRE_MAX_INTERNED_STRINGS) {
+            uint32_t index = static_cast<uint32_t>(interned_strings.size());
+            interned_strings.emplace(string, index);
+            is_remembered = true;
+          }
+        }
+        out_buffer.WriteVarInt((static_cast<uint64_t>(length) << 2)
+          | (is_remembered ? 2 : 0));
+        out_buffer.WriteArray(data, length);
+        break;
+      }
+      default:
+        return false;
+      }
+    }
+    return true;
+  }
+};
+}
+
+#endif // jchat_common_wire_format_hpp_
@@ -11,7 +11,11 @@
 
 // Required libraries
 #include <vector>
+#include <string.h>
 #include <stdint.h>
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#endif
 
 namespace jchat {
 // Provides a way to write to a buffer with objects of any type or to serialize
@@ -49,34 +53,134 @@ class Buffer {
   // AMD vs Intel CPUs or Network vs Host endian order.
   bool flip_endian_;
 
+  // Set all the data to 0 before releasing it, only needed when the buffer
+  // held important data
+  bool secure_wipe_;
+
+  static uint16_t byteSwap(uint16_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap16(value);
+#elif defined(_MSC_VER)
+    return _byteswap_ushort(value);
+#else
+    return static_cast<uint16_t>((value << 8) | (value >> 8));
+#endif
+  }
+
+  static uint32_t byteSwap(uint32_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap32(value);
+#elif defined(_MSC_VER)
+    return _byteswap_ulong(value);
+#else
+    return (value << 24) | ((value << 8) & 0x00FF0000)
+      | ((value >> 8) & 0x0000FF00) | (value >> 24);
+#endif
+  }
+
+  static uint64_t byteSwap(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap64(value);
+#elif defined(_MSC_VER)
+    return _byteswap_uint64(value);
+#else
+    return (static_cast<uint64_t>(byteSwap(static_cast<uint32_t>(value)))
+      << 32) | byteSwap(static_cast<uint32_t>(value >> 32));
+#endif
+  }
+
+  template<typename _TValue>
+  static void byteSwapInPlace(uint8_t *p_buffer) {
+    _TValue value;
+    memcpy(&value, p_buffer, sizeof(value));
+    value = byteSwap(value);
+    memcpy(p_buffer, &value, sizeof(value));
+  }
+
+  void wipe() {
+    // Written through a volatile pointer so the stores cannot be optimized
+    // away right before the memory is released
+    volatile uint8_t *p_buffer = buffer_.data();
+    for (size_t i = 0; i < buffer_.size(); i++) {
+      p_buffer[i] = 0;
+    }
+  }
+
+  // Grows geometrically so a series of small writes stays linear
+  void reserveFor(size_t end_position) {
+    if (end_position > buffer_.capacity()) {
+      Reserve(end_position > buffer_.capacity() * 2 ? end_position
+        : buffer_.capacity() * 2);
+    }
+  }
+
+  void writeBytes(const uint8_t *data, size_t size) {
+    size_t end_position = current_position_ + size;
+    if (end_position <= buffer_.size()) {
+      // Overwrite existing data
+      memcpy(buffer_.data() + current_position_, data, size);
+    } else {
+      reserveFor(end_position);
+
+      // Overwrite the remaining data and append the rest
+      size_t overlap_size = buffer_.size() - current_position_;
+      memcpy(buffer_.data() + current_position_, data, overlap_size);
+      buffer_.insert(buffer_.end(), data + overlap_size, data + size);
+    }
+    current_position_ = end_position;
+  }
+
+public:
   template<typename _TData>
   static void FlipEndian(_TData *buffer, size_t size) {
-    // Reverse the array
-    uint8_t *p_buffer = *(uint8_t **)&buffer;
-    for (size_t i = 0; i < size / 2; i++) {
-      uint8_t tmp = p_buffer[i];
-      p_buffer[i] = p_buffer[size - 1 - i];
-      p_buffer[size - 1 - i] = tmp;
+    uint8_t *p_buffer = reinterpret_cast<uint8_t *>(buffer);
+    switch (size) {
+    case 1:
+      break;
+    case 2:
+      byteSwapInPlace<uint16_t>(p_buffer);
+      break;
+    case 4:
+      byteSwapInPlace<uint32_t>(p_buffer);
+      break;
+    case 8:
+      byteSwapInPlace<uint64_t>(p_buffer);
+      break;
+    default:
+      // Reverse the array
+      for (size_t i = 0; i < size / 2; i++) {
+        uint8_t tmp = p_buffer[i];
+        p_buffer[i] = p_buffer[size - 1 - i];
+        p_buffer[size - 1 - i] = tmp;
+      }
+      break;
     }
   }
 
-public:
+  // Maps signed values to unsigned ones so small negative values stay small
+  // when written as a variable length integer
+  static uint64_t ZigZagEncode(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1)
+      ^ static_cast<uint64_t>(value >> 63);
+  }
+
+  static int64_t ZigZagDecode(uint64_t value) {
+    return static_cast<int64_t>(value >> 1)
+      ^ -static_cast<int64_t>(value & 1);
+  }
+
   Buffer(bool flip_endian = false) : current_position_(0),
-    flip_endian_(flip_endian) {
+    flip_endian_(flip_endian), secure_wipe_(false) {
   }
 
   Buffer(const uint8_t *buffer, size_t size, bool flip_endian = false)
-    : current_position_(0), flip_endian_(flip_endian) {
-    // Copy the data to the internal buffer
-    for (size_t i = 0; i < size; i++) {
-      buffer_.push_back(buffer[i]);
-    }
+    : buffer_(buffer, buffer + size), current_position_(0),
+    flip_endian_(flip_endian), secure_wipe_(false) {
   }
 
   ~Buffer() {
-    // Set all the data to 0 in case we had important data in the buffer
-    for (size_t i = 0; i < buffer_.size(); i++) {
-      buffer_[i] = 0;
+    if (secure_wipe_) {
+      wipe();
     }
   }
 
@@ -88,11 +192,8 @@ public:
       return false;
     }
     // Read the data into the object buffer
-    uint8_t *p_buffer = *(uint8_t **)&obj;
-    for (size_t i = 0; i < size; i++) {
-      p_buffer[i] = buffer_.data()[current_position_];
-      current_position_++;
-    }
+    memcpy(obj, buffer_.data() + current_position_, size);
+    current_position_ += size;
     // Flip the endian order of the object
     // if needed
     if (flip_endian_) {
@@ -103,14 +204,16 @@ public:
 
   template<typename _TData>
   bool ReadArray(_TData *obj, size_t size) {
-    // Check if there is any data to read
-    if (current_position_ + size * sizeof(_TData) - 1 > buffer_.size()) {
+    // Check if there is enough data to read
+    if (current_position_ + size * sizeof(_TData) > buffer_.size()) {
       return false;
     }
-    // Read the array object by object
-    for (size_t i = 0; i < size; i++) {
-      if (!Read<_TData>(&obj[i])) {
-        return false;
+    // Read the whole array at once and flip every object afterwards
+    memcpy(obj, buffer_.data() + current_position_, size * sizeof(_TData));
+    current_position_ += size * sizeof(_TData);
+    if (flip_endian_ && sizeof(_TData) > 1) {
+      for (size_t i = 0; i < size; i++) {
+        FlipEndian(&obj[i], sizeof(_TData));
       }
     }
     return true;
@@ -118,41 +221,45 @@ public:
 
   template<typename _TData>
   void Write(_TData obj) {
-    // Get the pointer to the data object and flip the object in
-    // case the endian order needs changing
-    uint8_t *p_buffer = (uint8_t *)&obj;
-    size_t size = sizeof(_TData);
+    // Flip the object in case the endian order needs changing
     if (flip_endian_) {
-      FlipEndian(p_buffer, size);
-    }
-    for (size_t i = 0; i < size; i++) {
-      // Check if we need to append to the buffer or
-      // replace existing data
-      if (current_position_ + i >= this->buffer_.size()) {
-        buffer_.push_back(p_buffer[i]);
-      } else {
-        buffer_[current_position_] = p_buffer[i];
-      }
-      current_position_++;
+      FlipEndian(&obj, sizeof(_TData));
     }
+    writeBytes((const uint8_t *)&obj, sizeof(_TData));
   }
 
-  template<typename _TData>
-  void WriteArray(_TData *obj, size_t size) {
-    // Write each object in the array
-    for (size_t i = 0; i < size; i++) {
-      Write(obj[i]);
+  // Writes the value 7 bits at a time, least significant group first, with
+  // the high bit of every byte set while more groups follow (LEB128)
+  void WriteVarInt(uint64_t value) {
+    uint8_t bytes[10];
+    size_t size = 0;
+    while (value >= 0x80) {
+      bytes[size++] = static_cast<uint8_t>(value | 0x80);
+      value >>= 7;
     }
+    bytes[size++] = static_cast<uint8_t>(value);
+    writeBytes(bytes, size);
   }
 
   template<typename _TData>
   void WriteArray(const _TData *obj, size_t size) {
-    // Write each object in the array
-    for (size_t i = 0; i < size; i++) {
-      Write(obj[i]);
+    // Objects need to be flipped one by one, otherwise copy the whole array
+    if (flip_endian_ && sizeof(_TData) > 1) {
+      reserveFor(current_position_ + size * sizeof(_TData));
+      for (size_t i = 0; i < size; i++) {
+        Write(obj[i]);
+      }
+    } else {
+      writeBytes((const uint8_t *)obj, size * sizeof(_TData));
     }
   }
 
+  // Preallocates space for the given total size, avoids reallocations when
+  // the final size is known up front
+  void Reserve(size_t size) {
+    buffer_.reserve(size);
+  }
+
   size_t GetPosition() {
     return current_position_;
   }
@@ -187,10 +294,18 @@ public:
     return buffer_.data();
   }
 
+  bool IsSecureWiping() {
+    return secure_wipe_;
+  }
+
+  void SetSecureWipe(bool secure_wipe) {
+    secure_wipe_ = secure_wipe;
+  }
+
   void Clear() {
     // Set all the data to 0 in case we had important data in the buffer
-    for (size_t i = 0; i < buffer_.size(); i++) {
-      buffer_[i] = 0;
+    if (secure_wipe_) {
+      wipe();
     }
 
     // Clear the buffer
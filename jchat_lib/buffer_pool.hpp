@@ -0,0 +1,90 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_buffer_pool_hpp_
+#define jchat_lib_buffer_pool_hpp_
+
+// Required libraries
+#include "object_pool.hpp"
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+namespace jchat {
+// Recycles fixed-size byte buffers, such as the initial receive buffer of
+// every connection. Buffers that come back with a different size, because
+// their owner had to grow them, are freed instead of pooled so the pool never
+// holds on to more than max_available buffers of block_size bytes.
+class BufferPool {
+  size_t block_size_;
+  size_t max_available_;
+  std::vector<std::vector<uint8_t>> buffers_;
+  std::mutex mutex_;
+  PoolStats stats_;
+
+public:
+  BufferPool(size_t block_size, size_t max_available = 1024)
+    : block_size_(block_size), max_available_(max_available) {
+    stats_.InUse = 0;
+    stats_.PeakInUse = 0;
+    stats_.Available = 0;
+    stats_.Acquisitions = 0;
+    stats_.Allocations = 0;
+  }
+
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+
+  std::vector<uint8_t> Acquire() {
+    std::vector<uint8_t> buffer;
+    mutex_.lock();
+    stats_.Acquisitions++;
+    if (++stats_.InUse > stats_.PeakInUse) {
+      stats_.PeakInUse = stats_.InUse;
+    }
+    if (!buffers_.empty()) {
+      buffer.swap(buffers_.back());
+      buffers_.pop_back();
+      mutex_.unlock();
+      return buffer;
+    }
+    stats_.Allocations++;
+    mutex_.unlock();
+
+    buffer.resize(block_size_);
+    return buffer;
+  }
+
+  void Release(std::vector<uint8_t> &&buffer) {
+    std::vector<uint8_t> released_buffer;
+    released_buffer.swap(buffer);
+
+    mutex_.lock();
+    stats_.InUse--;
+    if (released_buffer.size() == block_size_
+      && buffers_.size() < max_available_) {
+      buffers_.push_back(std::move(released_buffer));
+    }
+    mutex_.unlock();
+  }
+
+  size_t GetBlockSize() {
+    return block_size_;
+  }
+
+  PoolStats GetStats() {
+    mutex_.lock();
+    PoolStats stats = stats_;
+    stats.Available = buffers_.size();
+    mutex_.unlock();
+    return stats;
+  }
+};
+}
+
+#endif // jchat_lib_buffer_pool_hpp_
@@ -0,0 +1,136 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_buffer_view_hpp_
+#define jchat_lib_buffer_view_hpp_
+
+// Required libraries
+#include "buffer.hpp"
+
+namespace jchat {
+// Read-only counterpart of Buffer that reads from memory it does not own,
+// such as a packet inside of a connection's stream. The memory has to stay
+// valid and unchanged for as long as the view is used.
+class BufferView {
+  // The viewed memory
+  const uint8_t *buffer_;
+  size_t size_;
+
+  // The current read position within the viewed memory
+  size_t current_position_;
+
+  // Used to flip endian order if required, see Buffer
+  bool flip_endian_;
+
+public:
+  BufferView(const uint8_t *buffer, size_t size, bool flip_endian = false)
+    : buffer_(buffer), size_(size), current_position_(0),
+    flip_endian_(flip_endian) {
+  }
+
+  template<typename _TData>
+  bool Read(_TData *obj) {
+    // Check if there is enough data to read
+    size_t size = sizeof(_TData);
+    if (current_position_ + size > size_) {
+      return false;
+    }
+    // Read the data into the object buffer
+    memcpy(obj, buffer_ + current_position_, size);
+    current_position_ += size;
+    // Flip the endian order of the object
+    // if needed
+    if (flip_endian_) {
+      Buffer::FlipEndian(obj, size);
+    }
+    return true;
+  }
+
+  template<typename _TData>
+  bool ReadArray(_TData *obj, size_t size) {
+    // Check if there is enough data to read
+    if (current_position_ + size * sizeof(_TData) > size_) {
+      return false;
+    }
+    // Read the whole array at once and flip every object afterwards
+    memcpy(obj, buffer_ + current_position_, size * sizeof(_TData));
+    current_position_ += size * sizeof(_TData);
+    if (flip_endian_ && sizeof(_TData) > 1) {
+      for (size_t i = 0; i < size; i++) {
+        Buffer::FlipEndian(&obj[i], sizeof(_TData));
+      }
+    }
+    return true;
+  }
+
+  // Reads a value written by Buffer::WriteVarInt, values longer than 10 bytes
+  // are rejected
+  bool ReadVarInt(uint64_t &value) {
+    uint64_t result = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      if (current_position_ == size_) {
+        return false;
+      }
+      uint8_t byte = buffer_[current_position_++];
+      result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        value = result;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Returns a pointer to the next bytes and skips them, the caller reads
+  // them in place
+  const uint8_t *ReadPointer(size_t size) {
+    if (current_position_ + size > size_) {
+      return NULL;
+    }
+    const uint8_t *p_buffer = buffer_ + current_position_;
+    current_position_ += size;
+    return p_buffer;
+  }
+
+  size_t GetPosition() {
+    return current_position_;
+  }
+
+  bool SetPosition(size_t current_position) {
+    // If the specified position is past the end of the buffer
+    // return false
+    if (current_position > size_) {
+      return false;
+    }
+    current_position_ = current_position;
+    return true;
+  }
+
+  bool IsFlippingEndian() {
+    return flip_endian_;
+  }
+
+  void SetFlipEndian(bool flip_endian) {
+    flip_endian_ = flip_endian;
+  }
+
+  void Rewind() {
+    current_position_ = 0;
+  }
+
+  size_t GetSize() {
+    return size_;
+  }
+
+  const uint8_t *GetBuffer() {
+    return buffer_;
+  }
+};
+}
+
+#endif // jchat_lib_buffer_view_hpp_
@@ -0,0 +1,110 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_connection_limiter_hpp_
+#define jchat_lib_connection_limiter_hpp_
+
+// Required libraries
+#include "token_bucket.hpp"
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <stdint.h>
+
+// Addresses the limiter keeps track of before it forgets the ones that may
+// open a full burst again
+#ifndef JCHAT_CONNECTION_LIMITER_MIN_SWEEP_SIZE
+#define JCHAT_CONNECTION_LIMITER_MIN_SWEEP_SIZE 4096
+#endif // JCHAT_CONNECTION_LIMITER_MIN_SWEEP_SIZE
+
+namespace jchat {
+// Admits connections with a token bucket per address. An address may open a
+// burst of connections at once, and after that as many per second as the
+// rate allows.
+class ConnectionLimiter {
+  typedef TokenBucket::Clock Clock;
+
+  double rate_;
+  double burst_;
+  std::unordered_map<uint32_t, TokenBucket> buckets_;
+  size_t sweep_size_;
+  std::mutex mutex_;
+
+  void sweep(Clock::time_point now) {
+    for (auto bucket = buckets_.begin(); bucket != buckets_.end();) {
+      bucket->second.Refill(rate_, burst_, now);
+      if (bucket->second.IsFull(burst_)) {
+        bucket = buckets_.erase(bucket);
+      } else {
+        ++bucket;
+      }
+    }
+    sweep_size_ = std::max<size_t>(JCHAT_CONNECTION_LIMITER_MIN_SWEEP_SIZE,
+      buckets_.size() * 2);
+  }
+
+public:
+  ConnectionLimiter() : rate_(0), burst_(0),
+    sweep_size_(JCHAT_CONNECTION_LIMITER_MIN_SWEEP_SIZE) {
+  }
+
+  // A rate of 0 admits every connection
+  bool SetLimit(double rate, double burst) {
+    if (rate < 0 || (rate > 0 && burst < 1)) {
+      return false;
+    }
+    mutex_.lock();
+    rate_ = rate;
+    burst_ = burst;
+    buckets_.clear();
+    mutex_.unlock();
+    return true;
+  }
+
+  double GetRate() {
+    mutex_.lock();
+    double rate = rate_;
+    mutex_.unlock();
+    return rate;
+  }
+
+  double GetBurst() {
+    mutex_.lock();
+    double burst = burst_;
+    mutex_.unlock();
+    return burst;
+  }
+
+  // Takes a token from the address's bucket, returns false if it was empty
+  bool Admit(uint32_t address) {
+    mutex_.lock();
+    if (rate_ <= 0) {
+      mutex_.unlock();
+      return true;
+    }
+
+    Clock::time_point now = Clock::now();
+    auto bucket = buckets_.find(address);
+    if (bucket == buckets_.end()) {
+      if (buckets_.size() >= sweep_size_) {
+        sweep(now);
+      }
+      buckets_.emplace(address, TokenBucket(burst_ - 1));
+      mutex_.unlock();
+      return true;
+    }
+
+    bool is_admitted = bucket->second.Take(rate_, burst_, now);
+    mutex_.unlock();
+    return is_admitted;
+  }
+};
+}
+
+#endif // jchat_lib_connection_limiter_hpp_
@@ -0,0 +1,252 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_deflate_stream_hpp_
+#define jchat_lib_deflate_stream_hpp_
+
+// Required libraries
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+#if defined(JCHAT_USE_ZLIB)
+#include <zlib.h>
+#endif
+
+// Compression level, lower levels cost less CPU per byte
+#ifndef JCHAT_DEFLATE_LEVEL
+#define JCHAT_DEFLATE_LEVEL 3
+#endif // JCHAT_DEFLATE_LEVEL
+
+// Both ends of a stream have to use the same window size. The window and the
+// memory level decide how much memory every stream keeps, the defaults cost
+// about 36KB per connection instead of zlib's 256KB.
+#ifndef JCHAT_DEFLATE_WINDOW_BITS
+#define JCHAT_DEFLATE_WINDOW_BITS 12
+#endif // JCHAT_DEFLATE_WINDOW_BITS
+
+#ifndef JCHAT_DEFLATE_MEMORY_LEVEL
+#define JCHAT_DEFLATE_MEMORY_LEVEL 5
+#endif // JCHAT_DEFLATE_MEMORY_LEVEL
+
+namespace jchat {
+struct DeflateStats {
+  // Calls to Compress, with the bytes passed in and the bytes produced
+  uint64_t CompressedFrames;
+  uint64_t CompressInputBytes;
+  uint64_t CompressOutputBytes;
+  uint64_t CompressNanoseconds;
+
+  // Calls to Decompress, with the bytes passed in and the bytes produced
+  uint64_t DecompressedFrames;
+  uint64_t DecompressInputBytes;
+  uint64_t DecompressOutputBytes;
+  uint64_t DecompressNanoseconds;
+};
+
+// Raw deflate in both directions of a connection. Every chunk is flushed on
+// its own, but the window carries over from one chunk to the next, so chunks
+// have to be decompressed in the order they were compressed in and none of
+// them may be skipped. Text that repeats across messages, such as channel
+// and user names, compresses to a few bytes.
+// NOTE: Compress and Decompress may run on different threads, but neither
+// of them may be called by two threads at once. Only available when built
+// with JCHAT_USE_ZLIB, otherwise Initialize fails.
+class DeflateStream {
+#if defined(JCHAT_USE_ZLIB)
+  z_stream deflate_stream_;
+  z_stream inflate_stream_;
+#endif
+  bool is_initialized_;
+
+  // Read by GetStats from any thread
+  std::atomic<uint64_t> compressed_frames_;
+  std::atomic<uint64_t> compress_input_bytes_;
+  std::atomic<uint64_t> compress_output_bytes_;
+  std::atomic<uint64_t> compress_nanoseconds_;
+  std::atomic<uint64_t> decompressed_frames_;
+  std::atomic<uint64_t> decompress_input_bytes_;
+  std::atomic<uint64_t> decompress_output_bytes_;
+  std::atomic<uint64_t> decompress_nanoseconds_;
+
+  static uint64_t elapsedNanoseconds(
+    std::chrono::steady_clock::time_point start_time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start_time).count();
+  }
+
+public:
+  DeflateStream() : is_initialized_(false), compressed_frames_(0),
+    compress_input_bytes_(0), compress_output_bytes_(0),
+    compress_nanoseconds_(0), decompressed_frames_(0),
+    decompress_input_bytes_(0), decompress_output_bytes_(0),
+    decompress_nanoseconds_(0) {
+  }
+
+  ~DeflateStream() {
+#if defined(JCHAT_USE_ZLIB)
+    if (is_initialized_) {
+      deflateEnd(&deflate_stream_);
+      inflateEnd(&inflate_stream_);
+    }
+#endif
+  }
+
+  DeflateStream(const DeflateStream &) = delete;
+  DeflateStream &operator=(const DeflateStream &) = delete;
+
+  static bool IsSupported() {
+#if defined(JCHAT_USE_ZLIB)
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  bool Initialize() {
+#if defined(JCHAT_USE_ZLIB)
+    if (is_initialized_) {
+      return false;
+    }
+
+    memset(&deflate_stream_, 0, sizeof(deflate_stream_));
+    memset(&inflate_stream_, 0, sizeof(inflate_stream_));
+
+    // Negative window bits leave out the zlib header and checksum, TCP
+    // already protects the data
+    if (deflateInit2(&deflate_stream_, JCHAT_DEFLATE_LEVEL, Z_DEFLATED,
+      -JCHAT_DEFLATE_WINDOW_BITS, JCHAT_DEFLATE_MEMORY_LEVEL,
+      Z_DEFAULT_STRATEGY) != Z_OK) {
+      return false;
+    }
+    if (inflateInit2(&inflate_stream_, -JCHAT_DEFLATE_WINDOW_BITS) != Z_OK) {
+      deflateEnd(&deflate_stream_);
+      return false;
+    }
+
+    is_initialized_ = true;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  bool Compress(const uint8_t *data, size_t size,
+    std::vector<uint8_t> &out_data) {
+#if defined(JCHAT_USE_ZLIB)
+    if (!is_initialized_) {
+      return false;
+    }
+    std::chrono::steady_clock::time_point start_time =
+      std::chrono::steady_clock::now();
+
+    deflate_stream_.next_in = const_cast<Bytef *>(data);
+    deflate_stream_.avail_in = static_cast<uInt>(size);
+
+    // The flush is complete once deflate leaves output space unused
+    out_data.resize(deflateBound(&deflate_stream_, size) + 16);
+    size_t written_size = 0;
+    do {
+      if (written_size == out_data.size()) {
+        out_data.resize(out_data.size() * 2);
+      }
+      deflate_stream_.next_out = out_data.data() + written_size;
+      deflate_stream_.avail_out = static_cast<uInt>(out_data.size()
+        - written_size);
+      int result = deflate(&deflate_stream_, Z_SYNC_FLUSH);
+      if (result != Z_OK && result != Z_BUF_ERROR) {
+        return false;
+      }
+      written_size = out_data.size() - deflate_stream_.avail_out;
+    } while (deflate_stream_.avail_out == 0);
+    out_data.resize(written_size);
+
+    compressed_frames_++;
+    compress_input_bytes_ += size;
+    compress_output_bytes_ += written_size;
+    compress_nanoseconds_ += elapsedNanoseconds(start_time);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // Fails if the data decompresses to more than max_size bytes
+  bool Decompress(const uint8_t *data, size_t size, size_t max_size,
+    std::vector<uint8_t> &out_data) {
+#if defined(JCHAT_USE_ZLIB)
+    if (!is_initialized_) {
+      return false;
+    }
+    std::chrono::steady_clock::time_point start_time =
+      std::chrono::steady_clock::now();
+
+    inflate_stream_.next_in = const_cast<Bytef *>(data);
+    inflate_stream_.avail_in = static_cast<uInt>(size);
+
+    // One byte more than allowed tells a frame that is too large apart from
+    // one that is exactly max_size bytes
+    size_t capacity = max_size + 1;
+    out_data.resize(size * 4 + 64 < capacity ? size * 4 + 64 : capacity);
+    size_t written_size = 0;
+    while (true) {
+      if (written_size == out_data.size()) {
+        if (out_data.size() == capacity) {
+          return false;
+        }
+        out_data.resize(out_data.size() * 2 < capacity ? out_data.size() * 2
+          : capacity);
+      }
+      inflate_stream_.next_out = out_data.data() + written_size;
+      inflate_stream_.avail_out = static_cast<uInt>(out_data.size()
+        - written_size);
+      int result = inflate(&inflate_stream_, Z_SYNC_FLUSH);
+      written_size = out_data.size() - inflate_stream_.avail_out;
+      if (result != Z_OK && result != Z_BUF_ERROR) {
+        return false;
+      }
+      if (inflate_stream_.avail_out != 0) {
+        // Everything was consumed, or the data was cut off
+        if (inflate_stream_.avail_in != 0) {
+          return false;
+        }
+        break;
+      }
+    }
+    if (written_size > max_size) {
+      return false;
+    }
+    out_data.resize(written_size);
+
+    decompressed_frames_++;
+    decompress_input_bytes_ += size;
+    decompress_output_bytes_ += written_size;
+    decompress_nanoseconds_ += elapsedNanoseconds(start_time);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  DeflateStats GetStats() {
+    DeflateStats stats;
+    stats.CompressedFrames = compressed_frames_;
+    stats.CompressInputBytes = compress_input_bytes_;
+    stats.CompressOutputBytes = compress_output_bytes_;
+    stats.CompressNanoseconds = compress_nanoseconds_;
+    stats.DecompressedFrames = decompressed_frames_;
+    stats.DecompressInputBytes = decompress_input_bytes_;
+    stats.DecompressOutputBytes = decompress_output_bytes_;
+    stats.DecompressNanoseconds = decompress_nanoseconds_;
+    return stats;
+  }
+};
+}
+
+#endif // jchat_lib_deflate_stream_hpp_
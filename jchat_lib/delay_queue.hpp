@@ -0,0 +1,127 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_delay_queue_hpp_
+#define jchat_lib_delay_queue_hpp_
+
+// Required libraries
+#include "thread.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <stdint.h>
+
+namespace jchat {
+// Calls a callback with every pushed key once a fixed delay has passed, on a
+// thread of its own. Every key waits the same delay, so keys are due in the
+// order they were pushed in and a plain queue is enough to find the next one.
+class DelayQueue {
+  typedef std::chrono::steady_clock Clock;
+
+  std::thread worker_thread_;
+  bool is_running_;
+  Clock::duration delay_;
+  std::function<void(uint64_t)> callback_;
+  std::deque<std::pair<Clock::time_point, uint64_t>> keys_;
+  std::mutex keys_mutex_;
+  std::condition_variable keys_condition_;
+
+  void workerLoop() {
+    Thread::SetName("jchat-delay");
+    std::unique_lock<std::mutex> lock(keys_mutex_);
+    while (is_running_) {
+      if (keys_.empty()) {
+        keys_condition_.wait(lock);
+        continue;
+      }
+      if (Clock::now() < keys_.front().first) {
+        keys_condition_.wait_until(lock, keys_.front().first);
+        continue;
+      }
+
+      // The callback may push again, so it runs outside of the lock
+      uint64_t key = keys_.front().second;
+      keys_.pop_front();
+      lock.unlock();
+      callback_(key);
+      lock.lock();
+    }
+  }
+
+public:
+  DelayQueue() : is_running_(false), delay_(Clock::duration::zero()) {
+  }
+
+  ~DelayQueue() {
+    Stop();
+  }
+
+  bool Start(Clock::duration delay, std::function<void(uint64_t)> callback) {
+    keys_mutex_.lock();
+    if (is_running_) {
+      keys_mutex_.unlock();
+      return false;
+    }
+    is_running_ = true;
+    delay_ = delay;
+    callback_ = callback;
+    keys_mutex_.unlock();
+
+    worker_thread_ = std::thread(&DelayQueue::workerLoop, this);
+    return true;
+  }
+
+  // Keys that are not due yet are dropped
+  bool Stop() {
+    keys_mutex_.lock();
+    if (!is_running_) {
+      keys_mutex_.unlock();
+      return false;
+    }
+    is_running_ = false;
+    keys_.clear();
+    keys_mutex_.unlock();
+    keys_condition_.notify_one();
+
+    if (worker_thread_.joinable()) {
+      worker_thread_.join();
+    }
+    return true;
+  }
+
+  bool Push(uint64_t key) {
+    keys_mutex_.lock();
+    if (!is_running_) {
+      keys_mutex_.unlock();
+      return false;
+    }
+    bool was_empty = keys_.empty();
+    keys_.push_back(std::make_pair(Clock::now() + delay_, key));
+    keys_mutex_.unlock();
+
+    // Later keys are never due before the ones already waiting
+    if (was_empty) {
+      keys_condition_.notify_one();
+    }
+    return true;
+  }
+
+  bool IsRunning() {
+    keys_mutex_.lock();
+    bool is_running = is_running_;
+    keys_mutex_.unlock();
+    return is_running;
+  }
+};
+}
+
+#endif // jchat_lib_delay_queue_hpp_
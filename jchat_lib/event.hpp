@@ -10,34 +10,203 @@
 #define jchat_lib_event_hpp_
 
 // Required libraries
+#include <atomic>
 #include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
 #include <functional>
 
+// Largest function object a callback can store, lambdas capturing a few
+// pointers or a shared_ptr fit
+#ifndef JCHAT_EVENT_CALLBACK_SIZE
+#define JCHAT_EVENT_CALLBACK_SIZE (4 * sizeof(void *))
+#endif // JCHAT_EVENT_CALLBACK_SIZE
+
 namespace jchat {
+// Stores the function object inline instead of on the heap, invoking it is a
+// single indirect call
 template<typename... _TArgs>
 struct EventCallback {
-  std::function<bool(_TArgs...)> Function;
+  typename std::aligned_storage<JCHAT_EVENT_CALLBACK_SIZE>::type Function;
+  bool (*Invoke)(void *function, _TArgs... arguments);
+  void (*Destroy)(void *function);
   bool IsTemporary;
+  // Makes sure a temporary callback runs only once, even when the event is
+  // raised by several threads at the same time
+  std::atomic<bool> IsFired;
+
+  template<typename _TFunction>
+  EventCallback(_TFunction function, bool is_temporary)
+    : Invoke(&invoke<_TFunction>), Destroy(&destroy<_TFunction>),
+    IsTemporary(is_temporary), IsFired(false) {
+    static_assert(sizeof(_TFunction) <= sizeof(Function),
+      "Callback is too large, increase JCHAT_EVENT_CALLBACK_SIZE");
+    static_assert(std::alignment_of<_TFunction>::value
+      <= std::alignment_of<decltype(Function)>::value,
+      "Callback alignment is not supported");
+    new (&Function) _TFunction(std::move(function));
+  }
+
+  ~EventCallback() {
+    if (Destroy != nullptr) {
+      Destroy(&Function);
+    }
+  }
+
+  EventCallback(const EventCallback &) = delete;
+  EventCallback &operator=(const EventCallback &) = delete;
+
+  // Only once the callback can't be invoked anymore, the callback itself
+  // stays until nothing can read it
+  void Release() {
+    Destroy(&Function);
+    Destroy = nullptr;
+  }
+
+private:
+  template<typename _TFunction>
+  static bool invoke(void *function, _TArgs... arguments) {
+    return (*static_cast<_TFunction *>(function))(arguments...);
+  }
+
+  template<typename _TFunction>
+  static void destroy(void *function) {
+    static_cast<_TFunction *>(function)->~_TFunction();
+  }
 };
 
+// Raising an event never takes a lock or allocates. The subscribers are kept
+// in an immutable list that Add replaces with an updated copy. Readers count
+// themselves in the epoch they started in, and lists replaced in an epoch are
+// freed by whoever sees the last reader of it gone, usually that reader.
+// Temporary callbacks that fired are skipped until the next Add drops them.
+// Events without subscribers return right away.
 template<typename... _TArgs>
 class Event {
+  typedef EventCallback<_TArgs...> Callback;
+  typedef std::vector<Callback *> CallbackList;
+
+  // Replaced in the epoch of the same parity
+  struct Retired {
+    std::vector<CallbackList *> Lists;
+    std::vector<Callback *> Callbacks;
+  };
+
+  std::atomic<CallbackList *> callbacks_;
+  std::atomic<uint32_t> epoch_;
+  // Readers by the parity of the epoch they started in
+  std::atomic<uint32_t> reader_counts_[2];
+  std::atomic<bool> has_retired_;
   std::mutex event_mutex_;
-  std::vector<EventCallback<_TArgs...>> callbacks_;
+  Retired retired_[2];
+
+  uint32_t enter() {
+    while (true) {
+      uint32_t epoch = epoch_;
+      reader_counts_[epoch & 1]++;
+      // A reader counted in the epoch before the last one would hold up
+      // lists that are being freed, it starts again in the new one
+      if (epoch_ == epoch) {
+        return epoch;
+      }
+      leave(epoch);
+    }
+  }
+
+  void leave(uint32_t epoch) {
+    if (--reader_counts_[epoch & 1] == 0 && has_retired_) {
+      // Whoever holds the mutex reclaims before it lets go of it, or the
+      // next reader that leaves does
+      if (event_mutex_.try_lock()) {
+        reclaim();
+        event_mutex_.unlock();
+      }
+    }
+  }
+
+  static void free_retired(Retired &retired) {
+    for (auto callback_list : retired.Lists) {
+      delete callback_list;
+    }
+    retired.Lists.clear();
+    for (auto callback : retired.Callbacks) {
+      delete callback;
+    }
+    retired.Callbacks.clear();
+  }
+
+  // NOTE: The event mutex has to be held by the caller
+  void reclaim() {
+    while (true) {
+      uint32_t epoch = epoch_;
+      Retired &current = retired_[epoch & 1];
+      Retired &previous = retired_[(epoch & 1) ^ 1];
+      if (reader_counts_[(epoch & 1) ^ 1] != 0) {
+        break;
+      }
+
+      // Readers of the current epoch started after the previous one's lists
+      // were replaced
+      if (!previous.Lists.empty() || !previous.Callbacks.empty()) {
+        free_retired(previous);
+        continue;
+      }
+      if (current.Lists.empty() && current.Callbacks.empty()) {
+        break;
+      }
+      // Readers from now on can't see what was replaced so far
+      epoch_++;
+    }
+    has_retired_ = !retired_[0].Lists.empty()
+      || !retired_[0].Callbacks.empty() || !retired_[1].Lists.empty()
+      || !retired_[1].Callbacks.empty();
+  }
 
 public:
-  Event() {}
-  Event(const Event &event) {}
+  Event() : callbacks_(nullptr), epoch_(0), has_retired_(false) {
+    reader_counts_[0] = 0;
+    reader_counts_[1] = 0;
+  }
+  Event(const Event &event) : Event() {}
+
+  ~Event() {
+    CallbackList *callbacks = callbacks_;
+    if (callbacks != nullptr) {
+      for (auto callback : *callbacks) {
+        delete callback;
+      }
+      delete callbacks;
+    }
+    free_retired(retired_[0]);
+    free_retired(retired_[1]);
+  }
 
   template<typename _TFunction>
   Event &Add(_TFunction function, bool is_temporary = false) {
+    Callback *callback = new Callback(std::move(function), is_temporary);
+
     event_mutex_.lock();
 
-    EventCallback<_TArgs...> callback;
-    callback.Function = function;
-    callback.IsTemporary = is_temporary;
-    callbacks_.push_back(callback);
+    // Temporary callbacks that fired are left out of the copy
+    Retired &retired = retired_[epoch_ & 1];
+    CallbackList *current_callbacks = callbacks_;
+    CallbackList *callbacks = new CallbackList();
+    if (current_callbacks != nullptr) {
+      callbacks->reserve(current_callbacks->size() + 1);
+      for (auto current_callback : *current_callbacks) {
+        if (current_callback->IsTemporary && current_callback->IsFired) {
+          retired.Callbacks.push_back(current_callback);
+        } else {
+          callbacks->push_back(current_callback);
+        }
+      }
+      retired.Lists.push_back(current_callbacks);
+    }
+    callbacks->push_back(callback);
+    callbacks_ = callbacks;
+    reclaim();
 
     event_mutex_.unlock();
 
@@ -45,24 +214,29 @@ public:
   }
 
   bool operator()(_TArgs... arguments) {
-    event_mutex_.lock();
+    // Nothing to do if nobody subscribed
+    if (callbacks_.load(std::memory_order_acquire) == nullptr) {
+      return true;
+    }
+
+    uint32_t epoch = enter();
+    CallbackList *callbacks = callbacks_;
 
     bool success = true;
+    for (auto callback : *callbacks) {
+      if (callback->IsTemporary && callback->IsFired.exchange(true)) {
+        continue;
+      }
 
-    for (auto iterator = callbacks_.begin(); iterator != callbacks_.end();) {
-      if (!iterator->Function(arguments...)) {
+      if (!callback->Invoke(&callback->Function, arguments...)) {
         success = false;
       }
-
-      if (iterator->IsTemporary) {
-        iterator = callbacks_.erase(iterator);
-      } else {
-        ++iterator;
+      if (callback->IsTemporary) {
+        callback->Release();
       }
     }
 
-    event_mutex_.unlock();
-
+    leave(epoch);
     return success;
   }
 };
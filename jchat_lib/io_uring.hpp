@@ -0,0 +1,407 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_io_uring_hpp_
+#define jchat_lib_io_uring_hpp_
+
+// Required libraries
+#include "platform.h"
+#include "socket.h"
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#if defined(OS_LINUX) && defined(JCHAT_USE_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+
+// Multishot receives need headers of Linux 6.0 or later, older ones build
+// without io_uring
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define JCHAT_HAS_IO_URING
+#endif
+#endif
+
+#if defined(JCHAT_HAS_IO_URING)
+namespace jchat {
+// What an accepted connection has in flight on its reactor's ring, only
+// used by the reactor
+struct RingConnection {
+  // Operations whose completion is still to come, the connection is kept
+  // alive until there are none
+  size_t Operations;
+  bool IsReceiving;
+  bool IsSending;
+  // Point into the send queue for as long as the send is in flight
+  std::vector<iovec> Buffers;
+  msghdr Message;
+
+  RingConnection() : Operations(0), IsReceiving(false), IsSending(false) {
+    memset(&Message, 0, sizeof(Message));
+  }
+};
+
+// An io_uring instance talked to through the system calls, with one group
+// of provided buffers for multishot receives. Only the thread that waits on
+// it may use it.
+class IoUring {
+  int ring_fd_;
+  uint32_t features_;
+
+  void *ring_;
+  size_t ring_size_;
+  io_uring_sqe *sqes_;
+  size_t sqes_size_;
+
+  uint32_t *sq_head_;
+  uint32_t *sq_tail_;
+  uint32_t sq_mask_;
+  uint32_t *sq_array_;
+  // Prepared entries the kernel hasn't been told about yet
+  uint32_t sq_local_tail_;
+  uint32_t sq_pending_;
+
+  uint32_t *cq_head_;
+  uint32_t *cq_tail_;
+  uint32_t cq_mask_;
+  io_uring_cqe *cqes_;
+
+  std::vector<uint8_t> buffers_;
+  uint32_t buffer_count_;
+  uint32_t buffer_size_;
+
+  static int setup(uint32_t entries, io_uring_params &params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+  }
+
+  int enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags,
+    const void *argument, size_t argument_size) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd_, to_submit,
+      min_complete, flags, argument, argument_size));
+  }
+
+  int register_ring(uint32_t opcode, const void *argument, uint32_t count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, ring_fd_, opcode,
+      argument, count));
+  }
+
+  // Multishot receives came with Linux 6.0, as did zero copy sends, which
+  // are easy to probe for
+  bool probe() {
+    std::vector<uint8_t> probe_buffer(sizeof(io_uring_probe)
+      + 256 * sizeof(io_uring_probe_op));
+    io_uring_probe *ring_probe = (io_uring_probe *)probe_buffer.data();
+    if (register_ring(IORING_REGISTER_PROBE, ring_probe, 256) < 0) {
+      return false;
+    }
+    return ring_probe->last_op >= IORING_OP_SEND_ZC
+      && (ring_probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED);
+  }
+
+  // Hands buffers with consecutive ids to the kernel, which picks one for
+  // every receive
+  bool provide_buffers(uint16_t buffer_id, uint32_t count) {
+    io_uring_sqe *sqe = GetSqe();
+    if (sqe == nullptr) {
+      return false;
+    }
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = static_cast<int32_t>(count);
+    sqe->addr = (uint64_t)GetBuffer(buffer_id);
+    sqe->len = buffer_size_;
+    sqe->off = buffer_id;
+    sqe->buf_group = 0;
+    return true;
+  }
+
+  bool setup_buffers(uint32_t buffer_count, uint32_t buffer_size) {
+    buffer_count_ = buffer_count;
+    buffer_size_ = buffer_size;
+    buffers_.resize(static_cast<size_t>(buffer_count) * buffer_size);
+    if (!provide_buffers(0, buffer_count)
+      || enter(sq_pending_, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+      return false;
+    }
+    sq_pending_ = 0;
+    io_uring_cqe &cqe = cqes_[*cq_head_ & cq_mask_];
+    bool is_provided = cqe.res >= 0;
+    __atomic_store_n(cq_head_, *cq_head_ + 1, __ATOMIC_RELEASE);
+    return is_provided;
+  }
+
+  void close_ring() {
+    if (sqes_ != nullptr) {
+      munmap(sqes_, sqes_size_);
+      sqes_ = nullptr;
+    }
+    if (ring_ != nullptr) {
+      munmap(ring_, ring_size_);
+      ring_ = nullptr;
+    }
+    if (ring_fd_ != SOCKET_ERROR) {
+      close(ring_fd_);
+      ring_fd_ = SOCKET_ERROR;
+    }
+  }
+
+public:
+  IoUring() : ring_fd_(SOCKET_ERROR), features_(0), ring_(nullptr),
+    ring_size_(0), sqes_(nullptr), sqes_size_(0), sq_local_tail_(0),
+    sq_pending_(0), buffer_count_(0), buffer_size_(0) {
+  }
+
+  ~IoUring() {
+    close_ring();
+  }
+
+  IoUring(const IoUring &) = delete;
+  IoUring &operator=(const IoUring &) = delete;
+
+  // Entries are rounded up to a power of two by the kernel. Fails on kernels
+  // without multishot receives or timeouts for waits.
+  bool Initialize(uint32_t entries, uint32_t buffer_count,
+    uint32_t buffer_size) {
+    // Completions of multishot operations outnumber submissions by far
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = entries * 4;
+    ring_fd_ = setup(entries, params);
+    if (ring_fd_ < 0) {
+      memset(&params, 0, sizeof(params));
+      params.flags = IORING_SETUP_CQSIZE;
+      params.cq_entries = entries * 4;
+      ring_fd_ = setup(entries, params);
+    }
+    if (ring_fd_ < 0) {
+      ring_fd_ = SOCKET_ERROR;
+      return false;
+    }
+    features_ = params.features;
+    if ((features_ & IORING_FEAT_SINGLE_MMAP) == 0
+      || (features_ & IORING_FEAT_EXT_ARG) == 0
+      || (features_ & IORING_FEAT_NODROP) == 0 || !probe()) {
+      close_ring();
+      return false;
+    }
+
+    // Both rings share a mapping, the entries have one of their own
+    size_t sq_size = params.sq_off.array
+      + params.sq_entries * sizeof(uint32_t);
+    size_t cq_size = params.cq_off.cqes
+      + params.cq_entries * sizeof(io_uring_cqe);
+    ring_size_ = sq_size > cq_size ? sq_size : cq_size;
+    void *ring = mmap(NULL, ring_size_, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED) {
+      close_ring();
+      return false;
+    }
+    ring_ = ring;
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+      close_ring();
+      return false;
+    }
+    sqes_ = (io_uring_sqe *)sqes;
+
+    uint8_t *ring_bytes = (uint8_t *)ring_;
+    sq_head_ = (uint32_t *)(ring_bytes + params.sq_off.head);
+    sq_tail_ = (uint32_t *)(ring_bytes + params.sq_off.tail);
+    sq_mask_ = *(uint32_t *)(ring_bytes + params.sq_off.ring_mask);
+    sq_array_ = (uint32_t *)(ring_bytes + params.sq_off.array);
+    sq_local_tail_ = *sq_tail_;
+    cq_head_ = (uint32_t *)(ring_bytes + params.cq_off.head);
+    cq_tail_ = (uint32_t *)(ring_bytes + params.cq_off.tail);
+    cq_mask_ = *(uint32_t *)(ring_bytes + params.cq_off.ring_mask);
+    cqes_ = (io_uring_cqe *)(ring_bytes + params.cq_off.cqes);
+
+    if (!setup_buffers(buffer_count, buffer_size)) {
+      close_ring();
+      return false;
+    }
+    return true;
+  }
+
+  bool IsValid() {
+    return ring_fd_ != SOCKET_ERROR;
+  }
+
+  // Returns a cleared entry, submitting the prepared ones first if the ring
+  // is full. Returns nullptr if even that didn't make room.
+  io_uring_sqe *GetSqe() {
+    uint32_t head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sq_local_tail_ - head > sq_mask_) {
+      Submit();
+      head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+      if (sq_local_tail_ - head > sq_mask_) {
+        return nullptr;
+      }
+    }
+    uint32_t index = sq_local_tail_ & sq_mask_;
+    io_uring_sqe *sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    sq_local_tail_++;
+    sq_pending_++;
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+    return sqe;
+  }
+
+  // Hands every prepared entry to the kernel in one call
+  int32_t Submit() {
+    if (sq_pending_ == 0) {
+      return 0;
+    }
+    int result = enter(sq_pending_, 0, 0, NULL, 0);
+    if (result > 0) {
+      sq_pending_ -= static_cast<uint32_t>(result);
+    }
+    return result < 0 ? -errno : result;
+  }
+
+  // Submits the prepared entries and waits for a completion, a negative
+  // timeout waits forever and 0 doesn't wait at all
+  int32_t SubmitAndWait(int32_t timeout) {
+    if (timeout == 0) {
+      return Submit();
+    }
+    io_uring_getevents_arg argument;
+    memset(&argument, 0, sizeof(argument));
+    timespec timeout_value;
+    if (timeout > 0) {
+      timeout_value.tv_sec = timeout / 1000;
+      timeout_value.tv_nsec = (timeout % 1000) * 1000000;
+      argument.ts = (uint64_t)&timeout_value;
+    }
+    int result = enter(sq_pending_, 1,
+      IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &argument,
+      sizeof(argument));
+    if (result >= 0) {
+      sq_pending_ -= static_cast<uint32_t>(result);
+      return result;
+    }
+    // Running out of time or being interrupted isn't a failure
+    return errno == ETIME || errno == EINTR ? 0 : -errno;
+  }
+
+  // Calls the handler with every completion that arrived and returns their
+  // count. The handler may prepare new entries. Completions with user data 0
+  // are the ring's own and skipped.
+  template<typename _THandler>
+  size_t ForEachCompletion(_THandler handler) {
+    size_t count = 0;
+    uint32_t head = *cq_head_;
+    uint32_t tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      io_uring_cqe cqe = cqes_[head & cq_mask_];
+      head++;
+      // Let the kernel reuse the slot before the handler runs, it may take
+      // long
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+      if (cqe.user_data != 0) {
+        handler(cqe);
+        count++;
+      }
+      if (head == tail) {
+        tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+      }
+    }
+    return count;
+  }
+
+  bool PrepareAccept(SOCKET listen_socket, uint64_t user_data) {
+    io_uring_sqe *sqe = GetSqe();
+    if (sqe == nullptr) {
+      return false;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_socket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = user_data;
+    return true;
+  }
+
+  // Keeps receiving into provided buffers until it fails or runs out of
+  // them, every completion carries the id of the buffer it filled
+  bool PrepareReceive(SOCKET socket, uint64_t user_data) {
+    io_uring_sqe *sqe = GetSqe();
+    if (sqe == nullptr) {
+      return false;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = user_data;
+    return true;
+  }
+
+  // The message has to stay valid until the send completed
+  bool PrepareSend(SOCKET socket, const msghdr *message, uint64_t user_data) {
+    io_uring_sqe *sqe = GetSqe();
+    if (sqe == nullptr) {
+      return false;
+    }
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = socket;
+    sqe->addr = (uint64_t)message;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data;
+    return true;
+  }
+
+  // Reports every time the socket becomes readable
+  bool PreparePoll(SOCKET socket, uint64_t user_data) {
+    io_uring_sqe *sqe = GetSqe();
+    if (sqe == nullptr) {
+      return false;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = socket;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = user_data;
+    return true;
+  }
+
+  // Cancels the operation that was prepared with the target's user data,
+  // the cancel completes with the given one
+  bool PrepareCancel(uint64_t target_user_data, uint64_t user_data) {
+    io_uring_sqe *sqe = GetSqe();
+    if (sqe == nullptr) {
+      return false;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target_user_data;
+    sqe->user_data = user_data;
+    return true;
+  }
+
+  const uint8_t *GetBuffer(uint16_t buffer_id) {
+    return buffers_.data() + static_cast<size_t>(buffer_id) * buffer_size_;
+  }
+
+  // Gives a buffer back to the kernel once its data was copied out, it can
+  // be picked again after the next submit
+  bool ReturnBuffer(uint16_t buffer_id) {
+    return provide_buffers(buffer_id, 1);
+  }
+};
+}
+#endif
+
+#endif // jchat_lib_io_uring_hpp_
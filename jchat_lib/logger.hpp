@@ -0,0 +1,406 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_logger_hpp_
+#define jchat_lib_logger_hpp_
+
+// Required libraries
+#include "platform.h"
+#include "thread.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+// Longest message of a record, longer ones are cut off
+#ifndef JCHAT_LOG_MESSAGE_SIZE
+#define JCHAT_LOG_MESSAGE_SIZE 232
+#endif // JCHAT_LOG_MESSAGE_SIZE
+
+// Records every thread can have waiting for the writer, records written
+// while they are all taken are dropped. Has to be a power of two.
+#ifndef JCHAT_LOG_RING_SIZE
+#define JCHAT_LOG_RING_SIZE 1024
+#endif // JCHAT_LOG_RING_SIZE
+
+// Milliseconds the writer waits for records between writes
+#ifndef JCHAT_LOG_FLUSH_INTERVAL
+#define JCHAT_LOG_FLUSH_INTERVAL 100
+#endif // JCHAT_LOG_FLUSH_INTERVAL
+
+#if defined(__GNUC__)
+#define JCHAT_LOG_FORMAT(format_index, arguments_index) \
+  __attribute__((format(printf, format_index, arguments_index)))
+#else
+#define JCHAT_LOG_FORMAT(format_index, arguments_index)
+#endif
+
+namespace jchat {
+enum LogLevel : uint8_t {
+  kLogLevel_Debug,
+  kLogLevel_Info,
+  kLogLevel_Warning,
+  kLogLevel_Error,
+  // Only for SetLevel, nothing is written
+  kLogLevel_None,
+};
+
+// Lets through at most a number of events a second, for events that come in
+// storms such as connects. The events it held back are counted, so the next
+// one that is let through can say how many there were.
+class LogRateLimit {
+  uint32_t limit_;
+  std::atomic<uint64_t> window_;
+  std::atomic<uint32_t> count_;
+  std::atomic<uint64_t> suppressed_count_;
+
+public:
+  explicit LogRateLimit(uint32_t limit) : limit_(limit), window_(0),
+    count_(0), suppressed_count_(0) {
+  }
+
+  // A limit of 0 lets everything through
+  void SetLimit(uint32_t limit) {
+    limit_ = limit;
+  }
+
+  // The count is of the events held back since the last one let through
+  bool Allow(uint64_t &out_suppressed_count) {
+    out_suppressed_count = 0;
+    if (limit_ == 0) {
+      return true;
+    }
+    uint64_t window = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::seconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+    uint64_t last_window = window_.load(std::memory_order_relaxed);
+    if (window != last_window
+      && window_.compare_exchange_strong(last_window, window)) {
+      count_.store(0, std::memory_order_relaxed);
+    }
+    if (count_.fetch_add(1, std::memory_order_relaxed) >= limit_) {
+      suppressed_count_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    out_suppressed_count = suppressed_count_.exchange(0,
+      std::memory_order_relaxed);
+    return true;
+  }
+};
+
+// Writes log lines on a thread of its own, so logging never waits for the
+// file. Every thread that logs gets a ring of records that only it writes
+// to and only the writer reads from, formatting a message is the only work
+// done by the caller and no lock is taken after its first record. A
+// thread that logs faster than the writer keeps up loses records, which are
+// counted and reported instead of blocking it.
+// Example:
+//    logger.Write(kLogLevel_Info, "server", "Client from %s connected",
+//      endpoint.c_str());
+class Logger {
+  struct Record {
+    int64_t Time; // Microseconds since the epoch
+    LogLevel Level;
+    const char *Category;
+    char Message[JCHAT_LOG_MESSAGE_SIZE];
+  };
+
+  struct ThreadLog {
+    uint32_t Index;
+    std::unique_ptr<Record[]> Records;
+    std::atomic<uint64_t> Head; // Written by the thread
+    std::atomic<uint64_t> Tail; // Written by the writer
+    std::atomic<uint64_t> DroppedCount;
+    uint64_t ReportedDroppedCount;
+  };
+
+  struct ThreadCache {
+    uint64_t LoggerId;
+    ThreadLog *Log;
+  };
+
+  uint64_t id_;
+  std::atomic<uint8_t> level_;
+  // The logs of a thread outlive it, so its last records are still written
+  std::unordered_map<std::thread::id, std::unique_ptr<ThreadLog>>
+    thread_logs_;
+  std::mutex thread_logs_mutex_;
+
+  std::string path_;
+  FILE *file_;
+  std::thread writer_thread_;
+  bool is_running_;
+  std::mutex writer_mutex_;
+  std::condition_variable writer_condition_;
+
+  static ThreadCache &getThreadCache() {
+    static thread_local ThreadCache thread_cache = { 0, nullptr };
+    return thread_cache;
+  }
+
+  static uint64_t createId() {
+    static std::atomic<uint64_t> next_id(1);
+    return next_id++;
+  }
+
+  static const char *getLevelName(LogLevel level) {
+    switch (level) {
+    case kLogLevel_Debug:
+      return "DEBUG";
+    case kLogLevel_Info:
+      return "INFO";
+    case kLogLevel_Warning:
+      return "WARN";
+    case kLogLevel_Error:
+      return "ERROR";
+    default:
+      return "?";
+    }
+  }
+
+  ThreadLog &getThreadLog() {
+    ThreadCache &thread_cache = getThreadCache();
+    if (thread_cache.LoggerId == id_) {
+      return *thread_cache.Log;
+    }
+
+    thread_logs_mutex_.lock();
+    std::unique_ptr<ThreadLog> &thread_log =
+      thread_logs_[std::this_thread::get_id()];
+    if (!thread_log) {
+      thread_log.reset(new ThreadLog());
+      thread_log->Index = static_cast<uint32_t>(thread_logs_.size());
+      thread_log->Records.reset(new Record[JCHAT_LOG_RING_SIZE]);
+      thread_log->Head = 0;
+      thread_log->Tail = 0;
+      thread_log->DroppedCount = 0;
+      thread_log->ReportedDroppedCount = 0;
+    }
+    thread_cache.LoggerId = id_;
+    thread_cache.Log = thread_log.get();
+    thread_logs_mutex_.unlock();
+
+    return *thread_cache.Log;
+  }
+
+  void writeLine(const Record &record, uint32_t thread_index) {
+    time_t seconds = static_cast<time_t>(record.Time / 1000000);
+    struct tm local_time;
+#if defined(OS_WIN)
+    localtime_s(&local_time, &seconds);
+#else
+    localtime_r(&seconds, &local_time);
+#endif
+    char time_string[32];
+    strftime(time_string, sizeof(time_string), "%Y-%m-%d %H:%M:%S",
+      &local_time);
+    fprintf(file_, "%s.%06d %-5s [%u] %s: %s\n", time_string,
+      static_cast<int>(record.Time % 1000000), getLevelName(record.Level),
+      thread_index, record.Category, record.Message);
+  }
+
+  // Writes every waiting record of every thread in the order they were
+  // made, returns false if there were none
+  bool writeRecords() {
+    // Threads that log for the first time meanwhile are picked up next time
+    std::vector<ThreadLog *> thread_logs;
+    thread_logs_mutex_.lock();
+    thread_logs.reserve(thread_logs_.size());
+    for (auto &thread_log : thread_logs_) {
+      thread_logs.push_back(thread_log.second.get());
+    }
+    thread_logs_mutex_.unlock();
+
+    std::vector<std::pair<const Record *, ThreadLog *>> records;
+    std::vector<uint64_t> heads(thread_logs.size());
+    for (size_t i = 0; i < thread_logs.size(); i++) {
+      ThreadLog &thread_log = *thread_logs[i];
+      uint64_t tail = thread_log.Tail.load(std::memory_order_relaxed);
+      heads[i] = thread_log.Head.load(std::memory_order_acquire);
+      for (uint64_t j = tail; j < heads[i]; j++) {
+        records.push_back(std::make_pair(
+          &thread_log.Records[j & (JCHAT_LOG_RING_SIZE - 1)], &thread_log));
+      }
+
+      uint64_t dropped_count = thread_log.DroppedCount.load(
+        std::memory_order_relaxed);
+      if (dropped_count != thread_log.ReportedDroppedCount) {
+        fprintf(file_, "%-5s [%u] log: %llu records dropped\n",
+          getLevelName(kLogLevel_Warning), thread_log.Index,
+          static_cast<unsigned long long>(
+          dropped_count - thread_log.ReportedDroppedCount));
+        thread_log.ReportedDroppedCount = dropped_count;
+      }
+    }
+    if (records.empty()) {
+      return false;
+    }
+
+    std::stable_sort(records.begin(), records.end(),
+      [](const std::pair<const Record *, ThreadLog *> &a,
+      const std::pair<const Record *, ThreadLog *> &b) {
+      return a.first->Time < b.first->Time;
+    });
+    for (auto &record : records) {
+      writeLine(*record.first, record.second->Index);
+    }
+    fflush(file_);
+
+    // The records can be reused once they are written
+    for (size_t i = 0; i < thread_logs.size(); i++) {
+      thread_logs[i]->Tail.store(heads[i], std::memory_order_release);
+    }
+    return true;
+  }
+
+  void writerLoop() {
+    Thread::SetName("jchat-log");
+    std::unique_lock<std::mutex> lock(writer_mutex_);
+    while (is_running_) {
+      writer_condition_.wait_for(lock,
+        std::chrono::milliseconds(JCHAT_LOG_FLUSH_INTERVAL));
+      lock.unlock();
+      writeRecords();
+      lock.lock();
+    }
+  }
+
+public:
+  Logger() : id_(createId()), level_(kLogLevel_Info), file_(nullptr),
+    is_running_(false) {
+  }
+
+  ~Logger() {
+    Stop();
+  }
+
+  Logger(const Logger &) = delete;
+  Logger &operator=(const Logger &) = delete;
+
+  // Appends to the file at the path, empty (the default) writes to the
+  // standard output. Can only be changed while the logger is stopped.
+  bool SetPath(const std::string &path) {
+    if (is_running_) {
+      return false;
+    }
+    path_ = path;
+    return true;
+  }
+
+  std::string GetPath() {
+    return path_;
+  }
+
+  // Records below the level are skipped before they are formatted, can be
+  // changed at any time. Defaults to kLogLevel_Info.
+  void SetLevel(LogLevel level) {
+    level_.store(level, std::memory_order_relaxed);
+  }
+
+  LogLevel GetLevel() {
+    return static_cast<LogLevel>(level_.load(std::memory_order_relaxed));
+  }
+
+  bool IsEnabled(LogLevel level) {
+    return level != kLogLevel_None
+      && level >= level_.load(std::memory_order_relaxed);
+  }
+
+  // Records written before this wait for it
+  bool Start() {
+    writer_mutex_.lock();
+    if (is_running_) {
+      writer_mutex_.unlock();
+      return false;
+    }
+    if (path_.empty()) {
+      file_ = stdout;
+    } else {
+      file_ = fopen(path_.c_str(), "a");
+      if (file_ == nullptr) {
+        writer_mutex_.unlock();
+        return false;
+      }
+    }
+    is_running_ = true;
+    writer_mutex_.unlock();
+
+    writer_thread_ = std::thread(&Logger::writerLoop, this);
+    return true;
+  }
+
+  // Writes the records that are still waiting
+  bool Stop() {
+    writer_mutex_.lock();
+    if (!is_running_) {
+      writer_mutex_.unlock();
+      return false;
+    }
+    is_running_ = false;
+    writer_mutex_.unlock();
+    writer_condition_.notify_one();
+    if (writer_thread_.joinable()) {
+      writer_thread_.join();
+    }
+
+    writeRecords();
+    if (file_ != stdout) {
+      fclose(file_);
+    }
+    file_ = nullptr;
+    return true;
+  }
+
+  // The category has to outlive the logger, it should be a literal. Returns
+  // false if the record was skipped or dropped.
+  JCHAT_LOG_FORMAT(4, 5)
+  bool Write(LogLevel level, const char *category, const char *format, ...) {
+    if (!IsEnabled(level)) {
+      return false;
+    }
+
+    ThreadLog &thread_log = getThreadLog();
+    uint64_t head = thread_log.Head.load(std::memory_order_relaxed);
+    uint64_t tail = thread_log.Tail.load(std::memory_order_acquire);
+    if (head - tail >= JCHAT_LOG_RING_SIZE) {
+      thread_log.DroppedCount.store(thread_log.DroppedCount.load(
+        std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return false;
+    }
+
+    Record &record = thread_log.Records[head & (JCHAT_LOG_RING_SIZE - 1)];
+    record.Time = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+    record.Level = level;
+    record.Category = category;
+    va_list argument_list;
+    va_start(argument_list, format);
+    vsnprintf(record.Message, sizeof(record.Message), format, argument_list);
+    va_end(argument_list);
+    thread_log.Head.store(head + 1, std::memory_order_release);
+
+    // The writer is only woken early for a ring that is filling up
+    if (head + 1 - tail == JCHAT_LOG_RING_SIZE / 2) {
+      writer_condition_.notify_one();
+    }
+    return true;
+  }
+};
+}
+
+#endif // jchat_lib_logger_hpp_
@@ -0,0 +1,141 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_mapped_file_hpp_
+#define jchat_lib_mapped_file_hpp_
+
+// Required libraries
+#include "platform.h"
+#include <string>
+#include <stdint.h>
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#elif defined(OS_WIN)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+namespace jchat {
+// A whole file mapped read only into memory, so it can be read in place
+// without copying it into buffers first
+class MappedFile {
+  const uint8_t *data_;
+  size_t size_;
+#if defined(OS_WIN)
+  HANDLE file_;
+  HANDLE mapping_;
+#endif
+
+public:
+  MappedFile() : data_(nullptr), size_(0) {
+#if defined(OS_WIN)
+    file_ = INVALID_HANDLE_VALUE;
+    mapping_ = NULL;
+#endif
+  }
+
+  ~MappedFile() {
+    Close();
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // Returns false if the file doesn't exist or can't be mapped, empty files
+  // open with no data
+  bool Open(const std::string &path) {
+    Close();
+
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+    int file = open(path.c_str(), O_RDONLY);
+    if (file == -1) {
+      return false;
+    }
+    struct stat file_stat;
+    if (fstat(file, &file_stat) == -1) {
+      close(file);
+      return false;
+    }
+    size_ = static_cast<size_t>(file_stat.st_size);
+    if (size_ > 0) {
+      void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file, 0);
+      if (data == MAP_FAILED) {
+        close(file);
+        size_ = 0;
+        return false;
+      }
+      data_ = static_cast<const uint8_t *>(data);
+    }
+
+    // The mapping keeps the file open
+    close(file);
+#elif defined(OS_WIN)
+    file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_ == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_, &file_size)) {
+      Close();
+      return false;
+    }
+    size_ = static_cast<size_t>(file_size.QuadPart);
+    if (size_ > 0) {
+      mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+      if (mapping_ == NULL) {
+        Close();
+        return false;
+      }
+      data_ = static_cast<const uint8_t *>(MapViewOfFile(mapping_,
+        FILE_MAP_READ, 0, 0, 0));
+      if (data_ == nullptr) {
+        Close();
+        return false;
+      }
+    }
+#endif
+    return true;
+  }
+
+  void Close() {
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+    if (data_ != nullptr) {
+      munmap(const_cast<uint8_t *>(data_), size_);
+    }
+#elif defined(OS_WIN)
+    if (data_ != nullptr) {
+      UnmapViewOfFile(data_);
+    }
+    if (mapping_ != NULL) {
+      CloseHandle(mapping_);
+      mapping_ = NULL;
+    }
+    if (file_ != INVALID_HANDLE_VALUE) {
+      CloseHandle(file_);
+      file_ = INVALID_HANDLE_VALUE;
+    }
+#endif
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  const uint8_t *GetData() {
+    return data_;
+  }
+
+  size_t GetSize() {
+    return size_;
+  }
+};
+}
+
+#endif // jchat_lib_mapped_file_hpp_
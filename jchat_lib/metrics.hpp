@@ -0,0 +1,277 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_metrics_hpp_
+#define jchat_lib_metrics_hpp_
+
+// Required libraries
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Histograms have one bucket per power of two, bucket n holds the values
+// that need n bits
+#define JCHAT_METRICS_HISTOGRAM_BUCKETS 65
+
+// Expensive measurements, such as the ones that read the clock, are only
+// taken on one in this many calls to ShouldSample. Has to be a power of two.
+#ifndef JCHAT_METRICS_SAMPLE_RATE
+#define JCHAT_METRICS_SAMPLE_RATE 16
+#endif // JCHAT_METRICS_SAMPLE_RATE
+
+namespace jchat {
+struct HistogramSnapshot {
+  uint64_t Count;
+  uint64_t Sum;
+  uint64_t Max;
+  uint64_t Buckets[JCHAT_METRICS_HISTOGRAM_BUCKETS];
+
+  // Returns the upper bound of the bucket that the given fraction of the
+  // recorded values is smaller than or equal to, e.g. 0.99 for the 99th
+  // percentile
+  uint64_t GetPercentile(double fraction) const {
+    // Threads keep recording while a snapshot is taken, so the buckets are
+    // counted again instead of trusting Count
+    uint64_t total = 0;
+    for (size_t i = 0; i < JCHAT_METRICS_HISTOGRAM_BUCKETS; i++) {
+      total += Buckets[i];
+    }
+    uint64_t target = static_cast<uint64_t>(total * fraction);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < JCHAT_METRICS_HISTOGRAM_BUCKETS; i++) {
+      seen += Buckets[i];
+      if (seen > target || (seen == total && seen != 0)) {
+        uint64_t upper_bound = i == 0 ? 0 : i >= 64 ? UINT64_MAX
+          : (static_cast<uint64_t>(1) << i) - 1;
+        return upper_bound < Max ? upper_bound : Max;
+      }
+    }
+    return 0;
+  }
+};
+
+// Counters and histograms that are cheap enough for hot paths. Every thread
+// that records a metric gets its own copy of all of them, so recording never
+// takes a lock or a locked instruction. Reading a metric sums the copies of
+// every thread, which is only done when somebody asks for the values.
+// Metrics are identified by indexes the owner of the registry defines.
+// Example:
+//    MetricsRegistry metrics(kMyCounter_Max, kMyHistogram_Max);
+//    metrics.Add(kMyCounter_BytesReceived, size);
+//    uint64_t bytes_received = metrics.GetCounter(kMyCounter_BytesReceived);
+class MetricsRegistry {
+  struct Histogram {
+    std::atomic<uint64_t> Count;
+    std::atomic<uint64_t> Sum;
+    std::atomic<uint64_t> Max;
+    std::atomic<uint64_t> Buckets[JCHAT_METRICS_HISTOGRAM_BUCKETS];
+  };
+
+  struct ThreadMetrics {
+    std::unique_ptr<std::atomic<uint64_t>[]> Counters;
+    std::unique_ptr<Histogram[]> Histograms;
+  };
+
+  struct ThreadCache {
+    uint64_t RegistryId;
+    ThreadMetrics *Metrics;
+    uint32_t SampleCounter;
+  };
+
+  uint64_t id_;
+  size_t counter_count_;
+  size_t histogram_count_;
+  // The metrics of a thread outlive it, so no counts are lost
+  std::unordered_map<std::thread::id, std::unique_ptr<ThreadMetrics>>
+    thread_metrics_;
+  std::mutex thread_metrics_mutex_;
+
+  static ThreadCache &getThreadCache() {
+    static thread_local ThreadCache thread_cache = { 0, nullptr, 0 };
+    return thread_cache;
+  }
+
+  // Registries are told apart by id rather than address, a new registry
+  // may be created where a destroyed one used to be
+  static uint64_t createId() {
+    static std::atomic<uint64_t> next_id(1);
+    return next_id++;
+  }
+
+  // Only the owning thread writes to its metrics, a relaxed load and store
+  // is enough and avoids a locked add
+  static void increase(std::atomic<uint64_t> &value, uint64_t amount) {
+    value.store(value.load(std::memory_order_relaxed) + amount,
+      std::memory_order_relaxed);
+  }
+
+  static size_t getBucket(uint64_t value) {
+    if (value == 0) {
+      return 0;
+    }
+#if defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index = 0;
+    _BitScanReverse64(&index, value);
+    return index + 1;
+#elif defined(_MSC_VER)
+    unsigned long index = 0;
+    if (_BitScanReverse(&index, static_cast<unsigned long>(value >> 32))) {
+      return index + 33;
+    }
+    _BitScanReverse(&index, static_cast<unsigned long>(value));
+    return index + 1;
+#else
+    return 64 - __builtin_clzll(value);
+#endif
+  }
+
+  ThreadMetrics &getThreadMetrics() {
+    ThreadCache &thread_cache = getThreadCache();
+    if (thread_cache.RegistryId == id_) {
+      return *thread_cache.Metrics;
+    }
+
+    thread_metrics_mutex_.lock();
+    std::unique_ptr<ThreadMetrics> &thread_metrics =
+      thread_metrics_[std::this_thread::get_id()];
+    if (!thread_metrics) {
+      thread_metrics.reset(new ThreadMetrics());
+      thread_metrics->Counters.reset(
+        new std::atomic<uint64_t>[counter_count_]);
+      for (size_t i = 0; i < counter_count_; i++) {
+        thread_metrics->Counters[i] = 0;
+      }
+      thread_metrics->Histograms.reset(new Histogram[histogram_count_]);
+      for (size_t i = 0; i < histogram_count_; i++) {
+        Histogram &histogram = thread_metrics->Histograms[i];
+        histogram.Count = 0;
+        histogram.Sum = 0;
+        histogram.Max = 0;
+        for (size_t j = 0; j < JCHAT_METRICS_HISTOGRAM_BUCKETS; j++) {
+          histogram.Buckets[j] = 0;
+        }
+      }
+    }
+    thread_cache.RegistryId = id_;
+    thread_cache.Metrics = thread_metrics.get();
+    thread_metrics_mutex_.unlock();
+
+    return *thread_cache.Metrics;
+  }
+
+public:
+  MetricsRegistry(size_t counter_count, size_t histogram_count)
+    : id_(createId()), counter_count_(counter_count),
+    histogram_count_(histogram_count) {
+  }
+
+  MetricsRegistry(const MetricsRegistry &) = delete;
+  MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+
+  // Returns the time in nanoseconds on a clock that only moves forward
+  static uint64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // True on one in JCHAT_METRICS_SAMPLE_RATE calls on every thread
+  static bool ShouldSample() {
+    return (++getThreadCache().SampleCounter
+      & (JCHAT_METRICS_SAMPLE_RATE - 1)) == 0;
+  }
+
+  void Add(size_t counter, uint64_t amount = 1) {
+    if (counter >= counter_count_) {
+      return;
+    }
+    increase(getThreadMetrics().Counters[counter], amount);
+  }
+
+  void Record(size_t histogram, uint64_t value) {
+    if (histogram >= histogram_count_) {
+      return;
+    }
+    Histogram &thread_histogram = getThreadMetrics().Histograms[histogram];
+    increase(thread_histogram.Count, 1);
+    increase(thread_histogram.Sum, value);
+    increase(thread_histogram.Buckets[getBucket(value)], 1);
+    if (value > thread_histogram.Max.load(std::memory_order_relaxed)) {
+      thread_histogram.Max.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  // Locks the mutex and records how long that took. The clock is only read
+  // if the mutex is contended, uncontended locks are recorded as 0.
+  template<typename _TMutex>
+  void Lock(_TMutex &mutex, size_t histogram) {
+    if (mutex.try_lock()) {
+      Record(histogram, 0);
+      return;
+    }
+    uint64_t start_time = Now();
+    mutex.lock();
+    Record(histogram, Now() - start_time);
+  }
+
+  size_t GetCounterCount() {
+    return counter_count_;
+  }
+
+  size_t GetHistogramCount() {
+    return histogram_count_;
+  }
+
+  uint64_t GetCounter(size_t counter) {
+    if (counter >= counter_count_) {
+      return 0;
+    }
+    uint64_t value = 0;
+    thread_metrics_mutex_.lock();
+    for (auto &thread_metrics : thread_metrics_) {
+      value += thread_metrics.second->Counters[counter].load(
+        std::memory_order_relaxed);
+    }
+    thread_metrics_mutex_.unlock();
+    return value;
+  }
+
+  HistogramSnapshot GetHistogram(size_t histogram) {
+    HistogramSnapshot snapshot = {};
+    if (histogram >= histogram_count_) {
+      return snapshot;
+    }
+    thread_metrics_mutex_.lock();
+    for (auto &thread_metrics : thread_metrics_) {
+      Histogram &thread_histogram =
+        thread_metrics.second->Histograms[histogram];
+      snapshot.Count += thread_histogram.Count.load(std::memory_order_relaxed);
+      snapshot.Sum += thread_histogram.Sum.load(std::memory_order_relaxed);
+      uint64_t max = thread_histogram.Max.load(std::memory_order_relaxed);
+      if (max > snapshot.Max) {
+        snapshot.Max = max;
+      }
+      for (size_t i = 0; i < JCHAT_METRICS_HISTOGRAM_BUCKETS; i++) {
+        snapshot.Buckets[i] += thread_histogram.Buckets[i].load(
+          std::memory_order_relaxed);
+      }
+    }
+    thread_metrics_mutex_.unlock();
+    return snapshot;
+  }
+};
+}
+
+#endif // jchat_lib_metrics_hpp_
@@ -0,0 +1,132 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_object_pool_hpp_
+#define jchat_lib_object_pool_hpp_
+
+// Required libraries
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#ifndef JCHAT_OBJECT_POOL_SLAB_SIZE
+#define JCHAT_OBJECT_POOL_SLAB_SIZE 64
+#endif // JCHAT_OBJECT_POOL_SLAB_SIZE
+
+namespace jchat {
+struct PoolStats {
+  // Objects currently handed out and the most that were out at once
+  size_t InUse;
+  size_t PeakInUse;
+  // Objects that are ready to be handed out without allocating
+  size_t Available;
+  // Total number of objects handed out, and how often the pool had to ask
+  // the system allocator for more memory to do so
+  uint64_t Acquisitions;
+  uint64_t Allocations;
+};
+
+// Recycles the storage of objects that are created and destroyed at high
+// rates, such as one per connection. Storage is allocated in slabs of
+// JCHAT_OBJECT_POOL_SLAB_SIZE objects and is only given back to the system
+// when the pool is destroyed. Objects are constructed on every Create and
+// destroyed on every Destroy, only their memory is reused.
+// NOTE: Pools have to be owned by a std::shared_ptr, shared objects keep
+// their pool alive until they have been destroyed.
+// Example:
+//    auto pool = std::make_shared<ObjectPool<Session>>();
+//    std::shared_ptr<Session> session = pool->CreateShared(socket);
+template<typename _TObject>
+class ObjectPool : public std::enable_shared_from_this<ObjectPool<_TObject>> {
+  typedef typename std::aligned_storage<sizeof(_TObject),
+    std::alignment_of<_TObject>::value>::type Storage;
+
+  std::vector<std::unique_ptr<Storage[]>> slabs_;
+  std::vector<Storage *> free_storage_;
+  std::mutex mutex_;
+  PoolStats stats_;
+
+  Storage *acquire() {
+    mutex_.lock();
+    if (free_storage_.empty()) {
+      std::unique_ptr<Storage[]> slab(new Storage[JCHAT_OBJECT_POOL_SLAB_SIZE]);
+      for (size_t i = JCHAT_OBJECT_POOL_SLAB_SIZE; i > 0; i--) {
+        free_storage_.push_back(&slab[i - 1]);
+      }
+      slabs_.push_back(std::move(slab));
+      stats_.Allocations++;
+    }
+    Storage *storage = free_storage_.back();
+    free_storage_.pop_back();
+
+    stats_.Acquisitions++;
+    if (++stats_.InUse > stats_.PeakInUse) {
+      stats_.PeakInUse = stats_.InUse;
+    }
+    mutex_.unlock();
+    return storage;
+  }
+
+  void release(Storage *storage) {
+    mutex_.lock();
+    free_storage_.push_back(storage);
+    stats_.InUse--;
+    mutex_.unlock();
+  }
+
+public:
+  ObjectPool() {
+    stats_.InUse = 0;
+    stats_.PeakInUse = 0;
+    stats_.Available = 0;
+    stats_.Acquisitions = 0;
+    stats_.Allocations = 0;
+  }
+
+  ObjectPool(const ObjectPool &) = delete;
+  ObjectPool &operator=(const ObjectPool &) = delete;
+
+  template<typename... _TArgs>
+  _TObject *Create(_TArgs &&...args) {
+    Storage *storage = acquire();
+    return new (storage) _TObject(std::forward<_TArgs>(args)...);
+  }
+
+  void Destroy(_TObject *object) {
+    if (object == nullptr) {
+      return;
+    }
+    object->~_TObject();
+    release(reinterpret_cast<Storage *>(object));
+  }
+
+  // The object goes back to the pool once the last reference is released
+  template<typename... _TArgs>
+  std::shared_ptr<_TObject> CreateShared(_TArgs &&...args) {
+    std::shared_ptr<ObjectPool> pool = this->shared_from_this();
+    return std::shared_ptr<_TObject>(Create(std::forward<_TArgs>(args)...),
+      [pool](_TObject *object) {
+      pool->Destroy(object);
+    });
+  }
+
+  PoolStats GetStats() {
+    mutex_.lock();
+    PoolStats stats = stats_;
+    stats.Available = free_storage_.size();
+    mutex_.unlock();
+    return stats;
+  }
+};
+}
+
+#endif // jchat_lib_object_pool_hpp_
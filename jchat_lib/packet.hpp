@@ -0,0 +1,42 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_packet_hpp_
+#define jchat_lib_packet_hpp_
+
+// Required libraries
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+namespace jchat {
+// Fully framed message ready to be written to a socket. It cannot be changed
+// once created, so a single packet can be shared by every connection it is
+// sent to instead of framing the same bytes once per recipient.
+class Packet {
+  std::vector<uint8_t> data_;
+
+public:
+  Packet(const uint8_t *header, size_t header_size, const uint8_t *body,
+    size_t body_size) {
+    data_.reserve(header_size + body_size);
+    data_.insert(data_.end(), header, header + header_size);
+    data_.insert(data_.end(), body, body + body_size);
+  }
+
+  const uint8_t *GetData() const {
+    return data_.data();
+  }
+
+  size_t GetSize() const {
+    return data_.size();
+  }
+};
+}
+
+#endif // jchat_lib_packet_hpp_
@@ -0,0 +1,521 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_poller_hpp_
+#define jchat_lib_poller_hpp_
+
+// Required libraries
+#include "socket.h"
+#include <map>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+#if defined(OS_LINUX)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif defined(OS_OSX)
+#include <sys/event.h>
+#include <sys/time.h>
+#elif defined(OS_WIN)
+#include <string.h>
+#endif
+
+namespace jchat {
+enum PollerType : uint8_t {
+  kPollerType_Default,
+  kPollerType_Select,
+  kPollerType_Epoll,
+  kPollerType_Kqueue,
+  // Not a poller, TcpServer runs its reactors on io_uring instead and falls
+  // back to the default poller where it can't. See io_uring.hpp.
+  kPollerType_IoUring,
+};
+
+struct PollerEvent {
+  void *Data;
+  bool Readable;
+  bool Writable;
+  bool Closed;
+};
+
+// Lets another thread interrupt a poller that is blocked waiting. On Linux
+// this is an eventfd, other POSIX systems use a self-pipe and Windows uses a
+// loopback UDP socket connected to itself since select only accepts sockets.
+class Waker {
+#if defined(OS_LINUX)
+  int event_fd_;
+#elif defined(OS_WIN)
+  SOCKET socket_;
+#else
+  int pipe_fds_[2];
+#endif
+
+public:
+  Waker() {
+#if defined(OS_LINUX)
+    event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#elif defined(OS_WIN)
+    socket_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (socket_ == INVALID_SOCKET) {
+      return;
+    }
+
+    sockaddr_in endpoint;
+    int endpoint_size = sizeof(endpoint);
+    memset(&endpoint, 0, sizeof(endpoint));
+    endpoint.sin_family = AF_INET;
+    endpoint.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    endpoint.sin_port = 0;
+
+    u_long blocking = 1;
+    if (bind(socket_, (const sockaddr *)&endpoint, sizeof(endpoint))
+      == SOCKET_ERROR
+      || getsockname(socket_, (sockaddr *)&endpoint, &endpoint_size)
+      == SOCKET_ERROR
+      || connect(socket_, (const sockaddr *)&endpoint, sizeof(endpoint))
+      == SOCKET_ERROR
+      || ioctlsocket(socket_, FIONBIO, &blocking) == SOCKET_ERROR) {
+      closesocket(socket_);
+      socket_ = INVALID_SOCKET;
+    }
+#else
+    if (pipe(pipe_fds_) == SOCKET_ERROR) {
+      pipe_fds_[0] = pipe_fds_[1] = SOCKET_ERROR;
+      return;
+    }
+    for (int i = 0; i < 2; i++) {
+      fcntl(pipe_fds_[i], F_SETFL, fcntl(pipe_fds_[i], F_GETFL, 0)
+        | O_NONBLOCK);
+      fcntl(pipe_fds_[i], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+  }
+
+  ~Waker() {
+#if defined(OS_LINUX)
+    if (event_fd_ != SOCKET_ERROR) {
+      close(event_fd_);
+    }
+#elif defined(OS_WIN)
+    if (socket_ != INVALID_SOCKET) {
+      closesocket(socket_);
+    }
+#else
+    if (pipe_fds_[0] != SOCKET_ERROR) {
+      close(pipe_fds_[0]);
+      close(pipe_fds_[1]);
+    }
+#endif
+  }
+
+  bool IsValid() {
+#if defined(OS_LINUX)
+    return event_fd_ != SOCKET_ERROR;
+#elif defined(OS_WIN)
+    return socket_ != INVALID_SOCKET;
+#else
+    return pipe_fds_[0] != SOCKET_ERROR;
+#endif
+  }
+
+  SOCKET GetSocket() {
+#if defined(OS_LINUX)
+    return event_fd_;
+#elif defined(OS_WIN)
+    return socket_;
+#else
+    return pipe_fds_[0];
+#endif
+  }
+
+  // Safe to call from any thread, a full pipe already guarantees a wakeup
+  bool Notify() {
+#if defined(OS_LINUX)
+    uint64_t value = 1;
+    return write(event_fd_, &value, sizeof(value)) == sizeof(value)
+      || errno == EAGAIN;
+#elif defined(OS_WIN)
+    char value = 0;
+    return send(socket_, &value, sizeof(value), 0) != SOCKET_ERROR
+      || WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    char value = 0;
+    return write(pipe_fds_[1], &value, sizeof(value)) == sizeof(value)
+      || errno == EAGAIN;
+#endif
+  }
+
+  // Consumes every pending notification so an edge-triggered poller reports
+  // the next one again
+  void Drain() {
+#if defined(OS_LINUX)
+    uint64_t value;
+    while (read(event_fd_, &value, sizeof(value)) > 0) {
+    }
+#elif defined(OS_WIN)
+    char values[64];
+    while (recv(socket_, values, sizeof(values), 0) > 0) {
+    }
+#else
+    char values[64];
+    while (read(pipe_fds_[0], values, sizeof(values)) > 0) {
+    }
+#endif
+  }
+};
+
+// Waits for activity on a set of registered sockets. Each socket is
+// registered once and stays registered until it is removed, so the cost of a
+// wakeup depends only on the number of sockets that are ready. Backends other
+// than select are edge-triggered, callers must read each ready socket until
+// it would block.
+class Poller {
+  Waker waker_;
+  bool is_wakeable_;
+
+protected:
+  virtual int32_t wait(PollerEvent *events, size_t max_events,
+    int32_t timeout) = 0;
+
+public:
+  Poller() : is_wakeable_(false) {}
+  virtual ~Poller() {}
+
+  virtual bool IsValid() = 0;
+  virtual PollerType GetType() = 0;
+
+  virtual bool Add(SOCKET socket, void *data) = 0;
+  virtual bool Remove(SOCKET socket) = 0;
+
+  // Sockets are only watched for reads by default, write interest is meant to
+  // be enabled while there is queued output and disabled again once it has
+  // been written
+  virtual bool SetWritable(SOCKET socket, void *data, bool writable) = 0;
+
+  // Returns the number of events written to the array or SOCKET_ERROR, a
+  // negative timeout waits forever. A call to Wakeup makes it return early,
+  // possibly with no events.
+  int32_t Wait(PollerEvent *events, size_t max_events, int32_t timeout) {
+    int32_t event_count = wait(events, max_events, timeout);
+    if (event_count == SOCKET_ERROR) {
+      return SOCKET_ERROR;
+    }
+
+    // Hide the waker from the caller
+    int32_t socket_event_count = 0;
+    for (int32_t i = 0; i < event_count; i++) {
+      if (events[i].Data == &waker_) {
+        waker_.Drain();
+        continue;
+      }
+      events[socket_event_count++] = events[i];
+    }
+
+    return socket_event_count;
+  }
+
+  // Interrupts a pending or the next Wait, safe to call from any thread
+  bool Wakeup() {
+    return is_wakeable_ && waker_.Notify();
+  }
+
+  bool IsWakeable() {
+    return is_wakeable_;
+  }
+
+  static std::unique_ptr<Poller> Create(PollerType type = kPollerType_Default);
+};
+
+// Fallback for platforms without a scalable poller, it rebuilds the socket set
+// on every wait and is limited to FD_SETSIZE sockets
+class SelectPoller : public Poller {
+  struct SelectSocket {
+    void *Data;
+    bool Writable;
+  };
+
+  std::map<SOCKET, SelectSocket> sockets_;
+
+public:
+  virtual bool IsValid() override {
+    return true;
+  }
+
+  virtual PollerType GetType() override {
+    return kPollerType_Select;
+  }
+
+  virtual bool Add(SOCKET socket, void *data) override {
+#if !defined(OS_WIN)
+    // Sockets outside of the set range cannot be watched by select
+    if (socket >= FD_SETSIZE) {
+      return false;
+    }
+#endif
+    if (sockets_.size() >= FD_SETSIZE) {
+      return false;
+    }
+    SelectSocket &select_socket = sockets_[socket];
+    select_socket.Data = data;
+    select_socket.Writable = false;
+    return true;
+  }
+
+  virtual bool Remove(SOCKET socket) override {
+    return sockets_.erase(socket) > 0;
+  }
+
+  virtual bool SetWritable(SOCKET socket, void *data, bool writable) override {
+    auto select_socket = sockets_.find(socket);
+    if (select_socket == sockets_.end()) {
+      return false;
+    }
+    select_socket->second.Writable = writable;
+    return true;
+  }
+
+protected:
+  virtual int32_t wait(PollerEvent *events, size_t max_events,
+    int32_t timeout) override {
+    fd_set socket_set;
+    fd_set write_socket_set;
+    SOCKET max_socket = 0;
+
+    // Add all registered sockets to the set
+    FD_ZERO(&socket_set);
+    FD_ZERO(&write_socket_set);
+    for (auto &pair : sockets_) {
+      FD_SET(pair.first, &socket_set);
+      if (pair.second.Writable) {
+        FD_SET(pair.first, &write_socket_set);
+      }
+      if (pair.first > max_socket) {
+        max_socket = pair.first;
+      }
+    }
+
+    timeval timeout_value;
+    timeout_value.tv_sec = timeout / 1000;
+    timeout_value.tv_usec = (timeout % 1000) * 1000;
+
+    // Check if an activity was completed on any of those sockets
+    int32_t socket_activity = select(max_socket + 1, &socket_set,
+      &write_socket_set, NULL, timeout < 0 ? NULL : &timeout_value);
+    if (socket_activity == SOCKET_ERROR) {
+      return SOCKET_ERROR;
+    }
+
+    size_t event_count = 0;
+    for (auto &pair : sockets_) {
+      if (event_count == max_events) {
+        break;
+      }
+      bool readable = FD_ISSET(pair.first, &socket_set) != 0;
+      bool writable = FD_ISSET(pair.first, &write_socket_set) != 0;
+      if (readable || writable) {
+        events[event_count].Data = pair.second.Data;
+        events[event_count].Readable = readable;
+        events[event_count].Writable = writable;
+        events[event_count].Closed = false;
+        event_count++;
+      }
+    }
+
+    return static_cast<int32_t>(event_count);
+  }
+};
+
+#if defined(OS_LINUX)
+class EpollPoller : public Poller {
+  int epoll_fd_;
+  std::vector<epoll_event> ready_events_;
+
+public:
+  EpollPoller() : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)) {
+  }
+
+  ~EpollPoller() {
+    if (epoll_fd_ != SOCKET_ERROR) {
+      close(epoll_fd_);
+    }
+  }
+
+  virtual bool IsValid() override {
+    return epoll_fd_ != SOCKET_ERROR;
+  }
+
+  virtual PollerType GetType() override {
+    return kPollerType_Epoll;
+  }
+
+  virtual bool Add(SOCKET socket, void *data) override {
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = data;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, socket, &event)
+      != SOCKET_ERROR;
+  }
+
+  virtual bool Remove(SOCKET socket) override {
+    // NOTE: A non-null event is required by kernels before 2.6.9
+    epoll_event event;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, socket, &event)
+      != SOCKET_ERROR;
+  }
+
+  virtual bool SetWritable(SOCKET socket, void *data, bool writable) override {
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    if (writable) {
+      event.events |= EPOLLOUT;
+    }
+    event.data.ptr = data;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, socket, &event)
+      != SOCKET_ERROR;
+  }
+
+protected:
+  virtual int32_t wait(PollerEvent *events, size_t max_events,
+    int32_t timeout) override {
+    if (ready_events_.size() < max_events) {
+      ready_events_.resize(max_events);
+    }
+
+    int32_t event_count = epoll_wait(epoll_fd_, ready_events_.data(),
+      static_cast<int>(max_events), timeout);
+    if (event_count == SOCKET_ERROR) {
+      return SOCKET_ERROR;
+    }
+
+    for (int32_t i = 0; i < event_count; i++) {
+      uint32_t flags = ready_events_[i].events;
+      events[i].Data = ready_events_[i].data.ptr;
+      events[i].Readable = (flags & EPOLLIN) != 0;
+      events[i].Writable = (flags & EPOLLOUT) != 0;
+      events[i].Closed = (flags & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0;
+    }
+
+    return event_count;
+  }
+};
+#endif
+
+#if defined(OS_OSX)
+class KqueuePoller : public Poller {
+  int kqueue_fd_;
+  std::vector<struct kevent> ready_events_;
+
+public:
+  KqueuePoller() : kqueue_fd_(kqueue()) {
+  }
+
+  ~KqueuePoller() {
+    if (kqueue_fd_ != SOCKET_ERROR) {
+      close(kqueue_fd_);
+    }
+  }
+
+  virtual bool IsValid() override {
+    return kqueue_fd_ != SOCKET_ERROR;
+  }
+
+  virtual PollerType GetType() override {
+    return kPollerType_Kqueue;
+  }
+
+  virtual bool Add(SOCKET socket, void *data) override {
+    struct kevent event;
+    EV_SET(&event, socket, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, data);
+    return kevent(kqueue_fd_, &event, 1, NULL, 0, NULL) != SOCKET_ERROR;
+  }
+
+  virtual bool Remove(SOCKET socket) override {
+    // The write filter may not be registered, only the read one has to exist
+    struct kevent event;
+    EV_SET(&event, socket, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    kevent(kqueue_fd_, &event, 1, NULL, 0, NULL);
+    EV_SET(&event, socket, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    return kevent(kqueue_fd_, &event, 1, NULL, 0, NULL) != SOCKET_ERROR;
+  }
+
+  virtual bool SetWritable(SOCKET socket, void *data, bool writable) override {
+    struct kevent event;
+    EV_SET(&event, socket, EVFILT_WRITE, writable ? EV_ADD | EV_CLEAR
+      : EV_DELETE, 0, 0, data);
+    return kevent(kqueue_fd_, &event, 1, NULL, 0, NULL) != SOCKET_ERROR;
+  }
+
+protected:
+  virtual int32_t wait(PollerEvent *events, size_t max_events,
+    int32_t timeout) override {
+    if (ready_events_.size() < max_events) {
+      ready_events_.resize(max_events);
+    }
+
+    timespec timeout_value;
+    timeout_value.tv_sec = timeout / 1000;
+    timeout_value.tv_nsec = (timeout % 1000) * 1000000;
+
+    int32_t event_count = kevent(kqueue_fd_, NULL, 0, ready_events_.data(),
+      static_cast<int>(max_events), timeout < 0 ? NULL : &timeout_value);
+    if (event_count == SOCKET_ERROR) {
+      return SOCKET_ERROR;
+    }
+
+    for (int32_t i = 0; i < event_count; i++) {
+      events[i].Data = ready_events_[i].udata;
+      events[i].Readable = ready_events_[i].filter == EVFILT_READ;
+      events[i].Writable = ready_events_[i].filter == EVFILT_WRITE;
+      events[i].Closed = (ready_events_[i].flags & (EV_EOF | EV_ERROR)) != 0;
+    }
+
+    return event_count;
+  }
+};
+#endif
+
+inline std::unique_ptr<Poller> Poller::Create(PollerType type) {
+  std::unique_ptr<Poller> poller;
+
+  // Use the best poller available on this platform by default
+  if (type == kPollerType_Default || type == kPollerType_IoUring) {
+#if defined(OS_LINUX)
+    type = kPollerType_Epoll;
+#elif defined(OS_OSX)
+    type = kPollerType_Kqueue;
+#else
+    type = kPollerType_Select;
+#endif
+  }
+
+#if defined(OS_LINUX)
+  if (type == kPollerType_Epoll) {
+    poller.reset(new EpollPoller());
+  }
+#elif defined(OS_OSX)
+  if (type == kPollerType_Kqueue) {
+    poller.reset(new KqueuePoller());
+  }
+#endif
+
+  // Fall back to select if the requested poller is unavailable
+  if (!poller || !poller->IsValid()) {
+    poller.reset(new SelectPoller());
+  }
+
+  // Register the waker like any other socket, Wait filters it back out
+  if (poller->waker_.IsValid()) {
+    poller->is_wakeable_ = poller->Add(poller->waker_.GetSocket(),
+      &poller->waker_);
+  }
+
+  return poller;
+}
+}
+
+#endif // jchat_lib_poller_hpp_
@@ -0,0 +1,305 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_shared_ring_hpp_
+#define jchat_lib_shared_ring_hpp_
+
+// Required libraries
+#include "platform.h"
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define JCHAT_SHARED_RING_MAGIC 0x5253434A // "JCSR"
+#define JCHAT_SHARED_RING_VERSION 1
+
+namespace jchat {
+// The start of a ring file, the data follows it. Each frame is a 32 bit size
+// and the frame, padded to 8 bytes. A frame that wouldn't fit before the end
+// of the data is preceded by a skip to its start instead.
+struct SharedRingHeader {
+  uint32_t Magic;
+  uint32_t Version;
+  uint64_t Capacity;
+  // Where the frame that is being written ends, data before it may be
+  // overwritten as long as it isn't up to date
+  uint64_t Reserved;
+  // Where the last complete frame ends
+  uint64_t Committed;
+  uint8_t Padding[32];
+};
+
+// Frames in a file in shared memory, such as one in /dev/shm, that one
+// process appends to and any number of processes on the host tail. The
+// writer never waits for readers, readers that fall more than the capacity
+// behind lose what was overwritten. Only where files can be mapped shared.
+class SharedRing {
+protected:
+  static const uint32_t kSkip = 0xFFFFFFFF;
+
+  uint8_t *data_;
+  size_t size_;
+  SharedRingHeader *header_;
+  uint8_t *frames_;
+  uint64_t capacity_;
+
+  static uint64_t get_record_size(size_t frame_size) {
+    return (sizeof(uint32_t) + frame_size + 7) & ~static_cast<uint64_t>(7);
+  }
+
+  bool map(int file, size_t size, bool is_writable) {
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+    void *data = mmap(nullptr, size, is_writable ? PROT_READ | PROT_WRITE
+      : PROT_READ, MAP_SHARED, file, 0);
+    // The mapping keeps the file open
+    close(file);
+    if (data == MAP_FAILED) {
+      return false;
+    }
+    data_ = static_cast<uint8_t *>(data);
+    size_ = size;
+    header_ = reinterpret_cast<SharedRingHeader *>(data_);
+    frames_ = data_ + sizeof(SharedRingHeader);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+public:
+  SharedRing() : data_(nullptr), size_(0), header_(nullptr),
+    frames_(nullptr), capacity_(0) {
+  }
+
+  virtual ~SharedRing() {
+    Close();
+  }
+
+  SharedRing(const SharedRing &) = delete;
+  SharedRing &operator=(const SharedRing &) = delete;
+
+  void Close() {
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+    if (data_ != nullptr) {
+      munmap(data_, size_);
+    }
+#endif
+    data_ = nullptr;
+    size_ = 0;
+    header_ = nullptr;
+    frames_ = nullptr;
+    capacity_ = 0;
+  }
+
+  bool IsOpen() {
+    return data_ != nullptr;
+  }
+
+  uint64_t GetCapacity() {
+    return capacity_;
+  }
+};
+
+class SharedRingWriter : public SharedRing {
+  uint64_t position_;
+  std::mutex mutex_;
+
+public:
+  SharedRingWriter() : position_(0) {
+  }
+
+  // Replaces the file at the path with an empty ring, readers of the last
+  // one keep their mapping of it. The capacity is rounded up to a power of
+  // two.
+  bool Create(const std::string &path, size_t capacity) {
+    Close();
+
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+    capacity_ = 4096;
+    while (capacity_ < capacity) {
+      capacity_ <<= 1;
+    }
+    unlink(path.c_str());
+    int file = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (file == -1) {
+      return false;
+    }
+    size_t size = sizeof(SharedRingHeader) + static_cast<size_t>(capacity_);
+    if (ftruncate(file, static_cast<off_t>(size)) == -1) {
+      close(file);
+      unlink(path.c_str());
+      return false;
+    }
+    if (!map(file, size, true)) {
+      capacity_ = 0;
+      unlink(path.c_str());
+      return false;
+    }
+
+    // Readers check the magic, it goes in last
+    header_->Version = JCHAT_SHARED_RING_VERSION;
+    header_->Capacity = capacity_;
+    header_->Reserved = 0;
+    header_->Committed = 0;
+    position_ = 0;
+    __atomic_store_n(&header_->Magic, JCHAT_SHARED_RING_MAGIC,
+      __ATOMIC_RELEASE);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // Returns false if the frame is over a quarter of the capacity, which
+  // leaves readers room to catch up. Safe to use from any thread.
+  bool Write(const uint8_t *frame, size_t size) {
+    uint64_t record_size = get_record_size(size);
+    if (data_ == nullptr || record_size > capacity_ / 4) {
+      return false;
+    }
+
+    mutex_.lock();
+    uint64_t offset = position_ & (capacity_ - 1);
+    uint64_t skip_size = offset + record_size > capacity_
+      ? capacity_ - offset : 0;
+
+    // Readers see that the data they copied may have been overwritten before
+    // it is
+    __atomic_store_n(&header_->Reserved, position_ + skip_size + record_size,
+      __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (skip_size > 0) {
+      uint32_t skip = kSkip;
+      memcpy(frames_ + offset, &skip, sizeof(skip));
+      position_ += skip_size;
+      offset = 0;
+    }
+    uint32_t frame_size = static_cast<uint32_t>(size);
+    memcpy(frames_ + offset, &frame_size, sizeof(frame_size));
+    memcpy(frames_ + offset + sizeof(frame_size), frame, size);
+    position_ += record_size;
+    __atomic_store_n(&header_->Committed, position_, __ATOMIC_RELEASE);
+    mutex_.unlock();
+    return true;
+  }
+};
+
+class SharedRingReader : public SharedRing {
+  uint64_t position_;
+  uint64_t lost_bytes_;
+
+  // Moves on to the newest frame after being overtaken by the writer
+  void skip_lost(uint64_t committed) {
+    lost_bytes_ += committed - position_;
+    position_ = committed;
+  }
+
+public:
+  SharedRingReader() : position_(0), lost_bytes_(0) {
+  }
+
+  // Starts with the frames that are written from now on. Returns false if
+  // the file isn't a ring.
+  bool Open(const std::string &path) {
+    Close();
+
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+    int file = open(path.c_str(), O_RDONLY);
+    if (file == -1) {
+      return false;
+    }
+    struct stat file_stat;
+    if (fstat(file, &file_stat) == -1
+      || static_cast<size_t>(file_stat.st_size) < sizeof(SharedRingHeader)) {
+      close(file);
+      return false;
+    }
+    size_t size = static_cast<size_t>(file_stat.st_size);
+    if (!map(file, size, false)) {
+      return false;
+    }
+    if (__atomic_load_n(&header_->Magic, __ATOMIC_ACQUIRE)
+      != JCHAT_SHARED_RING_MAGIC) {
+      Close();
+      return false;
+    }
+    uint64_t capacity = header_->Capacity;
+    if (header_->Version != JCHAT_SHARED_RING_VERSION || capacity == 0
+      || (capacity & (capacity - 1)) != 0
+      || size < sizeof(SharedRingHeader) + capacity) {
+      Close();
+      return false;
+    }
+    capacity_ = capacity;
+    position_ = __atomic_load_n(&header_->Committed, __ATOMIC_ACQUIRE);
+    lost_bytes_ = 0;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // Copies the next frame, returns false if there is none yet
+  bool Read(std::vector<uint8_t> &out_frame) {
+    if (data_ == nullptr) {
+      return false;
+    }
+
+    while (true) {
+      uint64_t committed = __atomic_load_n(&header_->Committed,
+        __ATOMIC_ACQUIRE);
+      if (position_ == committed) {
+        return false;
+      }
+      if (committed - position_ > capacity_) {
+        skip_lost(committed);
+        return false;
+      }
+
+      // Copy first and check that the writer didn't get to it meanwhile
+      uint64_t offset = position_ & (capacity_ - 1);
+      uint32_t frame_size = 0;
+      memcpy(&frame_size, frames_ + offset, sizeof(frame_size));
+      uint64_t record_size = frame_size == kSkip ? capacity_ - offset
+        : get_record_size(frame_size);
+      bool is_valid = frame_size == kSkip || offset + record_size <= capacity_;
+      if (is_valid && frame_size != kSkip) {
+        out_frame.assign(frames_ + offset + sizeof(frame_size),
+          frames_ + offset + sizeof(frame_size) + frame_size);
+      }
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      uint64_t reserved = __atomic_load_n(&header_->Reserved,
+        __ATOMIC_RELAXED);
+      if (reserved - position_ > capacity_ || !is_valid) {
+        skip_lost(__atomic_load_n(&header_->Committed, __ATOMIC_ACQUIRE));
+        return false;
+      }
+
+      position_ += record_size;
+      if (frame_size != kSkip) {
+        return true;
+      }
+    }
+  }
+
+  // Bytes of frames that were overwritten before they were read
+  uint64_t GetLostBytes() {
+    return lost_bytes_;
+  }
+};
+}
+
+#endif // jchat_lib_shared_ring_hpp_
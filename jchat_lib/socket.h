@@ -0,0 +1,53 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_socket_h_
+#define jchat_lib_socket_h_
+
+// Required libraries
+#include "platform.h"
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#ifndef __SOCKET__
+#define __SOCKET__
+typedef int SOCKET;
+#endif // __SOCKET__
+
+#ifndef SOCKET_ERROR
+#define SOCKET_ERROR -1
+#endif // SOCKET_ERROR
+
+#ifndef __CLOSE_SOCKET__
+#define __CLOSE_SOCKET__
+#define closesocket(socket_fd) close(socket_fd)
+#endif // __CLOSE_SOCKET__
+
+#elif defined(OS_WIN)
+#define WIN32_LEAN_AND_MEAN
+#include <WinSock2.h>
+
+// Platform/Compiler patches
+#if defined(__CYGWIN__) || defined(__MINGW32__)
+#if defined(FIONBIO)
+#undef FIONBIO
+#define FIONBIO 0x8004667E
+#endif
+#endif
+#endif
+
+#endif // jchat_lib_socket_h_
@@ -0,0 +1,231 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_stream_buffer_hpp_
+#define jchat_lib_stream_buffer_hpp_
+
+// Required libraries
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+
+namespace jchat {
+// Ring buffer holding the bytes received on a connection that have not been
+// consumed yet. Data is received directly into the free space of the ring and
+// consumers only take whole messages, anything incomplete stays where it is
+// until the rest of it arrives.
+// Example:
+//    StreamBuffer stream;
+//    size_t free_size = 0;
+//    uint8_t *free_space = stream.GetWritePointer(free_size);
+//    stream.Commit(recv(socket, free_space, free_size, 0));
+//
+//    uint32_t size;
+//    while (stream.Peek(&size, sizeof(size))
+//      && stream.GetSize() >= sizeof(size) + size) {
+//      stream.Skip(sizeof(size));
+//      const uint8_t *message = stream.GetReadPointer(size);
+//      ...
+//      stream.Skip(size);
+//    }
+class StreamBuffer {
+  // Storage for the ring, the capacity is always a power of two so positions
+  // can be wrapped with a mask
+  std::vector<uint8_t> buffer_;
+
+  // Absolute read and write positions, their difference is the amount of
+  // data stored. They are only masked when indexing into the buffer.
+  size_t read_position_;
+  size_t write_position_;
+
+  // Upper bound for the capacity, the ring refuses to grow past it
+  size_t max_capacity_;
+
+  size_t mask() {
+    return buffer_.size() - 1;
+  }
+
+  // Moves the stored data to the start of a buffer of the given capacity,
+  // which also removes any wrap around
+  void relocate(size_t capacity) {
+    std::vector<uint8_t> buffer(capacity);
+    size_t size = GetSize();
+    Peek(buffer.data(), size);
+    buffer_.swap(buffer);
+    read_position_ = 0;
+    write_position_ = size;
+  }
+
+public:
+  StreamBuffer(size_t initial_capacity = 4096,
+    size_t max_capacity = 1024 * 1024) : read_position_(0),
+    write_position_(0), max_capacity_(max_capacity) {
+    size_t capacity = 1;
+    while (capacity < initial_capacity) {
+      capacity <<= 1;
+    }
+    buffer_.resize(capacity);
+  }
+
+  // Takes over existing storage, e.g. from a BufferPool, instead of
+  // allocating it
+  StreamBuffer(std::vector<uint8_t> &&buffer,
+    size_t max_capacity = 1024 * 1024) : read_position_(0),
+    write_position_(0), max_capacity_(max_capacity) {
+    buffer_.swap(buffer);
+    size_t capacity = 1;
+    while (capacity < buffer_.size()) {
+      capacity <<= 1;
+    }
+    buffer_.resize(capacity);
+  }
+
+  // Returns the number of bytes that have been received but not consumed
+  size_t GetSize() {
+    return write_position_ - read_position_;
+  }
+
+  size_t GetCapacity() {
+    return buffer_.size();
+  }
+
+  size_t GetMaxCapacity() {
+    return max_capacity_;
+  }
+
+  // Makes sure that at least the given amount of bytes can be written,
+  // returns false if that would exceed the maximum capacity
+  bool Reserve(size_t size) {
+    if (buffer_.size() - GetSize() >= size) {
+      return true;
+    }
+
+    size_t capacity = buffer_.size();
+    while (capacity - GetSize() < size) {
+      capacity <<= 1;
+    }
+    if (capacity > max_capacity_) {
+      return false;
+    }
+
+    relocate(capacity);
+    return true;
+  }
+
+  // Returns the contiguous free space following the stored data, data written
+  // there becomes readable after calling Commit. Returns NULL if the ring is
+  // full and cannot grow.
+  uint8_t *GetWritePointer(size_t &out_size) {
+    // Grow once the ring is full so a reader waiting for a large message
+    // always has space to receive the rest of it
+    if (GetSize() == buffer_.size() && !Reserve(buffer_.size())) {
+      out_size = 0;
+      return NULL;
+    }
+
+    size_t offset = write_position_ & mask();
+    size_t free_size = buffer_.size() - GetSize();
+    out_size = buffer_.size() - offset < free_size ? buffer_.size() - offset
+      : free_size;
+    return buffer_.data() + offset;
+  }
+
+  bool Commit(size_t size) {
+    if (size > buffer_.size() - GetSize()) {
+      return false;
+    }
+    write_position_ += size;
+    return true;
+  }
+
+  bool Write(const void *data, size_t size) {
+    if (!Reserve(size)) {
+      return false;
+    }
+
+    const uint8_t *p_data = static_cast<const uint8_t *>(data);
+    while (size > 0) {
+      size_t free_size = 0;
+      uint8_t *free_space = GetWritePointer(free_size);
+      if (free_size > size) {
+        free_size = size;
+      }
+      memcpy(free_space, p_data, free_size);
+      Commit(free_size);
+      p_data += free_size;
+      size -= free_size;
+    }
+    return true;
+  }
+
+  // Copies data without consuming it, the offset is relative to the oldest
+  // unconsumed byte
+  bool Peek(void *data, size_t size, size_t offset = 0) {
+    if (offset + size > GetSize()) {
+      return false;
+    }
+
+    size_t start = (read_position_ + offset) & mask();
+    size_t first_size = buffer_.size() - start < size ? buffer_.size() - start
+      : size;
+    memcpy(data, buffer_.data() + start, first_size);
+    memcpy(static_cast<uint8_t *>(data) + first_size, buffer_.data(),
+      size - first_size);
+    return true;
+  }
+
+  bool Read(void *data, size_t size) {
+    if (!Peek(data, size)) {
+      return false;
+    }
+    return Skip(size);
+  }
+
+  // Returns the next bytes as one contiguous block without consuming them.
+  // Only data that wraps around the end of the ring has to be moved.
+  const uint8_t *GetReadPointer(size_t size) {
+    if (size > GetSize()) {
+      return NULL;
+    }
+
+    if ((read_position_ & mask()) + size > buffer_.size()) {
+      relocate(buffer_.size());
+    }
+    return buffer_.data() + (read_position_ & mask());
+  }
+
+  bool Skip(size_t size) {
+    if (size > GetSize()) {
+      return false;
+    }
+    read_position_ += size;
+
+    // Start from the beginning again once everything has been consumed, this
+    // keeps most messages from wrapping
+    if (read_position_ == write_position_) {
+      read_position_ = write_position_ = 0;
+    }
+    return true;
+  }
+
+  void Clear() {
+    read_position_ = write_position_ = 0;
+  }
+
+  // Hands the storage back to the caller, the stream must not be used
+  // afterwards
+  std::vector<uint8_t> Release() {
+    std::vector<uint8_t> buffer;
+    buffer.swap(buffer_);
+    read_position_ = write_position_ = 0;
+    return buffer;
+  }
+};
+}
+
+#endif // jchat_lib_stream_buffer_hpp_
@@ -131,6 +131,33 @@ public:
     return output;
   }
 
+  // '*' matches any number of characters and '?' any one of them
+  static bool Matches(const std::string &pattern, const std::string &text) {
+    size_t pattern_index = 0, text_index = 0;
+    size_t star_index = std::string::npos, star_text_index = 0;
+    while (text_index < text.size()) {
+      if (pattern_index < pattern.size() && (pattern[pattern_index] == '?'
+        || pattern[pattern_index] == text[text_index])) {
+        pattern_index++;
+        text_index++;
+      } else if (pattern_index < pattern.size()
+        && pattern[pattern_index] == '*') {
+        star_index = pattern_index++;
+        star_text_index = text_index;
+      } else if (star_index != std::string::npos) {
+        // Let the last star take one more character
+        pattern_index = star_index + 1;
+        text_index = ++star_text_index;
+      } else {
+        return false;
+      }
+    }
+    while (pattern_index < pattern.size() && pattern[pattern_index] == '*') {
+      pattern_index++;
+    }
+    return pattern_index == pattern.size();
+  }
+
   static std::wstring ToWideString(std::string string) {
   	const char *c_string = string.c_str();
 
@@ -0,0 +1,77 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_string_view_hpp_
+#define jchat_lib_string_view_hpp_
+
+// Required libraries
+#include <string>
+#include <string.h>
+#include <stdint.h>
+
+namespace jchat {
+// Non-owning reference to a sequence of characters, usually pointing into a
+// received packet. It is only valid for as long as the memory it points to,
+// call ToString to keep the characters around.
+class StringView {
+  const char *data_;
+  size_t size_;
+
+public:
+  StringView() : data_(""), size_(0) {
+  }
+
+  StringView(const char *data, size_t size) : data_(data), size_(size) {
+  }
+
+  StringView(const char *data) : data_(data), size_(strlen(data)) {
+  }
+
+  StringView(const std::string &string) : data_(string.data()),
+    size_(string.size()) {
+  }
+
+  const char *GetData() const {
+    return data_;
+  }
+
+  size_t GetSize() const {
+    return size_;
+  }
+
+  bool IsEmpty() const {
+    return size_ == 0;
+  }
+
+  const char *begin() const {
+    return data_;
+  }
+
+  const char *end() const {
+    return data_ + size_;
+  }
+
+  char operator[](size_t index) const {
+    return data_[index];
+  }
+
+  std::string ToString() const {
+    return std::string(data_, size_);
+  }
+
+  bool operator==(const StringView &other) const {
+    return size_ == other.size_ && memcmp(data_, other.data_, size_) == 0;
+  }
+
+  bool operator!=(const StringView &other) const {
+    return !(*this == other);
+  }
+};
+}
+
+#endif // jchat_lib_string_view_hpp_
@@ -11,111 +11,254 @@
 
 // Required libraries
 #include "platform.h"
+#include "socket.h"
 #include "event.hpp"
 #include "buffer.hpp"
+#include "buffer_pool.hpp"
+#include "stream_buffer.hpp"
 #include "ip_endpoint.hpp"
+#include "packet.hpp"
+#include "poller.hpp"
+#include "io_uring.hpp"
+#include "timer_wheel.hpp"
+#include "thread.hpp"
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <thread>
-#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <sys/socket.h>
-#include <netinet/tcp.h>
-#include <netdb.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <errno.h>
-
-#ifndef __SOCKET__
-#define __SOCKET__
-typedef int SOCKET;
-#endif // __SOCKET__
-
-#ifndef SOCKET_ERROR
-#define SOCKET_ERROR -1
-#endif // SOCKET_ERROR
-
-#ifndef __CLOSE_SOCKET__
-#define __CLOSE_SOCKET__
-#define closesocket(socket_fd) close(socket_fd)
-#endif // __CLOSE_SOCKET__
+#include <unordered_set>
+#include <vector>
 
-#elif defined(OS_WIN)
-#define WIN32_LEAN_AND_MEAN
-#include <WinSock2.h>
+#ifndef JCHAT_TCP_BUFFER_SIZE
+#define JCHAT_TCP_BUFFER_SIZE 8192
+#endif // JCHAT_TCP_BUFFER_SIZE
 
-// Platform/Compiler patches
-#if defined(__CYGWIN__) || defined(__MINGW32__)
-#if defined(FIONBIO)
-#undef FIONBIO
-#define FIONBIO 0x8004667E
-#endif
-#endif
-#endif
+#ifndef JCHAT_TCP_MAX_BUFFER_SIZE
+#define JCHAT_TCP_MAX_BUFFER_SIZE (1024 * 1024)
+#endif // JCHAT_TCP_MAX_BUFFER_SIZE
 
-#ifndef JCHAT_TCP_CLIENT_BUFFER_SIZE
-#define JCHAT_TCP_BUFFER_SIZE 8192
-#endif // JCHAT_TCP_CLIENT_BUFFER_SIZE
+// Most events a ClientReactor worker handles per wait
+#ifndef JCHAT_CLIENT_REACTOR_MAX_EVENTS
+#define JCHAT_CLIENT_REACTOR_MAX_EVENTS 64
+#endif // JCHAT_CLIENT_REACTOR_MAX_EVENTS
 
 namespace jchat {
 class TcpServer;
-class TcpClient {
+class ClientReactor;
+class TcpClient : public std::enable_shared_from_this<TcpClient> {
   friend class TcpServer;
+  friend class ClientReactor;
 
   const char *hostname_;
   uint16_t port_;
-  bool is_connected_;
+  std::atomic<bool> is_connected_;
   bool is_internal_;
   SOCKET client_socket_;
   IPEndpoint client_endpoint_;
   IPEndpoint remote_endpoint_;
+  // Connects through a Unix domain socket instead while set
+  std::string local_path_;
+  std::unique_ptr<Poller> poller_;
   std::thread worker_thread_;
-  std::vector<uint8_t> read_buffer_;
+  StreamBuffer read_stream_;
+  std::shared_ptr<BufferPool> read_buffer_pool_;
+  // The reactor worker of a client accepted by a TcpServer or one connected
+  // through a ClientReactor, which is kept across connections
+  void *reactor_;
+  ClientReactor *client_reactor_;
+
+  // Output waiting for the socket to become writable, only used by clients
+  // accepted by a TcpServer. The first packet may have been written partly.
+  std::deque<std::shared_ptr<Packet>> send_queue_;
+  size_t send_queue_offset_;
+  size_t send_queue_size_;
+  bool is_write_pending_;
+  bool is_shedding_;
+  std::mutex send_mutex_;
+
+  // Idle detection of accepted clients, only used by their reactor. The
+  // timer isn't restarted by every read, it checks the receive time when it
+  // fires instead.
+  TimerWheel::Timer idle_timer_;
+  uint64_t receive_time_;
+  bool is_idle_;
+  // The handler left input in the stream for a later turn, see
+  // TcpServer::DeferRead. Only used by the reactor.
+  bool is_read_deferred_;
+#if defined(JCHAT_HAS_IO_URING)
+  RingConnection ring_;
+#endif
 
 #if defined(OS_WIN)
   WSADATA wsa_data_;
 #endif
 
-  void worker_loop() {
-    fd_set socket_set;
-    while (is_connected_) {
-      // Clear the socket set
-      FD_ZERO(&socket_set);
+  bool connect_local() {
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+    sockaddr_un local_endpoint;
+    if (local_path_.size() >= sizeof(local_endpoint.sun_path)) {
+      return false;
+    }
+    memset(&local_endpoint, 0, sizeof(local_endpoint));
+    local_endpoint.sun_family = AF_UNIX;
+    memcpy(local_endpoint.sun_path, local_path_.c_str(), local_path_.size());
+
+    if ((client_socket_ = socket(AF_UNIX, SOCK_STREAM, 0)) == SOCKET_ERROR) {
+      return false;
+    }
+    if (connect(client_socket_, (const sockaddr *)&local_endpoint,
+      sizeof(local_endpoint)) == SOCKET_ERROR) {
+      closesocket(client_socket_);
+      return false;
+    }
+    // There is no address, the server gives local clients the loopback one
+    client_endpoint_ = IPEndpoint("127.0.0.1", 0);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  bool connect_remote() {
+    if ((client_socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP))
+      == SOCKET_ERROR) {
+      return false;
+    }
 
-      // Add the client to the set
-      FD_SET(client_socket_, &socket_set);
+    sockaddr_in remote_endpoint = remote_endpoint_.GetSocketEndpoint();
+    if (connect(client_socket_, (const sockaddr *)&remote_endpoint,
+      sizeof(remote_endpoint)) == SOCKET_ERROR) {
+      closesocket(client_socket_);
+      return false;
+    }
 
-      // Check if an activity was completed on the client socket
-      int32_t socket_activity = select(client_socket_ + 1, &socket_set, NULL,
-        NULL, NULL);
+    // Messages are small and sent as they are made, Nagle's algorithm would
+    // hold them back until the last one was acknowledged
+    int32_t enable_no_delay = 1;
+    setsockopt(client_socket_, IPPROTO_TCP, TCP_NODELAY,
+      (const char *)&enable_no_delay, sizeof(enable_no_delay));
 
-      // Ensure select didn't fail
-      if (socket_activity == SOCKET_ERROR && errno == EINTR) {
-        continue;
+    sockaddr_in client_endpoint;
+    socklen_t client_endpoint_size = sizeof(client_endpoint);
+    if (getsockname(client_socket_, (sockaddr *)&client_endpoint,
+      &client_endpoint_size) == SOCKET_ERROR) {
+      closesocket(client_socket_);
+      return false;
+    }
+    client_endpoint_.SetSocketEndpoint(client_endpoint);
+    return true;
+  }
+
+  // Used by TcpServer to disconnect an accepted client, the socket itself is
+  // closed when the client is destroyed so that it cannot be reused while
+  // other threads still hold a reference to this client
+  void shutdown() {
+    if (is_connected_.exchange(false)) {
+#if defined(OS_WIN)
+      ::shutdown(client_socket_, SD_BOTH);
+#else
+      ::shutdown(client_socket_, SHUT_RDWR);
+#endif
+    }
+  }
+
+  // Reads until the socket would block, the poller is edge-triggered
+  bool read_socket() {
+    while (true) {
+      // Receive straight into the stream, fails once a peer has sent more
+      // unconsumed data than the stream is allowed to hold
+      size_t free_size = 0;
+      uint8_t *free_space = read_stream_.GetWritePointer(free_size);
+      if (free_space == NULL) {
+        return false;
       }
 
-      // Check if there was some operation completed on the client socket
-      if (FD_ISSET(client_socket_, &socket_set)) {
-        int32_t read_bytes = recv(client_socket_, (char *)read_buffer_.data(),
-          read_buffer_.size(), 0);
-        bool disconnect_client = false;
-        if (read_bytes > 0 && read_bytes < JCHAT_TCP_BUFFER_SIZE) {
-          Buffer buffer(read_buffer_.data(), read_bytes);
-          if (!OnDataReceived(buffer)) {
-            disconnect_client = true;
-          }
-        } else {
-          disconnect_client = true;
+      int32_t read_bytes = recv(client_socket_, (char *)free_space, free_size,
+        0);
+      if (read_bytes == SOCKET_ERROR) {
+#if defined(OS_WIN)
+        return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+        if (errno == EINTR) {
+          continue;
         }
-        if (disconnect_client) {
-          is_connected_ = false;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+      }
+      if (read_bytes <= 0) {
+        return false;
+      }
+      read_stream_.Commit(read_bytes);
+      if (!OnDataReceived(read_stream_)) {
+        return false;
+      }
+    }
+  }
+
+  // Waits for a socket that would block to become writable again, fails on
+  // any other error. Wakes up now and then so a disconnect is noticed.
+  bool wait_writable() {
+#if defined(OS_WIN)
+    if (WSAGetLastError() != WSAEWOULDBLOCK) {
+      return false;
+    }
+    fd_set write_set;
+    FD_ZERO(&write_set);
+    FD_SET(client_socket_, &write_set);
+    timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 100 * 1000;
+    int32_t result = select(0, NULL, &write_set, NULL, &timeout);
+#else
+    if (errno == EINTR) {
+      return true;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      return false;
+    }
+    // The socket may be numbered beyond what select can watch
+    pollfd poll_socket;
+    poll_socket.fd = client_socket_;
+    poll_socket.events = POLLOUT;
+    poll_socket.revents = 0;
+    int32_t result = poll(&poll_socket, 1, 100);
+    if (result == SOCKET_ERROR && errno == EINTR) {
+      return true;
+    }
+#endif
+    return result != SOCKET_ERROR && is_connected_;
+  }
+
+  // Defined after ClientReactor, hand the socket to the reactor and take it
+  // back. Detaching also waits for the callbacks of a remote close. Both
+  // fail on the thread of another worker, unless detaching must wait.
+  bool attach();
+  bool detach(bool must_wait = false);
+
+  void worker_loop() {
+    Thread::SetName("jchat-client");
+    PollerEvent events[2];
+    while (is_connected_) {
+      // Wait for an activity on the client socket or a wakeup from Disconnect
+      int32_t event_count = poller_->Wait(events, 2, -1);
+
+      // Ensure the wait didn't fail
+      if (event_count == SOCKET_ERROR) {
+        continue;
+      }
+
+      for (int32_t i = 0; i < event_count; i++) {
+        // Disconnect may race with a remote close, only one of them wins
+        if (events[i].Data == this && is_connected_ && !read_socket()
+          && is_connected_.exchange(false)) {
+          poller_->Remove(client_socket_);
           closesocket(client_socket_);
           OnDisconnected();
         }
       }
-
-      // Sleep
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
   }
 
@@ -123,8 +266,11 @@ public:
   TcpClient(const char *hostname, uint16_t port)
     : hostname_(hostname), port_(port), client_socket_(0),
     remote_endpoint_(hostname, port), is_connected_(false),
-    is_internal_(false) {
-    read_buffer_.resize(JCHAT_TCP_BUFFER_SIZE);
+    is_internal_(false),
+    read_stream_(JCHAT_TCP_BUFFER_SIZE, JCHAT_TCP_MAX_BUFFER_SIZE),
+    reactor_(nullptr), client_reactor_(nullptr), send_queue_offset_(0),
+    send_queue_size_(0), is_write_pending_(false), is_shedding_(false),
+    receive_time_(0), is_idle_(false), is_read_deferred_(false) {
 
 #if defined(OS_WIN)
     // Initialize Winsock
@@ -155,19 +301,36 @@ public:
      freeaddrinfo(result);
   }
 
-  // NOTE: For internal usage only!
+  // NOTE: For internal usage only! The receive buffer is taken from the pool
+  // if one is given and returned to it when the client is destroyed.
   TcpClient(SOCKET client_socket, sockaddr_in client_endpoint,
-    sockaddr_in server_endpoint) : client_socket_(client_socket),
-    client_endpoint_(client_endpoint), remote_endpoint_(server_endpoint),
-    is_connected_(true), is_internal_(true) {
-    read_buffer_.resize(JCHAT_TCP_BUFFER_SIZE);
+    sockaddr_in server_endpoint,
+    std::shared_ptr<BufferPool> read_buffer_pool = nullptr)
+    : client_socket_(client_socket), client_endpoint_(client_endpoint),
+    remote_endpoint_(server_endpoint), is_connected_(true),
+    is_internal_(true),
+    read_stream_(read_buffer_pool ? read_buffer_pool->Acquire()
+      : std::vector<uint8_t>(JCHAT_TCP_BUFFER_SIZE),
+      JCHAT_TCP_MAX_BUFFER_SIZE),
+    read_buffer_pool_(read_buffer_pool), reactor_(nullptr),
+    client_reactor_(nullptr), send_queue_offset_(0), send_queue_size_(0),
+    is_write_pending_(false), is_shedding_(false), receive_time_(0),
+    is_idle_(false), is_read_deferred_(false) {
 
 #if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+    // Sockets accepted with accept4 are already non-blocking
   	uint32_t flags = fcntl(client_socket, F_GETFL, 0);
-  	if (flags != SOCKET_ERROR) {
+  	if (flags != SOCKET_ERROR && (flags & O_NONBLOCK) == 0) {
   	  flags |= O_NONBLOCK;
   	  fcntl(client_socket, F_SETFL, flags);
   	}
+#if defined(SO_NOSIGPIPE)
+    // Writing to a closed connection must not raise SIGPIPE, platforms
+    // without MSG_NOSIGNAL can only disable it per socket
+    int32_t enable = 1;
+    setsockopt(client_socket, SOL_SOCKET, SO_NOSIGPIPE, &enable,
+      sizeof(enable));
+#endif
 #elif defined(OS_WIN)
 #if defined(__CYGWIN__) || defined(__MINGW32__)
     unsigned int blocking = 1;
@@ -179,12 +342,32 @@ public:
   }
 
   ~TcpClient() {
-    if (is_connected_) {
-      is_connected_ = false;
-      if (!is_internal_) {
+    if (is_internal_) {
+      closesocket(client_socket_);
+      if (read_buffer_pool_) {
+        read_buffer_pool_->Release(read_stream_.Release());
+      }
+    } else if (client_reactor_ != nullptr) {
+      // Like the worker thread, the reactor is left without raising
+      // OnDisconnected
+      bool was_connected = is_connected_.exchange(false);
+      detach(true);
+      if (was_connected) {
+        closesocket(client_socket_);
+      }
+#if defined(OS_WIN)
+      WSACleanup();
+#endif
+    } else {
+      if (is_connected_) {
+        is_connected_ = false;
+        poller_->Wakeup();
+        worker_thread_.join();
+        closesocket(client_socket_);
+      } else if (worker_thread_.joinable()) {
+        // The connection was closed by the remote end
         worker_thread_.join();
       }
-      closesocket(client_socket_);
 #if defined(OS_WIN)
       // Cleanup Winsock
       WSACleanup();
@@ -197,26 +380,14 @@ public:
       return false;
     }
 
-    if ((client_socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP))
-      == SOCKET_ERROR) {
-      return false;
+    // Reap the worker of a connection that was closed by the remote end
+    if (worker_thread_.joinable()) {
+      worker_thread_.join();
     }
 
-    sockaddr_in remote_endpoint = remote_endpoint_.GetSocketEndpoint();
-    if (connect(client_socket_, (const sockaddr *)&remote_endpoint,
-      sizeof(remote_endpoint)) == SOCKET_ERROR) {
-      closesocket(client_socket_);
-      return false;
-    }
-
-    sockaddr_in client_endpoint;
-    socklen_t client_endpoint_size = sizeof(client_endpoint);
-    if (getsockname(client_socket_, (sockaddr *)&client_endpoint,
-      &client_endpoint_size) == SOCKET_ERROR) {
-      closesocket(client_socket_);
+    if (!(local_path_.empty() ? connect_remote() : connect_local())) {
       return false;
     }
-    client_endpoint_.SetSocketEndpoint(client_endpoint);
 
 #if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
   	uint32_t flags = fcntl(client_socket_, F_GETFL, 0);
@@ -239,6 +410,26 @@ public:
       return false;
     }
 
+    read_stream_.Clear();
+    if (client_reactor_ != nullptr) {
+      // The reactor may see data before OnConnected was raised, just like
+      // a worker thread would
+      is_connected_ = true;
+      if (!attach()) {
+        is_connected_ = false;
+        closesocket(client_socket_);
+        return false;
+      }
+      OnConnected();
+      return true;
+    }
+
+    poller_ = Poller::Create();
+    if (!poller_->Add(client_socket_, this)) {
+      closesocket(client_socket_);
+      return false;
+    }
+
 	is_connected_ = true;
     worker_thread_ = std::thread(&TcpClient::worker_loop, this);
 
@@ -248,11 +439,25 @@ public:
   }
 
   bool Disconnect() {
-    if (!is_connected_ || is_internal_) {
+    if (is_internal_) {
       return false;
     }
 
-    is_connected_ = false;
+    // The worker may close the connection until it was detached from it
+    if (client_reactor_ != nullptr) {
+      if (!detach() || !is_connected_.exchange(false)) {
+        return false;
+      }
+      closesocket(client_socket_);
+      OnDisconnected();
+      return true;
+    }
+
+    if (!is_connected_.exchange(false)) {
+      return false;
+    }
+
+    poller_->Wakeup();
     worker_thread_.join();
     closesocket(client_socket_);
 
@@ -261,13 +466,64 @@ public:
     return true;
   }
 
+  // The socket is non-blocking, so this waits for it to take the rest of a
+  // buffer it only took part of. Sends from several threads don't interleave.
   bool Send(Buffer &buffer) {
     if (is_internal_ || !is_connected_) {
       return false;
     }
 
-    return send(client_socket_, (const char *)buffer.GetBuffer(),
-      buffer.GetSize(), 0) != SOCKET_ERROR;
+    const char *data = (const char *)buffer.GetBuffer();
+    size_t size = buffer.GetSize();
+    send_mutex_.lock();
+    while (size > 0) {
+#if defined(MSG_NOSIGNAL)
+      int32_t sent_bytes = send(client_socket_, data, size, MSG_NOSIGNAL);
+#else
+      int32_t sent_bytes = send(client_socket_, data, size, 0);
+#endif
+      if (sent_bytes == SOCKET_ERROR) {
+        if (!wait_writable()) {
+          send_mutex_.unlock();
+          return false;
+        }
+        continue;
+      }
+      data += sent_bytes;
+      size -= sent_bytes;
+    }
+    send_mutex_.unlock();
+    return true;
+  }
+
+  // Runs the connection on a worker of the reactor instead of a thread of
+  // its own, only while disconnected. The reactor has to outlive the client,
+  // which must not be destroyed by a callback on another of its workers.
+  bool SetReactor(ClientReactor *reactor) {
+    if (is_internal_ || is_connected_) {
+      return false;
+    }
+    client_reactor_ = reactor;
+    return true;
+  }
+
+  // Connects through the Unix domain socket at the path instead of to the
+  // host and port, only while disconnected. Empty goes back to TCP.
+  bool SetLocalPath(const std::string &local_path) {
+    if (is_internal_ || is_connected_) {
+      return false;
+    }
+    local_path_ = local_path;
+    return true;
+  }
+
+  // Bytes that were sent but are still waiting for the socket, only used by
+  // TcpServer clients
+  size_t GetSendQueueSize() {
+    send_mutex_.lock();
+    size_t send_queue_size = send_queue_size_;
+    send_mutex_.unlock();
+    return send_queue_size;
   }
 
   IPEndpoint GetLocalEndpoint() {
@@ -289,8 +545,253 @@ public:
   // NOTE: These are not intended to be used in combination with TcpServer
   Event<> OnConnected;
   Event<> OnDisconnected;
-  Event<Buffer &> OnDataReceived;
+  // Receives every unconsumed byte of the connection, handlers consume the
+  // complete messages and leave partial ones for the next call
+  Event<StreamBuffer &> OnDataReceived;
+};
+
+// Runs the connections of many TcpClients on a few threads instead of a
+// thread each. Every worker owns a poller, clients are spread over the
+// workers as they connect and stay on theirs until they disconnect. The
+// workers are made by the first start and kept until the reactor is
+// destroyed, so clients can always find the one they were on. Callbacks
+// on one worker can't connect or disconnect clients of another.
+class ClientReactor {
+  friend class TcpClient;
+
+  struct Worker {
+    std::unique_ptr<Poller> EventPoller;
+    std::thread WorkerThread;
+    // Clients whose events the worker handles. The worker holds the mutex
+    // while it waits and dispatches, other threads announce themselves in
+    // PendingLocks and wake it up to get the mutex. The worker sleeps on
+    // LocksReleased until the last of them is done.
+    std::unordered_set<TcpClient *> Clients;
+    std::mutex ClientsMutex;
+    std::atomic<uint32_t> PendingLocks;
+    std::condition_variable LocksReleased;
+
+    Worker() : PendingLocks(0) {}
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<size_t> next_worker_;
+  std::atomic<bool> is_running_;
+  std::mutex mutex_;
+
+  static bool is_worker_thread(Worker *worker) {
+    return std::this_thread::get_id() == worker->WorkerThread.get_id();
+  }
+
+  bool is_other_worker_thread(Worker *worker) {
+    for (auto &other_worker : workers_) {
+      if (other_worker.get() != worker
+        && is_worker_thread(other_worker.get())) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Callbacks of another worker hold the mutex of theirs, two of them
+  // waiting for each other would deadlock so they are turned away
+  bool lock_worker(Worker *worker) {
+    if (is_other_worker_thread(worker)) {
+      return false;
+    }
+    wait_worker(worker);
+    return true;
+  }
+
+  // Callbacks of the worker already run with the mutex held
+  static void wait_worker(Worker *worker) {
+    if (is_worker_thread(worker)) {
+      return;
+    }
+    worker->PendingLocks++;
+    worker->EventPoller->Wakeup();
+    worker->ClientsMutex.lock();
+    worker->PendingLocks--;
+  }
+
+  static void unlock_worker(Worker *worker) {
+    if (!is_worker_thread(worker)) {
+      worker->ClientsMutex.unlock();
+      worker->LocksReleased.notify_one();
+    }
+  }
+
+  // NOTE: The worker has to be locked
+  static void close_client(Worker *worker, TcpClient *tcp_client) {
+    worker->EventPoller->Remove(tcp_client->client_socket_);
+    worker->Clients.erase(tcp_client);
+    closesocket(tcp_client->client_socket_);
+    tcp_client->OnDisconnected();
+  }
+
+  void worker_loop(Worker *worker) {
+    Thread::SetName("jchat-reactor");
+    PollerEvent events[JCHAT_CLIENT_REACTOR_MAX_EVENTS];
+    std::unique_lock<std::mutex> lock(worker->ClientsMutex);
+    while (is_running_) {
+      int32_t event_count = worker->EventPoller->Wait(events,
+        JCHAT_CLIENT_REACTOR_MAX_EVENTS, -1);
+
+      for (int32_t i = 0; i < event_count; i++) {
+        // A client detached by an earlier event may already be gone
+        TcpClient *tcp_client = static_cast<TcpClient *>(events[i].Data);
+        if (worker->Clients.count(tcp_client) == 0) {
+          continue;
+        }
+        // Disconnect may race with a remote close, only one of them wins
+        if (tcp_client->is_connected_ && !tcp_client->read_socket()
+          && tcp_client->is_connected_.exchange(false)) {
+          close_client(worker, tcp_client);
+        }
+      }
+
+      // Let the threads that attach or detach clients in, they count
+      // themselves out while they hold the mutex
+      while (worker->PendingLocks > 0) {
+        worker->LocksReleased.wait(lock);
+      }
+    }
+  }
+
+public:
+  ClientReactor() : next_worker_(0), is_running_(false) {}
+
+  ~ClientReactor() {
+    Stop();
+  }
+
+  ClientReactor(const ClientReactor &) = delete;
+  ClientReactor &operator=(const ClientReactor &) = delete;
+
+  // Later starts have to use the thread count of the first one
+  bool Start(size_t thread_count) {
+    mutex_.lock();
+    if (is_running_ || thread_count == 0
+      || (!workers_.empty() && workers_.size() != thread_count)) {
+      mutex_.unlock();
+      return false;
+    }
+
+    for (size_t i = workers_.size(); i < thread_count; i++) {
+      std::unique_ptr<Worker> worker(new Worker());
+      worker->EventPoller = Poller::Create();
+      if (!worker->EventPoller->IsWakeable()) {
+        workers_.clear();
+        mutex_.unlock();
+        return false;
+      }
+      workers_.push_back(std::move(worker));
+    }
+
+    is_running_ = true;
+    for (auto &worker : workers_) {
+      worker->WorkerThread = std::thread(&ClientReactor::worker_loop, this,
+        worker.get());
+    }
+    mutex_.unlock();
+    return true;
+  }
+
+  // Disconnects the clients that are still connected once the workers are
+  // done, must not be called from a callback of a client
+  bool Stop() {
+    mutex_.lock();
+    if (!is_running_.exchange(false)) {
+      mutex_.unlock();
+      return false;
+    }
+
+    for (auto &worker : workers_) {
+      worker->EventPoller->Wakeup();
+    }
+    for (auto &worker : workers_) {
+      worker->WorkerThread.join();
+    }
+
+    for (auto &worker : workers_) {
+      worker->ClientsMutex.lock();
+      std::vector<TcpClient *> clients(worker->Clients.begin(),
+        worker->Clients.end());
+      for (TcpClient *tcp_client : clients) {
+        if (tcp_client->is_connected_.exchange(false)) {
+          close_client(worker.get(), tcp_client);
+        }
+      }
+      worker->ClientsMutex.unlock();
+    }
+    mutex_.unlock();
+    return true;
+  }
+
+  bool IsRunning() {
+    return is_running_;
+  }
+
+  size_t GetThreadCount() {
+    mutex_.lock();
+    size_t thread_count = workers_.size();
+    mutex_.unlock();
+    return thread_count;
+  }
+
+  // Clients that are connected through the reactor, must not be called
+  // from a callback of a client
+  size_t GetClientCount() {
+    size_t client_count = 0;
+    for (auto &worker : workers_) {
+      wait_worker(worker.get());
+      client_count += worker->Clients.size();
+      unlock_worker(worker.get());
+    }
+    return client_count;
+  }
 };
+
+inline bool TcpClient::attach() {
+  if (!client_reactor_->is_running_) {
+    return false;
+  }
+  size_t index = client_reactor_->next_worker_++
+    % client_reactor_->workers_.size();
+  ClientReactor::Worker *worker = client_reactor_->workers_[index].get();
+
+  // A stop that got the worker first closes the clients it has, so the
+  // client is only added while the reactor still runs
+  if (!client_reactor_->lock_worker(worker)) {
+    return false;
+  }
+  bool is_added = client_reactor_->is_running_
+    && worker->EventPoller->Add(client_socket_, this);
+  if (is_added) {
+    reactor_ = worker;
+    worker->Clients.insert(this);
+  }
+  ClientReactor::unlock_worker(worker);
+  return is_added;
+}
+
+inline bool TcpClient::detach(bool must_wait) {
+  if (reactor_ == nullptr) {
+    return true;
+  }
+  ClientReactor::Worker *worker =
+    static_cast<ClientReactor::Worker *>(reactor_);
+  if (must_wait) {
+    ClientReactor::wait_worker(worker);
+  } else if (!client_reactor_->lock_worker(worker)) {
+    return false;
+  }
+  if (worker->Clients.erase(this) > 0) {
+    worker->EventPoller->Remove(client_socket_);
+  }
+  ClientReactor::unlock_worker(worker);
+  return true;
+}
 }
 
 #endif // jchat_lib_tcp_client_hpp_
@@ -11,120 +11,1127 @@
 
 // Required libraries
 #include "tcp_client.hpp"
+#include "poller.hpp"
+#include "packet.hpp"
+#include "object_pool.hpp"
+#include "buffer_pool.hpp"
+#include "connection_limiter.hpp"
+#include "io_uring.hpp"
+#include "thread.hpp"
+#include <unordered_map>
 
+// Default length of the queue of connections waiting to be accepted, see
+// SetListenBacklog. The kernel may cap it (net.core.somaxconn on Linux).
 #ifndef JCHAT_TCP_SERVER_BACKLOG
-#define JCHAT_TCP_SERVER_BACKLOG 50
+#define JCHAT_TCP_SERVER_BACKLOG 1024
 #endif // JCHAT_TCP_SERVER_BACKLOG
 
+// Resolution of the idle timeouts in milliseconds
+#ifndef JCHAT_TCP_SERVER_TIMER_TICK
+#define JCHAT_TCP_SERVER_TIMER_TICK 100
+#endif // JCHAT_TCP_SERVER_TIMER_TICK
+
+// Most connections a reactor accepts before it handles the events of its
+// clients again, the rest are accepted right after
+#ifndef JCHAT_TCP_SERVER_ACCEPT_BATCH
+#define JCHAT_TCP_SERVER_ACCEPT_BATCH 64
+#endif // JCHAT_TCP_SERVER_ACCEPT_BATCH
+
+#ifndef JCHAT_TCP_SERVER_MAX_EVENTS
+#define JCHAT_TCP_SERVER_MAX_EVENTS 256
+#endif // JCHAT_TCP_SERVER_MAX_EVENTS
+
+// Maximum number of queued packets written by a single writev call
+#ifndef JCHAT_TCP_SERVER_MAX_IOVECS
+#define JCHAT_TCP_SERVER_MAX_IOVECS 64
+#endif // JCHAT_TCP_SERVER_MAX_IOVECS
+
+// Submission entries of a reactor that runs on io_uring, and the buffers its
+// multishot receives fill. The counts have to be powers of two.
+#ifndef JCHAT_TCP_SERVER_RING_ENTRIES
+#define JCHAT_TCP_SERVER_RING_ENTRIES 1024
+#endif // JCHAT_TCP_SERVER_RING_ENTRIES
+
+#ifndef JCHAT_TCP_SERVER_RING_BUFFERS
+#define JCHAT_TCP_SERVER_RING_BUFFERS 512
+#endif // JCHAT_TCP_SERVER_RING_BUFFERS
+
+#ifndef JCHAT_TCP_SERVER_RING_BUFFER_SIZE
+#define JCHAT_TCP_SERVER_RING_BUFFER_SIZE JCHAT_TCP_BUFFER_SIZE
+#endif // JCHAT_TCP_SERVER_RING_BUFFER_SIZE
+
+#ifndef JCHAT_TCP_SEND_HIGH_WATERMARK
+#define JCHAT_TCP_SEND_HIGH_WATERMARK (4 * 1024 * 1024)
+#endif // JCHAT_TCP_SEND_HIGH_WATERMARK
+
+#ifndef JCHAT_TCP_SEND_LOW_WATERMARK
+#define JCHAT_TCP_SEND_LOW_WATERMARK (1024 * 1024)
+#endif // JCHAT_TCP_SEND_LOW_WATERMARK
+
 namespace jchat {
+// What happens to a client whose send queue grows past the high watermark
+enum SendQueuePolicy : uint8_t {
+  // Drop the connection
+  kSendQueuePolicy_Disconnect,
+  // Discard new messages until the queue has drained below the low watermark
+  kSendQueuePolicy_Shed,
+};
+
 class TcpServer {
+  // Each reactor owns a poller, a worker thread and the connections it
+  // accepted. Connections never move between reactors.
+  struct Reactor {
+    SOCKET ListenSocket;
+    size_t Index;
+    // The reactor's share of the pools, so what was allocated on its thread
+    // stays close to it
+    std::shared_ptr<ObjectPool<TcpClient>> ClientPool;
+    std::shared_ptr<BufferPool> ReadBufferPool;
+    // Not set for a reactor that runs on io_uring
+    std::unique_ptr<Poller> EventPoller;
+    std::unordered_map<TcpClient *, std::shared_ptr<TcpClient>> Clients;
+    std::mutex ClientsMutex;
+    std::thread WorkerThread;
+    // Clients that queued output from any thread, the reactor flushes them
+    // and watches them for writability if the socket is still full
+    std::vector<std::shared_ptr<TcpClient>> PendingWrites;
+    std::mutex PendingWritesMutex;
+    // The last accept stopped at the batch size, only used by the reactor
+    bool IsAcceptPending;
+    // Clients whose handler deferred the rest of their input, in the order
+    // they get their next turn. Only used by the reactor.
+    std::vector<std::shared_ptr<TcpClient>> PendingReads;
+    // Idle timers of the clients, only used by the reactor
+    TimerWheel Timers;
+#if defined(JCHAT_HAS_IO_URING)
+    // Set instead of the poller, see ring_loop. Other threads wake the
+    // reactor through the waker, which the ring polls.
+    std::unique_ptr<IoUring> Ring;
+    std::unique_ptr<Waker> RingWaker;
+    // Clients with operations in flight on the ring are kept alive here
+    // until they completed, only used by the reactor
+    std::unordered_map<TcpClient *, std::shared_ptr<TcpClient>> RingClients;
+#endif
+
+    Reactor() : Index(0), IsAcceptPending(false),
+      Timers(JCHAT_TCP_SERVER_TIMER_TICK) {
+    }
+  };
+
+#if defined(JCHAT_HAS_IO_URING)
+  // Kept in the low bits of the user data of a ring operation, the rest is
+  // the reactor or client it is for
+  enum RingOperation : uint64_t {
+    kRingOperation_Accept = 1,
+    kRingOperation_Wakeup,
+    kRingOperation_Receive,
+    kRingOperation_Send,
+    kRingOperation_Cancel,
+    kRingOperation_LocalAccept,
+  };
+#endif
+
   const char *hostname_;
   uint16_t port_;
-  bool is_listening_;
+  std::atomic<bool> is_listening_;
   SOCKET listen_socket_;
   IPEndpoint listen_endpoint_;
-  std::vector<TcpClient *> accepted_clients_;
-  std::mutex accepted_clients_mutex_;
-  std::thread worker_thread_;
+  // Set to listen on a Unix domain socket as well, which every reactor
+  // accepts from like from a shared listener
+  std::string local_path_;
+  SOCKET local_socket_;
+  PollerType poller_type_;
+  size_t io_thread_count_;
+  // CPUs the I/O threads are kept on in turn, any CPU if empty
+  std::vector<int> io_cpus_;
+  bool is_reusing_port_;
+  size_t send_high_watermark_;
+  size_t send_low_watermark_;
+  SendQueuePolicy send_queue_policy_;
+  int32_t listen_backlog_;
+  bool is_no_delay_;
+  int32_t send_buffer_size_;
+  int32_t receive_buffer_size_;
+  uint64_t idle_timeout_;
+  ConnectionLimiter connection_limiter_;
+  std::vector<std::unique_ptr<Reactor>> reactors_;
+
+  // Connections and their receive buffers are recycled instead of being
+  // allocated for every accept
+  // One of each for every reactor, kept across restarts
+  std::vector<std::shared_ptr<ObjectPool<TcpClient>>> client_pools_;
+  std::vector<std::shared_ptr<BufferPool>> read_buffer_pools_;
 
 #if defined(OS_WIN)
   WSADATA wsa_data_;
 #endif
 
-  void worker_loop() {
-    fd_set socket_set;
-    SOCKET max_socket = 0;
-    while (is_listening_) {
-      // Clear the socket set
-      FD_ZERO(&socket_set);
-
-      // Add the listener to the set
-      FD_SET(listen_socket_, &socket_set);
-      max_socket = listen_socket_;
-
-      // Add all clients to the set
-      accepted_clients_mutex_.lock();
-      for (auto tcp_client : accepted_clients_) {
-        if (tcp_client->is_connected_) {
-          FD_SET(tcp_client->client_socket_, &socket_set);
-
-          // If the client socket is the largest socket, set it so
-          if (tcp_client->client_socket_ > max_socket) {
-            max_socket = tcp_client->client_socket_;
-          }
-        }
+  SOCKET create_listen_socket(bool reuse_port) {
+    SOCKET listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listen_socket == SOCKET_ERROR) {
+      return SOCKET_ERROR;
+    }
+
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+    // A restarted server can listen again while connections of the last one
+    // linger, cluster nodes have to come back on the port the others know
+    int32_t reuse_address = 1;
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR,
+      (const char *)&reuse_address, sizeof(reuse_address));
+#endif
+
+#if defined(SO_REUSEPORT)
+    if (reuse_port) {
+      int32_t enable = 1;
+      if (setsockopt(listen_socket, SOL_SOCKET, SO_REUSEPORT,
+        (const char *)&enable, sizeof(enable)) == SOCKET_ERROR) {
+        closesocket(listen_socket);
+        return SOCKET_ERROR;
       }
-      accepted_clients_mutex_.unlock();
+    }
+#endif
 
-      // Check if an activity was completed on any of those sockets
-      int32_t socket_activity = select(max_socket + 1, &socket_set, NULL, NULL,
-        NULL);
+    // Accepted connections inherit the buffer sizes, the receive buffer has
+    // to be set before the handshake to scale the window to it
+    if (send_buffer_size_ > 0) {
+      setsockopt(listen_socket, SOL_SOCKET, SO_SNDBUF,
+        (const char *)&send_buffer_size_, sizeof(send_buffer_size_));
+    }
+    if (receive_buffer_size_ > 0) {
+      setsockopt(listen_socket, SOL_SOCKET, SO_RCVBUF,
+        (const char *)&receive_buffer_size_, sizeof(receive_buffer_size_));
+    }
 
-      // Ensure select didn't fail
-      if (socket_activity == SOCKET_ERROR && errno == EINTR) {
-        continue;
+    sockaddr_in listen_endpoint = listen_endpoint_.GetSocketEndpoint();
+    if (bind(listen_socket, (const sockaddr *)&listen_endpoint,
+      sizeof(listen_endpoint)) == SOCKET_ERROR) {
+      closesocket(listen_socket);
+      return SOCKET_ERROR;
+    }
+
+    if (listen(listen_socket, listen_backlog_) == SOCKET_ERROR) {
+      closesocket(listen_socket);
+      return SOCKET_ERROR;
+    }
+
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+    uint32_t flags = fcntl(listen_socket, F_GETFL, 0);
+    if (flags != SOCKET_ERROR) {
+      flags |= O_NONBLOCK;
+      if (fcntl(listen_socket, F_SETFL, flags) == SOCKET_ERROR) {
+        closesocket(listen_socket);
+        return SOCKET_ERROR;
       }
+    } else {
+#elif defined(OS_WIN)
+#if defined(__CYGWIN__) || defined(__MINGW32__)
+    unsigned int blocking = 1;
+#else
+    u_long blocking = 1;
+#endif
+    if (ioctlsocket(listen_socket, FIONBIO, &blocking) == SOCKET_ERROR) {
+#endif
+      closesocket(listen_socket);
+      return SOCKET_ERROR;
+    }
 
-      // Check if a new connection is awaiting
-      if (FD_ISSET(listen_socket_, &socket_set)) {
-        sockaddr_in client_endpoint;
+    return listen_socket;
+  }
+
+  // Local connections skip the TCP stack, they are only possible where Unix
+  // domain sockets are
+  SOCKET create_local_socket() {
 #if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
-        uint32_t client_endpoint_size = sizeof(client_endpoint);
+    sockaddr_un local_endpoint;
+    if (local_path_.size() >= sizeof(local_endpoint.sun_path)) {
+      return SOCKET_ERROR;
+    }
+    memset(&local_endpoint, 0, sizeof(local_endpoint));
+    local_endpoint.sun_family = AF_UNIX;
+    memcpy(local_endpoint.sun_path, local_path_.c_str(), local_path_.size());
+
+    // The socket of a server that exited without closing it is in the way,
+    // other files are left alone
+    struct stat path_stat;
+    if (stat(local_path_.c_str(), &path_stat) == 0
+      && S_ISSOCK(path_stat.st_mode)) {
+      unlink(local_path_.c_str());
+    }
+
+    SOCKET local_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (local_socket == SOCKET_ERROR) {
+      return SOCKET_ERROR;
+    }
+    if (bind(local_socket, (const sockaddr *)&local_endpoint,
+      sizeof(local_endpoint)) == SOCKET_ERROR
+      || listen(local_socket, listen_backlog_) == SOCKET_ERROR
+      || fcntl(local_socket, F_SETFL, fcntl(local_socket, F_GETFL, 0)
+      | O_NONBLOCK) == SOCKET_ERROR) {
+      closesocket(local_socket);
+      return SOCKET_ERROR;
+    }
+    return local_socket;
+#else
+    return SOCKET_ERROR;
+#endif
+  }
+
+  void close_local_socket() {
+    if (local_socket_ == SOCKET_ERROR) {
+      return;
+    }
+    closesocket(local_socket_);
+    local_socket_ = SOCKET_ERROR;
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+    unlink(local_path_.c_str());
+#endif
+  }
+
+  // Local connections have no address, they are all given the loopback one
+  static sockaddr_in get_local_endpoint() {
+    return IPEndpoint("127.0.0.1", 0).GetSocketEndpoint();
+  }
+
+  static void add_stats(PoolStats &stats, const PoolStats &pool_stats) {
+    stats.InUse += pool_stats.InUse;
+    stats.PeakInUse += pool_stats.PeakInUse;
+    stats.Available += pool_stats.Available;
+    stats.Acquisitions += pool_stats.Acquisitions;
+    stats.Allocations += pool_stats.Allocations;
+  }
+
+  bool wakeup(Reactor *reactor) {
+#if defined(JCHAT_HAS_IO_URING)
+    if (reactor->Ring) {
+      return reactor->RingWaker->Notify();
+    }
+#endif
+    return reactor->EventPoller->Wakeup();
+  }
+
+  void close_reactors() {
+    // Interrupt every reactor first so they all shut down in parallel
+    for (auto &reactor : reactors_) {
+      wakeup(reactor.get());
+    }
+
+    for (auto &reactor : reactors_) {
+      if (reactor->WorkerThread.joinable()) {
+        reactor->WorkerThread.join();
+      }
+      if (is_reusing_port_) {
+        closesocket(reactor->ListenSocket);
+      }
+
+      reactor->ClientsMutex.lock();
+      for (auto &pair : reactor->Clients) {
+        pair.second->shutdown();
+      }
+      reactor->Clients.clear();
+      reactor->ClientsMutex.unlock();
+
+      reactor->PendingWritesMutex.lock();
+      reactor->PendingWrites.clear();
+      reactor->PendingWritesMutex.unlock();
+      reactor->PendingReads.clear();
+#if defined(JCHAT_HAS_IO_URING)
+      reactor->RingClients.clear();
+#endif
+    }
+    reactors_.clear();
+
+    if (!is_reusing_port_) {
+      closesocket(listen_socket_);
+    }
+    close_local_socket();
+  }
+
+  // Takes over an accepted socket, unless its address is over the rate
+  // limit. Local connections aren't limited.
+  void add_client(Reactor *reactor, SOCKET client_socket,
+    sockaddr_in &client_endpoint, bool is_local) {
+    if (!is_local
+      && !connection_limiter_.Admit(ntohl(client_endpoint.sin_addr.s_addr))) {
+      closesocket(client_socket);
+      IPEndpoint endpoint(client_endpoint);
+      OnClientRejected(endpoint);
+      return;
+    }
+    if (is_no_delay_ && !is_local) {
+      // Output is already gathered into few writes, waiting for more only
+      // delays it
+      int32_t enable = 1;
+      setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY,
+        (const char *)&enable, sizeof(enable));
+    }
+
+    std::shared_ptr<TcpClient> tcp_client = reactor->ClientPool->CreateShared(
+      client_socket, client_endpoint, listen_endpoint_.GetSocketEndpoint(),
+      reactor->ReadBufferPool);
+    tcp_client->reactor_ = reactor;
+
+    reactor->ClientsMutex.lock();
+    reactor->Clients[tcp_client.get()] = tcp_client;
+    reactor->ClientsMutex.unlock();
+
+    // A client on a ring is read by a multishot receive instead
+#if defined(JCHAT_HAS_IO_URING)
+    bool is_added = reactor->Ring ? receive_ring(reactor, tcp_client.get())
+      : reactor->EventPoller->Add(client_socket, tcp_client.get());
+#else
+    bool is_added = reactor->EventPoller->Add(client_socket,
+      tcp_client.get());
+#endif
+    if (!is_added) {
+      reactor->ClientsMutex.lock();
+      reactor->Clients.erase(tcp_client.get());
+      reactor->ClientsMutex.unlock();
+      return;
+    }
+
+    if (idle_timeout_ > 0) {
+      tcp_client->receive_time_ = reactor->Timers.GetTime();
+      tcp_client->idle_timer_.Data = tcp_client.get();
+      reactor->Timers.Start(tcp_client->idle_timer_, idle_timeout_);
+    }
+
+    OnClientConnected(*tcp_client);
+  }
+
+  // Returns false if connections were left in the queue
+  bool accept_batch(Reactor *reactor, SOCKET listen_socket, bool is_local) {
+    for (size_t i = 0; is_listening_; i++) {
+      if (i == JCHAT_TCP_SERVER_ACCEPT_BATCH) {
+        return false;
+      }
+
+      sockaddr_in client_endpoint;
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+      socklen_t client_endpoint_size = sizeof(client_endpoint);
 #elif defined(OS_WIN)
-        int32_t client_endpoint_size = sizeof(client_endpoint);
+      int32_t client_endpoint_size = sizeof(client_endpoint);
+#endif
+#if defined(OS_LINUX)
+      // Saves making the socket non-blocking with more system calls
+      SOCKET client_socket = accept4(listen_socket,
+        (sockaddr *)&client_endpoint, &client_endpoint_size,
+        SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+      SOCKET client_socket = accept(listen_socket,
+        (sockaddr *)&client_endpoint, &client_endpoint_size);
+#endif
+      if (client_socket == SOCKET_ERROR) {
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+        // A connection that was reset while it waited doesn't mean the
+        // queue is empty
+        if (errno == EINTR || errno == ECONNABORTED) {
+          continue;
+        }
+#endif
+        break;
+      }
+
+      if (is_local) {
+        client_endpoint = get_local_endpoint();
+      }
+      add_client(reactor, client_socket, client_endpoint, is_local);
+    }
+    return true;
+  }
+
+  void accept_clients(Reactor *reactor) {
+    // Accept every pending connection, the listeners are edge-triggered so
+    // they will not be reported again until a new connection arrives. A
+    // batch at a time, so the clients of the reactor aren't starved during a
+    // storm.
+    reactor->IsAcceptPending = !accept_batch(reactor, reactor->ListenSocket,
+      false);
+    if (local_socket_ != SOCKET_ERROR
+      && !accept_batch(reactor, local_socket_, true)) {
+      reactor->IsAcceptPending = true;
+    }
+  }
+
+  // Hands the stream to the handlers, a client whose handler deferred the
+  // rest of it waits for its next turn
+  bool receive(Reactor *reactor, TcpClient *tcp_client) {
+    if (!OnDataReceived(*tcp_client, tcp_client->read_stream_)) {
+      return false;
+    }
+    if (tcp_client->is_read_deferred_) {
+      reactor->PendingReads.push_back(tcp_client->shared_from_this());
+    }
+    return true;
+  }
+
+  bool read_client(Reactor *reactor, TcpClient *tcp_client, bool is_turn) {
+    // A client that deferred its input isn't read until its turn, so the
+    // socket fills up and the peer has to slow down. The turn starts with
+    // what was left in the stream.
+    if (tcp_client->is_read_deferred_) {
+      if (!is_turn) {
+        return true;
+      }
+      tcp_client->is_read_deferred_ = false;
+      if (!receive(reactor, tcp_client)) {
+        return false;
+      }
+      if (tcp_client->is_read_deferred_) {
+        return true;
+      }
+    }
+
+#if defined(JCHAT_HAS_IO_URING)
+    // The ring delivers whatever arrives once it receives again
+    if (reactor->Ring) {
+      return receive_ring(reactor, tcp_client);
+    }
 #endif
-        SOCKET client_socket = accept(listen_socket_,
-          (sockaddr *)&client_endpoint, &client_endpoint_size);
-        if (client_socket != SOCKET_ERROR) {
-          TcpClient *tcp_client = new TcpClient(client_socket, client_endpoint,
-            listen_endpoint_.GetSocketEndpoint());
-          accepted_clients_mutex_.lock();
-          accepted_clients_.push_back(tcp_client);
-          accepted_clients_mutex_.unlock();
-
-          OnClientConnected(*tcp_client);
+
+    tcp_client->receive_time_ = reactor->Timers.GetTime();
+    tcp_client->is_idle_ = false;
+
+    // Read until the socket would block, the client is edge-triggered
+    StreamBuffer &read_stream = tcp_client->read_stream_;
+    while (true) {
+      // Receive straight into the stream, fails once a peer has sent more
+      // unconsumed data than the stream is allowed to hold
+      size_t free_size = 0;
+      uint8_t *free_space = read_stream.GetWritePointer(free_size);
+      if (free_space == NULL) {
+        return false;
+      }
+
+      int32_t read_bytes = recv(tcp_client->client_socket_,
+        (char *)free_space, free_size, 0);
+      if (read_bytes == SOCKET_ERROR) {
+#if defined(OS_WIN)
+        return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+        if (errno == EINTR) {
+          continue;
         }
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+      }
+      if (read_bytes <= 0) {
+        return false;
+      }
+      read_stream.Commit(read_bytes);
+      if (!receive(reactor, tcp_client)) {
+        return false;
+      }
+      if (tcp_client->is_read_deferred_) {
+        return true;
       }
+    }
+  }
+
+  // Gives every client that deferred its input its next turn, one after the
+  // other in the order they deferred it. Clients that defer again line up
+  // behind the others.
+  void read_deferred(Reactor *reactor) {
+    std::vector<std::shared_ptr<TcpClient>> pending_reads;
+    pending_reads.swap(reactor->PendingReads);
+
+    for (auto &tcp_client : pending_reads) {
+      // The flag is cleared once the client was disconnected
+      if (tcp_client->is_read_deferred_
+        && !read_client(reactor, tcp_client.get(), true)) {
+        disconnect_client(reactor, tcp_client.get());
+      }
+    }
+  }
+
+  // Releases every packet that was written completely. NOTE: The client's
+  // send mutex has to be held.
+  void release_sent(TcpClient *tcp_client, size_t written_bytes) {
+    size_t remaining_bytes = written_bytes;
+    tcp_client->send_queue_size_ -= remaining_bytes;
+    while (remaining_bytes > 0) {
+      size_t packet_size = tcp_client->send_queue_.front()->GetSize()
+        - tcp_client->send_queue_offset_;
+      if (remaining_bytes < packet_size) {
+        tcp_client->send_queue_offset_ += remaining_bytes;
+        break;
+      }
+      remaining_bytes -= packet_size;
+      tcp_client->send_queue_offset_ = 0;
+      tcp_client->send_queue_.pop_front();
+    }
 
-      // Check if there was some operation completed on another socket
-      accepted_clients_mutex_.lock();
-      for (auto tcp_client = accepted_clients_.begin();
-        tcp_client != accepted_clients_.end();) {
-        if (FD_ISSET((*tcp_client)->client_socket_, &socket_set)) {
-          int32_t read_bytes = recv((*tcp_client)->client_socket_,
-            (char *)(*tcp_client)->read_buffer_.data(),
-            (*tcp_client)->read_buffer_.size(), 0);
-          bool disconnect_client = false;
-          if (read_bytes > 0 && read_bytes < JCHAT_TCP_BUFFER_SIZE) {
-            Buffer buffer((*tcp_client)->read_buffer_.data(), read_bytes);
-            if (!OnDataReceived(**tcp_client, buffer)) {
-              disconnect_client = true;
-            }
-          } else {
-            disconnect_client = true;
-          }
-          if (disconnect_client) {
-            (*tcp_client)->is_connected_ = false;
-            closesocket((*tcp_client)->client_socket_);
-            OnClientDisconnected(**tcp_client);
-            delete *tcp_client;
-            tcp_client = accepted_clients_.erase(tcp_client);
-            continue;
-          }
+    // Accept messages again once enough of the backlog was written
+    if (tcp_client->is_shedding_
+      && tcp_client->send_queue_size_ <= send_low_watermark_) {
+      tcp_client->is_shedding_ = false;
+    }
+  }
+
+  // Releases the output that can no longer be written
+  void clear_queue(TcpClient *tcp_client) {
+    tcp_client->send_mutex_.lock();
+    tcp_client->send_queue_.clear();
+    tcp_client->send_queue_offset_ = 0;
+    tcp_client->send_queue_size_ = 0;
+    tcp_client->send_mutex_.unlock();
+  }
+
+  // Writes as much of the send queue as the socket accepts, gathering the
+  // queued packets into as few calls as possible. Returns false if the
+  // connection failed. NOTE: The client's send mutex has to be held.
+  bool write_queue(TcpClient *tcp_client) {
+    while (!tcp_client->send_queue_.empty()) {
+#if defined(OS_WIN)
+      WSABUF buffers[JCHAT_TCP_SERVER_MAX_IOVECS];
+#else
+      iovec buffers[JCHAT_TCP_SERVER_MAX_IOVECS];
+#endif
+      size_t buffer_count = 0;
+      size_t offset = tcp_client->send_queue_offset_;
+      for (auto &packet : tcp_client->send_queue_) {
+        if (buffer_count == JCHAT_TCP_SERVER_MAX_IOVECS) {
+          break;
         }
-        ++tcp_client;
+#if defined(OS_WIN)
+        buffers[buffer_count].buf = (CHAR *)packet->GetData() + offset;
+        buffers[buffer_count].len = static_cast<ULONG>(packet->GetSize()
+          - offset);
+#else
+        buffers[buffer_count].iov_base = (void *)(packet->GetData() + offset);
+        buffers[buffer_count].iov_len = packet->GetSize() - offset;
+#endif
+        buffer_count++;
+        offset = 0;
+      }
+
+#if defined(OS_WIN)
+      DWORD written_bytes = 0;
+      if (WSASend(tcp_client->client_socket_, buffers,
+        static_cast<DWORD>(buffer_count), &written_bytes, 0, NULL, NULL)
+        == SOCKET_ERROR) {
+        return WSAGetLastError() == WSAEWOULDBLOCK;
       }
-      accepted_clients_mutex_.unlock();
+#else
+      msghdr message;
+      memset(&message, 0, sizeof(message));
+      message.msg_iov = buffers;
+      message.msg_iovlen = buffer_count;
+#if defined(MSG_NOSIGNAL)
+      ssize_t written_bytes = sendmsg(tcp_client->client_socket_, &message,
+        MSG_NOSIGNAL);
+#else
+      ssize_t written_bytes = sendmsg(tcp_client->client_socket_, &message, 0);
+#endif
+      if (written_bytes == SOCKET_ERROR) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+      }
+#endif
+
+      release_sent(tcp_client, static_cast<size_t>(written_bytes));
+    }
+
+    return true;
+  }
+
+  // Called on the reactor thread when a client queued output or its socket
+  // became writable
+  bool flush_client(Reactor *reactor, TcpClient *tcp_client) {
+    tcp_client->send_mutex_.lock();
+#if defined(JCHAT_HAS_IO_URING)
+    if (reactor->Ring) {
+      bool is_sent = send_ring(reactor, tcp_client);
+      tcp_client->send_mutex_.unlock();
+      return is_sent;
+    }
+#endif
+    if (!write_queue(tcp_client)) {
+      tcp_client->send_mutex_.unlock();
+      return false;
+    }
+
+    // Only watch for writability while there is something left to write
+    bool is_write_pending = !tcp_client->send_queue_.empty();
+    if (is_write_pending != tcp_client->is_write_pending_) {
+      tcp_client->is_write_pending_ = is_write_pending;
+      reactor->EventPoller->SetWritable(tcp_client->client_socket_,
+        tcp_client, is_write_pending);
+    }
+    tcp_client->send_mutex_.unlock();
+
+    return true;
+  }
+
+  void flush_pending_writes(Reactor *reactor) {
+    std::vector<std::shared_ptr<TcpClient>> pending_writes;
+    reactor->PendingWritesMutex.lock();
+    pending_writes.swap(reactor->PendingWrites);
+    reactor->PendingWritesMutex.unlock();
+
+    for (auto &tcp_client : pending_writes) {
+      if (tcp_client->is_connected_
+        && !flush_client(reactor, tcp_client.get())) {
+        disconnect_client(reactor, tcp_client.get());
+      }
+    }
+  }
+
+  bool queue_packet(TcpClient &tcp_client,
+    const std::shared_ptr<Packet> &packet) {
+    if (!tcp_client.is_internal_ || !tcp_client.is_connected_) {
+      return false;
+    }
+
+    tcp_client.send_mutex_.lock();
+
+    // Never let a slow reader hold up the sender, either stop queueing for
+    // it or drop it entirely
+    if (tcp_client.is_shedding_ || tcp_client.send_queue_size_
+      + packet->GetSize() > send_high_watermark_) {
+      if (send_queue_policy_ == kSendQueuePolicy_Shed) {
+        tcp_client.is_shedding_ = true;
+        tcp_client.send_mutex_.unlock();
+        return false;
+      }
+      tcp_client.send_mutex_.unlock();
+      tcp_client.shutdown();
+      return false;
+    }
+
+    bool was_empty = tcp_client.send_queue_.empty();
+    tcp_client.send_queue_.push_back(packet);
+    tcp_client.send_queue_size_ += packet->GetSize();
+
+    Reactor *reactor = static_cast<Reactor *>(tcp_client.reactor_);
+#if defined(JCHAT_HAS_IO_URING)
+    // The reactor of a ring sends the output of all of its clients at once,
+    // with a single system call
+    if (reactor->Ring) {
+      bool needs_send = !tcp_client.is_write_pending_;
+      tcp_client.is_write_pending_ = true;
+      tcp_client.send_mutex_.unlock();
+      if (needs_send) {
+        schedule_flush(reactor, tcp_client);
+      }
+      return true;
+    }
+#endif
+
+    // Write straight away if nothing is queued ahead of this packet, the
+    // reactor takes over whatever the socket didn't accept
+    if (was_empty && !write_queue(&tcp_client)) {
+      tcp_client.send_mutex_.unlock();
+      tcp_client.shutdown();
+      return false;
+    }
+    bool needs_flush = !tcp_client.send_queue_.empty()
+      && !tcp_client.is_write_pending_;
+    tcp_client.send_mutex_.unlock();
+
+    if (needs_flush) {
+      schedule_flush(reactor, tcp_client);
+    }
+
+    return true;
+  }
+
+  void schedule_flush(Reactor *reactor, TcpClient &tcp_client) {
+    reactor->PendingWritesMutex.lock();
+    reactor->PendingWrites.push_back(tcp_client.shared_from_this());
+    reactor->PendingWritesMutex.unlock();
+    if (std::this_thread::get_id() != reactor->WorkerThread.get_id()) {
+      wakeup(reactor);
+    }
+  }
+
+  bool disconnect_client(Reactor *reactor, TcpClient *tcp_client) {
+    // Keep the client alive until the disconnect has been handled, other
+    // threads may still be holding a reference to it
+    std::shared_ptr<TcpClient> client_reference;
+    reactor->ClientsMutex.lock();
+    auto client = reactor->Clients.find(tcp_client);
+    if (client == reactor->Clients.end()) {
+      reactor->ClientsMutex.unlock();
+      return false;
+    }
+    client_reference = client->second;
+    reactor->Clients.erase(client);
+    reactor->ClientsMutex.unlock();
+
+    if (reactor->EventPoller) {
+      reactor->EventPoller->Remove(tcp_client->client_socket_);
+    }
+    reactor->Timers.Stop(tcp_client->idle_timer_);
+    tcp_client->is_read_deferred_ = false;
+    tcp_client->shutdown();
+
+#if defined(JCHAT_HAS_IO_URING)
+    // A send in flight still points into the queue, it is cleared once the
+    // send failed on the closed socket
+    if (!tcp_client->ring_.IsSending) {
+      clear_queue(tcp_client);
+    }
+#else
+    clear_queue(tcp_client);
+#endif
+
+    OnClientDisconnected(*tcp_client);
+
+    return true;
+  }
+
+  // Clients that sent nothing for the idle timeout are reported once, if
+  // they still send nothing for another idle timeout they are dropped
+  void check_idle(Reactor *reactor, TcpClient *tcp_client) {
+    uint64_t idle_time = reactor->Timers.GetTime() - tcp_client->receive_time_;
+    if (idle_time < idle_timeout_) {
+      reactor->Timers.Start(tcp_client->idle_timer_,
+        idle_timeout_ - idle_time);
+      return;
+    }
+    if (tcp_client->is_idle_) {
+      disconnect_client(reactor, tcp_client);
+      return;
+    }
+
+    tcp_client->is_idle_ = true;
+    reactor->Timers.Start(tcp_client->idle_timer_, idle_timeout_);
+    if (!OnClientIdle(*tcp_client)) {
+      disconnect_client(reactor, tcp_client);
+    }
+  }
+
+#if defined(JCHAT_HAS_IO_URING)
+  static uint64_t ring_data(void *data, RingOperation operation) {
+    return reinterpret_cast<uint64_t>(data) | operation;
+  }
 
-      // Sleep
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  // Keeps the client alive while the ring may still complete an operation of
+  // it
+  void start_operation(Reactor *reactor, TcpClient *tcp_client) {
+    if (tcp_client->ring_.Operations++ == 0) {
+      reactor->RingClients[tcp_client] = tcp_client->shared_from_this();
+    }
+  }
+
+  // NOTE: This may destroy the client
+  void end_operation(Reactor *reactor, TcpClient *tcp_client) {
+    if (--tcp_client->ring_.Operations == 0) {
+      reactor->RingClients.erase(tcp_client);
+    }
+  }
+
+  bool receive_ring(Reactor *reactor, TcpClient *tcp_client) {
+    if (tcp_client->ring_.IsReceiving) {
+      return true;
+    }
+    if (!reactor->Ring->PrepareReceive(tcp_client->client_socket_,
+      ring_data(tcp_client, kRingOperation_Receive))) {
+      return false;
+    }
+    tcp_client->ring_.IsReceiving = true;
+    start_operation(reactor, tcp_client);
+    return true;
+  }
+
+  // Sends as much of the queue as fits in one message, unless a send is
+  // already in flight. NOTE: The client's send mutex has to be held.
+  bool send_ring(Reactor *reactor, TcpClient *tcp_client) {
+    RingConnection &ring_connection = tcp_client->ring_;
+    if (ring_connection.IsSending) {
+      return true;
+    }
+    if (tcp_client->send_queue_.empty()) {
+      tcp_client->is_write_pending_ = false;
+      return true;
+    }
+
+    ring_connection.Buffers.clear();
+    size_t offset = tcp_client->send_queue_offset_;
+    for (auto &packet : tcp_client->send_queue_) {
+      if (ring_connection.Buffers.size() == JCHAT_TCP_SERVER_MAX_IOVECS) {
+        break;
+      }
+      iovec buffer;
+      buffer.iov_base = (void *)(packet->GetData() + offset);
+      buffer.iov_len = packet->GetSize() - offset;
+      ring_connection.Buffers.push_back(buffer);
+      offset = 0;
+    }
+    ring_connection.Message.msg_iov = ring_connection.Buffers.data();
+    ring_connection.Message.msg_iovlen = ring_connection.Buffers.size();
+    if (!reactor->Ring->PrepareSend(tcp_client->client_socket_,
+      &ring_connection.Message, ring_data(tcp_client, kRingOperation_Send))) {
+      return false;
+    }
+    ring_connection.IsSending = true;
+    start_operation(reactor, tcp_client);
+    return true;
+  }
+
+  void accept_ring(Reactor *reactor, SOCKET client_socket, bool is_local) {
+    // Multishot accepts can't return the address of each connection
+    sockaddr_in client_endpoint = get_local_endpoint();
+    socklen_t client_endpoint_size = sizeof(client_endpoint);
+    if (!is_local && getpeername(client_socket, (sockaddr *)&client_endpoint,
+      &client_endpoint_size) == SOCKET_ERROR) {
+      closesocket(client_socket);
+      return;
+    }
+    add_client(reactor, client_socket, client_endpoint, is_local);
+  }
+
+  bool receive_buffer(Reactor *reactor, TcpClient *tcp_client,
+    const uint8_t *data, size_t size) {
+    tcp_client->receive_time_ = reactor->Timers.GetTime();
+    tcp_client->is_idle_ = false;
+    if (!tcp_client->read_stream_.Write(data, size)) {
+      return false;
+    }
+
+    // Input of a client that waits for its turn is only collected
+    if (tcp_client->is_read_deferred_) {
+      return true;
+    }
+    if (!receive(reactor, tcp_client)) {
+      return false;
+    }
+
+    // Stop receiving so the socket fills up, the turn receives again
+    if (tcp_client->is_read_deferred_ && tcp_client->ring_.IsReceiving) {
+      reactor->Ring->PrepareCancel(ring_data(tcp_client,
+        kRingOperation_Receive), ring_data(nullptr, kRingOperation_Cancel));
+    }
+    return true;
+  }
+
+  void handle_receive(Reactor *reactor, TcpClient *tcp_client,
+    const io_uring_cqe &cqe) {
+    IoUring &ring = *reactor->Ring;
+    bool is_connected = cqe.res > 0 || cqe.res == -ENOBUFS
+      || cqe.res == -ECANCELED;
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+      uint16_t buffer_id = static_cast<uint16_t>(cqe.flags
+        >> IORING_CQE_BUFFER_SHIFT);
+      if (cqe.res > 0 && tcp_client->is_connected_) {
+        is_connected = receive_buffer(reactor, tcp_client,
+          ring.GetBuffer(buffer_id), static_cast<size_t>(cqe.res));
+      }
+      ring.ReturnBuffer(buffer_id);
+    }
+
+    // The receive stops when it was cancelled, ran out of buffers or failed.
+    // It is started again unless the client waits for its turn.
+    if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+      tcp_client->ring_.IsReceiving = false;
+    }
+    if (!is_connected || !tcp_client->is_connected_) {
+      disconnect_client(reactor, tcp_client);
+    } else if (!tcp_client->is_read_deferred_
+      && !receive_ring(reactor, tcp_client)) {
+      disconnect_client(reactor, tcp_client);
+    }
+    if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+      end_operation(reactor, tcp_client);
+    }
+  }
+
+  void handle_send(Reactor *reactor, TcpClient *tcp_client,
+    const io_uring_cqe &cqe) {
+    tcp_client->send_mutex_.lock();
+    tcp_client->ring_.IsSending = false;
+    bool is_sent = tcp_client->is_connected_;
+    if (cqe.res >= 0) {
+      release_sent(tcp_client, static_cast<size_t>(cqe.res));
+    } else if (cqe.res != -EAGAIN && cqe.res != -EINTR) {
+      is_sent = false;
+    }
+    // Send the rest, and whatever was queued in the meantime
+    if (is_sent) {
+      is_sent = send_ring(reactor, tcp_client);
+    }
+    tcp_client->send_mutex_.unlock();
+
+    if (!is_sent) {
+      disconnect_client(reactor, tcp_client);
+      clear_queue(tcp_client);
+    }
+    end_operation(reactor, tcp_client);
+  }
+
+  void handle_completion(Reactor *reactor, const io_uring_cqe &cqe) {
+    RingOperation operation = static_cast<RingOperation>(cqe.user_data & 7);
+    bool is_more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+    switch (operation) {
+    case kRingOperation_Accept:
+      if (cqe.res >= 0) {
+        accept_ring(reactor, cqe.res, false);
+      }
+      if (!is_more && is_listening_) {
+        reactor->Ring->PrepareAccept(reactor->ListenSocket,
+          ring_data(reactor, kRingOperation_Accept));
+      }
+      break;
+    case kRingOperation_LocalAccept:
+      if (cqe.res >= 0) {
+        accept_ring(reactor, cqe.res, true);
+      }
+      if (!is_more && is_listening_) {
+        reactor->Ring->PrepareAccept(local_socket_,
+          ring_data(reactor, kRingOperation_LocalAccept));
+      }
+      break;
+    case kRingOperation_Wakeup:
+      reactor->RingWaker->Drain();
+      if (!is_more) {
+        reactor->Ring->PreparePoll(reactor->RingWaker->GetSocket(),
+          ring_data(reactor, kRingOperation_Wakeup));
+      }
+      break;
+    case kRingOperation_Receive:
+      handle_receive(reactor, (TcpClient *)(cqe.user_data & ~7ULL), cqe);
+      break;
+    case kRingOperation_Send:
+      handle_send(reactor, (TcpClient *)(cqe.user_data & ~7ULL), cqe);
+      break;
+    case kRingOperation_Cancel:
+      break;
+    }
+  }
+
+  // Like worker_loop, but the ring reports completed reads and writes
+  // instead of sockets that are ready for them. The sends prepared by one
+  // iteration are submitted together with the next wait.
+  void ring_loop(Reactor *reactor) {
+    IoUring &ring = *reactor->Ring;
+    ring.PrepareAccept(reactor->ListenSocket,
+      ring_data(reactor, kRingOperation_Accept));
+    if (local_socket_ != SOCKET_ERROR) {
+      ring.PrepareAccept(local_socket_,
+        ring_data(reactor, kRingOperation_LocalAccept));
+    }
+    ring.PreparePoll(reactor->RingWaker->GetSocket(),
+      ring_data(reactor, kRingOperation_Wakeup));
+
+    while (is_listening_) {
+      ring.SubmitAndWait(reactor->PendingReads.empty()
+        ? reactor->Timers.GetTimeout() : 0);
+      reactor->Timers.Advance([this, reactor](TimerWheel::Timer &timer) {
+        check_idle(reactor, static_cast<TcpClient *>(timer.Data));
+      });
+
+      ring.ForEachCompletion([this, reactor](const io_uring_cqe &cqe) {
+        handle_completion(reactor, cqe);
+      });
+
+      if (!reactor->PendingReads.empty()) {
+        read_deferred(reactor);
+      }
+
+      // Queue the sends of the output queued since the last wait
+      flush_pending_writes(reactor);
+    }
+  }
+
+  // Reactors fall back to a poller on kernels that lack what they need
+  bool create_ring(Reactor *reactor) {
+    std::unique_ptr<IoUring> ring(new IoUring());
+    std::unique_ptr<Waker> waker(new Waker());
+    if (!waker->IsValid() || !ring->Initialize(JCHAT_TCP_SERVER_RING_ENTRIES,
+      JCHAT_TCP_SERVER_RING_BUFFERS, JCHAT_TCP_SERVER_RING_BUFFER_SIZE)) {
+      return false;
+    }
+    reactor->Ring = std::move(ring);
+    reactor->RingWaker = std::move(waker);
+    return true;
+  }
+#endif
+
+  void worker_loop(Reactor *reactor) {
+    // Placed before the reactor allocates anything on its own
+    Thread::SetName("jchat-io-" + std::to_string(reactor->Index));
+    if (!io_cpus_.empty()) {
+      Thread::SetCpu(io_cpus_[reactor->Index % io_cpus_.size()]);
+    }
+
+#if defined(JCHAT_HAS_IO_URING)
+    if (reactor->Ring) {
+      ring_loop(reactor);
+      return;
+    }
+#endif
+    std::vector<PollerEvent> events(JCHAT_TCP_SERVER_MAX_EVENTS);
+    while (is_listening_) {
+      // Wait for an activity on any of the registered sockets, only check for
+      // one while work was left over
+      bool is_work_pending = reactor->IsAcceptPending
+        || !reactor->PendingReads.empty();
+      int32_t event_count = reactor->EventPoller->Wait(events.data(),
+        events.size(), is_work_pending ? 0 : reactor->Timers.GetTimeout());
+      reactor->Timers.Advance([this, reactor](TimerWheel::Timer &timer) {
+        check_idle(reactor, static_cast<TcpClient *>(timer.Data));
+      });
+
+      // Ensure the wait didn't fail
+      if (event_count == SOCKET_ERROR) {
+        continue;
+      }
+
+      for (int32_t i = 0; i < event_count; i++) {
+        // Check if a new connection is awaiting
+        if (events[i].Data == reactor) {
+          accept_clients(reactor);
+          continue;
+        }
+
+        // Check if there was some operation completed on another socket, the
+        // client may have been disconnected by another thread in the meantime
+        std::shared_ptr<TcpClient> tcp_client;
+        reactor->ClientsMutex.lock();
+        auto client = reactor->Clients.find(
+          static_cast<TcpClient *>(events[i].Data));
+        if (client != reactor->Clients.end()) {
+          tcp_client = client->second;
+        }
+        reactor->ClientsMutex.unlock();
+
+        if (!tcp_client) {
+          continue;
+        }
+        if ((events[i].Writable && !flush_client(reactor, tcp_client.get()))
+          || ((events[i].Readable || events[i].Closed)
+          && !read_client(reactor, tcp_client.get(), false))) {
+          disconnect_client(reactor, tcp_client.get());
+        }
+      }
+
+      if (!reactor->PendingReads.empty()) {
+        read_deferred(reactor);
+      }
+
+      // Write the output queued since the last wait
+      flush_pending_writes(reactor);
+
+      if (reactor->IsAcceptPending) {
+        accept_clients(reactor);
+      }
     }
   }
 
 public:
   TcpServer(const char *hostname, uint16_t port)
     : hostname_(hostname), port_(port), is_listening_(false),
-    listen_socket_(0), listen_endpoint_("0.0.0.0", port) {
+    listen_socket_(0), listen_endpoint_("0.0.0.0", port),
+    local_socket_(SOCKET_ERROR),
+    poller_type_(kPollerType_Default), io_thread_count_(1),
+    is_reusing_port_(false),
+    send_high_watermark_(JCHAT_TCP_SEND_HIGH_WATERMARK),
+    send_low_watermark_(JCHAT_TCP_SEND_LOW_WATERMARK),
+    send_queue_policy_(kSendQueuePolicy_Disconnect),
+    listen_backlog_(JCHAT_TCP_SERVER_BACKLOG), is_no_delay_(true),
+    send_buffer_size_(0), receive_buffer_size_(0), idle_timeout_(0) {
 #if defined(OS_WIN)
     // Initialize Winsock
     WSAStartup(MAKEWORD(2, 2), &wsa_data_);
@@ -157,69 +1164,82 @@ public:
   ~TcpServer() {
     if (is_listening_) {
       is_listening_ = false;
-      worker_thread_.join();
-      closesocket(listen_socket_);
+      close_reactors();
+    }
 
 #if defined(OS_WIN)
-      // Cleanup Winsock
-      WSACleanup();
+    // Cleanup Winsock
+    WSACleanup();
 #endif
-    }
-
-    if (!accepted_clients_.empty()) {
-      for (auto tcp_client : accepted_clients_) {
-        delete tcp_client;
-      }
-      accepted_clients_.clear();
-    }
   }
 
   bool Start() {
-	  if (is_listening_) {
-		  return false;
-	  }
-
-	  if ((listen_socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP))
-		  == SOCKET_ERROR) {
-		  return false;
-	  }
-
-	  sockaddr_in listen_endpoint = listen_endpoint_.GetSocketEndpoint();
-	  if (bind(listen_socket_, (const sockaddr *)&listen_endpoint,
-		  sizeof(listen_endpoint)) == SOCKET_ERROR) {
-		  closesocket(listen_socket_);
-		  return false;
-	  }
-
-	  if (listen(listen_socket_, JCHAT_TCP_SERVER_BACKLOG) == SOCKET_ERROR) {
-		  closesocket(listen_socket_);
-		  return false;
-	  }
+    if (is_listening_) {
+      return false;
+    }
 
-#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
-	  uint32_t flags = fcntl(listen_socket_, F_GETFL, 0);
-	  if (flags != SOCKET_ERROR) {
-		  flags |= O_NONBLOCK;
-		  if (fcntl(listen_socket_, F_SETFL, flags) == SOCKET_ERROR) {
-			  closesocket(listen_socket_);
-			  return false;
-		  }
-	  } else {
-#elif defined(OS_WIN)
-#if defined(__CYGWIN__) || defined(__MINGW32__)
-	    unsigned int blocking = 1;
+    // Give every reactor its own listener when the kernel can balance
+    // connections between them, otherwise they all wait on a shared one
+#if defined(OS_LINUX) && defined(SO_REUSEPORT)
+    is_reusing_port_ = io_thread_count_ > 1;
 #else
-		  u_long blocking = 1;
+    is_reusing_port_ = false;
 #endif
-		if (ioctlsocket(listen_socket_, FIONBIO, &blocking) == SOCKET_ERROR) {
-#endif
-      closesocket(listen_socket_);
+
+    if (!is_reusing_port_) {
+      if ((listen_socket_ = create_listen_socket(false)) == SOCKET_ERROR) {
+        return false;
+      }
+    }
+    if (!local_path_.empty()
+      && (local_socket_ = create_local_socket()) == SOCKET_ERROR) {
+      if (!is_reusing_port_) {
+        closesocket(listen_socket_);
+      }
       return false;
     }
 
+    for (size_t i = 0; i < io_thread_count_; i++) {
+      std::unique_ptr<Reactor> reactor(new Reactor());
+      if (client_pools_.size() <= i) {
+        client_pools_.push_back(std::make_shared<ObjectPool<TcpClient>>());
+        read_buffer_pools_.push_back(
+          std::make_shared<BufferPool>(JCHAT_TCP_BUFFER_SIZE));
+      }
+      reactor->Index = i;
+      reactor->ClientPool = client_pools_[i];
+      reactor->ReadBufferPool = read_buffer_pools_[i];
+      reactor->ListenSocket = is_reusing_port_ ? create_listen_socket(true)
+        : listen_socket_;
+#if defined(JCHAT_HAS_IO_URING)
+      if (poller_type_ != kPollerType_IoUring || !create_ring(reactor.get())) {
+        reactor->EventPoller = Poller::Create(poller_type_);
+      }
+#else
+      reactor->EventPoller = Poller::Create(poller_type_);
+#endif
+
+      // Register the listener with the poller, the ring accepts on its own
+      if (reactor->ListenSocket == SOCKET_ERROR || (reactor->EventPoller
+        && (!reactor->EventPoller->Add(reactor->ListenSocket, reactor.get())
+        || (local_socket_ != SOCKET_ERROR
+        && !reactor->EventPoller->Add(local_socket_, reactor.get()))))) {
+        if (is_reusing_port_ && reactor->ListenSocket != SOCKET_ERROR) {
+          closesocket(reactor->ListenSocket);
+        }
+        close_reactors();
+        return false;
+      }
+
+      reactors_.push_back(std::move(reactor));
+    }
+
     is_listening_ = true;
 
-    worker_thread_ = std::thread(&TcpServer::worker_loop, this);
+    for (auto &reactor : reactors_) {
+      reactor->WorkerThread = std::thread(&TcpServer::worker_loop, this,
+        reactor.get());
+    }
 
     return true;
   }
@@ -230,56 +1250,239 @@ public:
     }
 
     is_listening_ = false;
-    worker_thread_.join();
-    closesocket(listen_socket_);
-
-    accepted_clients_mutex_.lock();
-    if (!accepted_clients_.empty()) {
-      for (auto tcp_client : accepted_clients_) {
-        delete tcp_client;
-      }
-      accepted_clients_.clear();
-    }
-    accepted_clients_mutex_.unlock();
+    close_reactors();
 
     return true;
   }
 
   bool DisconnectClient(TcpClient &tcp_client) {
-    accepted_clients_mutex_.lock();
-    for (auto client = accepted_clients_.begin();
-      client != accepted_clients_.end();) {
-      if (*client == &tcp_client) {
-        (*client)->is_connected_ = false;
-        closesocket((*client)->client_socket_);
-        OnClientDisconnected(**client);
-        accepted_clients_.erase(client);
-        accepted_clients_mutex_.unlock();
-        return true;
-      } else {
-        ++client;
-      }
+    if (!tcp_client.is_internal_ || tcp_client.reactor_ == nullptr) {
+      return false;
     }
-    accepted_clients_mutex_.unlock();
-    return false;
+
+    return disconnect_client(static_cast<Reactor *>(tcp_client.reactor_),
+      &tcp_client);
   }
 
-  bool Send(TcpClient &tcp_client, Buffer &buffer) {
+  // Only to be called by an OnDataReceived handler, which then returns with
+  // input left in the stream. The handler is called again with it once the
+  // other clients of the reactor had a turn, even if nothing else arrives,
+  // and the socket isn't read until then.
+  bool DeferRead(TcpClient &tcp_client) {
+    if (!tcp_client.is_internal_ || tcp_client.reactor_ == nullptr) {
+      return false;
+    }
+
+    tcp_client.is_read_deferred_ = true;
+    return true;
+  }
+
+  // Unlike DisconnectClient this is safe to call from any thread, the
+  // client's reactor disconnects it once it notices the socket was shut down
+  bool ShutdownClient(TcpClient &tcp_client) {
     if (!tcp_client.is_internal_ || !tcp_client.is_connected_) {
       return false;
     }
 
-    return send(tcp_client.client_socket_, (const char *)buffer.GetBuffer(),
-      buffer.GetSize(), 0) != SOCKET_ERROR;
+    tcp_client.shutdown();
+    return true;
+  }
+
+  // Sends never block, output the socket doesn't accept right away is queued
+  // and written once it becomes writable. They fail if the client is gone or
+  // its queue is over the high watermark.
+  bool Send(TcpClient &tcp_client, Buffer &buffer) {
+    return queue_packet(tcp_client, std::make_shared<Packet>(
+      buffer.GetBuffer(), buffer.GetSize(), nullptr, 0));
+  }
+
+  bool Send(TcpClient &tcp_client, const std::shared_ptr<Packet> &packet) {
+    return queue_packet(tcp_client, packet);
   }
 
   IPEndpoint GetListenEndpoint() {
     return listen_endpoint_;
   }
 
+  bool SetPollerType(PollerType poller_type) {
+    if (is_listening_) {
+      return false;
+    }
+    poller_type_ = poller_type;
+    return true;
+  }
+
+  PollerType GetPollerType() {
+    if (!reactors_.empty()) {
+#if defined(JCHAT_HAS_IO_URING)
+      if (reactors_[0]->Ring) {
+        return kPollerType_IoUring;
+      }
+#endif
+      return reactors_[0]->EventPoller->GetType();
+    }
+    return poller_type_;
+  }
+
+  bool SetIoThreadCount(size_t io_thread_count) {
+    if (is_listening_ || io_thread_count == 0) {
+      return false;
+    }
+    io_thread_count_ = io_thread_count;
+    return true;
+  }
+
+  size_t GetIoThreadCount() {
+    return io_thread_count_;
+  }
+
+  bool IsReusingPort() {
+    return is_reusing_port_;
+  }
+
+  // The pools of all reactors together
+  PoolStats GetClientPoolStats() {
+    PoolStats stats = PoolStats();
+    for (auto &client_pool : client_pools_) {
+      add_stats(stats, client_pool->GetStats());
+    }
+    return stats;
+  }
+
+  PoolStats GetReadBufferPoolStats() {
+    PoolStats stats = PoolStats();
+    for (auto &read_buffer_pool : read_buffer_pools_) {
+      add_stats(stats, read_buffer_pool->GetStats());
+    }
+    return stats;
+  }
+
+  // Only while not listening, see Thread::SetCpu
+  bool SetIoCpus(const std::vector<int> &io_cpus) {
+    if (is_listening_) {
+      return false;
+    }
+    io_cpus_ = io_cpus;
+    return true;
+  }
+
+  const std::vector<int> &GetIoCpus() {
+    return io_cpus_;
+  }
+
+  bool SetSendQueueLimits(size_t high_watermark, size_t low_watermark) {
+    if (is_listening_ || low_watermark > high_watermark) {
+      return false;
+    }
+    send_high_watermark_ = high_watermark;
+    send_low_watermark_ = low_watermark;
+    return true;
+  }
+
+  size_t GetSendHighWatermark() {
+    return send_high_watermark_;
+  }
+
+  size_t GetSendLowWatermark() {
+    return send_low_watermark_;
+  }
+
+  bool SetSendQueuePolicy(SendQueuePolicy send_queue_policy) {
+    if (is_listening_) {
+      return false;
+    }
+    send_queue_policy_ = send_queue_policy;
+    return true;
+  }
+
+  SendQueuePolicy GetSendQueuePolicy() {
+    return send_queue_policy_;
+  }
+
+  bool SetListenBacklog(int32_t listen_backlog) {
+    if (is_listening_ || listen_backlog <= 0) {
+      return false;
+    }
+    listen_backlog_ = listen_backlog;
+    return true;
+  }
+
+  int32_t GetListenBacklog() {
+    return listen_backlog_;
+  }
+
+  // Disables Nagle's algorithm on accepted connections, on by default
+  bool SetNoDelay(bool is_no_delay) {
+    if (is_listening_) {
+      return false;
+    }
+    is_no_delay_ = is_no_delay;
+    return true;
+  }
+
+  bool IsNoDelay() {
+    return is_no_delay_;
+  }
+
+  // Also accepts connections on a Unix domain socket at the path, a stale
+  // socket there is replaced. Empty listens on the port only, which is the
+  // default. Only while stopped.
+  bool SetLocalPath(const std::string &local_path) {
+    if (is_listening_) {
+      return false;
+    }
+    local_path_ = local_path;
+    return true;
+  }
+
+  std::string GetLocalPath() {
+    return local_path_;
+  }
+
+  // Kernel buffer sizes of accepted connections in bytes, 0 keeps the
+  // system default
+  bool SetSocketBufferSizes(int32_t send_buffer_size,
+    int32_t receive_buffer_size) {
+    if (is_listening_ || send_buffer_size < 0 || receive_buffer_size < 0) {
+      return false;
+    }
+    send_buffer_size_ = send_buffer_size;
+    receive_buffer_size_ = receive_buffer_size;
+    return true;
+  }
+
+  // Clients that sent nothing for this many milliseconds raise OnClientIdle,
+  // and are disconnected if they still didn't after as long again. 0 turns
+  // it off, which is the default.
+  bool SetIdleTimeout(uint64_t idle_timeout) {
+    if (is_listening_) {
+      return false;
+    }
+    idle_timeout_ = idle_timeout;
+    return true;
+  }
+
+  uint64_t GetIdleTimeout() {
+    return idle_timeout_;
+  }
+
+  // Connections per second and burst every address may open, over it they
+  // are closed right after they were accepted. A rate of 0 turns it off,
+  // which is the default. Can be changed while listening.
+  bool SetConnectionRateLimit(double rate, double burst) {
+    return connection_limiter_.SetLimit(rate, burst);
+  }
+
   Event<TcpClient &> OnClientConnected;
   Event<TcpClient &> OnClientDisconnected;
-  Event<TcpClient &, Buffer &> OnDataReceived;
+  // A connection was closed by the rate limit, raised on a reactor's thread
+  Event<IPEndpoint &> OnClientRejected;
+  // Raised on the client's reactor, the client is disconnected if a handler
+  // returns false
+  Event<TcpClient &> OnClientIdle;
+  // Receives every unconsumed byte of the connection, handlers consume the
+  // complete messages and leave partial ones for the next call
+  Event<TcpClient &, StreamBuffer &> OnDataReceived;
 };
 }
 
@@ -0,0 +1,116 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_thread_hpp_
+#define jchat_lib_thread_hpp_
+
+// Required libraries
+#include "platform.h"
+#include <cstdlib>
+#include <string>
+#include <vector>
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+#include <pthread.h>
+#endif
+#if defined(OS_LINUX)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(OS_WIN)
+#include <windows.h>
+#endif
+
+// Allocations are taken from the node of the CPU the thread runs on
+#ifndef MPOL_LOCAL
+#define MPOL_LOCAL 4
+#endif // MPOL_LOCAL
+
+namespace jchat {
+// Placement of the calling thread, for the workers of servers
+class Thread {
+public:
+  // Shown by top and perf, Linux keeps the first 15 characters
+  static bool SetName(const std::string &name) {
+#if defined(OS_LINUX)
+    return pthread_setname_np(pthread_self(),
+      name.substr(0, 15).c_str()) == 0;
+#elif defined(OS_OSX)
+    return pthread_setname_np(name.c_str()) == 0;
+#else
+    return false;
+#endif
+  }
+
+  // Keeps the thread on the CPU. Memory the thread allocates later comes
+  // from the CPU's NUMA node, so the thread should be placed before it
+  // allocates what it uses.
+  static bool SetCpu(int cpu) {
+    if (cpu < 0) {
+      return false;
+    }
+#if defined(OS_LINUX)
+    if (cpu >= CPU_SETSIZE) {
+      return false;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+      return false;
+    }
+    // Overrides a policy the process was started with, such as interleave,
+    // hosts that are not NUMA fail this and don't need it
+    syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0);
+    return true;
+#elif defined(OS_WIN)
+    if (cpu >= static_cast<int>(sizeof(DWORD_PTR) * 8)) {
+      return false;
+    }
+    return SetThreadAffinityMask(GetCurrentThread(),
+      static_cast<DWORD_PTR>(1) << cpu) != 0;
+#else
+    return false;
+#endif
+  }
+
+  // Lists like 0-3,8,10-11, in the order they are given
+  static bool ParseCpuList(const std::string &list,
+    std::vector<int> &out_cpus) {
+    out_cpus.clear();
+    size_t start = 0;
+    while (start <= list.size()) {
+      size_t end = list.find(',', start);
+      if (end == std::string::npos) {
+        end = list.size();
+      }
+      std::string range = list.substr(start, end - start);
+      const char *text = range.c_str();
+      char *number_end = nullptr;
+      long first = strtol(text, &number_end, 10);
+      long last = first;
+      bool is_valid = number_end != text && first >= 0;
+      if (is_valid && *number_end == '-') {
+        const char *last_text = number_end + 1;
+        last = strtol(last_text, &number_end, 10);
+        is_valid = number_end != last_text;
+      }
+      if (!is_valid || *number_end != '\0' || last < first || last > 4095) {
+        out_cpus.clear();
+        return false;
+      }
+      for (long cpu = first; cpu <= last; cpu++) {
+        out_cpus.push_back(static_cast<int>(cpu));
+      }
+      start = end + 1;
+    }
+    return !out_cpus.empty();
+  }
+};
+}
+
+#endif // jchat_lib_thread_hpp_
@@ -0,0 +1,217 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_timer_wheel_hpp_
+#define jchat_lib_timer_wheel_hpp_
+
+// Required libraries
+#include <chrono>
+#include <stdint.h>
+
+namespace jchat {
+// Timers of many connections with constant time start and stop. The wheel
+// has levels of 64 slots, a slot of the first level is one tick wide and the
+// slots of every level above are 64 times wider than the ones below. When
+// the first level wraps around, the next slot of the level above is spread
+// over it, so a timer is moved at most once per level. Timers further out
+// than the wheel reaches wait in its top level and are placed again.
+// NOTE: Not thread safe, a wheel belongs to the thread that advances it.
+class TimerWheel {
+public:
+  // Embedded in the object it times, the wheel never allocates
+  class Timer {
+    friend class TimerWheel;
+
+    Timer *previous_;
+    Timer *next_;
+    uint64_t due_tick_;
+
+  public:
+    // Handed back when the timer fires
+    void *Data;
+
+    Timer() : previous_(nullptr), next_(nullptr), due_tick_(0),
+      Data(nullptr) {
+    }
+
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+
+    bool IsActive() {
+      return next_ != nullptr;
+    }
+  };
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  static const size_t kLevelBits = 6;
+  static const size_t kSlotCount = 1 << kLevelBits;
+  static const size_t kLevelCount = 4;
+
+  // Every slot is the head of a circular list
+  Timer slots_[kLevelCount][kSlotCount];
+  Clock::time_point start_time_;
+  uint64_t tick_milliseconds_;
+  uint64_t tick_;
+  size_t timer_count_;
+
+  uint64_t getElapsedTicks() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<
+      std::chrono::milliseconds>(Clock::now() - start_time_).count())
+      / tick_milliseconds_;
+  }
+
+  void link(Timer &timer) {
+    uint64_t delta = timer.due_tick_ - tick_;
+    uint64_t slot_tick = timer.due_tick_;
+    size_t level = 0;
+    while (level < kLevelCount - 1
+      && delta >= (1ull << (kLevelBits * (level + 1)))) {
+      level++;
+    }
+    if (delta >= (1ull << (kLevelBits * kLevelCount))) {
+      slot_tick = tick_ + (1ull << (kLevelBits * kLevelCount)) - 1;
+    }
+
+    Timer &head = slots_[level][(slot_tick >> (kLevelBits * level))
+      & (kSlotCount - 1)];
+    timer.previous_ = head.previous_;
+    timer.next_ = &head;
+    head.previous_->next_ = &timer;
+    head.previous_ = &timer;
+  }
+
+  void unlink(Timer &timer) {
+    timer.previous_->next_ = timer.next_;
+    timer.next_->previous_ = timer.previous_;
+    timer.previous_ = nullptr;
+    timer.next_ = nullptr;
+  }
+
+  // Moves the slot's timers to a list of their own first, so placing them
+  // again or firing them can't add to the slot while it is walked
+  void take(Timer &head, Timer &out_list) {
+    if (head.next_ == &head) {
+      out_list.previous_ = &out_list;
+      out_list.next_ = &out_list;
+      return;
+    }
+    out_list.next_ = head.next_;
+    out_list.previous_ = head.previous_;
+    out_list.next_->previous_ = &out_list;
+    out_list.previous_->next_ = &out_list;
+    head.previous_ = &head;
+    head.next_ = &head;
+  }
+
+  template<typename _TCallback>
+  void advanceTick(_TCallback &callback) {
+    tick_++;
+
+    // Spread the next slot of every level that wrapped around over the
+    // levels below it
+    Timer list;
+    for (size_t level = 1; level < kLevelCount; level++) {
+      size_t shift = kLevelBits * level;
+      if ((tick_ & ((1ull << shift) - 1)) != 0) {
+        break;
+      }
+      take(slots_[level][(tick_ >> shift) & (kSlotCount - 1)], list);
+      while (list.next_ != &list) {
+        Timer &timer = *list.next_;
+        unlink(timer);
+        link(timer);
+      }
+    }
+
+    // Every timer in the slot is due now. Callbacks may start and stop any
+    // timer, including the ones still in the list.
+    take(slots_[0][tick_ & (kSlotCount - 1)], list);
+    while (list.next_ != &list) {
+      Timer &timer = *list.next_;
+      unlink(timer);
+      timer_count_--;
+      callback(timer);
+    }
+  }
+
+public:
+  explicit TimerWheel(uint64_t tick_milliseconds)
+    : start_time_(Clock::now()),
+    tick_milliseconds_(tick_milliseconds > 0 ? tick_milliseconds : 1),
+    tick_(0), timer_count_(0) {
+    for (size_t level = 0; level < kLevelCount; level++) {
+      for (size_t slot = 0; slot < kSlotCount; slot++) {
+        slots_[level][slot].previous_ = &slots_[level][slot];
+        slots_[level][slot].next_ = &slots_[level][slot];
+      }
+    }
+  }
+
+  TimerWheel(const TimerWheel &) = delete;
+  TimerWheel &operator=(const TimerWheel &) = delete;
+
+  // Restarts the timer if it was running. It fires on the first tick at
+  // least the delay from the current time, which is rounded down to a tick.
+  void Start(Timer &timer, uint64_t delay_milliseconds) {
+    if (timer.IsActive()) {
+      unlink(timer);
+    } else {
+      timer_count_++;
+    }
+    uint64_t delay_ticks = (delay_milliseconds + tick_milliseconds_ - 1)
+      / tick_milliseconds_;
+    timer.due_tick_ = tick_ + (delay_ticks > 0 ? delay_ticks : 1);
+    link(timer);
+  }
+
+  void Stop(Timer &timer) {
+    if (timer.IsActive()) {
+      unlink(timer);
+      timer_count_--;
+    }
+  }
+
+  // Fires the timers that are due, in tick order
+  template<typename _TCallback>
+  void Advance(_TCallback callback) {
+    uint64_t target_tick = getElapsedTicks();
+    if (timer_count_ == 0 && target_tick > tick_) {
+      tick_ = target_tick;
+      return;
+    }
+    while (tick_ < target_tick) {
+      advanceTick(callback);
+    }
+  }
+
+  // Milliseconds until the next tick, or -1 if no timer is running
+  int32_t GetTimeout() {
+    if (timer_count_ == 0) {
+      return -1;
+    }
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      Clock::now() - start_time_).count();
+    int64_t timeout = static_cast<int64_t>((tick_ + 1) * tick_milliseconds_)
+      - elapsed;
+    return timeout > 0 ? static_cast<int32_t>(timeout) : 0;
+  }
+
+  // The current time of the wheel in milliseconds, only moves on Advance
+  uint64_t GetTime() {
+    return tick_ * tick_milliseconds_;
+  }
+
+  size_t GetTimerCount() {
+    return timer_count_;
+  }
+};
+}
+
+#endif // jchat_lib_timer_wheel_hpp_
@@ -0,0 +1,64 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_token_bucket_hpp_
+#define jchat_lib_token_bucket_hpp_
+
+// Required libraries
+#include <algorithm>
+#include <chrono>
+
+namespace jchat {
+// Tokens that come back at a rate per second up to a burst, one is taken for
+// everything that is admitted. The rate and burst are passed in by the owner,
+// which keeps them for all of its buckets. It has no lock of its own.
+class TokenBucket {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+private:
+  double tokens_;
+  Clock::time_point update_time_;
+
+public:
+  TokenBucket(double tokens = 0) : tokens_(tokens),
+    update_time_(Clock::now()) {
+  }
+
+  void Refill(double rate, double burst, Clock::time_point now) {
+    double seconds = std::chrono::duration<double>(now - update_time_).count();
+    tokens_ = std::min(burst, tokens_ + seconds * rate);
+    update_time_ = now;
+  }
+
+  // Returns false if there was no token left
+  bool Take(double rate, double burst, Clock::time_point now) {
+    Refill(rate, burst, now);
+    if (tokens_ < 1) {
+      return false;
+    }
+    tokens_ -= 1;
+    return true;
+  }
+
+  // How long until a token can be taken, as of the last refill
+  std::chrono::milliseconds GetWaitTime(double rate) {
+    if (tokens_ >= 1 || rate <= 0) {
+      return std::chrono::milliseconds(0);
+    }
+    return std::chrono::milliseconds(static_cast<int64_t>(
+      (1 - tokens_) * 1000 / rate) + 1);
+  }
+
+  bool IsFull(double burst) {
+    return tokens_ >= burst;
+  }
+};
+}
+
+#endif // jchat_lib_token_bucket_hpp_
@@ -0,0 +1,141 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_lib_utf8_hpp_
+#define jchat_lib_utf8_hpp_
+
+// Required libraries
+#include <string>
+#include <stdint.h>
+#include <string.h>
+
+// Define JCHAT_UTF8_SCALAR to check a byte at a time everywhere
+#if !defined(JCHAT_UTF8_SCALAR) && (defined(__SSE2__) || defined(_M_X64) \
+  || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define JCHAT_UTF8_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace jchat {
+class Utf8 {
+  // Bytes checked one at a time before trying whole blocks again, so text
+  // that is mostly not ASCII doesn't try a block for every character
+  static const size_t kScalarRun = 16;
+
+  // The size of the valid character at the start of the data, 0 if it
+  // isn't one. Overlong forms, surrogates and anything past U+10FFFF are
+  // invalid.
+  static size_t get_character_size(const uint8_t *data, size_t size) {
+    uint8_t first = data[0];
+    if (first < 0x80) {
+      return 1;
+    }
+
+    size_t character_size = 0;
+    uint8_t second_min = 0x80, second_max = 0xBF;
+    if (first >= 0xC2 && first <= 0xDF) {
+      character_size = 2;
+    } else if (first >= 0xE0 && first <= 0xEF) {
+      character_size = 3;
+      if (first == 0xE0) {
+        second_min = 0xA0;
+      } else if (first == 0xED) {
+        second_max = 0x9F;
+      }
+    } else if (first >= 0xF0 && first <= 0xF4) {
+      character_size = 4;
+      if (first == 0xF0) {
+        second_min = 0x90;
+      } else if (first == 0xF4) {
+        second_max = 0x8F;
+      }
+    } else {
+      return 0;
+    }
+
+    if (character_size > size || data[1] < second_min
+      || data[1] > second_max) {
+      return 0;
+    }
+    for (size_t i = 2; i < character_size; i++) {
+      if ((data[i] & 0xC0) != 0x80) {
+        return 0;
+      }
+    }
+    return character_size;
+  }
+
+  // C0 controls, DEL and C1 controls
+  static bool is_control(const uint8_t *data, size_t character_size) {
+    if (character_size == 1) {
+      return data[0] < 0x20 || data[0] == 0x7F;
+    }
+    return character_size == 2 && data[0] == 0xC2 && data[1] <= 0x9F;
+  }
+
+public:
+  // Drops control characters and moves the rest to the front. Returns
+  // false, leaving the data partly changed, if it isn't valid UTF-8.
+  // Printable ASCII is checked and moved 16 bytes at a time where SSE2 is
+  // there.
+  static bool Sanitize(char *text, size_t &size) {
+    uint8_t *data = reinterpret_cast<uint8_t *>(text);
+    size_t read = 0, write = 0;
+    while (read < size) {
+#if defined(JCHAT_UTF8_SSE2)
+      // Bytes over 0x1F as signed bytes are printable ASCII or DEL
+      const __m128i control_max = _mm_set1_epi8(0x1F);
+      const __m128i del = _mm_set1_epi8(0x7F);
+      while (read + 16 <= size) {
+        __m128i block = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(data + read));
+        __m128i printable = _mm_andnot_si128(_mm_cmpeq_epi8(block, del),
+          _mm_cmpgt_epi8(block, control_max));
+        if (_mm_movemask_epi8(printable) != 0xFFFF) {
+          break;
+        }
+        if (write != read) {
+          _mm_storeu_si128(reinterpret_cast<__m128i *>(data + write), block);
+        }
+        read += 16;
+        write += 16;
+      }
+#endif
+
+      size_t run_end = read + kScalarRun < size ? read + kScalarRun : size;
+      while (read < run_end) {
+        size_t character_size = get_character_size(data + read,
+          size - read);
+        if (character_size == 0) {
+          return false;
+        }
+        if (!is_control(data + read, character_size)) {
+          if (write != read) {
+            memmove(data + write, data + read, character_size);
+          }
+          write += character_size;
+        }
+        read += character_size;
+      }
+    }
+    size = write;
+    return true;
+  }
+
+  static bool Sanitize(std::string &text) {
+    size_t size = text.size();
+    if (!Sanitize(&text[0], size)) {
+      return false;
+    }
+    text.resize(size);
+    return true;
+  }
+};
+}
+
+#endif // jchat_lib_utf8_hpp_
@@ -10,36 +10,132 @@
 #define jchat_lib_utility_hpp_
 
 // Required libraries
-#include <cstdlib>
-#include <ctime>
-#include <mutex>
-#include <sstream>
-#include <iomanip>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <stdint.h>
+#include <string.h>
 
 namespace jchat {
 class Utility {
+  // wyhash, version final4
+  static const uint64_t kSecret0 = 0x2d358dccaa6c78a5ull;
+  static const uint64_t kSecret1 = 0x8bb84b93962eacc9ull;
+  static const uint64_t kSecret2 = 0x4b33a62ed433d4a3ull;
+  static const uint64_t kSecret3 = 0x4d5a2da51de1aa47ull;
+
+  // The 128 bit product of the two, low half in a and high half in b
+  static void multiply(uint64_t &a, uint64_t &b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = static_cast<__uint128_t>(a) * b;
+    a = static_cast<uint64_t>(product);
+    b = static_cast<uint64_t>(product >> 64);
+#else
+    uint64_t a_high = a >> 32, a_low = static_cast<uint32_t>(a);
+    uint64_t b_high = b >> 32, b_low = static_cast<uint32_t>(b);
+    uint64_t high = a_high * b_high, middle0 = a_high * b_low;
+    uint64_t middle1 = a_low * b_high, low = a_low * b_low;
+    uint64_t cross = (low >> 32) + static_cast<uint32_t>(middle0)
+      + static_cast<uint32_t>(middle1);
+    a = (cross << 32) | static_cast<uint32_t>(low);
+    b = high + (middle0 >> 32) + (middle1 >> 32) + (cross >> 32);
+#endif
+  }
+
+  static uint64_t mix(uint64_t a, uint64_t b) {
+    multiply(a, b);
+    return a ^ b;
+  }
+
+  // Little endian reads, so every host hashes the same bytes the same way
+  static uint64_t read64(const uint8_t *data) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+  }
+
+  static uint64_t read32(const uint8_t *data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+  }
+
+  static uint64_t &get_random_state() {
+    // Every thread seeds its own state the first time it is used
+    static thread_local uint64_t state = std::random_device()()
+      ^ (static_cast<uint64_t>(std::random_device()()) << 32)
+      ^ static_cast<uint64_t>(std::chrono::steady_clock::now()
+        .time_since_epoch().count())
+      ^ std::hash<std::thread::id>()(std::this_thread::get_id());
+    return state;
+  }
+
 public:
+  // wyrand, not for anything that has to be unpredictable
+  static uint64_t RandomUInt64() {
+    uint64_t &state = get_random_state();
+    state += kSecret0;
+    return mix(state, state ^ kSecret1);
+  }
+
   static uint32_t Random(uint32_t min, uint32_t max) {
-    static bool seeded = false;
-    static std::mutex mutex;
-    mutex.lock();
-    if (!seeded) {
-      srand(time(0));
-      seeded = true;
-    }
-    uint32_t random = (rand() % (max - min + 1)) + min;
-    mutex.unlock();
-    return random;
+    uint64_t range = static_cast<uint64_t>(max - min) + 1;
+    return min + static_cast<uint32_t>(((RandomUInt64() >> 32) * range) >> 32);
   }
 
+  // wyhash. Tables keyed by something clients choose should pass a key
+  // they can't guess, such as GetProcessKey, or use StringHash.
   template<typename _TData>
-  static uint64_t Hash(_TData *data, size_t size) {
-    uint64_t output = size * size;
-    char *ptr_data = (char *)data;
-    while (size--) {
-      output |= 0xFF ^ ptr_data[size];
+  static uint64_t Hash(_TData *data, size_t size, uint64_t key = 0) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+    uint64_t seed = key ^ mix(key ^ kSecret0, kSecret1);
+    uint64_t a = 0, b = 0;
+    if (size <= 16) {
+      if (size >= 4) {
+        size_t middle = (size >> 3) << 2;
+        a = (read32(bytes) << 32) | read32(bytes + middle);
+        b = (read32(bytes + size - 4) << 32)
+          | read32(bytes + size - 4 - middle);
+      } else if (size > 0) {
+        a = (static_cast<uint64_t>(bytes[0]) << 16)
+          | (static_cast<uint64_t>(bytes[size >> 1]) << 8) | bytes[size - 1];
+      }
+    } else {
+      size_t remaining = size;
+      if (remaining >= 48) {
+        // Three lanes that don't depend on each other, so their multiplies
+        // overlap
+        uint64_t seed1 = seed, seed2 = seed;
+        do {
+          seed = mix(read64(bytes) ^ kSecret1, read64(bytes + 8) ^ seed);
+          seed1 = mix(read64(bytes + 16) ^ kSecret2,
+            read64(bytes + 24) ^ seed1);
+          seed2 = mix(read64(bytes + 32) ^ kSecret3,
+            read64(bytes + 40) ^ seed2);
+          bytes += 48;
+          remaining -= 48;
+        } while (remaining >= 48);
+        seed ^= seed1 ^ seed2;
+      }
+      while (remaining > 16) {
+        seed = mix(read64(bytes) ^ kSecret1, read64(bytes + 8) ^ seed);
+        bytes += 16;
+        remaining -= 16;
+      }
+      a = read64(bytes + remaining - 16);
+      b = read64(bytes + remaining - 8);
     }
-    return output;
+    a ^= kSecret1;
+    b ^= seed;
+    multiply(a, b);
+    return mix(a ^ kSecret0 ^ size, b ^ kSecret1);
   }
 
   template<typename _TData>
@@ -47,11 +143,32 @@ public:
     return Hash(&data, sizeof(data));
   }
 
+  // A random key picked once for this process
+  static uint64_t GetProcessKey() {
+    static const uint64_t key = std::random_device()()
+      ^ (static_cast<uint64_t>(std::random_device()()) << 32);
+    return key;
+  }
+
+  // For unordered containers of strings clients send, keyed with the
+  // process key so they can't pick strings that all collide
+  struct StringHash {
+    size_t operator()(const std::string &string) const {
+      return static_cast<size_t>(Hash(string.data(), string.size(),
+        GetProcessKey()));
+    }
+  };
+
+  // The hash as 16 hex digits
   template<typename _TData>
-  static std::string HashString(_TData *data, size_t size) {
-    std::stringstream output;
-    output << std::hex << Hash(data, size);
-    return output.str();
+  static std::string HashString(_TData *data, size_t size, uint64_t key = 0) {
+    static const char digits[] = "0123456789abcdef";
+    uint64_t hash = Hash(data, size, key);
+    std::string output(16, '0');
+    for (size_t i = 16; i-- > 0; hash >>= 4) {
+      output[i] = digits[hash & 0xF];
+    }
+    return output;
   }
 
   template<typename _TData>
@@ -0,0 +1,40 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_microbench_frame_decode_benchmark_h_
+#define jchat_microbench_frame_decode_benchmark_h_
+
+// Required libraries
+#include "chat_server.h"
+#include "stream_buffer.hpp"
+#include <memory>
+#include <vector>
+
+namespace jchat {
+// Feeds a received chunk of pipelined frames to ChatServer::onDataReceived
+// without a socket. The frames are user messages handled by a component
+// that only reads them, so the framing and decoding is what gets measured.
+class FrameDecodeBenchmark {
+  ChatServer server_;
+  std::shared_ptr<TcpClient> connection_;
+  StreamBuffer stream_;
+  std::vector<uint8_t> chunk_;
+
+public:
+  FrameDecodeBenchmark(WireFormat format, size_t frame_count,
+    size_t message_size);
+  ~FrameDecodeBenchmark();
+
+  size_t GetChunkSize();
+  // Decodes the chunk once per iteration, returns false if the server
+  // dropped the connection or the chunk did not fit
+  bool Run(uint64_t iterations);
+};
+}
+
+#endif // jchat_microbench_frame_decode_benchmark_h_
@@ -0,0 +1,64 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_microbench_microbench_h_
+#define jchat_microbench_microbench_h_
+
+// Required libraries
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace jchat {
+// Keeps the compiler from optimizing away a value a benchmark computed
+template<typename _TValue>
+inline void DoNotOptimize(const _TValue &value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r"(&value) : "memory");
+#else
+  static volatile const void *sink;
+  sink = &value;
+#endif
+}
+
+struct MicrobenchResult {
+  std::string Name;
+  // Iterations of every repetition
+  uint64_t Iterations;
+  // Nanoseconds per iteration of the fastest and the median repetition
+  double MinNanoseconds;
+  double MedianNanoseconds;
+  // Bytes one iteration processes, 0 if it does not apply
+  uint64_t BytesPerIteration;
+};
+
+// Runs benchmark functions, each is given the number of iterations to run.
+// The iteration count is doubled until a run takes at least the minimum
+// time, then that count is repeated and the repetitions are summarized.
+class Microbench {
+  std::string filter_;
+  double min_seconds_;
+  size_t repetitions_;
+  std::vector<MicrobenchResult> results_;
+
+public:
+  Microbench(const std::string &filter, double min_seconds,
+    size_t repetitions);
+
+  // Benchmarks whose name does not contain the filter are skipped
+  void Run(const std::string &name, uint64_t bytes_per_iteration,
+    std::function<void(uint64_t iterations)> function);
+
+  const std::vector<MicrobenchResult> &GetResults();
+  void WriteJson(std::ostream &stream);
+};
+}
+
+#endif // jchat_microbench_microbench_h_
@@ -0,0 +1,102 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#include "frame_decode_benchmark.h"
+#include "microbench.h"
+#include "protocol/components/user_message_type.h"
+
+namespace jchat {
+class SinkComponent : public ChatComponent {
+public:
+  virtual bool Initialize(ChatServer &server) override {
+    return true;
+  }
+
+  virtual bool Shutdown() override {
+    return true;
+  }
+
+  virtual bool OnStart() override {
+    return true;
+  }
+
+  virtual bool OnStop() override {
+    return true;
+  }
+
+  virtual void OnClientConnected(RemoteChatClient &client) override {
+  }
+
+  virtual void OnClientDisconnected(RemoteChatClient &client) override {
+  }
+
+  virtual void OnClientResumed(RemoteChatClient &client,
+    RemoteChatClient &session) override {
+  }
+
+  virtual ComponentType GetType() override {
+    return kComponentType_User;
+  }
+
+  // Reads the body the way the user component reads a message
+  virtual bool Handle(RemoteChatClient &client, uint16_t message_type,
+    TypedBufferView &buffer) override {
+    std::string username;
+    std::string message;
+    if (!buffer.ReadString(username) || !buffer.ReadString(message)) {
+      return false;
+    }
+    DoNotOptimize(message);
+    return true;
+  }
+};
+
+FrameDecodeBenchmark::FrameDecodeBenchmark(WireFormat format,
+  size_t frame_count, size_t message_size) : server_("127.0.0.1", 0) {
+  server_.AddComponent(std::make_shared<SinkComponent>());
+
+  // The socket is never connected, it only has to be valid until the
+  // connection closes it
+  sockaddr_in endpoint;
+  memset(&endpoint, 0, sizeof(endpoint));
+  connection_ = std::make_shared<TcpClient>(socket(AF_INET, SOCK_STREAM, 0),
+    endpoint, endpoint);
+  server_.onClientConnected(*connection_);
+  server_.clients_[connection_.get()]->ReceiveFormat = format;
+
+  TypedBuffer body = server_.CreateBuffer();
+  body.WriteString("microbench");
+  body.WriteString(std::string(message_size, 'x'));
+  std::shared_ptr<Packet> packet = server_.CreatePacket(kComponentType_User,
+    kUserMessageType_SendMessage, body, format);
+  for (size_t i = 0; i < frame_count; i++) {
+    chunk_.insert(chunk_.end(), packet->GetData(),
+      packet->GetData() + packet->GetSize());
+  }
+  // The whole chunk has to fit in the stream, like a single large read
+  stream_ = StreamBuffer(chunk_.size(), chunk_.size() * 2);
+}
+
+FrameDecodeBenchmark::~FrameDecodeBenchmark() {
+  server_.onClientDisconnected(*connection_);
+}
+
+size_t FrameDecodeBenchmark::GetChunkSize() {
+  return chunk_.size();
+}
+
+bool FrameDecodeBenchmark::Run(uint64_t iterations) {
+  for (uint64_t i = 0; i < iterations; i++) {
+    if (!stream_.Write(chunk_.data(), chunk_.size())
+      || !server_.onDataReceived(*connection_, stream_)) {
+      return false;
+    }
+  }
+  return true;
+}
+}
@@ -0,0 +1,199 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+// Required libraries
+#include "command_line.hpp"
+#include "buffer.hpp"
+#include "typed_buffer.hpp"
+#include "microbench.h"
+#include "frame_decode_benchmark.h"
+#include <fstream>
+#include <iostream>
+
+// Values written or read by one iteration of the integer benchmarks
+#define JCHAT_MICROBENCH_VALUE_COUNT 256
+
+// Frames in the chunk one iteration of the frame decode benchmarks decodes
+#define JCHAT_MICROBENCH_FRAME_COUNT 256
+
+static void RunBufferBenchmarks(jchat::Microbench &microbench) {
+  const bool flip_endians[] = { false, true };
+  for (bool flip_endian : flip_endians) {
+    std::string suffix = flip_endian ? "_flip" : "";
+
+    // A new buffer every iteration, so it includes growing the buffer like
+    // building a message does
+    microbench.Run("buffer_write_uint32" + suffix,
+      JCHAT_MICROBENCH_VALUE_COUNT * sizeof(uint32_t),
+      [flip_endian](uint64_t iterations) {
+      for (uint64_t i = 0; i < iterations; i++) {
+        jchat::Buffer buffer(flip_endian);
+        for (uint32_t j = 0; j < JCHAT_MICROBENCH_VALUE_COUNT; j++) {
+          buffer.Write(j);
+        }
+        jchat::DoNotOptimize(buffer);
+      }
+    });
+
+    microbench.Run("buffer_read_uint32" + suffix,
+      JCHAT_MICROBENCH_VALUE_COUNT * sizeof(uint32_t),
+      [flip_endian](uint64_t iterations) {
+      jchat::Buffer buffer(flip_endian);
+      for (uint32_t j = 0; j < JCHAT_MICROBENCH_VALUE_COUNT; j++) {
+        buffer.Write(j);
+      }
+      for (uint64_t i = 0; i < iterations; i++) {
+        buffer.Rewind();
+        uint32_t value = 0;
+        for (uint32_t j = 0; j < JCHAT_MICROBENCH_VALUE_COUNT; j++) {
+          buffer.Read(&value);
+          jchat::DoNotOptimize(value);
+        }
+      }
+    });
+
+    // Byte arrays are copied as they are, wider elements are flipped one by
+    // one when the endian order differs
+    const size_t sizes[] = { 16, 256, 4096 };
+    for (size_t size : sizes) {
+      std::vector<char> chars(size, 'x');
+      microbench.Run("buffer_write_array_char_" + std::to_string(size)
+        + suffix, size, [flip_endian, &chars](uint64_t iterations) {
+        jchat::Buffer buffer(flip_endian);
+        for (uint64_t i = 0; i < iterations; i++) {
+          buffer.Rewind();
+          buffer.WriteArray(chars.data(), chars.size());
+          jchat::DoNotOptimize(buffer);
+        }
+      });
+
+      std::vector<uint16_t> values(size / sizeof(uint16_t), 1);
+      microbench.Run("buffer_write_array_uint16_" + std::to_string(size)
+        + suffix, size, [flip_endian, &values](uint64_t iterations) {
+        jchat::Buffer buffer(flip_endian);
+        for (uint64_t i = 0; i < iterations; i++) {
+          buffer.Rewind();
+          buffer.WriteArray(values.data(), values.size());
+          jchat::DoNotOptimize(buffer);
+        }
+      });
+    }
+  }
+}
+
+template<typename _TValue>
+static void RunFlipEndianBenchmark(jchat::Microbench &microbench,
+  const std::string &name) {
+  std::vector<_TValue> values(JCHAT_MICROBENCH_VALUE_COUNT);
+  microbench.Run(name, values.size() * sizeof(_TValue),
+    [&values](uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+      for (_TValue &value : values) {
+        jchat::Buffer::FlipEndian(&value, sizeof(value));
+      }
+      jchat::DoNotOptimize(values);
+    }
+  });
+}
+
+struct UInt128 {
+  uint64_t Values[2];
+};
+
+static void RunFlipEndianBenchmarks(jchat::Microbench &microbench) {
+  RunFlipEndianBenchmark<uint16_t>(microbench, "flip_endian_2");
+  RunFlipEndianBenchmark<uint32_t>(microbench, "flip_endian_4");
+  RunFlipEndianBenchmark<uint64_t>(microbench, "flip_endian_8");
+  // Sizes without a byte swap instruction reverse the bytes in a loop
+  RunFlipEndianBenchmark<UInt128>(microbench, "flip_endian_16");
+}
+
+static void RunTypedBufferBenchmarks(jchat::Microbench &microbench) {
+  const size_t sizes[] = { 8, 64, 512, 4096 };
+  for (size_t size : sizes) {
+    std::string string(size, 'x');
+
+    microbench.Run("typed_buffer_write_string_" + std::to_string(size), size,
+      [&string](uint64_t iterations) {
+      jchat::TypedBuffer buffer;
+      for (uint64_t i = 0; i < iterations; i++) {
+        buffer.Rewind();
+        buffer.WriteString(string);
+        jchat::DoNotOptimize(buffer);
+      }
+    });
+
+    microbench.Run("typed_buffer_read_string_" + std::to_string(size), size,
+      [&string](uint64_t iterations) {
+      jchat::TypedBuffer buffer;
+      buffer.WriteString(string);
+      std::string value;
+      for (uint64_t i = 0; i < iterations; i++) {
+        buffer.Rewind();
+        buffer.ReadString(value);
+        jchat::DoNotOptimize(value);
+      }
+    });
+  }
+}
+
+static void RunFrameDecodeBenchmarks(jchat::Microbench &microbench) {
+  const jchat::WireFormat formats[] = {
+    jchat::kWireFormat_Tagged, jchat::kWireFormat_Compact
+  };
+  const size_t sizes[] = { 16, 256, 4096 };
+  for (jchat::WireFormat format : formats) {
+    for (size_t size : sizes) {
+      jchat::FrameDecodeBenchmark benchmark(format,
+        JCHAT_MICROBENCH_FRAME_COUNT, size);
+      std::string name = "frame_decode_"
+        + std::string(format == jchat::kWireFormat_Tagged ? "tagged"
+        : "compact") + "_" + std::to_string(size);
+      microbench.Run(name, benchmark.GetChunkSize(),
+        [&benchmark, &name](uint64_t iterations) {
+        if (!benchmark.Run(iterations)) {
+          std::cerr << name << ": The chunk was not decoded" << std::endl;
+        }
+      });
+    }
+  }
+}
+
+// Program entrypoint
+int main(int argc, char **argv) {
+  jchat::CommandLine command_line(argc, argv);
+
+  // Benchmarks are selected by a substring of their name
+  std::string filter = command_line.GetString("filter", "");
+  double min_seconds = command_line.GetInt32("mintime", 100) / 1000.0;
+  int32_t repetitions = command_line.GetInt32("repetitions", 5);
+  std::string output_path = command_line.GetString("output", "");
+
+  jchat::Microbench microbench(filter, min_seconds,
+    repetitions < 1 ? 1 : static_cast<size_t>(repetitions));
+  RunBufferBenchmarks(microbench);
+  RunFlipEndianBenchmarks(microbench);
+  RunTypedBufferBenchmarks(microbench);
+  RunFrameDecodeBenchmarks(microbench);
+
+  // The results go to stdout unless a file is given, so they can be piped
+  // into other tools
+  if (output_path.empty()) {
+    microbench.WriteJson(std::cout);
+    return 0;
+  }
+  std::ofstream output(output_path);
+  if (!output) {
+    std::cerr << "Failed to open " << output_path << std::endl;
+    return 1;
+  }
+  microbench.WriteJson(output);
+  std::cout << "Wrote " << microbench.GetResults().size()
+            << " results to " << output_path << std::endl;
+  return 0;
+}
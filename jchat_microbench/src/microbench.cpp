@@ -0,0 +1,84 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#include "microbench.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+namespace jchat {
+static double TimeRun(std::function<void(uint64_t)> &function,
+  uint64_t iterations) {
+  std::chrono::steady_clock::time_point start_time =
+    std::chrono::steady_clock::now();
+  function(iterations);
+  return std::chrono::duration<double>(std::chrono::steady_clock::now()
+    - start_time).count();
+}
+
+Microbench::Microbench(const std::string &filter, double min_seconds,
+  size_t repetitions) : filter_(filter), min_seconds_(min_seconds),
+  repetitions_(repetitions < 1 ? 1 : repetitions) {
+}
+
+void Microbench::Run(const std::string &name, uint64_t bytes_per_iteration,
+  std::function<void(uint64_t iterations)> function) {
+  if (name.find(filter_) == std::string::npos) {
+    return;
+  }
+
+  // Find an iteration count that runs long enough to be timed accurately,
+  // which also warms up the caches and the allocator
+  uint64_t iterations = 1;
+  while (TimeRun(function, iterations) < min_seconds_
+    && iterations < (1ull << 40)) {
+    iterations *= 2;
+  }
+
+  std::vector<double> nanoseconds;
+  for (size_t i = 0; i < repetitions_; i++) {
+    nanoseconds.push_back(TimeRun(function, iterations) * 1e9 / iterations);
+  }
+  std::sort(nanoseconds.begin(), nanoseconds.end());
+
+  MicrobenchResult result;
+  result.Name = name;
+  result.Iterations = iterations;
+  result.MinNanoseconds = nanoseconds.front();
+  result.MedianNanoseconds = nanoseconds[nanoseconds.size() / 2];
+  result.BytesPerIteration = bytes_per_iteration;
+  results_.push_back(result);
+}
+
+const std::vector<MicrobenchResult> &Microbench::GetResults() {
+  return results_;
+}
+
+void Microbench::WriteJson(std::ostream &stream) {
+  // Names are made of identifier characters only, so they need no escaping
+  stream << "{" << std::endl;
+  stream << "  \"repetitions\": " << repetitions_ << "," << std::endl;
+  stream << "  \"benchmarks\": [";
+  for (size_t i = 0; i < results_.size(); i++) {
+    MicrobenchResult &result = results_[i];
+    stream << (i == 0 ? "" : ",") << std::endl;
+    stream << "    {\"name\": \"" << result.Name << "\", \"iterations\": "
+           << result.Iterations << std::fixed << std::setprecision(3)
+           << ", \"min_ns\": " << result.MinNanoseconds
+           << ", \"median_ns\": " << result.MedianNanoseconds;
+    if (result.BytesPerIteration > 0) {
+      stream << ", \"bytes\": " << result.BytesPerIteration
+             << ", \"mb_per_second\": " << result.BytesPerIteration * 1e3
+             / result.MedianNanoseconds;
+    }
+    stream << "}";
+    stream.unsetf(std::ios_base::floatfield);
+  }
+  stream << std::endl << "  ]" << std::endl << "}" << std::endl;
+}
+}
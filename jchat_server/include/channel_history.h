@@ -0,0 +1,73 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_server_channel_history_h_
+#define jchat_server_channel_history_h_
+
+#include "packet_set.h"
+#include <chrono>
+#include <vector>
+
+namespace jchat {
+// A message sent to a channel, kept framed so catching up a client is only
+// queueing the packet of its wire format
+struct HistoryMessage {
+  PacketSet Packets;
+  std::chrono::steady_clock::time_point Time;
+  // Increases with every message of the shard, see ChannelShard::AddHistory
+  uint64_t Sequence;
+  // Bytes of both packets
+  size_t Size;
+};
+
+// Bounds the history of the channels of a server, messages over any of them
+// are dropped oldest first
+struct HistoryLimits {
+  // Messages of a channel, 0 keeps no history at all
+  size_t MaxMessages;
+  // Bytes of a channel and of every channel together
+  size_t MaxChannelSize;
+  size_t MaxTotalSize;
+  // Zero keeps messages however old they are
+  std::chrono::steady_clock::duration MaxAge;
+};
+
+// The last messages of a channel in a ring that is allocated once, with the
+// first message
+class ChannelHistory {
+  std::vector<HistoryMessage> messages_;
+  size_t capacity_;
+  size_t first_;
+  size_t count_;
+  size_t size_;
+
+public:
+  ChannelHistory();
+
+  // Adds the message as the newest one, the oldest message has to be taken
+  // out first once the history is full
+  void Push(HistoryMessage message);
+  void PopOldest();
+  void Clear();
+
+  // Index 0 is the oldest message
+  HistoryMessage &Get(size_t index);
+  HistoryMessage &GetOldest();
+
+  // The capacity can only be changed while the history is empty
+  bool SetCapacity(size_t capacity);
+  size_t GetCapacity();
+  size_t GetCount();
+  // Bytes of all packets
+  size_t GetSize();
+  bool IsFull();
+  bool IsEmpty();
+};
+}
+
+#endif // jchat_server_channel_history_h_
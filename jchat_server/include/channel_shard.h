@@ -0,0 +1,135 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_server_channel_shard_h_
+#define jchat_server_channel_shard_h_
+
+#include "chat_channel.h"
+#include "request_context.h"
+#include "server_metrics.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <set>
+#include <thread>
+#include <unordered_map>
+
+namespace jchat {
+// Owns part of the channels and runs every operation on them, one after the
+// other, on its own thread. Channels are assigned to shards by the hash of
+// their name and are only ever touched by their shard, so they need no locks
+// and busy channels on different shards never wait on each other.
+class ChannelShard {
+  typedef std::chrono::steady_clock Clock;
+
+  std::thread worker_thread_;
+  bool is_running_;
+  std::deque<std::function<void()>> tasks_;
+  // Ordered by the time they are due at
+  std::multimap<Clock::time_point, std::function<void()>> delayed_tasks_;
+  std::mutex tasks_mutex_;
+  std::condition_variable tasks_condition_;
+  std::atomic<MetricsRegistry *> metrics_;
+  std::string thread_name_;
+  int cpu_;
+
+  // Only used by tasks running on the shard
+  std::unordered_map<std::string, std::shared_ptr<ChatChannel>,
+    Utility::StringHash> channels_;
+  // The channels of this shard every client is in, so a disconnect doesn't
+  // have to look at every channel
+  std::unordered_map<uint64_t, std::vector<std::shared_ptr<ChatChannel>>>
+    client_channels_;
+  // The subscriptions of every subscribed client, new channels are matched
+  // against all of them
+  std::unordered_map<uint64_t,
+    std::vector<std::shared_ptr<const ChannelSubscription>>>
+    client_subscriptions_;
+  // Channels with presence changes that weren't sent yet
+  std::vector<std::shared_ptr<ChatChannel>> presence_channels_;
+
+  // Channels with history by the sequence of their oldest message, so the
+  // oldest message of the shard is the first one of the first channel
+  HistoryLimits history_limits_;
+  std::set<std::pair<uint64_t, ChatChannel *>> history_channels_;
+  size_t history_size_;
+  uint64_t next_history_sequence_;
+
+  void workerLoop();
+  void popHistory(ChatChannel &channel);
+  void clearHistory(ChatChannel &channel);
+
+public:
+  ChannelShard();
+  ~ChannelShard();
+
+  bool Start();
+  // Runs the tasks that were already posted before returning, delayed tasks
+  // that are not due yet are dropped
+  bool Stop();
+
+  // Queues a task to run on the shard's thread. Tasks run in the order they
+  // were posted in, tasks posted before Start run once it is called. The task
+  // runs in the request that was current when it was posted.
+  void Post(std::function<void()> task);
+  // Queues a task to run on the shard's thread once the delay has passed,
+  // without a request
+  void PostAfter(Clock::duration delay, std::function<void()> task);
+  bool IsShardThread();
+
+  // Posts record how long they waited for the queue and how long it was
+  void SetMetrics(MetricsRegistry *metrics);
+  // The total size is this shard's share. Can only be changed while the
+  // shard is stopped.
+  bool SetHistoryLimits(const HistoryLimits &history_limits);
+  // Names the shard's thread and keeps it on the CPU, any CPU if it is -1.
+  // Can only be changed while the shard is stopped.
+  bool SetThreadPlacement(const std::string &name, int cpu);
+
+  // NOTE: These may only be called by tasks running on the shard
+  std::shared_ptr<ChatChannel> Find(const std::string &name);
+  std::shared_ptr<ChatChannel> Create(const std::string &name);
+
+  void AddClient(const std::shared_ptr<ChatChannel> &channel,
+    uint64_t client_id, const std::shared_ptr<ChatUser> &user);
+  // Also takes away operator status, the channel is removed once the last
+  // client left it unless it is stored. Returns false if the client wasn't
+  // in the channel.
+  bool RemoveClient(const std::shared_ptr<ChatChannel> &channel,
+    uint64_t client_id);
+  std::vector<std::shared_ptr<ChatChannel>> GetClientChannels(
+    uint64_t client_id);
+
+  // The subscription is added to the channels that match it now and to those
+  // created later
+  void AddSubscription(
+    const std::shared_ptr<const ChannelSubscription> &subscription);
+  // All of the client's subscriptions if the pattern is empty
+  void RemoveSubscriptions(uint64_t client_id, const std::string &pattern);
+
+  // Returns true if the channel is the first one added since the last take
+  bool AddPresenceChannel(const std::shared_ptr<ChatChannel> &channel);
+  std::vector<std::shared_ptr<ChatChannel>> TakePresenceChannels();
+
+  // Keeps the message as the channel's newest, dropping the oldest messages
+  // of the channel and then of the shard until the limits hold again
+  void AddHistory(const std::shared_ptr<ChatChannel> &channel,
+    const PacketSet &packets);
+  // Drops the messages that got too old
+  void PruneHistory();
+  size_t GetHistorySize();
+
+  std::vector<std::shared_ptr<ChatChannel>> GetChannels();
+  size_t GetChannelCount();
+  void Clear();
+};
+}
+
+#endif // jchat_server_channel_shard_h_
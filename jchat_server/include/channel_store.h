@@ -0,0 +1,112 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_server_channel_store_h_
+#define jchat_server_channel_store_h_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// Seconds between snapshots of the channels, they are only written if
+// something changed since the last one
+#ifndef JCHAT_CHANNEL_SNAPSHOT_INTERVAL
+#define JCHAT_CHANNEL_SNAPSHOT_INTERVAL 300
+#endif // JCHAT_CHANNEL_SNAPSHOT_INTERVAL
+
+// Bytes the change log may grow to before a snapshot is written early
+#ifndef JCHAT_CHANNEL_STORE_MAX_LOG_SIZE
+#define JCHAT_CHANNEL_STORE_MAX_LOG_SIZE (16 * 1024 * 1024)
+#endif // JCHAT_CHANNEL_STORE_MAX_LOG_SIZE
+
+namespace jchat {
+// What is kept of a channel across restarts, only channels with bans are
+// stored
+struct StoredChannel {
+  std::string Name;
+  // ChatUser::Identity of the users that are made operators when they join
+  std::unordered_set<std::string> Operators;
+  std::unordered_set<std::string> BannedUsers; // ChatUser::Identity
+};
+
+enum ChannelChange : uint8_t {
+  // The identity is the creator, who is the channel's first operator
+  kChannelChange_Created,
+  kChannelChange_Banned,
+  // The channel has nothing left to store, the identity is empty
+  kChannelChange_Removed,
+};
+
+// Keeps the channels in a snapshot file and a log of the changes made
+// since, both at a path prefix:
+//  - <path>.snapshot holds fixed size records that point into a block of
+//    strings. It is mapped and read in place, nothing is parsed.
+//  - <path>.log has a record appended for every change. While a snapshot
+//    is written the log is moved to <path>.log.old and a new one started.
+// Snapshots are written on a thread of their own, which asks for the
+// channels through the capture function.
+class ChannelStore {
+public:
+  typedef std::function<std::vector<StoredChannel>()> CaptureFunction;
+
+private:
+  std::string path_;
+  FILE *log_file_;
+  size_t log_size_;
+  std::mutex log_mutex_;
+
+  std::thread snapshot_thread_;
+  bool is_running_;
+  std::chrono::milliseconds snapshot_interval_;
+  CaptureFunction capture_;
+  std::condition_variable snapshot_condition_;
+
+  void snapshotLoop();
+  bool openLog();
+  bool rotateLog();
+
+public:
+  ChannelStore();
+  ~ChannelStore();
+
+  ChannelStore(const ChannelStore &) = delete;
+  ChannelStore &operator=(const ChannelStore &) = delete;
+
+  // Loads the channels of the snapshot and both logs, then writes the ones
+  // with bans to a new snapshot and starts an empty log. A store that was
+  // never written opens without channels.
+  bool Open(const std::string &path,
+    std::vector<StoredChannel> &out_channels);
+  // Stops the snapshots first
+  void Close();
+  bool IsOpen();
+
+  // Safe to call from any thread, the record is in the log once it returns
+  bool Append(ChannelChange change, const std::string &channel_name,
+    const std::string &identity);
+
+  // Replaces the snapshot and drops <path>.log.old, whose changes have to be
+  // in the channels
+  bool WriteSnapshot(const std::vector<StoredChannel> &channels);
+
+  // Writes a snapshot every interval, or sooner once the log is bigger than
+  // JCHAT_CHANNEL_STORE_MAX_LOG_SIZE. The capture function is called on the
+  // snapshot thread.
+  bool Start(std::chrono::milliseconds snapshot_interval,
+    CaptureFunction capture);
+  bool Stop();
+};
+}
+
+#endif // jchat_server_channel_store_h_
@@ -11,19 +11,67 @@
 
 #include "remote_chat_client.h"
 #include "chat_user.h"
+#include "channel_history.h"
+#include "utility.hpp"
 #include <map>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace jchat {
+// A join or leave the other members of a channel weren't told about yet
+struct PresenceChange {
+  std::shared_ptr<ChatUser> User;
+  // The client was a member before the change was started and left since
+  bool Left;
+  // The client is a member now and joined after that
+  bool Joined;
+  // ChatChannel::MemberLists when the client joined, a join nobody could
+  // have seen in a member list is dropped if the client leaves again
+  uint64_t MemberLists;
+};
+
+// A client that gets the messages of the channels whose names match the
+// pattern without joining them, from any sender unless one is given
+struct ChannelSubscription {
+  uint64_t ClientId;
+  std::string Pattern;
+  std::string Sender; // ChatUser::Username, empty for every sender
+  // Banned users get nothing of the channel either
+  std::shared_ptr<ChatUser> User;
+};
+
+// Only used by the ChannelShard that owns the channel, see ChannelComponent.
+// Clients are identified by their RemoteChatClient's id, which stays valid
+// after they disconnected.
 struct ChatChannel {
-  bool Enabled;
   std::string Name;
-  std::map<RemoteChatClient *, std::shared_ptr<ChatUser>> Operators;
-  std::mutex OperatorsMutex;
-  std::map<RemoteChatClient *, std::shared_ptr<ChatUser>> Clients;
-  std::mutex ClientsMutex;
-  std::vector<std::string> BannedUsers; // Format: username@hostname
-  std::mutex BannedUsersMutex;
+  std::unordered_set<uint64_t> Operators;
+  // Ordered by id, so the member list can be sent in pages that continue
+  // after the id of the last member of the previous page
+  std::map<uint64_t, std::shared_ptr<ChatUser>> Clients;
+  // Identified usernames are unique and never change, so members can be
+  // looked up by them
+  std::unordered_map<std::string, uint64_t, Utility::StringHash> Usernames;
+  std::unordered_set<std::string> BannedUsers; // ChatUser::Identity
+  // Made operators whenever they join, only kept while there is a store
+  std::unordered_set<std::string> OperatorIdentities; // ChatUser::Identity
+  // Kept in the ChannelStore once it has bans, and kept after the last
+  // client left
+  bool IsStored;
+
+  // By client id, sent to the members together once the presence interval
+  // ran out
+  std::unordered_map<uint64_t, PresenceChange> PresenceChanges;
+  // Member lists sent so far
+  uint64_t MemberLists;
+
+  // Subscriptions whose pattern matches the name, they are not members and
+  // only get the messages
+  std::vector<std::shared_ptr<const ChannelSubscription>> Subscribers;
+
+  // The last messages, see ChannelShard::AddHistory
+  ChannelHistory History;
 };
 }
 
@@ -12,6 +12,7 @@
 #include "protocol/component_type.h"
 #include "remote_chat_client.h"
 #include "typed_buffer.hpp"
+#include "typed_buffer_view.hpp"
 
 namespace jchat {
 class ChatServer;
@@ -27,11 +28,16 @@ public:
   // Internal events
   virtual void OnClientConnected(RemoteChatClient &client) = 0;
   virtual void OnClientDisconnected(RemoteChatClient &client) = 0;
+  // The client resumed the session, whose connection dropped earlier. What
+  // is kept for the session has to be moved to the client, the session is
+  // deleted without a disconnect afterwards. See ChatServer::ResumeSession.
+  virtual void OnClientResumed(RemoteChatClient &client,
+    RemoteChatClient &session) = 0;
 
   // Handler functions
   virtual ComponentType GetType() = 0;
   virtual bool Handle(RemoteChatClient &client, uint16_t message_type,
-    TypedBuffer &buffer) = 0;
+    TypedBufferView &buffer) = 0;
 };
 }
 
@@ -11,34 +11,125 @@
 
 // Required libraries
 #include "tcp_server.hpp"
+#include "delay_queue.hpp"
+#include "object_pool.hpp"
+#include "logger.hpp"
 #include "remote_chat_client.h"
+#include "chat_user.h"
 #include "chat_component.h"
+#include "client_relay.h"
+#include "packet_set.h"
+#include "request_context.h"
+#include "server_metrics.h"
 #include "protocol/protocol.h"
 #include "protocol/component_type.h"
-#include <map>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <unordered_map>
 
 namespace jchat {
+enum ResumeResult {
+  kResumeResult_Resumed,
+  // There is no session with the token, or it can't be resumed by the
+  // client and was ended
+  kResumeResult_InvalidSession,
+  // The session's connection is still open, it is closed so the resume can
+  // be tried again
+  kResumeResult_SessionInUse,
+};
+
 class ChatServer {
+  // Kept for an identified client that asked for resume, see ResumeSession
+  struct Session {
+    std::string Token;
+    // Set while the connection of the session is gone
+    RemoteChatClient *Client;
+    std::chrono::steady_clock::time_point Expiry;
+    // Sent to the session while it was away, framed in its wire format
+    std::vector<std::shared_ptr<Packet>> MissedPackets;
+    size_t MissedSize;
+    // More than JCHAT_CHAT_RESUME_MAX_MISSED_SIZE was missed
+    bool IsOverflowed;
+    bool IsResuming;
+  };
+
   bool is_listening_;
   TcpServer tcp_server_;
   bool is_little_endian_;
+  // Declared before the components, which may log until they are destroyed
+  Logger logger_;
   std::vector<std::shared_ptr<ChatComponent>> components_;
-  std::map<TcpClient *, RemoteChatClient *> clients_;
+  // Only one component can handle each component type, received messages
+  // are routed by indexing this table
+  std::shared_ptr<ChatComponent> components_by_type_[kComponentType_Max];
+  std::unordered_map<TcpClient *, RemoteChatClient *> clients_;
+  std::unordered_map<uint64_t, RemoteChatClient *> clients_by_id_;
   std::mutex clients_mutex_;
+  std::atomic<uint64_t> next_client_id_;
+  std::shared_ptr<ObjectPool<RemoteChatClient>> client_pool_;
+  MetricsRegistry metrics_;
+  // Sends the batches of clients whose batch window ran out
+  DelayQueue batch_queue_;
+  std::chrono::microseconds batch_window_;
+  uint16_t node_id_;
+  ClientRelay *client_relay_;
+  // By client id and by token, kept with the clients mutex
+  std::unordered_map<uint64_t, Session> sessions_;
+  std::unordered_map<std::string, uint64_t> session_tokens_;
+  // Ends the sessions whose grace period ran out
+  DelayQueue session_queue_;
+  std::chrono::milliseconds resume_grace_period_;
+  size_t receive_budget_;
+  // Messages per second and burst of every client, a rate of 0 has no limit
+  double message_rate_;
+  double message_burst_;
+
+  // Drives the receive path without a socket, see jchat_microbench
+  friend class FrameDecodeBenchmark;
 
   // Internal events
   bool onClientConnected(TcpClient &tcp_client);
   bool onClientDisconnected(TcpClient &tcp_client);
-  bool onDataReceived(TcpClient &tcp_client, Buffer &buffer);
+  bool onClientIdle(TcpClient &tcp_client);
+  bool onDataReceived(TcpClient &tcp_client, StreamBuffer &stream);
 
   // Internal functions
-  bool getTcpClient(RemoteChatClient &client, TcpClient **out_client);
-
-  // Send functions
-  bool send(TcpClient &client, ComponentType component_type,
-    uint8_t message_type, TypedBuffer &buffer);
-  bool send(TcpClient *client, ComponentType component_type,
-    uint8_t message_type, TypedBuffer &buffer);
+  bool getConnection(uint64_t client_id,
+    std::shared_ptr<TcpClient> &out_connection, WireFormat &out_format,
+    std::shared_ptr<ConnectionCompression> &out_compression,
+    std::shared_ptr<ConnectionBatch> &out_batch);
+  // The message is handled as the current request if it has an id
+  bool handleMessage(RemoteChatClient &client, uint8_t component_type,
+    uint16_t message_type, const uint8_t *body, size_t size,
+    uint32_t request_id);
+  // Drops a message of a client that is over the message rate limit
+  void throttle(RemoteChatClient &client, uint8_t component_type,
+    uint16_t message_type, uint32_t request_id);
+  // Adds the packet to the batch if the client has one, otherwise sends it
+  bool sendPacket(TcpClient &connection, ConnectionCompression *compression,
+    ConnectionBatch *batch, const std::shared_ptr<Packet> &packet);
+  bool sendFrame(TcpClient &connection, ConnectionCompression *compression,
+    const std::shared_ptr<Packet> &packet);
+  // NOTE: The mutex of the batch has to be held
+  bool sendBatch(TcpClient &connection, ConnectionCompression *compression,
+    ConnectionBatch &batch);
+  void flushBatch(uint64_t client_id);
+  void recordSend(TcpClient &connection, size_t size);
+  // Reads the header of a packet made by CreatePacket, returns its size
+  size_t readHeader(Packet &packet, uint8_t &out_component_type,
+    uint16_t &out_message_type, uint32_t &out_request_id);
+  bool relay(uint64_t client_id, ComponentType component_type,
+    uint8_t message_type, TypedBuffer &buffer, uint32_t request_id);
+  // Keeps a packet for a client whose session waits to be resumed, or sends
+  // it if the session was resumed since the connection was looked up
+  bool keepMissed(uint64_t client_id, const std::shared_ptr<Packet> &packet);
+  void expireSession(uint64_t client_id);
+  // NOTE: The clients mutex has to be held
+  void eraseSession(uint64_t client_id);
+  // Raises the disconnect of a client that is no longer in the client maps
+  // and deletes it
+  void endClient(RemoteChatClient *chat_client);
 
 public:
   ChatServer(const char *hostname, uint16_t port);
@@ -60,15 +151,149 @@ public:
   }
 
   TypedBuffer CreateBuffer();
+  // Renames the user, its strings are encoded once for every message that
+  // names it
+  void SetIdentity(ChatUser &user, const std::string &username,
+    const std::string &hostname);
+  // Sends to clients of other cluster nodes go through the client relay.
+  // These sends and the ones by id below carry the id of the current
+  // request, if it is one of the client's, see RequestContext.
   bool Send(RemoteChatClient &client, ComponentType component_type,
     uint8_t message_type, TypedBuffer &buffer);
   bool Send(RemoteChatClient *client, ComponentType component_type,
     uint8_t message_type, TypedBuffer &buffer);
 
+  // Frames a message once so it can be sent to any number of clients that
+  // use the given wire format. Packets only reach clients of this server.
+  // A request id other than 0 is only understood by clients that negotiated
+  // request ids.
+  std::shared_ptr<Packet> CreatePacket(ComponentType component_type,
+    uint8_t message_type, TypedBuffer &buffer,
+    WireFormat format = kWireFormat_Tagged, uint32_t request_id = 0);
+  bool Send(RemoteChatClient &client, const std::shared_ptr<Packet> &packet);
+  bool Send(RemoteChatClient *client, const std::shared_ptr<Packet> &packet);
+  // Frames the message in every wire format, for messages that are kept
+  PacketSet CreatePackets(ComponentType component_type, uint8_t message_type,
+    TypedBuffer &buffer);
+
+  // Sends by id are safe to use from any thread, they fail once the client
+  // has disconnected instead of touching a deleted client
+  bool Send(uint64_t client_id, ComponentType component_type,
+    uint8_t message_type, TypedBuffer &buffer);
+  bool Send(uint64_t client_id, const std::shared_ptr<Packet> &packet);
+  // Sends the packet of the client's wire format. Clients of other cluster
+  // nodes are relayed the tagged one, which has to be there.
+  bool Send(uint64_t client_id, const PacketSet &packets);
+
+  // Returns the number of clients the message was sent to
+  size_t Broadcast(const std::vector<RemoteChatClient *> &clients,
+    ComponentType component_type, uint8_t message_type, TypedBuffer &buffer);
+  // Safe to use from any thread like the sends by id, clients that have
+  // disconnected are skipped
+  size_t Broadcast(const std::vector<uint64_t> &client_ids,
+    ComponentType component_type, uint8_t message_type, TypedBuffer &buffer);
+  // Frames the formats that are missing from the packets, so they can be
+  // sent again later
+  size_t Broadcast(const std::vector<uint64_t> &client_ids,
+    TypedBuffer &buffer, PacketSet &packets);
+
+  // Gives an identified client that asked for resume in its Hello the token
+  // of a session, which keeps everything the server knows about the client
+  // for the grace period after its connection dropped. Returns an empty
+  // token if the client didn't ask or is gone. Safe to use from any thread.
+  std::string CreateSession(uint64_t client_id);
+  // The client takes over the id of the session and with it the channels
+  // and username of the session, the components move what they keep in
+  // OnClientResumed. The messages the session missed are sent after
+  // whatever the components sent the client in there. Sessions are only
+  // known to the server that created them.
+  ResumeResult ResumeSession(RemoteChatClient &client,
+    const std::string &token);
+
   IPEndpoint GetListenEndpoint();
 
+  bool SetPollerType(PollerType poller_type);
+  PollerType GetPollerType();
+
+  bool SetIoThreadCount(size_t io_thread_count);
+  size_t GetIoThreadCount();
+  // CPUs the I/O threads are kept on in turn, any CPU if empty
+  bool SetIoCpus(const std::vector<int> &io_cpus);
+  const std::vector<int> &GetIoCpus();
+
+  bool SetSendQueueLimits(size_t high_watermark, size_t low_watermark);
+  bool SetSendQueuePolicy(SendQueuePolicy send_queue_policy);
+  SendQueuePolicy GetSendQueuePolicy();
+
+  // Socket options of the listener and accepted connections, see TcpServer.
+  // Only the rate limit can be changed while the server is running.
+  bool SetListenBacklog(int32_t listen_backlog);
+  bool SetNoDelay(bool is_no_delay);
+  bool SetSocketBufferSizes(int32_t send_buffer_size,
+    int32_t receive_buffer_size);
+  bool SetConnectionRateLimit(double rate, double burst);
+  // Services on the same host may connect through a Unix domain socket at
+  // the path as well, see TcpServer::SetLocalPath
+  bool SetLocalPath(const std::string &local_path);
+  std::string GetLocalPath();
+
+  // Clients that send nothing for the timeout are pinged if they negotiated
+  // heartbeats, and dropped if they didn't complete a Hello. Every client
+  // that still sent nothing after as long again is dropped. 0 turns it off,
+  // it can only be changed while the server is stopped.
+  bool SetIdleTimeout(std::chrono::milliseconds idle_timeout);
+  std::chrono::milliseconds GetIdleTimeout();
+
+  // Clients are only offered batching while the window is not zero. It can
+  // only be changed while the server is stopped.
+  bool SetBatchWindow(std::chrono::microseconds batch_window);
+  std::chrono::microseconds GetBatchWindow();
+
+  // Sessions are kept at least this long after their connection dropped,
+  // defaults to JCHAT_CHAT_RESUME_GRACE_PERIOD. 0 keeps none, clients are
+  // only offered resume while it is not. It can only be changed while the
+  // server is stopped.
+  bool SetResumeGracePeriod(std::chrono::milliseconds resume_grace_period);
+  std::chrono::milliseconds GetResumeGracePeriod();
+
+  // Messages a connection may have handled in a row before the other
+  // connections of its reactor get a turn, defaults to
+  // JCHAT_CHAT_RECEIVE_BUDGET. 0 handles everything that was received at
+  // once. It can only be changed while the server is stopped.
+  bool SetReceiveBudget(size_t receive_budget);
+  size_t GetReceiveBudget();
+
+  // Messages per second and burst every client may send, the system
+  // messages and cluster links aren't counted. Messages over it are dropped
+  // and answered with a Throttled. A rate of 0 turns it off, which is the
+  // default. It can only be changed while the server is stopped.
+  bool SetMessageRateLimit(double rate, double burst);
+  double GetMessageRate();
+  double GetMessageBurst();
+
+  // Client ids start with the node id, see JCHAT_CHAT_NODE_ID_SHIFT. Both of
+  // these can only be changed while the server is stopped.
+  bool SetNodeId(uint16_t node_id);
+  uint16_t GetNodeId();
+  bool SetClientRelay(ClientRelay *client_relay);
+  bool IsLocalClient(uint64_t client_id);
+
+  PoolStats GetConnectionPoolStats();
+  PoolStats GetReadBufferPoolStats();
+  PoolStats GetClientPoolStats();
+
+  // Counters and histograms of the server, see server_metrics.h. Components
+  // may record their own metrics in it.
+  MetricsRegistry &GetMetrics();
+  // Written on a thread of its own while the server runs, components may log
+  // from any thread without waiting for it
+  Logger &GetLogger();
+
   Event<RemoteChatClient &> OnClientConnected;
+  // Not raised for a session that was resumed, the client that resumed it
+  // is disconnected under the session's id in the end
   Event<RemoteChatClient &> OnClientDisconnected;
+  Event<RemoteChatClient &> OnClientResumed;
 };
 }
 
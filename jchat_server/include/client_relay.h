@@ -0,0 +1,33 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_server_client_relay_h_
+#define jchat_server_client_relay_h_
+
+#include "protocol/component_type.h"
+#include "typed_buffer.hpp"
+#include <vector>
+
+namespace jchat {
+// Delivers messages to clients connected to other servers of a cluster, the
+// server hands it every send to a client id it does not know itself
+class ClientRelay {
+public:
+  virtual ~ClientRelay() {
+  }
+
+  // Returns the number of clients the message was handed on for. The
+  // request id is only given for messages to a single client, 0 if it has
+  // none.
+  virtual size_t Relay(const std::vector<uint64_t> &client_ids,
+    ComponentType component_type, uint8_t message_type,
+    TypedBuffer &buffer, uint32_t request_id) = 0;
+};
+}
+
+#endif // jchat_server_client_relay_h_
@@ -10,16 +10,143 @@
 #define jchat_server_channel_component_h_
 
 #include "chat_component.h"
+#include "message_dispatcher.hpp"
 #include "chat_channel.h"
+#include "channel_shard.h"
+#include "channel_store.h"
+#include "shared_ring.hpp"
 #include "protocol/components/channel_message_result.h"
+#include "protocol/components/channel_message_type.h"
 #include "event.hpp"
+#include "string_view.hpp"
+#include <set>
 
 namespace jchat {
+// Hands the requests for channels that belong to other servers of a cluster
+// to them, see ClusterComponent
+class ChannelRouter {
+public:
+  virtual ~ChannelRouter() {
+  }
+
+  // Returns false if the request is to be handled by this server. The
+  // buffer is the complete request, the channel name was read from a copy.
+  virtual bool Forward(RemoteChatClient &client, uint16_t message_type,
+    StringView &channel_name, TypedBufferView &buffer) = 0;
+};
+
 class ChannelComponent : public ChatComponent {
 private:
   ChatServer *server_;
-  std::vector<std::shared_ptr<ChatChannel>> channels_;
-  std::mutex channels_mutex_;
+  bool is_started_;
+  ChannelRouter *channel_router_;
+  std::chrono::milliseconds presence_interval_;
+  std::vector<std::unique_ptr<ChannelShard>> shards_;
+  std::vector<int> shard_cpus_;
+  std::string state_path_;
+  std::chrono::seconds snapshot_interval_;
+  ChannelStore store_;
+  HistoryLimits history_limits_;
+  std::shared_ptr<SharedRingWriter> message_tap_;
+  // The patterns of every subscribed client, those of other servers too, so
+  // requests are checked before they go to all the shards
+  std::unordered_map<uint64_t, std::set<std::string>> subscriptions_;
+  std::mutex subscriptions_mutex_;
+
+  ChannelShard &getShard(const std::string &channel_name);
+
+  // Loads the stored channels into their shards before they start
+  bool loadChannels();
+  // Copies the stored channels of every shard, waiting for each of them to
+  // get to it
+  std::vector<StoredChannel> captureChannels();
+  // Removes the client through the shard. A stored channel without bans
+  // has nothing left to keep once it is empty, so it is removed from the
+  // store first.
+  void removeClient(ChannelShard &shard,
+    const std::shared_ptr<ChatChannel> &channel, uint64_t client_id);
+
+  // Sends to every other enabled member of the channel, after the presence
+  // changes that are still waiting so members never hear from a client
+  // before they heard it joined. Messages of a sender also go to the
+  // channel's subscribers that take messages from it.
+  void broadcast(ChatChannel &channel, uint64_t source_client_id,
+    ChannelMessageType message_type, TypedBuffer &buffer,
+    const ChatUser *sender = nullptr);
+  void broadcast(ChatChannel &channel, uint64_t source_client_id,
+    TypedBuffer &buffer, PacketSet &packets,
+    const ChatUser *sender = nullptr);
+  std::vector<uint64_t> getRecipients(ChatChannel &channel,
+    uint64_t source_client_id, const ChatUser *sender);
+
+  // Sends the last messages of the channel as they were framed for its
+  // members, announced by a History with how old each of them is
+  void sendHistory(ChannelShard &shard, ChatChannel &channel,
+    uint64_t client_id, uint64_t history_count);
+  // Drops the messages that got too old every
+  // JCHAT_CHAT_HISTORY_PRUNE_INTERVAL
+  void pruneHistory(ChannelShard &shard);
+
+  // Joins and leaves wait for the presence interval, so a member that sees
+  // many of them at once gets a few PresenceChanged instead of a UserJoined
+  // or UserLeft for each
+  void addPresenceChange(ChannelShard &shard,
+    const std::shared_ptr<ChatChannel> &channel, uint64_t client_id,
+    const std::shared_ptr<ChatUser> &user, bool is_joined);
+  void sendPresenceChanges(ChannelShard &shard);
+  void sendPresenceChanges(ChatChannel &channel);
+
+  // Writes the page of members that starts at the cursor, leaving out the
+  // client itself. Returns the cursor of the next page, or 0 after the last.
+  uint64_t writeMembers(TypedBuffer &buffer, ChatChannel &channel,
+    uint64_t client_id, uint64_t cursor);
+
+  MessageDispatcher<ChannelComponent, kChannelMessageType_Max,
+    RemoteChatClient &, TypedBufferView &> dispatcher_;
+
+  // Message handlers, these validate a request on the connection's thread and
+  // hand it to the shard that owns the channel
+  bool handleJoinChannel(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleLeaveChannel(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleSendMessage(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleOpUser(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleDeopUser(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleKickUser(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleBanUser(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleUnbanUser(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleGetMembers(RemoteChatClient &client, TypedBufferView &buffer);
+  // Subscriptions cover all the shards, so they are kept by every one of them
+  bool handleSubscribe(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleUnsubscribe(RemoteChatClient &client, TypedBufferView &buffer);
+
+  // Replies to clients of this server only, a cluster sends subscriptions to
+  // every server
+  void completeSubscribe(RemoteChatClient &client,
+    ChannelMessageResult message_result, std::string &pattern,
+    std::string &sender, ChatUser &chat_user);
+  void completeUnsubscribe(RemoteChatClient &client,
+    ChannelMessageResult message_result, std::string &pattern,
+    ChatUser &chat_user);
+
+  // Channel operations, these run on the shard that owns the channel
+  void joinChannel(ChannelShard &shard, uint64_t client_id,
+    std::shared_ptr<ChatUser> &chat_user, std::string &channel_name,
+    bool include_bans, uint64_t history_count);
+  void leaveChannel(ChannelShard &shard, uint64_t client_id,
+    std::shared_ptr<ChatUser> &chat_user, std::string &channel_name);
+  void sendMessage(ChannelShard &shard, uint64_t client_id,
+    std::shared_ptr<ChatUser> &chat_user, std::string &channel_name,
+    std::string &message);
+  void kickUser(ChannelShard &shard, uint64_t client_id,
+    std::shared_ptr<ChatUser> &chat_user, std::string &channel_name,
+    std::string &target);
+  void banUser(ChannelShard &shard, uint64_t client_id,
+    std::shared_ptr<ChatUser> &chat_user, std::string &channel_name,
+    std::string &target);
+  void getMembers(ChannelShard &shard, uint64_t client_id,
+    std::shared_ptr<ChatUser> &chat_user, std::string &channel_name,
+    uint64_t cursor);
+  void disconnectClient(ChannelShard &shard, uint64_t client_id);
 
 public:
   ChannelComponent();
@@ -35,17 +162,67 @@ public:
   // Internal events
   virtual void OnClientConnected(RemoteChatClient &client) override;
   virtual void OnClientDisconnected(RemoteChatClient &client) override;
+  virtual void OnClientResumed(RemoteChatClient &client,
+    RemoteChatClient &session) override;
 
   // Handler functions
   virtual ComponentType GetType() override;
   virtual bool Handle(RemoteChatClient &client, uint16_t message_type,
-    TypedBuffer &buffer) override;
+    TypedBufferView &buffer) override;
 
   // API functions
+  // Channels are spread over this many threads, defaults to one per core.
+  // Can only be changed while the server is stopped.
+  bool SetShardCount(size_t shard_count);
+  size_t GetShardCount();
+  // CPUs the shard threads are kept on in turn, any CPU if empty. Can only
+  // be changed while the server is stopped.
+  bool SetShardCpus(const std::vector<int> &shard_cpus);
+  const std::vector<int> &GetShardCpus();
+
+  // Every request starts with the channel name, the router sees it before
+  // the request is handled. Can only be changed while the server is stopped.
+  void SetChannelRouter(ChannelRouter *channel_router);
 
+  // How long joins and leaves are collected before they are sent, defaults
+  // to JCHAT_CHAT_PRESENCE_INTERVAL. 0 sends them right away. Can only be
+  // changed while the server is stopped.
+  bool SetPresenceInterval(std::chrono::milliseconds presence_interval);
+  std::chrono::milliseconds GetPresenceInterval();
+
+  // Keeps channel names, bans and the operators that created them at this
+  // path prefix, see ChannelStore. Stored channels stay when their last
+  // client leaves and are loaded again on start. Empty (the default) keeps
+  // nothing. Can only be changed while the server is stopped.
+  bool SetStatePath(const std::string &state_path);
+  std::string GetStatePath();
+  // Defaults to JCHAT_CHANNEL_SNAPSHOT_INTERVAL, changes are logged right
+  // away in between
+  bool SetSnapshotInterval(std::chrono::seconds snapshot_interval);
+  std::chrono::seconds GetSnapshotInterval();
+
+  // Bounds the messages kept for clients that ask for them when they join,
+  // defaults to the JCHAT_CHAT_HISTORY_* limits. No messages keeps no
+  // history, no age keeps messages however old. Can only be changed while
+  // the server is stopped.
+  bool SetHistoryLimits(size_t max_messages, size_t max_channel_size,
+    size_t max_server_size, std::chrono::seconds max_age);
+  HistoryLimits GetHistoryLimits();
+
+  // Every message sent to a channel of this server is also written to the
+  // ring, framed like for clients of protocol version 1, so services on the
+  // host can tail all of them. Can only be changed while the server is
+  // stopped.
+  bool SetMessageTap(std::shared_ptr<SharedRingWriter> message_tap);
+  std::shared_ptr<SharedRingWriter> GetMessageTap();
+
+  // Removes the client from all of its channels and subscriptions like a
+  // disconnect does, for clients of other servers
+  void RemoveClient(uint64_t client_id);
 
   // API events
-  // NOTE: The last argument in these (ChatUser &) is always the source user
+  // NOTE: The last argument in these (ChatUser &) is always the source user.
+  // The events of channel operations are raised on the channel's shard.
   Event<ChannelMessageResult, std::string &, ChatUser &> OnJoinCompleted;
   Event<ChannelMessageResult, std::string &, ChatUser &> OnLeaveCompleted;
   Event<ChannelMessageResult, std::string &, std::string &,
@@ -60,6 +237,10 @@ public:
     ChatUser &> OnBanUserCompleted;
   Event<ChannelMessageResult, std::string &, std::string &,
     ChatUser &> OnUnbanUserCompleted;
+  // The pattern and the sender
+  Event<ChannelMessageResult, std::string &, std::string &,
+    ChatUser &> OnSubscribeCompleted;
+  Event<ChannelMessageResult, std::string &, ChatUser &> OnUnsubscribeCompleted;
 
   Event<ChatChannel &> OnChannelCreated;
   Event<ChatChannel &, ChatUser &> OnChannelJoined;
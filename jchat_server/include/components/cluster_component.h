@@ -0,0 +1,228 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_server_cluster_component_h_
+#define jchat_server_cluster_component_h_
+
+#include "chat_component.h"
+#include "client_relay.h"
+#include "components/user_component.h"
+#include "components/channel_component.h"
+#include "message_dispatcher.hpp"
+#include "protocol/components/cluster_message_type.h"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Milliseconds between attempts to open the links that are down
+#ifndef JCHAT_CLUSTER_RECONNECT_INTERVAL
+#define JCHAT_CLUSTER_RECONNECT_INTERVAL 1000
+#endif // JCHAT_CLUSTER_RECONNECT_INTERVAL
+
+// Milliseconds a link may have nothing to send for before it sends a
+// heartbeat, has to be less than the idle timeout of the other nodes
+#ifndef JCHAT_CLUSTER_HEARTBEAT_INTERVAL
+#define JCHAT_CLUSTER_HEARTBEAT_INTERVAL 10000
+#endif // JCHAT_CLUSTER_HEARTBEAT_INTERVAL
+
+// Bytes that may wait for a node before its link is dropped
+#ifndef JCHAT_CLUSTER_MAX_QUEUE_SIZE
+#define JCHAT_CLUSTER_MAX_QUEUE_SIZE (64 * 1024 * 1024)
+#endif // JCHAT_CLUSTER_MAX_QUEUE_SIZE
+
+// Most client ids in one relayed message, bigger broadcasts are split so
+// every message fits in a frame
+#ifndef JCHAT_CLUSTER_RELAY_MAX_CLIENTS
+#define JCHAT_CLUSTER_RELAY_MAX_CLIENTS 4096
+#endif // JCHAT_CLUSTER_RELAY_MAX_CLIENTS
+
+namespace jchat {
+struct ClusterNode {
+  std::string Hostname;
+  uint16_t Port;
+};
+
+// Lets several servers act as one. Every node knows the same ordered list of
+// nodes and has a link to each of the others.
+//  - Channels and usernames are owned by one node, picked by a hash of the
+//    name. Channel requests are forwarded to the owner, which handles them
+//    for a stand-in of the client.
+//  - Identified users are announced to every node, so direct messages and
+//    channel members of other nodes look like local clients.
+//  - Messages for clients of other nodes are relayed to them, one copy per
+//    node however many of its clients receive it.
+// NOTE: State owned by a node is lost with it, channels aren't moved to
+// another node while it is down.
+class ClusterComponent : public ChatComponent, public ClientRelay,
+  public UserDirectory, public ChannelRouter {
+private:
+  // The connection this server sends to a node over, the node sends back
+  // over a connection of its own. A thread of its own opens it and writes
+  // the queued frames, so no I/O thread waits for a node that is slow to
+  // read.
+  struct Peer {
+    uint16_t NodeId;
+    ClusterNode Node;
+    std::shared_ptr<TcpClient> Link;
+    // Set once the Hello and the users are queued for a new link
+    bool IsLinked;
+    bool IsRunning;
+    std::deque<std::shared_ptr<Buffer>> Queue;
+    size_t QueueSize;
+    std::mutex Mutex;
+    std::condition_variable Condition;
+    std::thread Thread;
+
+    Peer() : NodeId(0), IsLinked(false), IsRunning(false),
+      QueueSize(0) {
+    }
+  };
+
+  // A client of another node as the components of this server see it
+  struct RemoteUser {
+    RemoteChatClient Client;
+    std::shared_ptr<ChatUser> User;
+  };
+
+  // What the other nodes are told about a user identified on this server
+  struct LocalUser {
+    std::shared_ptr<const ChatIdentity> Interned;
+    bool PresenceChanges;
+  };
+
+  // An identify waiting for the node that owns the username
+  struct PendingClaim {
+    uint16_t NodeId;
+    std::function<void(UserMessageResult)> OnClaimed;
+  };
+
+  ChatServer *server_;
+  std::shared_ptr<UserComponent> user_component_;
+  std::shared_ptr<ChannelComponent> channel_component_;
+  uint16_t node_id_;
+  std::vector<ClusterNode> nodes_;
+  std::string key_;
+
+  // Indexed by node id, there is none for this server
+  std::vector<std::unique_ptr<Peer>> peers_;
+  bool is_started_;
+
+  // Node ids of the connections other nodes opened, and the current one of
+  // every node
+  std::unordered_map<uint64_t, uint16_t> links_;
+  std::vector<uint64_t> inbound_links_;
+  std::mutex links_mutex_;
+
+  // Users identified on this server, every newly opened link gets all of
+  // them
+  std::unordered_map<uint64_t, LocalUser> local_users_;
+  std::mutex local_users_mutex_;
+
+  std::unordered_map<uint64_t, std::shared_ptr<RemoteUser>> remote_users_;
+  std::mutex remote_users_mutex_;
+
+  // Clients holding the usernames this node owns
+  std::unordered_map<std::string, uint64_t, Utility::StringHash> usernames_;
+  std::mutex usernames_mutex_;
+
+  std::unordered_map<uint64_t, PendingClaim> pending_claims_;
+  uint64_t next_claim_id_;
+  std::mutex pending_claims_mutex_;
+
+  MessageDispatcher<ClusterComponent, kClusterMessageType_Max,
+    RemoteChatClient &, TypedBufferView &> dispatcher_;
+
+  // Message handlers, only accepted from connections that sent a Hello
+  bool handleHello(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleClaimUsername(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleClaimUsernameComplete(RemoteChatClient &client,
+    TypedBufferView &buffer);
+  bool handleUserOnline(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleUserOffline(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleChannelRequest(RemoteChatClient &client,
+    TypedBufferView &buffer);
+  bool handleRelay(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleHeartbeat(RemoteChatClient &client, TypedBufferView &buffer);
+
+  // Internal functions
+  uint16_t getOwner(const char *name, size_t size);
+  bool getLinkNode(RemoteChatClient &client, uint16_t &out_node_id);
+  bool send(uint16_t node_id, ClusterMessageType message_type,
+    TypedBuffer &buffer);
+  std::shared_ptr<Buffer> createFrame(ClusterMessageType message_type,
+    TypedBuffer &buffer);
+  void sendToAll(ClusterMessageType message_type, TypedBuffer &buffer);
+  void writeUserOnline(TypedBuffer &buffer, uint64_t client_id,
+    const ChatIdentity &identity, bool presence_changes);
+
+  void linkLoop(Peer &peer);
+  bool openLink(Peer &peer);
+  void closeLink(std::shared_ptr<TcpClient> &link);
+  void onLinkClosed(Peer &peer, TcpClient *link);
+
+  UserMessageResult claimUsername(uint64_t client_id,
+    const std::string &username);
+  void releaseUsername(uint64_t client_id, const std::string &username);
+  void failClaims(uint16_t node_id);
+  void addRemoteUser(uint64_t client_id, const std::string &username,
+    const std::string &hostname, bool is_presence_changes);
+  void removeRemoteUser(uint64_t client_id);
+  void removeNode(uint16_t node_id);
+  void replyUnavailable(RemoteChatClient &client, uint16_t message_type,
+    TypedBufferView &buffer);
+
+public:
+  ClusterComponent();
+  ~ClusterComponent();
+
+  // Internal functions
+  virtual bool Initialize(ChatServer &server) override;
+  virtual bool Shutdown() override;
+
+  virtual bool OnStart() override;
+  virtual bool OnStop() override;
+
+  // Internal events
+  virtual void OnClientConnected(RemoteChatClient &client) override;
+  virtual void OnClientDisconnected(RemoteChatClient &client) override;
+  virtual void OnClientResumed(RemoteChatClient &client,
+    RemoteChatClient &session) override;
+
+  // Handler functions
+  virtual ComponentType GetType() override;
+  virtual bool Handle(RemoteChatClient &client, uint16_t message_type,
+    TypedBufferView &buffer) override;
+
+  // Cluster hooks of the server and the other components
+  virtual size_t Relay(const std::vector<uint64_t> &client_ids,
+    ComponentType component_type, uint8_t message_type,
+    TypedBuffer &buffer, uint32_t request_id) override;
+  virtual void Claim(uint64_t client_id, const std::string &username,
+    std::function<void(UserMessageResult)> on_claimed) override;
+  virtual void Add(uint64_t client_id, ChatUser &user) override;
+  virtual void Remove(uint64_t client_id, const std::string &username)
+    override;
+  virtual bool Forward(RemoteChatClient &client, uint16_t message_type,
+    StringView &channel_name, TypedBufferView &buffer) override;
+
+  // API functions
+  // Every node has to be given the same nodes in the same order, this server
+  // is the one at node_id. Can only be changed before the component is added
+  // to the server, which has to have the user and channel components.
+  bool SetNodes(uint16_t node_id, const std::vector<ClusterNode> &nodes);
+  uint16_t GetNodeId();
+  // Connections that say a different key in their Hello are dropped
+  void SetKey(const std::string &key);
+};
+}
+
+#endif // jchat_server_cluster_component_h_
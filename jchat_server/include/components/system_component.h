@@ -10,6 +10,8 @@
 #define jchat_server_system_component_h_
 
 #include "chat_component.h"
+#include "message_dispatcher.hpp"
+#include "protocol/components/system_message_type.h"
 #include "protocol/components/system_message_result.h"
 #include "event.hpp"
 
@@ -17,6 +19,17 @@ namespace jchat {
 class SystemComponent : public ChatComponent {
 private:
   ChatServer *server_;
+  bool is_compression_enabled_;
+  std::string stats_key_;
+
+  MessageDispatcher<SystemComponent, kSystemMessageType_Max,
+    RemoteChatClient &, TypedBufferView &> dispatcher_;
+
+  // Message handlers
+  bool handleHello(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleGetStats(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handlePing(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handlePong(RemoteChatClient &client, TypedBufferView &buffer);
 
 public:
   SystemComponent();
@@ -32,11 +45,22 @@ public:
   // Internal events
   virtual void OnClientConnected(RemoteChatClient &client) override;
   virtual void OnClientDisconnected(RemoteChatClient &client) override;
+  virtual void OnClientResumed(RemoteChatClient &client,
+    RemoteChatClient &session) override;
 
   // Handler functions
   virtual ComponentType GetType() override;
   virtual bool Handle(RemoteChatClient &client, uint16_t message_type,
-    TypedBuffer &buffer) override;
+    TypedBufferView &buffer) override;
+
+  // API functions
+  // Clients that ask for compression in their Hello get it unless this is
+  // disabled or the server was built without zlib
+  void SetCompressionEnabled(bool is_compression_enabled);
+  bool IsCompressionEnabled();
+  // Clients that send this key may read the server's metrics, nobody may if
+  // it is empty (the default)
+  void SetStatsKey(const std::string &stats_key);
 
   // API events
   Event<RemoteChatClient &> OnHelloCompleted;
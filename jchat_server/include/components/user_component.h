@@ -10,19 +10,71 @@
 #define jchat_server_user_component_h_
 
 #include "chat_component.h"
+#include "message_dispatcher.hpp"
+#include "protocol/components/user_message_type.h"
 #include "chat_user.h"
+#include "object_pool.hpp"
 #include "protocol/components/user_message_result.h"
 #include "event.hpp"
-#include <map>
+#include "utility.hpp"
+#include <functional>
 #include <memory>
+#include <unordered_map>
 
 namespace jchat {
+// Keeps usernames unique across the servers of a cluster, see
+// ClusterComponent
+class UserDirectory {
+public:
+  virtual ~UserDirectory() {
+  }
+
+  // Calls on_claimed with kUserMessageResult_Ok once the client holds the
+  // username, which may happen later and on another thread
+  virtual void Claim(uint64_t client_id, const std::string &username,
+    std::function<void(UserMessageResult)> on_claimed) = 0;
+
+  // The client identified with a username it claimed, or gave it up
+  virtual void Add(uint64_t client_id, ChatUser &user) = 0;
+  virtual void Remove(uint64_t client_id, const std::string &username) = 0;
+};
+
 class UserComponent : public ChatComponent {
 private:
+  struct IdentifiedUser {
+    uint64_t ClientId;
+    std::shared_ptr<ChatUser> User;
+  };
+
   ChatServer *server_;
-  std::map<RemoteChatClient *, std::shared_ptr<ChatUser>> users_;
+  std::shared_ptr<ObjectPool<ChatUser>> user_pool_;
+  std::unordered_map<RemoteChatClient *, std::shared_ptr<ChatUser>> users_;
   std::mutex users_mutex_;
 
+  // Identified users by username, kept apart from users_ so identifies and
+  // direct messages don't wait on connects and disconnects
+  std::unordered_map<std::string, IdentifiedUser, Utility::StringHash>
+    usernames_;
+  // Usernames of clients still waiting for the directory, these are reserved
+  // in usernames_ already
+  std::unordered_map<uint64_t, std::string> claims_;
+  std::mutex usernames_mutex_;
+  UserDirectory *user_directory_;
+  uint64_t hostname_key_;
+
+  MessageDispatcher<UserComponent, kUserMessageType_Max,
+    RemoteChatClient &, TypedBufferView &> dispatcher_;
+
+  // Message handlers
+  bool handleIdentify(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleSendMessage(RemoteChatClient &client, TypedBufferView &buffer);
+  bool handleResume(RemoteChatClient &client, TypedBufferView &buffer);
+
+  void completeIdentify(uint64_t client_id,
+    std::shared_ptr<ChatUser> &chat_user, std::string &username,
+    UserMessageResult result);
+  std::shared_ptr<ChatUser> removeUser(RemoteChatClient &client);
+
 public:
   UserComponent();
   ~UserComponent();
@@ -37,20 +89,40 @@ public:
   // Internal events
   virtual void OnClientConnected(RemoteChatClient &client) override;
   virtual void OnClientDisconnected(RemoteChatClient &client) override;
+  virtual void OnClientResumed(RemoteChatClient &client,
+    RemoteChatClient &session) override;
 
   // Handler functions
   virtual ComponentType GetType() override;
   virtual bool Handle(RemoteChatClient &client, uint16_t message_type,
-    TypedBuffer &buffer) override;
+    TypedBufferView &buffer) override;
 
   // API functions
   bool GetChatUser(RemoteChatClient &client,
     std::shared_ptr<ChatUser> &out_user);
+  PoolStats GetUserPoolStats();
+
+  // Identifies check every username with the directory, if there is one. Can
+  // only be changed while the server is stopped.
+  void SetUserDirectory(UserDirectory *user_directory);
+  // Hostnames are hashed with the key once their user identifies, so
+  // clients can't work out the address behind one. Servers of a cluster,
+  // and restarts that are to keep bans, need the same key. It is random if
+  // none is set, see the -hostnamekey option of the server. Can only be
+  // changed while the server is stopped.
+  void SetHostnameKey(const std::string &key);
+
+  // Users of other servers, the client only has to outlive the user. Their
+  // messages are sent through the server's client relay.
+  bool AddRemoteUser(RemoteChatClient &client,
+    std::shared_ptr<ChatUser> &user);
+  void RemoveRemoteUser(RemoteChatClient &client);
 
   // API events
   Event<UserMessageResult, std::string &, ChatUser &> OnIdentifyCompleted;
   Event<UserMessageResult, std::string &, std::string &,
     ChatUser &> OnSendMessageCompleted;
+  Event<UserMessageResult, ChatUser &> OnResumeCompleted;
 
   Event<ChatUser &> OnIdentified;
   Event<ChatUser &, ChatUser &, std::string> OnMessage;
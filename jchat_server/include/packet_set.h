@@ -0,0 +1,30 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_server_packet_set_h_
+#define jchat_server_packet_set_h_
+
+#include "packet.hpp"
+#include "wire_format.hpp"
+#include "protocol/component_type.h"
+#include <memory>
+
+namespace jchat {
+// A message framed once for every wire format, see ChatServer::CreatePackets.
+// Formats nobody asked for yet may not be framed.
+struct PacketSet {
+  ComponentType Component;
+  uint8_t MessageType;
+  std::shared_ptr<Packet> Packets[kWireFormat_Compact + 1];
+
+  PacketSet() : Component(kComponentType_System), MessageType(0) {
+  }
+};
+}
+
+#endif // jchat_server_packet_set_h_
@@ -0,0 +1,40 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_server_request_context_h_
+#define jchat_server_request_context_h_
+
+#include <stdint.h>
+
+namespace jchat {
+// The request of a client a thread is working on. While it is current, the
+// messages sent to that client carry the request id, so the client can tell
+// which of its requests they answer. Work that is handed to another thread
+// takes the request along, see ChannelShard::Post.
+struct RequestContext {
+  uint64_t ClientId;
+  // 0 if the client sent no id
+  uint32_t RequestId;
+
+  RequestContext() : ClientId(0), RequestId(0) {
+  }
+
+  RequestContext(uint64_t client_id, uint32_t request_id)
+    : ClientId(client_id), RequestId(request_id) {
+  }
+
+  // Both are of the calling thread, setting returns the previous request
+  static RequestContext GetCurrent();
+  static RequestContext SetCurrent(const RequestContext &request);
+  // The id to send the client a message with, 0 unless the current request
+  // is one of the client's
+  static uint32_t GetRequestId(uint64_t client_id);
+};
+}
+
+#endif // jchat_server_request_context_h_
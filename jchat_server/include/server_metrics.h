@@ -0,0 +1,143 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#ifndef jchat_server_server_metrics_h_
+#define jchat_server_server_metrics_h_
+
+// Required libraries
+#include "metrics.hpp"
+#include "protocol/component_type.h"
+
+// Received frames are counted per component and message type for message
+// types below this, the rest share the counter of the last one
+#ifndef JCHAT_METRICS_MESSAGE_TYPES
+#define JCHAT_METRICS_MESSAGE_TYPES 32
+#endif // JCHAT_METRICS_MESSAGE_TYPES
+
+namespace jchat {
+enum ServerCounter : size_t {
+  // Bytes as they went over the wire, including headers
+  kServerCounter_BytesReceived,
+  kServerCounter_BytesSent,
+  kServerCounter_FramesReceived,
+  kServerCounter_FramesSent,
+  kServerCounter_Broadcasts,
+  // Batch frames, their messages are counted like frames of their own in
+  // the received frame counters
+  kServerCounter_BatchesReceived,
+  kServerCounter_BatchesSent,
+  // Connections closed by the per address rate limit
+  kServerCounter_ConnectionsRejected,
+  // Clients that sent nothing for the idle timeout
+  kServerCounter_ClientsIdle,
+  // Sessions kept after their connection dropped, and what became of them
+  kServerCounter_SessionsParked,
+  kServerCounter_SessionsResumed,
+  kServerCounter_SessionsExpired,
+  // Messages dropped by the message rate limit
+  kServerCounter_MessagesThrottled,
+  // Receives that stopped at the receive budget with messages left over
+  kServerCounter_ReceivesDeferred,
+
+  // Followed by the received frame counters, see GetFrameCounter
+  kServerCounter_Max,
+};
+
+enum ServerHistogram : size_t {
+  // Time spent in ChatComponent::Handle, sampled
+  kServerHistogram_HandleNanoseconds,
+  // Bytes queued for a client after a send to it, sampled
+  kServerHistogram_SendQueueBytes,
+  kServerHistogram_BroadcastRecipients,
+  kServerHistogram_ClientsLockWaitNanoseconds,
+  // Wait for the task queue of a channel shard, and its length after a post
+  kServerHistogram_ShardLockWaitNanoseconds,
+  kServerHistogram_ShardQueueLength,
+
+  kServerHistogram_Max,
+};
+
+#define JCHAT_METRICS_SERVER_COUNTERS (kServerCounter_Max \
+  + kComponentType_Max * JCHAT_METRICS_MESSAGE_TYPES)
+
+inline size_t GetFrameCounter(uint8_t component_type, uint16_t message_type) {
+  if (message_type >= JCHAT_METRICS_MESSAGE_TYPES) {
+    message_type = JCHAT_METRICS_MESSAGE_TYPES - 1;
+  }
+  return kServerCounter_Max + component_type * JCHAT_METRICS_MESSAGE_TYPES
+    + message_type;
+}
+
+inline const char *GetComponentName(uint8_t component_type) {
+  switch (component_type) {
+  case kComponentType_System:
+    return "system";
+  case kComponentType_User:
+    return "user";
+  case kComponentType_Channel:
+    return "channel";
+  case kComponentType_Cluster:
+    return "cluster";
+  }
+  return "unknown";
+}
+
+inline const char *GetServerCounterName(size_t counter) {
+  switch (counter) {
+  case kServerCounter_BytesReceived:
+    return "bytes_received";
+  case kServerCounter_BytesSent:
+    return "bytes_sent";
+  case kServerCounter_FramesReceived:
+    return "frames_received";
+  case kServerCounter_FramesSent:
+    return "frames_sent";
+  case kServerCounter_Broadcasts:
+    return "broadcasts";
+  case kServerCounter_BatchesReceived:
+    return "batches_received";
+  case kServerCounter_BatchesSent:
+    return "batches_sent";
+  case kServerCounter_ConnectionsRejected:
+    return "connections_rejected";
+  case kServerCounter_ClientsIdle:
+    return "clients_idle";
+  case kServerCounter_SessionsParked:
+    return "sessions_parked";
+  case kServerCounter_SessionsResumed:
+    return "sessions_resumed";
+  case kServerCounter_SessionsExpired:
+    return "sessions_expired";
+  case kServerCounter_MessagesThrottled:
+    return "messages_throttled";
+  case kServerCounter_ReceivesDeferred:
+    return "receives_deferred";
+  }
+  return "";
+}
+
+inline const char *GetServerHistogramName(size_t histogram) {
+  switch (histogram) {
+  case kServerHistogram_HandleNanoseconds:
+    return "handle_ns";
+  case kServerHistogram_SendQueueBytes:
+    return "send_queue_bytes";
+  case kServerHistogram_BroadcastRecipients:
+    return "broadcast_recipients";
+  case kServerHistogram_ClientsLockWaitNanoseconds:
+    return "clients_lock_wait_ns";
+  case kServerHistogram_ShardLockWaitNanoseconds:
+    return "shard_lock_wait_ns";
+  case kServerHistogram_ShardQueueLength:
+    return "shard_queue_length";
+  }
+  return "";
+}
+}
+
+#endif // jchat_server_server_metrics_h_
@@ -0,0 +1,87 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#include "channel_history.h"
+
+namespace jchat {
+ChannelHistory::ChannelHistory() : capacity_(0), first_(0), count_(0),
+  size_(0) {
+}
+
+void ChannelHistory::Push(HistoryMessage message) {
+  if (capacity_ == 0 || count_ == capacity_) {
+    return;
+  }
+  if (messages_.empty()) {
+    messages_.resize(capacity_);
+  }
+  size_ += message.Size;
+  messages_[(first_ + count_) % capacity_] = std::move(message);
+  count_++;
+}
+
+void ChannelHistory::PopOldest() {
+  if (count_ == 0) {
+    return;
+  }
+  HistoryMessage &message = messages_[first_];
+  size_ -= message.Size;
+  // Release the packets now instead of when the slot is reused
+  for (auto &packet : message.Packets.Packets) {
+    packet.reset();
+  }
+  first_ = (first_ + 1) % capacity_;
+  count_--;
+}
+
+void ChannelHistory::Clear() {
+  while (count_ > 0) {
+    PopOldest();
+  }
+  first_ = 0;
+}
+
+HistoryMessage &ChannelHistory::Get(size_t index) {
+  return messages_[(first_ + index) % capacity_];
+}
+
+HistoryMessage &ChannelHistory::GetOldest() {
+  return messages_[first_];
+}
+
+bool ChannelHistory::SetCapacity(size_t capacity) {
+  if (count_ > 0) {
+    return false;
+  }
+  capacity_ = capacity;
+  first_ = 0;
+  messages_.clear();
+  messages_.shrink_to_fit();
+  return true;
+}
+
+size_t ChannelHistory::GetCapacity() {
+  return capacity_;
+}
+
+size_t ChannelHistory::GetCount() {
+  return count_;
+}
+
+size_t ChannelHistory::GetSize() {
+  return size_;
+}
+
+bool ChannelHistory::IsFull() {
+  return count_ == capacity_;
+}
+
+bool ChannelHistory::IsEmpty() {
+  return count_ == 0;
+}
+}
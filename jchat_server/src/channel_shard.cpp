@@ -0,0 +1,400 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#include "channel_shard.h"
+#include "string.hpp"
+#include "thread.hpp"
+#include <algorithm>
+
+namespace jchat {
+ChannelShard::ChannelShard() : is_running_(false), metrics_(nullptr),
+  thread_name_("jchat-shard"), cpu_(-1), history_size_(0),
+  next_history_sequence_(0) {
+  history_limits_.MaxMessages = 0;
+  history_limits_.MaxChannelSize = 0;
+  history_limits_.MaxTotalSize = 0;
+  history_limits_.MaxAge = Clock::duration::zero();
+}
+
+ChannelShard::~ChannelShard() {
+  Stop();
+}
+
+void ChannelShard::workerLoop() {
+  // Channels are created by the shard's tasks, after this, so they are
+  // close to the CPU
+  Thread::SetName(thread_name_);
+  if (cpu_ >= 0) {
+    Thread::SetCpu(cpu_);
+  }
+
+  std::deque<std::function<void()>> tasks;
+  while (true) {
+    // Take every queued task at once so posting threads only wait for the
+    // swap, not for the tasks to run
+    std::unique_lock<std::mutex> lock(tasks_mutex_);
+    while (is_running_ && tasks_.empty()) {
+      if (delayed_tasks_.empty()) {
+        tasks_condition_.wait(lock);
+        continue;
+      }
+
+      // Due delayed tasks run after the tasks that were posted before them
+      auto delayed_task = delayed_tasks_.begin();
+      if (Clock::now() < delayed_task->first) {
+        tasks_condition_.wait_until(lock, delayed_task->first);
+        continue;
+      }
+      tasks_.push_back(std::move(delayed_task->second));
+      delayed_tasks_.erase(delayed_task);
+    }
+    if (tasks_.empty()) {
+      return;
+    }
+    tasks.swap(tasks_);
+    lock.unlock();
+
+    for (auto &task : tasks) {
+      task();
+    }
+    tasks.clear();
+  }
+}
+
+bool ChannelShard::Start() {
+  tasks_mutex_.lock();
+  if (is_running_) {
+    tasks_mutex_.unlock();
+    return false;
+  }
+  is_running_ = true;
+  tasks_mutex_.unlock();
+
+  worker_thread_ = std::thread(&ChannelShard::workerLoop, this);
+  return true;
+}
+
+bool ChannelShard::Stop() {
+  tasks_mutex_.lock();
+  if (!is_running_) {
+    tasks_mutex_.unlock();
+    return false;
+  }
+  is_running_ = false;
+  tasks_mutex_.unlock();
+  tasks_condition_.notify_one();
+
+  if (worker_thread_.joinable()) {
+    worker_thread_.join();
+  }
+
+  tasks_mutex_.lock();
+  delayed_tasks_.clear();
+  tasks_mutex_.unlock();
+  return true;
+}
+
+void ChannelShard::Post(std::function<void()> task) {
+  RequestContext request = RequestContext::GetCurrent();
+  if (request.RequestId != 0) {
+    task = [request, task]() {
+      RequestContext previous = RequestContext::SetCurrent(request);
+      task();
+      RequestContext::SetCurrent(previous);
+    };
+  }
+
+  MetricsRegistry *metrics = metrics_;
+  if (metrics == nullptr) {
+    tasks_mutex_.lock();
+    tasks_.push_back(std::move(task));
+    tasks_mutex_.unlock();
+    tasks_condition_.notify_one();
+    return;
+  }
+
+  metrics->Lock(tasks_mutex_, kServerHistogram_ShardLockWaitNanoseconds);
+  tasks_.push_back(std::move(task));
+  size_t queue_length = tasks_.size();
+  tasks_mutex_.unlock();
+  tasks_condition_.notify_one();
+  metrics->Record(kServerHistogram_ShardQueueLength, queue_length);
+}
+
+void ChannelShard::PostAfter(Clock::duration delay,
+  std::function<void()> task) {
+  tasks_mutex_.lock();
+  Clock::time_point due_time = Clock::now() + delay;
+  // The worker only has to wake up early for a task due before all others
+  bool is_first = delayed_tasks_.empty()
+    || due_time < delayed_tasks_.begin()->first;
+  delayed_tasks_.emplace(due_time, std::move(task));
+  tasks_mutex_.unlock();
+  if (is_first) {
+    tasks_condition_.notify_one();
+  }
+}
+
+void ChannelShard::SetMetrics(MetricsRegistry *metrics) {
+  metrics_ = metrics;
+}
+
+bool ChannelShard::SetHistoryLimits(const HistoryLimits &history_limits) {
+  tasks_mutex_.lock();
+  if (is_running_) {
+    tasks_mutex_.unlock();
+    return false;
+  }
+  history_limits_ = history_limits;
+  tasks_mutex_.unlock();
+  return true;
+}
+
+bool ChannelShard::SetThreadPlacement(const std::string &name, int cpu) {
+  tasks_mutex_.lock();
+  if (is_running_) {
+    tasks_mutex_.unlock();
+    return false;
+  }
+  thread_name_ = name;
+  cpu_ = cpu;
+  tasks_mutex_.unlock();
+  return true;
+}
+
+bool ChannelShard::IsShardThread() {
+  return std::this_thread::get_id() == worker_thread_.get_id();
+}
+
+std::shared_ptr<ChatChannel> ChannelShard::Find(const std::string &name) {
+  auto channel = channels_.find(name);
+  if (channel == channels_.end()) {
+    return nullptr;
+  }
+  return channel->second;
+}
+
+std::shared_ptr<ChatChannel> ChannelShard::Create(const std::string &name) {
+  std::shared_ptr<ChatChannel> &channel = channels_[name];
+  if (channel) {
+    return nullptr;
+  }
+  channel = std::make_shared<ChatChannel>();
+  channel->Name = name;
+  channel->MemberLists = 0;
+  channel->IsStored = false;
+  for (auto &client : client_subscriptions_) {
+    for (auto &subscription : client.second) {
+      if (String::Matches(subscription->Pattern, name)) {
+        channel->Subscribers.push_back(subscription);
+      }
+    }
+  }
+  return channel;
+}
+
+void ChannelShard::AddClient(const std::shared_ptr<ChatChannel> &channel,
+  uint64_t client_id, const std::shared_ptr<ChatUser> &user) {
+  if (channel->Clients.emplace(client_id, user).second) {
+    channel->Usernames[user->Username] = client_id;
+    client_channels_[client_id].push_back(channel);
+  }
+}
+
+bool ChannelShard::RemoveClient(const std::shared_ptr<ChatChannel> &channel,
+  uint64_t client_id) {
+  auto client = channel->Clients.find(client_id);
+  if (client == channel->Clients.end()) {
+    return false;
+  }
+  channel->Usernames.erase(client->second->Username);
+  channel->Clients.erase(client);
+  channel->Operators.erase(client_id);
+
+  auto client_channels = client_channels_.find(client_id);
+  if (client_channels != client_channels_.end()) {
+    std::vector<std::shared_ptr<ChatChannel>> &channels =
+      client_channels->second;
+    channels.erase(std::remove(channels.begin(), channels.end(), channel),
+      channels.end());
+    if (channels.empty()) {
+      client_channels_.erase(client_channels);
+    }
+  }
+
+  // Nobody is left in the channel, delete it
+  if (channel->Clients.empty()) {
+    channel->Operators.clear();
+    channel->Usernames.clear();
+    channel->PresenceChanges.clear();
+    if (!channel->IsStored) {
+      clearHistory(*channel);
+      channels_.erase(channel->Name);
+    }
+  }
+  return true;
+}
+
+std::vector<std::shared_ptr<ChatChannel>> ChannelShard::GetClientChannels(
+  uint64_t client_id) {
+  auto client_channels = client_channels_.find(client_id);
+  if (client_channels == client_channels_.end()) {
+    return std::vector<std::shared_ptr<ChatChannel>>();
+  }
+  return client_channels->second;
+}
+
+bool ChannelShard::AddPresenceChannel(
+  const std::shared_ptr<ChatChannel> &channel) {
+  presence_channels_.push_back(channel);
+  return presence_channels_.size() == 1;
+}
+
+std::vector<std::shared_ptr<ChatChannel>>
+  ChannelShard::TakePresenceChannels() {
+  std::vector<std::shared_ptr<ChatChannel>> channels;
+  channels.swap(presence_channels_);
+  return channels;
+}
+
+std::vector<std::shared_ptr<ChatChannel>> ChannelShard::GetChannels() {
+  std::vector<std::shared_ptr<ChatChannel>> channels;
+  channels.reserve(channels_.size());
+  for (auto &channel : channels_) {
+    channels.push_back(channel.second);
+  }
+  return channels;
+}
+
+void ChannelShard::popHistory(ChatChannel &channel) {
+  ChannelHistory &history = channel.History;
+  HistoryMessage &oldest = history.GetOldest();
+  history_channels_.erase(std::make_pair(oldest.Sequence, &channel));
+  history_size_ -= oldest.Size;
+  history.PopOldest();
+  if (!history.IsEmpty()) {
+    history_channels_.emplace(history.GetOldest().Sequence, &channel);
+  }
+}
+
+void ChannelShard::clearHistory(ChatChannel &channel) {
+  ChannelHistory &history = channel.History;
+  if (!history.IsEmpty()) {
+    history_channels_.erase(std::make_pair(history.GetOldest().Sequence,
+      &channel));
+    history_size_ -= history.GetSize();
+    history.Clear();
+  }
+}
+
+void ChannelShard::AddHistory(const std::shared_ptr<ChatChannel> &channel,
+  const PacketSet &packets) {
+  HistoryMessage message;
+  message.Packets = packets;
+  message.Time = Clock::now();
+  message.Size = 0;
+  for (auto &packet : packets.Packets) {
+    if (packet) {
+      message.Size += packet->GetSize();
+    }
+  }
+  if (history_limits_.MaxMessages == 0
+    || message.Size > history_limits_.MaxChannelSize
+    || message.Size > history_limits_.MaxTotalSize) {
+    return;
+  }
+
+  ChannelHistory &history = channel->History;
+  if (history.IsEmpty()) {
+    history.SetCapacity(history_limits_.MaxMessages);
+  }
+  while (!history.IsEmpty() && (history.IsFull()
+    || history.GetSize() + message.Size > history_limits_.MaxChannelSize)) {
+    popHistory(*channel);
+  }
+
+  message.Sequence = next_history_sequence_++;
+  if (history.IsEmpty()) {
+    history_channels_.emplace(message.Sequence, channel.get());
+  }
+  history_size_ += message.Size;
+  history.Push(std::move(message));
+
+  PruneHistory();
+}
+
+void ChannelShard::PruneHistory() {
+  // Sequences grow with time, so the oldest messages of the shard are the
+  // first ones of the first channels
+  Clock::time_point oldest_time = Clock::now() - history_limits_.MaxAge;
+  while (!history_channels_.empty()) {
+    ChatChannel &channel = *history_channels_.begin()->second;
+    bool is_too_old = history_limits_.MaxAge > Clock::duration::zero()
+      && channel.History.GetOldest().Time < oldest_time;
+    if (!is_too_old && history_size_ <= history_limits_.MaxTotalSize) {
+      break;
+    }
+    popHistory(channel);
+  }
+}
+
+size_t ChannelShard::GetHistorySize() {
+  return history_size_;
+}
+
+size_t ChannelShard::GetChannelCount() {
+  return channels_.size();
+}
+
+void ChannelShard::AddSubscription(
+  const std::shared_ptr<const ChannelSubscription> &subscription) {
+  client_subscriptions_[subscription->ClientId].push_back(subscription);
+  for (auto &channel : channels_) {
+    if (String::Matches(subscription->Pattern, channel.first)) {
+      channel.second->Subscribers.push_back(subscription);
+    }
+  }
+}
+
+void ChannelShard::RemoveSubscriptions(uint64_t client_id,
+  const std::string &pattern) {
+  auto client = client_subscriptions_.find(client_id);
+  if (client == client_subscriptions_.end()) {
+    return;
+  }
+
+  auto is_removed = [&](
+    const std::shared_ptr<const ChannelSubscription> &subscription) {
+    return subscription->ClientId == client_id
+      && (pattern.empty() || subscription->Pattern == pattern);
+  };
+  for (auto &channel : channels_) {
+    std::vector<std::shared_ptr<const ChannelSubscription>> &subscribers =
+      channel.second->Subscribers;
+    subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(),
+      is_removed), subscribers.end());
+  }
+  client->second.erase(std::remove_if(client->second.begin(),
+    client->second.end(), is_removed), client->second.end());
+  if (client->second.empty()) {
+    client_subscriptions_.erase(client);
+  }
+}
+
+void ChannelShard::Clear() {
+  for (auto &channel : channels_) {
+    channel.second->History.Clear();
+  }
+  history_channels_.clear();
+  history_size_ = 0;
+  channels_.clear();
+  client_channels_.clear();
+  client_subscriptions_.clear();
+  presence_channels_.clear();
+}
+}
@@ -0,0 +1,451 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#include "channel_store.h"
+#include "mapped_file.hpp"
+#include "platform.h"
+#include "thread.hpp"
+#include <cstring>
+#include <stdint.h>
+#include <unordered_map>
+#if defined(OS_LINUX) || defined(OS_OSX) || defined(OS_UNIX)
+#include <unistd.h>
+#elif defined(OS_WIN)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#endif
+
+// "JCCS", read back in the other order on machines of the other byte order,
+// which then don't load the snapshot
+#define JCHAT_CHANNEL_SNAPSHOT_MAGIC 0x5343434A
+#define JCHAT_CHANNEL_SNAPSHOT_VERSION 1
+
+namespace jchat {
+namespace {
+// The snapshot is these records in this order, then the strings. Every
+// record is a multiple of 8 bytes, so all of them can be read in place.
+struct SnapshotHeader {
+  uint32_t Magic;
+  uint32_t Version;
+  uint64_t ChannelCount;
+  uint64_t EntryCount;
+  uint64_t StringsSize;
+};
+
+struct SnapshotString {
+  uint32_t Offset;
+  uint32_t Size;
+};
+
+// The entries of a channel are its operators followed by its bans
+struct SnapshotChannel {
+  SnapshotString Name;
+  uint32_t FirstEntry;
+  uint32_t OperatorCount;
+  uint32_t BanCount;
+  uint32_t Reserved;
+};
+
+// Followed by the channel name and the identity
+struct LogRecord {
+  uint8_t Change;
+  uint8_t Reserved;
+  uint16_t NameSize;
+  uint16_t IdentitySize;
+};
+
+typedef std::unordered_map<std::string, StoredChannel> ChannelMap;
+
+bool readString(const SnapshotHeader &header, const uint8_t *strings,
+  const SnapshotString &string, std::string &out_string) {
+  if (static_cast<uint64_t>(string.Offset) + string.Size
+    > header.StringsSize) {
+    return false;
+  }
+  out_string.assign(reinterpret_cast<const char *>(strings + string.Offset),
+    string.Size);
+  return true;
+}
+
+// Missing snapshots load as empty ones
+bool loadSnapshot(const std::string &path, ChannelMap &channels) {
+  MappedFile file;
+  if (!file.Open(path)) {
+    return true;
+  }
+  const uint8_t *data = file.GetData();
+  size_t size = file.GetSize();
+
+  SnapshotHeader header;
+  if (size < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, data, sizeof(header));
+  if (header.Magic != JCHAT_CHANNEL_SNAPSHOT_MAGIC
+    || header.Version != JCHAT_CHANNEL_SNAPSHOT_VERSION
+    || header.ChannelCount > size / sizeof(SnapshotChannel)
+    || header.EntryCount > size / sizeof(SnapshotString)
+    || header.StringsSize > size
+    || sizeof(header) + header.ChannelCount * sizeof(SnapshotChannel)
+    + header.EntryCount * sizeof(SnapshotString) + header.StringsSize
+    != size) {
+    return false;
+  }
+
+  const SnapshotChannel *snapshot_channels =
+    reinterpret_cast<const SnapshotChannel *>(data + sizeof(header));
+  const SnapshotString *entries = reinterpret_cast<const SnapshotString *>(
+    snapshot_channels + header.ChannelCount);
+  const uint8_t *strings = reinterpret_cast<const uint8_t *>(
+    entries + header.EntryCount);
+
+  channels.reserve(header.ChannelCount);
+  std::string name;
+  std::string entry;
+  for (uint64_t i = 0; i < header.ChannelCount; i++) {
+    const SnapshotChannel &snapshot_channel = snapshot_channels[i];
+    uint64_t entry_end = static_cast<uint64_t>(snapshot_channel.FirstEntry)
+      + snapshot_channel.OperatorCount + snapshot_channel.BanCount;
+    if (entry_end > header.EntryCount
+      || !readString(header, strings, snapshot_channel.Name, name)) {
+      return false;
+    }
+
+    StoredChannel &channel = channels[name];
+    channel.Name = name;
+    channel.Operators.reserve(snapshot_channel.OperatorCount);
+    channel.BannedUsers.reserve(snapshot_channel.BanCount);
+    for (uint64_t j = snapshot_channel.FirstEntry; j < entry_end; j++) {
+      if (!readString(header, strings, entries[j], entry)) {
+        return false;
+      }
+      if (j - snapshot_channel.FirstEntry < snapshot_channel.OperatorCount) {
+        channel.Operators.insert(entry);
+      } else {
+        channel.BannedUsers.insert(entry);
+      }
+    }
+  }
+  return true;
+}
+
+// Changes are only ever added, so a log can be replayed over a snapshot
+// that already has some of them. A record that was cut off by a crash ends
+// the log.
+bool replayLog(const std::string &path, ChannelMap &channels) {
+  MappedFile file;
+  if (!file.Open(path)) {
+    return true;
+  }
+  const uint8_t *data = file.GetData();
+  size_t size = file.GetSize();
+
+  size_t offset = 0;
+  std::string name;
+  while (size - offset >= sizeof(LogRecord)) {
+    LogRecord record;
+    memcpy(&record, data + offset, sizeof(record));
+    size_t record_size = sizeof(record) + record.NameSize
+      + record.IdentitySize;
+    if (size - offset < record_size) {
+      break;
+    }
+    const char *strings = reinterpret_cast<const char *>(data + offset
+      + sizeof(record));
+    offset += record_size;
+
+    name.assign(strings, record.NameSize);
+    std::string identity(strings + record.NameSize, record.IdentitySize);
+    if (record.Change == kChannelChange_Removed) {
+      channels.erase(name);
+      continue;
+    }
+    StoredChannel &channel = channels[name];
+    channel.Name = name;
+    switch (record.Change) {
+    case kChannelChange_Created:
+      channel.Operators.insert(std::move(identity));
+      break;
+    case kChannelChange_Banned:
+      channel.BannedUsers.insert(std::move(identity));
+      break;
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+bool fileExists(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  fclose(file);
+  return true;
+}
+
+bool replaceFile(const std::string &from_path, const std::string &to_path) {
+#if defined(OS_WIN)
+  return MoveFileExA(from_path.c_str(), to_path.c_str(),
+    MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return rename(from_path.c_str(), to_path.c_str()) == 0;
+#endif
+}
+
+bool syncFile(FILE *file) {
+  if (fflush(file) != 0) {
+    return false;
+  }
+#if defined(OS_WIN)
+  return _commit(_fileno(file)) == 0;
+#else
+  return fsync(fileno(file)) == 0;
+#endif
+}
+
+void addString(std::vector<SnapshotString> &entries, std::string &strings,
+  const std::string &string) {
+  SnapshotString entry;
+  entry.Offset = static_cast<uint32_t>(strings.size());
+  entry.Size = static_cast<uint32_t>(string.size());
+  entries.push_back(entry);
+  strings += string;
+}
+}
+
+ChannelStore::ChannelStore() : log_file_(nullptr), log_size_(0),
+  is_running_(false), snapshot_interval_(0) {
+}
+
+ChannelStore::~ChannelStore() {
+  Close();
+}
+
+bool ChannelStore::openLog() {
+  log_file_ = fopen((path_ + ".log").c_str(), "wb");
+  log_size_ = 0;
+  return log_file_ != nullptr;
+}
+
+bool ChannelStore::rotateLog() {
+  // The last snapshot failed and the old log is still needed, the current
+  // one is kept until a snapshot works
+  if (fileExists(path_ + ".log.old")) {
+    return true;
+  }
+
+  log_mutex_.lock();
+  fclose(log_file_);
+  bool result = replaceFile(path_ + ".log", path_ + ".log.old");
+  // Appending to the old log again is all that's left if it can't be moved
+  log_file_ = fopen((path_ + ".log").c_str(), result ? "wb" : "ab");
+  log_size_ = 0;
+  log_mutex_.unlock();
+  return result && log_file_ != nullptr;
+}
+
+bool ChannelStore::Open(const std::string &path,
+  std::vector<StoredChannel> &out_channels) {
+  if (IsOpen()) {
+    return false;
+  }
+  path_ = path;
+
+  ChannelMap channels;
+  if (!loadSnapshot(path_ + ".snapshot", channels)
+    || !replayLog(path_ + ".log.old", channels)
+    || !replayLog(path_ + ".log", channels)) {
+    return false;
+  }
+  out_channels.clear();
+  out_channels.reserve(channels.size());
+  for (auto &channel : channels) {
+    if (!channel.second.BannedUsers.empty()) {
+      out_channels.push_back(std::move(channel.second));
+    }
+  }
+
+  // Both logs are in the new snapshot, so they aren't needed anymore
+  if (!WriteSnapshot(out_channels)) {
+    return false;
+  }
+
+  log_mutex_.lock();
+  bool result = openLog();
+  log_mutex_.unlock();
+  return result;
+}
+
+void ChannelStore::Close() {
+  Stop();
+
+  log_mutex_.lock();
+  if (log_file_ != nullptr) {
+    fclose(log_file_);
+    log_file_ = nullptr;
+  }
+  log_mutex_.unlock();
+}
+
+bool ChannelStore::IsOpen() {
+  log_mutex_.lock();
+  bool is_open = log_file_ != nullptr;
+  log_mutex_.unlock();
+  return is_open;
+}
+
+bool ChannelStore::Append(ChannelChange change,
+  const std::string &channel_name, const std::string &identity) {
+  LogRecord record;
+  record.Change = change;
+  record.Reserved = 0;
+  record.NameSize = static_cast<uint16_t>(channel_name.size());
+  record.IdentitySize = static_cast<uint16_t>(identity.size());
+  if (record.NameSize != channel_name.size()
+    || record.IdentitySize != identity.size()) {
+    return false;
+  }
+
+  // One write per record, a crash can only cut off the last one
+  std::string bytes(reinterpret_cast<const char *>(&record), sizeof(record));
+  bytes += channel_name;
+  bytes += identity;
+
+  log_mutex_.lock();
+  if (log_file_ == nullptr) {
+    log_mutex_.unlock();
+    return false;
+  }
+  bool result = fwrite(bytes.data(), 1, bytes.size(), log_file_)
+    == bytes.size() && fflush(log_file_) == 0;
+  log_size_ += bytes.size();
+  bool is_full = log_size_ > JCHAT_CHANNEL_STORE_MAX_LOG_SIZE;
+  log_mutex_.unlock();
+
+  if (is_full) {
+    snapshot_condition_.notify_one();
+  }
+  return result;
+}
+
+bool ChannelStore::WriteSnapshot(const std::vector<StoredChannel> &channels) {
+  std::vector<SnapshotChannel> snapshot_channels;
+  std::vector<SnapshotString> entries;
+  std::vector<SnapshotString> names;
+  std::string strings;
+  snapshot_channels.reserve(channels.size());
+  for (auto &channel : channels) {
+    SnapshotChannel snapshot_channel;
+    addString(names, strings, channel.Name);
+    snapshot_channel.Name = names.back();
+    snapshot_channel.FirstEntry = static_cast<uint32_t>(entries.size());
+    snapshot_channel.OperatorCount = static_cast<uint32_t>(
+      channel.Operators.size());
+    snapshot_channel.BanCount = static_cast<uint32_t>(
+      channel.BannedUsers.size());
+    snapshot_channel.Reserved = 0;
+    for (auto &identity : channel.Operators) {
+      addString(entries, strings, identity);
+    }
+    for (auto &identity : channel.BannedUsers) {
+      addString(entries, strings, identity);
+    }
+    snapshot_channels.push_back(snapshot_channel);
+  }
+  if (strings.size() > UINT32_MAX || entries.size() > UINT32_MAX) {
+    return false;
+  }
+  // Keeps the records that follow the strings aligned in later versions
+  strings.resize((strings.size() + 7) & ~static_cast<size_t>(7));
+
+  SnapshotHeader header;
+  header.Magic = JCHAT_CHANNEL_SNAPSHOT_MAGIC;
+  header.Version = JCHAT_CHANNEL_SNAPSHOT_VERSION;
+  header.ChannelCount = snapshot_channels.size();
+  header.EntryCount = entries.size();
+  header.StringsSize = strings.size();
+
+  // Written next to the snapshot and moved over it, so a crash leaves
+  // either the old or the new one
+  std::string temporary_path = path_ + ".snapshot.tmp";
+  FILE *file = fopen(temporary_path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool result = fwrite(&header, sizeof(header), 1, file) == 1
+    && fwrite(snapshot_channels.data(), sizeof(SnapshotChannel),
+    snapshot_channels.size(), file) == snapshot_channels.size()
+    && fwrite(entries.data(), sizeof(SnapshotString), entries.size(), file)
+    == entries.size()
+    && fwrite(strings.data(), 1, strings.size(), file) == strings.size()
+    && syncFile(file);
+  fclose(file);
+  if (!result || !replaceFile(temporary_path, path_ + ".snapshot")) {
+    remove(temporary_path.c_str());
+    return false;
+  }
+
+  remove((path_ + ".log.old").c_str());
+  return true;
+}
+
+void ChannelStore::snapshotLoop() {
+  Thread::SetName("jchat-snapshot");
+  std::unique_lock<std::mutex> lock(log_mutex_);
+  while (is_running_) {
+    snapshot_condition_.wait_for(lock, snapshot_interval_);
+    if (!is_running_ || log_size_ == 0) {
+      continue;
+    }
+    lock.unlock();
+
+    // Changes made while the channels are captured are in the new log, and
+    // maybe in the snapshot as well, which doesn't hurt
+    if (rotateLog()) {
+      WriteSnapshot(capture_());
+    }
+    lock.lock();
+  }
+}
+
+bool ChannelStore::Start(std::chrono::milliseconds snapshot_interval,
+  CaptureFunction capture) {
+  log_mutex_.lock();
+  if (is_running_ || log_file_ == nullptr
+    || snapshot_interval.count() <= 0) {
+    log_mutex_.unlock();
+    return false;
+  }
+  is_running_ = true;
+  snapshot_interval_ = snapshot_interval;
+  capture_ = capture;
+  log_mutex_.unlock();
+
+  snapshot_thread_ = std::thread(&ChannelStore::snapshotLoop, this);
+  return true;
+}
+
+bool ChannelStore::Stop() {
+  log_mutex_.lock();
+  if (!is_running_) {
+    log_mutex_.unlock();
+    return false;
+  }
+  is_running_ = false;
+  log_mutex_.unlock();
+  snapshot_condition_.notify_one();
+
+  if (snapshot_thread_.joinable()) {
+    snapshot_thread_.join();
+  }
+  return true;
+}
+}
@@ -7,10 +7,21 @@
 */
 
 #include "chat_server.h"
+#include "protocol/components/system_message_type.h"
+#include <random>
 
 namespace jchat {
 ChatServer::ChatServer(const char *hostname, uint16_t port)
-  : tcp_server_(hostname, port), is_listening_(false) {
+  : tcp_server_(hostname, port), is_listening_(false), next_client_id_(1),
+  client_pool_(std::make_shared<ObjectPool<RemoteChatClient>>()),
+  metrics_(JCHAT_METRICS_SERVER_COUNTERS, kServerHistogram_Max),
+  batch_window_(JCHAT_CHAT_BATCH_WINDOW), node_id_(0),
+  client_relay_(nullptr),
+  resume_grace_period_(std::chrono::seconds(JCHAT_CHAT_RESUME_GRACE_PERIOD)),
+  receive_budget_(JCHAT_CHAT_RECEIVE_BUDGET), message_rate_(0),
+  message_burst_(0) {
+  tcp_server_.SetIdleTimeout(JCHAT_CHAT_IDLE_TIMEOUT);
+
   int16_t number = 0x00FF;
   is_little_endian_ = ((uint8_t *)&number)[0] == 0xFF;
 
@@ -20,8 +31,16 @@ ChatServer::ChatServer(const char *hostname, uint16_t port)
   tcp_server_.OnClientDisconnected.Add([this](TcpClient &client) {
     return onClientDisconnected(client);
   });
-  tcp_server_.OnDataReceived.Add([this](TcpClient &client, Buffer &buffer) {
-    return onDataReceived(client, buffer);
+  tcp_server_.OnDataReceived.Add([this](TcpClient &client,
+    StreamBuffer &stream) {
+    return onDataReceived(client, stream);
+  });
+  tcp_server_.OnClientIdle.Add([this](TcpClient &client) {
+    return onClientIdle(client);
+  });
+  tcp_server_.OnClientRejected.Add([this](IPEndpoint &endpoint) {
+    metrics_.Add(kServerCounter_ConnectionsRejected);
+    return true;
   });
 }
 
@@ -30,10 +49,18 @@ ChatServer::~ChatServer() {
   if (!clients_.empty()) {
     for (auto client : clients_) {
       client.first->Disconnect();
-      delete client.second;
+      client_pool_->Destroy(client.second);
     }
     clients_.clear();
+    clients_by_id_.clear();
   }
+  for (auto &session : sessions_) {
+    if (session.second.Client != nullptr) {
+      client_pool_->Destroy(session.second.Client);
+    }
+  }
+  sessions_.clear();
+  session_tokens_.clear();
 }
 
 bool ChatServer::Start() {
@@ -41,9 +68,23 @@ bool ChatServer::Start() {
     return false;
   }
 
+  if (!logger_.Start()) {
+    return false;
+  }
   if (!tcp_server_.Start()) {
+    logger_.Stop();
     return false;
   }
+  if (batch_window_.count() > 0) {
+    batch_queue_.Start(batch_window_, [this](uint64_t client_id) {
+      flushBatch(client_id);
+    });
+  }
+  if (resume_grace_period_.count() > 0) {
+    session_queue_.Start(resume_grace_period_, [this](uint64_t client_id) {
+      expireSession(client_id);
+    });
+  }
 
   for (auto component : components_) {
     component->OnStart();
@@ -62,21 +103,32 @@ bool ChatServer::Stop() {
   if (!tcp_server_.Stop()) {
     return false;
   }
+  batch_queue_.Stop();
+  session_queue_.Stop();
 
-  // Remove clients
+  // Remove clients, and the ones whose sessions wait to be resumed
   clients_mutex_.lock();
   if (!clients_.empty()) {
     for (auto client : clients_) {
       client.first->Disconnect();
-      delete client.second;
+      client_pool_->Destroy(client.second);
     }
     clients_.clear();
+    clients_by_id_.clear();
+  }
+  for (auto &session : sessions_) {
+    if (session.second.Client != nullptr) {
+      client_pool_->Destroy(session.second.Client);
+    }
   }
+  sessions_.clear();
+  session_tokens_.clear();
   clients_mutex_.unlock();
 
   for (auto component : components_) {
     component->OnStop();
   }
+  logger_.Stop();
 
   is_listening_ = false;
 
@@ -88,15 +140,16 @@ bool ChatServer::AddComponent(std::shared_ptr<ChatComponent> component) {
     return false;
   }
 
-  for (auto it = components_.begin(); it != components_.end(); ++it) {
-    if (*it == component) {
-      return false;
-    }
+  ComponentType component_type = component->GetType();
+  if (component_type >= kComponentType_Max
+    || components_by_type_[component_type]) {
+    return false;
   }
   if (!component->Initialize(*this)) {
     return false;
   }
   components_.push_back(component);
+  components_by_type_[component_type] = component;
 
   return true;
 }
@@ -112,6 +165,7 @@ bool ChatServer::RemoveComponent(std::shared_ptr<ChatComponent> component) {
 		    return false;
       }
       components_.erase(it);
+      components_by_type_[component->GetType()].reset();
       return true;
     }
   }
@@ -121,47 +175,469 @@ bool ChatServer::RemoveComponent(std::shared_ptr<ChatComponent> component) {
 
 bool ChatServer::GetComponent(ComponentType component_type,
   std::shared_ptr<ChatComponent> &out_component) {
-  for (auto component : components_) {
-    if (component->GetType() == component_type) {
-      out_component = component;
-      return true;
-    }
+  if (component_type >= kComponentType_Max
+    || !components_by_type_[component_type]) {
+    return false;
   }
-  return false;
+  out_component = components_by_type_[component_type];
+  return true;
 }
 
 TypedBuffer ChatServer::CreateBuffer() {
     return TypedBuffer(!is_little_endian_);
 }
 
+void ChatServer::SetIdentity(ChatUser &user, const std::string &username,
+  const std::string &hostname) {
+  user.Interned = std::make_shared<const ChatIdentity>(username, hostname,
+    !is_little_endian_);
+  user.Username = username;
+  user.Hostname = hostname;
+  user.Identity = user.Interned->GetIdentity();
+}
+
 bool ChatServer::Send(RemoteChatClient &client,
   ComponentType component_type, uint8_t message_type, TypedBuffer &buffer) {
-  TcpClient *tcp_client = NULL;
-  if (!getTcpClient(client, &tcp_client)) {
-    return false;
+  uint32_t request_id = RequestContext::GetRequestId(client.Id);
+  if (!IsLocalClient(client.Id)) {
+    return relay(client.Id, component_type, message_type, buffer,
+      request_id);
   }
-  return send(*tcp_client, component_type, message_type, buffer);
+  return Send(client, CreatePacket(component_type, message_type, buffer,
+    client.SendFormat, request_id));
 }
 
 bool ChatServer::Send(RemoteChatClient *client,
   ComponentType component_type, uint8_t message_type, TypedBuffer &buffer) {
-  TcpClient *tcp_client = NULL;
-  if (!getTcpClient(*client, &tcp_client)) {
+  return Send(*client, component_type, message_type, buffer);
+}
+
+std::shared_ptr<Packet> ChatServer::CreatePacket(ComponentType component_type,
+  uint8_t message_type, TypedBuffer &buffer, WireFormat format,
+  uint32_t request_id) {
+  const uint8_t *body = buffer.GetBuffer();
+  size_t body_size = buffer.GetSize();
+
+  // Components always write the tagged format, convert it for clients that
+  // agreed on the compact one
+  Buffer compact_body(!is_little_endian_);
+  if (format == kWireFormat_Compact) {
+    compact_body.Reserve(body_size);
+    if (!WireFormatConverter::ToCompact(body, body_size, !is_little_endian_,
+      compact_body)) {
+      return nullptr;
+    }
+    body = compact_body.GetBuffer();
+    body_size = compact_body.GetSize();
+  }
+
+  Buffer header(!is_little_endian_);
+  header.Reserve(sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint32_t)
+    + sizeof(request_id));
+
+  // Write header
+  header.Write<uint8_t>(request_id != 0
+    ? component_type | JCHAT_CHAT_FRAME_REQUEST : component_type);
+  header.Write<uint16_t>(message_type);
+  header.Write<uint32_t>(body_size);
+  if (request_id != 0) {
+    header.Write<uint32_t>(request_id);
+  }
+
+  return std::make_shared<Packet>(header.GetBuffer(), header.GetSize(),
+    body, body_size);
+}
+
+PacketSet ChatServer::CreatePackets(ComponentType component_type,
+  uint8_t message_type, TypedBuffer &buffer) {
+  PacketSet packets;
+  packets.Component = component_type;
+  packets.MessageType = message_type;
+  packets.Packets[kWireFormat_Tagged] = CreatePacket(component_type,
+    message_type, buffer, kWireFormat_Tagged);
+  packets.Packets[kWireFormat_Compact] = CreatePacket(component_type,
+    message_type, buffer, kWireFormat_Compact);
+  return packets;
+}
+
+bool ChatServer::Send(RemoteChatClient &client,
+  const std::shared_ptr<Packet> &packet) {
+  if (!client.Connection || !packet) {
     return false;
   }
-  return send(*tcp_client, component_type, message_type, buffer);
+  std::shared_ptr<ConnectionCompression> compression =
+    std::atomic_load(&client.Compression);
+  std::shared_ptr<ConnectionBatch> batch = std::atomic_load(&client.Batch);
+  return sendPacket(*client.Connection, compression.get(), batch.get(),
+    packet);
+}
+
+bool ChatServer::Send(RemoteChatClient *client,
+  const std::shared_ptr<Packet> &packet) {
+  return Send(*client, packet);
+}
+
+bool ChatServer::Send(uint64_t client_id, ComponentType component_type,
+  uint8_t message_type, TypedBuffer &buffer) {
+  if (!IsLocalClient(client_id)) {
+    return relay(client_id, component_type, message_type, buffer,
+      RequestContext::GetRequestId(client_id));
+  }
+
+  std::shared_ptr<TcpClient> connection;
+  WireFormat format;
+  std::shared_ptr<ConnectionCompression> compression;
+  std::shared_ptr<ConnectionBatch> batch;
+  if (!getConnection(client_id, connection, format, compression, batch)) {
+    return false;
+  }
+  std::shared_ptr<Packet> packet = CreatePacket(component_type, message_type,
+    buffer, format, RequestContext::GetRequestId(client_id));
+  if (packet && !connection) {
+    return keepMissed(client_id, packet);
+  }
+  return packet && sendPacket(*connection, compression.get(), batch.get(),
+    packet);
+}
+
+bool ChatServer::Send(uint64_t client_id,
+  const std::shared_ptr<Packet> &packet) {
+  std::shared_ptr<TcpClient> connection;
+  WireFormat format;
+  std::shared_ptr<ConnectionCompression> compression;
+  std::shared_ptr<ConnectionBatch> batch;
+  if (!packet || !getConnection(client_id, connection, format, compression,
+    batch)) {
+    return false;
+  }
+  if (!connection) {
+    return keepMissed(client_id, packet);
+  }
+  return sendPacket(*connection, compression.get(), batch.get(), packet);
+}
+
+bool ChatServer::Send(uint64_t client_id, const PacketSet &packets) {
+  if (!IsLocalClient(client_id)) {
+    // The tagged body is what the component wrote in the first place
+    const std::shared_ptr<Packet> &packet =
+      packets.Packets[kWireFormat_Tagged];
+    size_t header_size = sizeof(uint8_t) + sizeof(uint16_t)
+      + sizeof(uint32_t);
+    if (!packet || packet->GetSize() < header_size) {
+      return false;
+    }
+    TypedBuffer buffer(packet->GetData() + header_size,
+      packet->GetSize() - header_size, !is_little_endian_);
+    return relay(client_id, packets.Component, packets.MessageType, buffer,
+      0);
+  }
+
+  std::shared_ptr<TcpClient> connection;
+  WireFormat format;
+  std::shared_ptr<ConnectionCompression> compression;
+  std::shared_ptr<ConnectionBatch> batch;
+  if (!getConnection(client_id, connection, format, compression, batch)) {
+    return false;
+  }
+  const std::shared_ptr<Packet> &packet = packets.Packets[format];
+  if (packet && !connection) {
+    return keepMissed(client_id, packet);
+  }
+  return packet && sendPacket(*connection, compression.get(), batch.get(),
+    packet);
+}
+
+size_t ChatServer::Broadcast(const std::vector<RemoteChatClient *> &clients,
+  ComponentType component_type, uint8_t message_type, TypedBuffer &buffer) {
+  if (clients.empty()) {
+    return 0;
+  }
+
+  // Every wire format is framed at most once, however many clients use it
+  std::shared_ptr<Packet> packets[2];
+
+  size_t sent_count = 0;
+  for (auto client : clients) {
+    WireFormat format = client->SendFormat;
+    std::shared_ptr<Packet> &packet = packets[format];
+    if (!packet) {
+      packet = CreatePacket(component_type, message_type, buffer, format);
+    }
+    if (Send(*client, packet)) {
+      sent_count++;
+    }
+  }
+  metrics_.Add(kServerCounter_Broadcasts);
+  metrics_.Record(kServerHistogram_BroadcastRecipients, sent_count);
+  return sent_count;
+}
+
+size_t ChatServer::Broadcast(const std::vector<uint64_t> &client_ids,
+  ComponentType component_type, uint8_t message_type, TypedBuffer &buffer) {
+  PacketSet packets;
+  packets.Component = component_type;
+  packets.MessageType = message_type;
+  return Broadcast(client_ids, buffer, packets);
+}
+
+size_t ChatServer::Broadcast(const std::vector<uint64_t> &client_ids,
+  TypedBuffer &buffer, PacketSet &packets) {
+  if (client_ids.empty()) {
+    return 0;
+  }
+  ComponentType component_type = packets.Component;
+  uint8_t message_type = packets.MessageType;
+
+  // Clients of other cluster nodes are handed to the relay all at once, it
+  // sends every node a single copy for all of its clients
+  size_t relayed_count = 0;
+  std::vector<uint64_t> remote_client_ids;
+  if (client_relay_ != nullptr) {
+    for (uint64_t client_id : client_ids) {
+      if (!IsLocalClient(client_id)) {
+        remote_client_ids.push_back(client_id);
+      }
+    }
+    if (!remote_client_ids.empty()) {
+      relayed_count = client_relay_->Relay(remote_client_ids, component_type,
+        message_type, buffer, 0);
+    }
+  }
+
+  // Look every client up at once, the sends happen outside of the lock
+  struct Recipient {
+    uint64_t ClientId;
+    std::shared_ptr<TcpClient> Connection;
+    WireFormat Format;
+    std::shared_ptr<ConnectionCompression> Compression;
+    std::shared_ptr<ConnectionBatch> Batch;
+  };
+  std::vector<Recipient> recipients;
+  recipients.reserve(client_ids.size());
+  metrics_.Lock(clients_mutex_, kServerHistogram_ClientsLockWaitNanoseconds);
+  for (uint64_t client_id : client_ids) {
+    auto client = clients_by_id_.find(client_id);
+    if (client == clients_by_id_.end()) {
+      continue;
+    }
+    Recipient recipient;
+    recipient.ClientId = client_id;
+    recipient.Connection = client->second->Connection;
+    recipient.Format = client->second->SendFormat;
+    recipient.Compression = std::atomic_load(&client->second->Compression);
+    recipient.Batch = std::atomic_load(&client->second->Batch);
+    recipients.push_back(std::move(recipient));
+  }
+  clients_mutex_.unlock();
+
+  // Every wire format is framed at most once, however many clients use it
+  size_t sent_count = relayed_count;
+  for (auto &recipient : recipients) {
+    std::shared_ptr<Packet> &packet = packets.Packets[recipient.Format];
+    if (!packet) {
+      packet = CreatePacket(component_type, message_type, buffer,
+        recipient.Format);
+    }
+    // Clients whose sessions wait to be resumed have no connection
+    if (!packet) {
+      continue;
+    }
+    if (recipient.Connection ? sendPacket(*recipient.Connection,
+      recipient.Compression.get(), recipient.Batch.get(), packet)
+      : keepMissed(recipient.ClientId, packet)) {
+      sent_count++;
+    }
+  }
+  metrics_.Add(kServerCounter_Broadcasts);
+  metrics_.Record(kServerHistogram_BroadcastRecipients, sent_count);
+  return sent_count;
 }
 
 IPEndpoint ChatServer::GetListenEndpoint() {
   return tcp_server_.GetListenEndpoint();
 }
 
+bool ChatServer::SetPollerType(PollerType poller_type) {
+  return tcp_server_.SetPollerType(poller_type);
+}
+
+PollerType ChatServer::GetPollerType() {
+  return tcp_server_.GetPollerType();
+}
+
+bool ChatServer::SetIoThreadCount(size_t io_thread_count) {
+  return tcp_server_.SetIoThreadCount(io_thread_count);
+}
+
+size_t ChatServer::GetIoThreadCount() {
+  return tcp_server_.GetIoThreadCount();
+}
+
+bool ChatServer::SetIoCpus(const std::vector<int> &io_cpus) {
+  return tcp_server_.SetIoCpus(io_cpus);
+}
+
+const std::vector<int> &ChatServer::GetIoCpus() {
+  return tcp_server_.GetIoCpus();
+}
+
+bool ChatServer::SetSendQueueLimits(size_t high_watermark,
+  size_t low_watermark) {
+  return tcp_server_.SetSendQueueLimits(high_watermark, low_watermark);
+}
+
+bool ChatServer::SetSendQueuePolicy(SendQueuePolicy send_queue_policy) {
+  return tcp_server_.SetSendQueuePolicy(send_queue_policy);
+}
+
+SendQueuePolicy ChatServer::GetSendQueuePolicy() {
+  return tcp_server_.GetSendQueuePolicy();
+}
+
+bool ChatServer::SetListenBacklog(int32_t listen_backlog) {
+  return tcp_server_.SetListenBacklog(listen_backlog);
+}
+
+bool ChatServer::SetNoDelay(bool is_no_delay) {
+  return tcp_server_.SetNoDelay(is_no_delay);
+}
+
+bool ChatServer::SetLocalPath(const std::string &local_path) {
+  return tcp_server_.SetLocalPath(local_path);
+}
+
+std::string ChatServer::GetLocalPath() {
+  return tcp_server_.GetLocalPath();
+}
+
+bool ChatServer::SetSocketBufferSizes(int32_t send_buffer_size,
+  int32_t receive_buffer_size) {
+  return tcp_server_.SetSocketBufferSizes(send_buffer_size,
+    receive_buffer_size);
+}
+
+bool ChatServer::SetConnectionRateLimit(double rate, double burst) {
+  return tcp_server_.SetConnectionRateLimit(rate, burst);
+}
+
+bool ChatServer::SetIdleTimeout(std::chrono::milliseconds idle_timeout) {
+  return tcp_server_.SetIdleTimeout(
+    static_cast<uint64_t>(idle_timeout.count()));
+}
+
+std::chrono::milliseconds ChatServer::GetIdleTimeout() {
+  return std::chrono::milliseconds(tcp_server_.GetIdleTimeout());
+}
+
+bool ChatServer::SetBatchWindow(std::chrono::microseconds batch_window) {
+  if (is_listening_) {
+    return false;
+  }
+  batch_window_ = batch_window;
+  return true;
+}
+
+std::chrono::microseconds ChatServer::GetBatchWindow() {
+  return batch_window_;
+}
+
+bool ChatServer::SetResumeGracePeriod(
+  std::chrono::milliseconds resume_grace_period) {
+  if (is_listening_) {
+    return false;
+  }
+  resume_grace_period_ = resume_grace_period;
+  return true;
+}
+
+std::chrono::milliseconds ChatServer::GetResumeGracePeriod() {
+  return resume_grace_period_;
+}
+
+bool ChatServer::SetReceiveBudget(size_t receive_budget) {
+  if (is_listening_) {
+    return false;
+  }
+  receive_budget_ = receive_budget;
+  return true;
+}
+
+size_t ChatServer::GetReceiveBudget() {
+  return receive_budget_;
+}
+
+bool ChatServer::SetMessageRateLimit(double rate, double burst) {
+  if (is_listening_ || rate < 0 || (rate > 0 && burst < 1)) {
+    return false;
+  }
+  message_rate_ = rate;
+  message_burst_ = burst;
+  return true;
+}
+
+double ChatServer::GetMessageRate() {
+  return message_rate_;
+}
+
+double ChatServer::GetMessageBurst() {
+  return message_burst_;
+}
+
+bool ChatServer::SetNodeId(uint16_t node_id) {
+  if (is_listening_) {
+    return false;
+  }
+  node_id_ = node_id;
+  next_client_id_ = (static_cast<uint64_t>(node_id) << JCHAT_CHAT_NODE_ID_SHIFT)
+    + 1;
+  return true;
+}
+
+uint16_t ChatServer::GetNodeId() {
+  return node_id_;
+}
+
+bool ChatServer::SetClientRelay(ClientRelay *client_relay) {
+  if (is_listening_) {
+    return false;
+  }
+  client_relay_ = client_relay;
+  return true;
+}
+
+bool ChatServer::IsLocalClient(uint64_t client_id) {
+  return (client_id >> JCHAT_CHAT_NODE_ID_SHIFT) == node_id_;
+}
+
+PoolStats ChatServer::GetConnectionPoolStats() {
+  return tcp_server_.GetClientPoolStats();
+}
+
+PoolStats ChatServer::GetReadBufferPoolStats() {
+  return tcp_server_.GetReadBufferPoolStats();
+}
+
+PoolStats ChatServer::GetClientPoolStats() {
+  return client_pool_->GetStats();
+}
+
+Logger &ChatServer::GetLogger() {
+  return logger_;
+}
+
+MetricsRegistry &ChatServer::GetMetrics() {
+  return metrics_;
+}
+
 bool ChatServer::onClientConnected(TcpClient &tcp_client) {
-  RemoteChatClient *chat_client = new RemoteChatClient();
+  RemoteChatClient *chat_client = client_pool_->Create();
 
   // Set the endpoint for the client as the remote endpoint (the client's
   // address and port)
   chat_client->Endpoint = tcp_client.GetRemoteEndpoint();
+  chat_client->Connection = tcp_client.shared_from_this();
+  chat_client->Id = next_client_id_++;
+  chat_client->MessageTokens = TokenBucket(message_burst_);
 
   for (auto component : components_) {
     component->OnClientConnected(*chat_client);
@@ -169,6 +645,7 @@ bool ChatServer::onClientConnected(TcpClient &tcp_client) {
 
   clients_mutex_.lock();
   clients_[&tcp_client] = chat_client;
+  clients_by_id_[chat_client->Id] = chat_client;
   clients_mutex_.unlock();
 
   OnClientConnected(*chat_client);
@@ -179,6 +656,23 @@ bool ChatServer::onClientConnected(TcpClient &tcp_client) {
 bool ChatServer::onClientDisconnected(TcpClient &tcp_client) {
   clients_mutex_.lock();
   RemoteChatClient *chat_client = clients_[&tcp_client];
+
+  // A client with a session is kept without its connection until the
+  // session is resumed or expires, nobody sees it leave in the meantime
+  auto session = sessions_.find(chat_client->Id);
+  if (session != sessions_.end() && session_queue_.Push(chat_client->Id)) {
+    clients_.erase(&tcp_client);
+    chat_client->Connection.reset();
+    std::atomic_store(&chat_client->Compression,
+      std::shared_ptr<ConnectionCompression>());
+    std::atomic_store(&chat_client->Batch, std::shared_ptr<ConnectionBatch>());
+    session->second.Client = chat_client;
+    session->second.Expiry = std::chrono::steady_clock::now()
+      + resume_grace_period_;
+    clients_mutex_.unlock();
+    metrics_.Add(kServerCounter_SessionsParked);
+    return true;
+  }
   clients_mutex_.unlock();
 
   for (auto component : components_) {
@@ -195,14 +689,251 @@ bool ChatServer::onClientDisconnected(TcpClient &tcp_client) {
   // Remove client
   clients_mutex_.lock();
   clients_.erase(&tcp_client);
+  clients_by_id_.erase(chat_client->Id);
+  eraseSession(chat_client->Id);
   clients_mutex_.unlock();
 
-  delete chat_client;
+  client_pool_->Destroy(chat_client);
 
   return true;
 }
 
-bool ChatServer::onDataReceived(TcpClient &tcp_client, Buffer &buffer) {
+std::string ChatServer::CreateSession(uint64_t client_id) {
+  // Anyone holding the token can take over the client, so it is random
+  // bytes and not something derived from the client
+  std::random_device random;
+  std::string token;
+  static const char digits[] = "0123456789abcdef";
+  for (size_t i = 0; i < 8; i++) {
+    uint32_t value = random();
+    for (size_t j = 0; j < 8; j++) {
+      token += digits[(value >> (j * 4)) & 0xF];
+    }
+  }
+
+  clients_mutex_.lock();
+  auto client = clients_by_id_.find(client_id);
+  if (client == clients_by_id_.end() || !client->second->Connection
+    || !client->second->IsResumeEnabled
+    || session_tokens_.find(token) != session_tokens_.end()) {
+    clients_mutex_.unlock();
+    return std::string();
+  }
+  eraseSession(client_id);
+  Session &session = sessions_[client_id];
+  session.Token = token;
+  session.Client = nullptr;
+  session.MissedSize = 0;
+  session.IsOverflowed = false;
+  session.IsResuming = false;
+  session_tokens_[token] = client_id;
+  clients_mutex_.unlock();
+  return token;
+}
+
+ResumeResult ChatServer::ResumeSession(RemoteChatClient &client,
+  const std::string &token) {
+  clients_mutex_.lock();
+  auto session_token = session_tokens_.find(token);
+  if (session_token == session_tokens_.end()
+    || session_token->second == client.Id) {
+    clients_mutex_.unlock();
+    return kResumeResult_InvalidSession;
+  }
+  uint64_t session_id = session_token->second;
+  Session &session = sessions_[session_id];
+
+  // The server may not have noticed yet that the old connection dropped
+  if (session.Client == nullptr || session.IsResuming) {
+    std::shared_ptr<TcpClient> connection;
+    auto session_client = clients_by_id_.find(session_id);
+    if (session_client != clients_by_id_.end()) {
+      connection = session_client->second->Connection;
+    }
+    clients_mutex_.unlock();
+    if (connection) {
+      tcp_server_.ShutdownClient(*connection);
+    }
+    return kResumeResult_SessionInUse;
+  }
+  RemoteChatClient *session_client = session.Client;
+
+  // The missed packets were framed for the old connection, a client that
+  // can't read them starts over
+  if (session.IsOverflowed || session_client->SendFormat != client.SendFormat
+    || (session_client->IsRequestIdEnabled && !client.IsRequestIdEnabled)) {
+    eraseSession(session_id);
+    clients_by_id_.erase(session_id);
+    clients_mutex_.unlock();
+    metrics_.Add(kServerCounter_SessionsExpired);
+    endClient(session_client);
+    return kResumeResult_InvalidSession;
+  }
+  session.IsResuming = true;
+  clients_mutex_.unlock();
+
+  for (auto component : components_) {
+    component->OnClientResumed(client, *session_client);
+  }
+
+  // Packets sent to the session keep being added to it while the missed ones
+  // are sent. Once there are none left the client takes over the session's
+  // id, with the batch held so nothing is batched under the old id after.
+  std::shared_ptr<ConnectionCompression> compression =
+    std::atomic_load(&client.Compression);
+  std::shared_ptr<ConnectionBatch> batch = std::atomic_load(&client.Batch);
+  std::vector<std::shared_ptr<Packet>> missed_packets;
+  while (true) {
+    if (batch) {
+      batch->Mutex.lock();
+    }
+    clients_mutex_.lock();
+    missed_packets.swap(session.MissedPackets);
+    session.MissedSize = 0;
+    if (missed_packets.empty()) {
+      break;
+    }
+    clients_mutex_.unlock();
+    if (batch) {
+      batch->Mutex.unlock();
+    }
+    for (auto &packet : missed_packets) {
+      sendPacket(*client.Connection, compression.get(), batch.get(), packet);
+    }
+    missed_packets.clear();
+  }
+  clients_by_id_.erase(client.Id);
+  client.Id = session_id;
+  clients_by_id_[session_id] = &client;
+  session.Client = nullptr;
+  session.IsResuming = false;
+  clients_mutex_.unlock();
+  if (batch) {
+    batch->ClientId = session_id;
+    batch->IsScheduled = false;
+    sendBatch(*client.Connection, compression.get(), *batch);
+    batch->Mutex.unlock();
+  }
+
+  client_pool_->Destroy(session_client);
+  metrics_.Add(kServerCounter_SessionsResumed);
+  OnClientResumed(client);
+  return kResumeResult_Resumed;
+}
+
+bool ChatServer::keepMissed(uint64_t client_id,
+  const std::shared_ptr<Packet> &packet) {
+  clients_mutex_.lock();
+  auto session = sessions_.find(client_id);
+  if (session != sessions_.end() && session->second.Client != nullptr) {
+    // A session that missed too much can't be resumed, and keeps nothing
+    Session &missed = session->second;
+    bool result = false;
+    if (!missed.IsResuming && missed.MissedSize + packet->GetSize()
+      > JCHAT_CHAT_RESUME_MAX_MISSED_SIZE) {
+      missed.IsOverflowed = true;
+      missed.MissedPackets.clear();
+      missed.MissedPackets.shrink_to_fit();
+      missed.MissedSize = 0;
+    } else if (!missed.IsOverflowed) {
+      missed.MissedPackets.push_back(packet);
+      missed.MissedSize += packet->GetSize();
+      result = true;
+    }
+    clients_mutex_.unlock();
+    return result;
+  }
+  clients_mutex_.unlock();
+
+  std::shared_ptr<TcpClient> connection;
+  WireFormat format;
+  std::shared_ptr<ConnectionCompression> compression;
+  std::shared_ptr<ConnectionBatch> batch;
+  if (!getConnection(client_id, connection, format, compression, batch)
+    || !connection) {
+    return false;
+  }
+  return sendPacket(*connection, compression.get(), batch.get(), packet);
+}
+
+void ChatServer::expireSession(uint64_t client_id) {
+  clients_mutex_.lock();
+  auto session = sessions_.find(client_id);
+  if (session == sessions_.end() || session->second.Client == nullptr
+    || session->second.IsResuming) {
+    clients_mutex_.unlock();
+    return;
+  }
+
+  // The session was resumed and parked again since it was pushed
+  if (std::chrono::steady_clock::now() < session->second.Expiry) {
+    clients_mutex_.unlock();
+    session_queue_.Push(client_id);
+    return;
+  }
+  RemoteChatClient *chat_client = session->second.Client;
+  eraseSession(client_id);
+  clients_by_id_.erase(client_id);
+  clients_mutex_.unlock();
+
+  metrics_.Add(kServerCounter_SessionsExpired);
+  endClient(chat_client);
+}
+
+void ChatServer::eraseSession(uint64_t client_id) {
+  auto session = sessions_.find(client_id);
+  if (session == sessions_.end()) {
+    return;
+  }
+  session_tokens_.erase(session->second.Token);
+  sessions_.erase(session);
+}
+
+void ChatServer::endClient(RemoteChatClient *chat_client) {
+  for (auto component : components_) {
+    component->OnClientDisconnected(*chat_client);
+  }
+  OnClientDisconnected(*chat_client);
+  client_pool_->Destroy(chat_client);
+}
+
+bool ChatServer::onClientIdle(TcpClient &tcp_client) {
+  metrics_.Add(kServerCounter_ClientsIdle);
+
+  clients_mutex_.lock();
+  auto client = clients_.find(&tcp_client);
+  if (client == clients_.end()) {
+    clients_mutex_.unlock();
+    return true;
+  }
+  RemoteChatClient *chat_client = client->second;
+  clients_mutex_.unlock();
+
+  // Only the client's reactor disconnects it, and this runs on it
+  if (!chat_client->IsHandshakeCompleted) {
+    if (logger_.IsEnabled(kLogLevel_Debug)) {
+      logger_.Write(kLogLevel_Debug, "server",
+        "Client from %s dropped before its Hello",
+        chat_client->Endpoint.ToString().c_str());
+    }
+    return false;
+  }
+
+  // Older clients can't answer a ping, they are kept until they went quiet
+  // for twice the timeout
+  if (chat_client->IsHeartbeatEnabled) {
+    TypedBuffer send_buffer = CreateBuffer();
+    send_buffer.WriteUInt64(static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count()));
+    Send(*chat_client, kComponentType_System, kSystemMessageType_Ping,
+      send_buffer);
+  }
+
+  return true;
+}
+
+bool ChatServer::onDataReceived(TcpClient &tcp_client, StreamBuffer &stream) {
   uint8_t component_type = 0;
   uint16_t message_type = 0;
   uint32_t size = 0;
@@ -211,78 +942,359 @@ bool ChatServer::onDataReceived(TcpClient &tcp_client, Buffer &buffer) {
   size_t header_size = sizeof(component_type) + sizeof(message_type)
     + sizeof(size);
 
-  // Flip data endian order if needed
-  buffer.SetFlipEndian(!is_little_endian_);
+  metrics_.Lock(clients_mutex_, kServerHistogram_ClientsLockWaitNanoseconds);
+  RemoteChatClient *chat_client = clients_[&tcp_client];
+  clients_mutex_.unlock();
 
-  // Try to handle the requests, if any are unhandled, drop the connection
-  bool handled = false;
+  // Handle every complete packet, a partial one stays in the stream until the
+  // rest of it has been received. Complete ones are left for the next turn
+  // once the receive budget is spent.
+  size_t message_count = 0;
+  while (stream.GetSize() >= header_size) {
+    // Read the header, flipping the data endian order if needed
+    BufferView header(stream.GetReadPointer(header_size), header_size,
+      !is_little_endian_);
+    header.Read(&component_type);
+    header.Read(&message_type);
+    header.Read(&size);
 
-  // Keep reading the buffer till the end
-  while (buffer.GetSize() - buffer.GetPosition() >= header_size) {
-    // Check if the packet is valid
-    if (!buffer.Read(&component_type) || !buffer.Read(&message_type)
-      || !buffer.Read(&size) || buffer.GetSize() - buffer.GetPosition() < size
-      || component_type >= kComponentType_Max) {
+    bool is_compressed = (component_type & JCHAT_CHAT_FRAME_COMPRESSED) != 0;
+    bool is_batch = (component_type & JCHAT_CHAT_FRAME_BATCH) != 0;
+    bool is_request = (component_type & JCHAT_CHAT_FRAME_REQUEST) != 0;
+    component_type &= ~(JCHAT_CHAT_FRAME_COMPRESSED | JCHAT_CHAT_FRAME_BATCH
+      | JCHAT_CHAT_FRAME_REQUEST);
 
+    // Check if the packet is valid. The batch, compression and request id
+    // state is only changed by this thread. The messages of a batch carry
+    // their own request ids.
+    if ((is_batch ? component_type != 0 || !chat_client->Batch || is_request
+      : component_type >= kComponentType_Max)
+      || size > JCHAT_CHAT_MAX_FRAME_SIZE
+      || (is_compressed && !chat_client->Compression)
+      || (is_request && !chat_client->IsRequestIdEnabled)) {
       // Drop connection
       return false;
     }
 
-    // Read the packet into a typed buffer
-    TypedBuffer typed_buffer(buffer.GetBuffer() + buffer.GetPosition(),
-      size, !is_little_endian_);
-
-    // Increase the position of the buffer
-    buffer.SetPosition(buffer.GetPosition() + size);
+    // Wait for the rest of the packet, and then read the request id
+    size_t frame_header_size = header_size
+      + (is_request ? sizeof(uint32_t) : 0);
+    if (stream.GetSize() < frame_header_size + size) {
+      break;
+    }
+    if (receive_budget_ > 0 && message_count >= receive_budget_
+      && tcp_server_.DeferRead(tcp_client)) {
+      metrics_.Add(kServerCounter_ReceivesDeferred);
+      break;
+    }
+    message_count += is_batch ? message_type : 1;
+    uint32_t request_id = 0;
+    if (is_request) {
+      BufferView request_header(stream.GetReadPointer(frame_header_size)
+        + header_size, sizeof(request_id), !is_little_endian_);
+      request_header.Read(&request_id);
+    }
+    stream.Skip(frame_header_size);
+    metrics_.Add(kServerCounter_BytesReceived, frame_header_size + size);
+    metrics_.Add(kServerCounter_FramesReceived);
 
-    clients_mutex_.lock();
-    RemoteChatClient *chat_client = clients_[&tcp_client];
-    clients_mutex_.unlock();
+    // Read the packet in place, it is consumed once it has been handled.
+    // Compressed packets are read from the connection's receive buffer.
+    const uint8_t *body = stream.GetReadPointer(size);
+    size_t body_size = size;
+    if (is_compressed) {
+      ConnectionCompression &compression = *chat_client->Compression;
+      if (!compression.Stream.Decompress(body, size,
+        JCHAT_CHAT_MAX_FRAME_SIZE, compression.ReceiveBuffer)) {
+        return false;
+      }
+      body = compression.ReceiveBuffer.data();
+      body_size = compression.ReceiveBuffer.size();
+    }
 
-    for (auto component : components_) {
-      if (component->GetType() == static_cast<ComponentType>(component_type)) {
-        if (component->Handle(*chat_client, message_type, typed_buffer)) {
-          handled = true;
-          break;
+    // The messages of a batch are handled in place one after the other, the
+    // batch is dropped with the connection if any of them is malformed
+    if (is_batch) {
+      metrics_.Add(kServerCounter_BatchesReceived);
+      FrameBatchReader batch(body, body_size, message_type);
+      uint8_t batch_component_type = 0;
+      uint16_t batch_message_type = 0;
+      const uint8_t *message = nullptr;
+      size_t message_size = 0;
+      uint32_t batch_request_id = 0;
+      while (batch.Next(batch_component_type, batch_message_type, message,
+        message_size, batch_request_id)) {
+        if ((batch_request_id != 0 && !chat_client->IsRequestIdEnabled)
+          || !handleMessage(*chat_client, batch_component_type,
+          batch_message_type, message, message_size, batch_request_id)) {
+          return false;
         }
       }
+      if (!batch.IsComplete()) {
+        return false;
+      }
+    } else if (!handleMessage(*chat_client, component_type, message_type,
+      body, body_size, request_id)) {
+      return false;
     }
+    stream.Skip(size);
   }
 
-  return handled;
+  // Replies to everything that was just received go out together instead of
+  // waiting for the batch window
+  if (chat_client->Batch) {
+    std::shared_ptr<ConnectionCompression> compression =
+      std::atomic_load(&chat_client->Compression);
+    ConnectionBatch &batch = *chat_client->Batch;
+    batch.Mutex.lock();
+    sendBatch(tcp_client, compression.get(), batch);
+    batch.Mutex.unlock();
+  }
+
+  return true;
 }
 
-bool ChatServer::getTcpClient(RemoteChatClient &client,
-  TcpClient **out_client) {
-  clients_mutex_.lock();
-  for (auto pair : clients_) {
-    if (pair.second == &client) {
-      clients_mutex_.unlock();
-      *out_client = pair.first;
+bool ChatServer::handleMessage(RemoteChatClient &client,
+  uint8_t component_type, uint16_t message_type, const uint8_t *body,
+  size_t size, uint32_t request_id) {
+  // Try to handle the request, if it is unhandled, drop the connection
+  if (component_type >= kComponentType_Max) {
+    return false;
+  }
+  ChatComponent *component = components_by_type_[component_type].get();
+  if (component == nullptr) {
+    return false;
+  }
+  metrics_.Add(GetFrameCounter(component_type, message_type));
+
+  // The handshake, heartbeats and cluster links are never throttled
+  if (message_rate_ > 0 && component_type != kComponentType_System
+    && component_type != kComponentType_Cluster) {
+    if (!client.MessageTokens.Take(message_rate_, message_burst_,
+      TokenBucket::Clock::now())) {
+      throttle(client, component_type, message_type, request_id);
       return true;
     }
+    client.IsThrottled = false;
+  }
+
+  TypedBufferView typed_buffer(body, size, !is_little_endian_,
+    client.ReceiveFormat);
+  bool is_sampled = MetricsRegistry::ShouldSample();
+  uint64_t start_time = is_sampled ? MetricsRegistry::Now() : 0;
+  RequestContext previous = RequestContext::SetCurrent(
+    RequestContext(client.Id, request_id));
+  bool result = component->Handle(client, message_type, typed_buffer);
+  RequestContext::SetCurrent(previous);
+  if (!result) {
+    return false;
+  }
+  if (is_sampled) {
+    metrics_.Record(kServerHistogram_HandleNanoseconds,
+      MetricsRegistry::Now() - start_time);
+  }
+  return true;
+}
+
+void ChatServer::throttle(RemoteChatClient &client, uint8_t component_type,
+  uint16_t message_type, uint32_t request_id) {
+  metrics_.Add(kServerCounter_MessagesThrottled);
+
+  // A flood of untagged messages is only answered once, requests are always
+  // answered so they can complete
+  if (!client.IsThrottleEnabled || (request_id == 0 && client.IsThrottled)) {
+    return;
   }
+  client.IsThrottled = true;
+
+  TypedBuffer send_buffer = CreateBuffer();
+  send_buffer.WriteUInt8(component_type);
+  send_buffer.WriteUInt16(message_type);
+  send_buffer.WriteUInt32(static_cast<uint32_t>(
+    client.MessageTokens.GetWaitTime(message_rate_).count()));
+  RequestContext previous = RequestContext::SetCurrent(
+    RequestContext(client.Id, request_id));
+  Send(client, kComponentType_System, kSystemMessageType_Throttled,
+    send_buffer);
+  RequestContext::SetCurrent(previous);
+}
+
+bool ChatServer::getConnection(uint64_t client_id,
+  std::shared_ptr<TcpClient> &out_connection, WireFormat &out_format,
+  std::shared_ptr<ConnectionCompression> &out_compression,
+  std::shared_ptr<ConnectionBatch> &out_batch) {
+  metrics_.Lock(clients_mutex_, kServerHistogram_ClientsLockWaitNanoseconds);
+  auto client = clients_by_id_.find(client_id);
+  if (client == clients_by_id_.end()) {
+    clients_mutex_.unlock();
+    return false;
+  }
+  out_connection = client->second->Connection;
+  out_format = client->second->SendFormat;
+  out_compression = std::atomic_load(&client->second->Compression);
+  out_batch = std::atomic_load(&client->second->Batch);
   clients_mutex_.unlock();
-  return false;
+  return true;
 }
 
-bool ChatServer::send(TcpClient &client, ComponentType component_type,
-  uint8_t message_type, TypedBuffer &buffer) {
-  Buffer temp_buffer(!is_little_endian_);
+bool ChatServer::sendPacket(TcpClient &connection,
+  ConnectionCompression *compression, ConnectionBatch *batch,
+  const std::shared_ptr<Packet> &packet) {
+  if (batch == nullptr) {
+    return sendFrame(connection, compression, packet);
+  }
 
-  // Write header
-  temp_buffer.Write<uint8_t>(component_type);
-  temp_buffer.Write<uint16_t>(message_type);
-  temp_buffer.Write<uint32_t>(buffer.GetSize());
+  uint8_t component_type = 0;
+  uint16_t message_type = 0;
+  uint32_t request_id = 0;
+  size_t header_size = readHeader(*packet, component_type, message_type,
+    request_id);
+  const uint8_t *body = packet->GetData() + header_size;
+  size_t body_size = packet->GetSize() - header_size;
+
+  batch->Mutex.lock();
+  bool result = true;
+  if (!batch->Messages.Add(component_type, message_type, body, body_size,
+    request_id)) {
+    // Make room, a message too big for any batch is sent on its own
+    result = sendBatch(connection, compression, *batch);
+    if (result && !batch->Messages.Add(component_type, message_type, body,
+      body_size, request_id)) {
+      result = sendFrame(connection, compression, packet);
+      batch->Mutex.unlock();
+      return result;
+    }
+  }
+  if (result && (batch->Messages.GetSize() >= JCHAT_CHAT_BATCH_MAX_SIZE
+    || (!batch->IsScheduled && !batch_queue_.Push(batch->ClientId)))) {
+    result = sendBatch(connection, compression, *batch);
+  } else if (result) {
+    batch->IsScheduled = true;
+  }
+  batch->Mutex.unlock();
+  return result;
+}
+
+bool ChatServer::sendFrame(TcpClient &connection,
+  ConnectionCompression *compression, const std::shared_ptr<Packet> &packet) {
+  uint8_t component_type = 0;
+  uint16_t message_type = 0;
+  uint32_t request_id = 0;
+  size_t header_size = compression == nullptr ? 0
+    : readHeader(*packet, component_type, message_type, request_id);
+  if (compression == nullptr
+    || packet->GetSize() < header_size + JCHAT_CHAT_COMPRESSION_MIN_SIZE) {
+    if (!tcp_server_.Send(connection, packet)) {
+      return false;
+    }
+    recordSend(connection, packet->GetSize());
+    return true;
+  }
+
+  // The packet may be shared with other clients, frame a compressed copy
+
+  std::vector<uint8_t> body;
+  compression->SendMutex.lock();
+  if (!compression->Stream.Compress(packet->GetData() + header_size,
+    packet->GetSize() - header_size, body)) {
+    compression->SendMutex.unlock();
+    tcp_server_.ShutdownClient(connection);
+    return false;
+  }
+
+  Buffer header(!is_little_endian_);
+  header.Reserve(header_size);
+  header.Write<uint8_t>(component_type | JCHAT_CHAT_FRAME_COMPRESSED
+    | (request_id != 0 ? JCHAT_CHAT_FRAME_REQUEST : 0));
+  header.Write<uint16_t>(message_type);
+  header.Write<uint32_t>(body.size());
+  if (request_id != 0) {
+    header.Write<uint32_t>(request_id);
+  }
 
-  // Write body
-  temp_buffer.WriteArray<uint8_t>(buffer.GetBuffer(), buffer.GetSize());
+  bool result = tcp_server_.Send(connection, std::make_shared<Packet>(
+    header.GetBuffer(), header.GetSize(), body.data(), body.size()));
+  compression->SendMutex.unlock();
 
-  return tcp_server_.Send(client, temp_buffer);
+  // The client cannot decompress anything after a compressed frame that
+  // never reached it
+  if (!result) {
+    tcp_server_.ShutdownClient(connection);
+    return false;
+  }
+  recordSend(connection, header_size + body.size());
+  return true;
 }
 
-bool ChatServer::send(TcpClient *client, ComponentType component_type,
-  uint8_t message_type, TypedBuffer &buffer) {
-  return send(*client, component_type, message_type, buffer);
+bool ChatServer::sendBatch(TcpClient &connection,
+  ConnectionCompression *compression, ConnectionBatch &batch) {
+  if (batch.Messages.IsEmpty()) {
+    return true;
+  }
+
+  Buffer header(!is_little_endian_);
+  header.Reserve(sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint32_t));
+  header.Write<uint8_t>(JCHAT_CHAT_FRAME_BATCH);
+  header.Write<uint16_t>(batch.Messages.GetCount());
+  header.Write<uint32_t>(batch.Messages.GetSize());
+  std::shared_ptr<Packet> packet = std::make_shared<Packet>(
+    header.GetBuffer(), header.GetSize(), batch.Messages.GetBuffer(),
+    batch.Messages.GetSize());
+  batch.Messages.Clear();
+
+  metrics_.Add(kServerCounter_BatchesSent);
+  return sendFrame(connection, compression, packet);
+}
+
+void ChatServer::flushBatch(uint64_t client_id) {
+  std::shared_ptr<TcpClient> connection;
+  WireFormat format;
+  std::shared_ptr<ConnectionCompression> compression;
+  std::shared_ptr<ConnectionBatch> batch;
+  if (!getConnection(client_id, connection, format, compression, batch)
+    || !batch) {
+    return;
+  }
+  batch->Mutex.lock();
+  batch->IsScheduled = false;
+  sendBatch(*connection, compression.get(), *batch);
+  batch->Mutex.unlock();
+}
+
+bool ChatServer::relay(uint64_t client_id, ComponentType component_type,
+  uint8_t message_type, TypedBuffer &buffer, uint32_t request_id) {
+  if (client_relay_ == nullptr) {
+    return false;
+  }
+  std::vector<uint64_t> client_ids(1, client_id);
+  return client_relay_->Relay(client_ids, component_type, message_type,
+    buffer, request_id) > 0;
+}
+
+size_t ChatServer::readHeader(Packet &packet, uint8_t &out_component_type,
+  uint16_t &out_message_type, uint32_t &out_request_id) {
+  size_t header_size = sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint32_t);
+  uint32_t size = 0;
+  BufferView packet_header(packet.GetData(), packet.GetSize(),
+    !is_little_endian_);
+  packet_header.Read(&out_component_type);
+  packet_header.Read(&out_message_type);
+  packet_header.Read(&size);
+  out_request_id = 0;
+  if ((out_component_type & JCHAT_CHAT_FRAME_REQUEST) != 0) {
+    out_component_type &= ~JCHAT_CHAT_FRAME_REQUEST;
+    packet_header.Read(&out_request_id);
+    header_size += sizeof(out_request_id);
+  }
+  return header_size;
+}
+
+void ChatServer::recordSend(TcpClient &connection, size_t size) {
+  metrics_.Add(kServerCounter_BytesSent, size);
+  metrics_.Add(kServerCounter_FramesSent);
+  if (MetricsRegistry::ShouldSample()) {
+    metrics_.Record(kServerHistogram_SendQueueBytes,
+      connection.GetSendQueueSize());
+  }
 }
 }
@@ -12,15 +12,48 @@
 #include "protocol/protocol.h"
 #include "protocol/components/channel_message_type.h"
 #include "string.hpp"
+#include "utf8.hpp"
+#include <algorithm>
 
 namespace jchat {
-ChannelComponent::ChannelComponent() {
+ChannelComponent::ChannelComponent() : server_(0), is_started_(false),
+  channel_router_(nullptr),
+  presence_interval_(JCHAT_CHAT_PRESENCE_INTERVAL),
+  snapshot_interval_(JCHAT_CHANNEL_SNAPSHOT_INTERVAL) {
+  history_limits_.MaxMessages = JCHAT_CHAT_HISTORY_MESSAGES;
+  history_limits_.MaxChannelSize = JCHAT_CHAT_HISTORY_CHANNEL_SIZE;
+  history_limits_.MaxTotalSize = JCHAT_CHAT_HISTORY_SERVER_SIZE;
+  history_limits_.MaxAge = std::chrono::seconds(JCHAT_CHAT_HISTORY_MAX_AGE);
+
+  dispatcher_.Register(kChannelMessageType_JoinChannel,
+    &ChannelComponent::handleJoinChannel);
+  dispatcher_.Register(kChannelMessageType_LeaveChannel,
+    &ChannelComponent::handleLeaveChannel);
+  dispatcher_.Register(kChannelMessageType_SendMessage,
+    &ChannelComponent::handleSendMessage);
+  dispatcher_.Register(kChannelMessageType_OpUser,
+    &ChannelComponent::handleOpUser);
+  dispatcher_.Register(kChannelMessageType_DeopUser,
+    &ChannelComponent::handleDeopUser);
+  dispatcher_.Register(kChannelMessageType_KickUser,
+    &ChannelComponent::handleKickUser);
+  dispatcher_.Register(kChannelMessageType_BanUser,
+    &ChannelComponent::handleBanUser);
+  dispatcher_.Register(kChannelMessageType_UnbanUser,
+    &ChannelComponent::handleUnbanUser);
+  dispatcher_.Register(kChannelMessageType_GetMembers,
+    &ChannelComponent::handleGetMembers);
+  dispatcher_.Register(kChannelMessageType_Subscribe,
+    &ChannelComponent::handleSubscribe);
+  dispatcher_.Register(kChannelMessageType_Unsubscribe,
+    &ChannelComponent::handleUnsubscribe);
+
+  unsigned core_count = std::thread::hardware_concurrency();
+  SetShardCount(core_count > 0 ? core_count : 1);
 }
 
 ChannelComponent::~ChannelComponent() {
-  if (!channels_.empty()) {
-    channels_.clear();
-  }
+  shards_.clear();
 }
 
 bool ChannelComponent::Initialize(ChatServer &server) {
@@ -29,29 +62,64 @@ bool ChannelComponent::Initialize(ChatServer &server) {
 }
 
 bool ChannelComponent::Shutdown() {
+  // Let the shards finish what they were doing before the server goes away
+  OnStop();
   server_ = 0;
 
-  // Remove channels
-  channels_mutex_.lock();
-  if (!channels_.empty()) {
-    channels_.clear();
-  }
-  channels_mutex_.unlock();
-
   return true;
 }
 
 bool ChannelComponent::OnStart() {
-  return true;
+  if (is_started_) {
+    return false;
+  }
+  // Channels that can't be loaded aren't kept either, so the files stay as
+  // they are for somebody to look at
+  bool is_loaded = state_path_.empty() || loadChannels();
+  if (!is_loaded) {
+    server_->GetLogger().Write(kLogLevel_Error, "channel",
+      "Failed to load the channels at %s, they are not kept",
+      state_path_.c_str());
+  }
+
+  // Every shard keeps its share of the server's history
+  HistoryLimits shard_limits = history_limits_;
+  shard_limits.MaxTotalSize /= shards_.size();
+  for (size_t i = 0; i < shards_.size(); i++) {
+    ChannelShard *shard = shards_[i].get();
+    shard->SetMetrics(&server_->GetMetrics());
+    shard->SetHistoryLimits(shard_limits);
+    shard->SetThreadPlacement("jchat-shard-" + std::to_string(i),
+      shard_cpus_.empty() ? -1 : shard_cpus_[i % shard_cpus_.size()]);
+    shard->Start();
+    if (history_limits_.MaxMessages > 0
+      && history_limits_.MaxAge.count() > 0) {
+      pruneHistory(*shard);
+    }
+  }
+  if (store_.IsOpen()) {
+    store_.Start(snapshot_interval_, [this]() {
+      return captureChannels();
+    });
+  }
+  is_started_ = true;
+  return is_loaded;
 }
 
 bool ChannelComponent::OnStop() {
-  // Remove channels
-  channels_mutex_.lock();
-  if (!channels_.empty()) {
-    channels_.clear();
+  // Snapshots wait for the shards, so they are stopped first. Every change
+  // is in the log already.
+  store_.Close();
+
+  // Stop the shards, then remove channels
+  for (auto &shard : shards_) {
+    shard->Stop();
+    shard->Clear();
   }
-  channels_mutex_.unlock();
+  subscriptions_mutex_.lock();
+  subscriptions_.clear();
+  subscriptions_mutex_.unlock();
+  is_started_ = false;
 
   return true;
 }
@@ -61,1077 +129,1725 @@ void ChannelComponent::OnClientConnected(RemoteChatClient &client) {
 }
 
 void ChannelComponent::OnClientDisconnected(RemoteChatClient &client) {
-  // Notify all clients in participating channels that the client has
-  // disconnected
-  channels_mutex_.lock();
-  for (auto it = channels_.begin(); it != channels_.end(); ++it) {
-    std::shared_ptr<ChatChannel> channel = *it;
-
-    if (channel->Enabled) {
-      channel->ClientsMutex.lock();
-      if (channel->Clients.find(&client) != channel->Clients.end()) {
-        // Get the chat user
-        std::shared_ptr<ChatUser> chat_user = channel->Clients[&client];
-
-        // Notify all clients in that channel that the client left
-        TypedBuffer clients_buffer = server_->CreateBuffer();
-        clients_buffer.WriteUInt16(kChannelMessageResult_UserLeft);
-        clients_buffer.WriteString(channel->Name);
-        clients_buffer.WriteString(chat_user->Username);
-        clients_buffer.WriteString(chat_user->Hostname);
-
-        for (auto &pair : channel->Clients) {
-          if (pair.first != &client && pair.second->Enabled) {
-            server_->Send(pair.first, kComponentType_Channel,
-              kChannelMessageType_LeaveChannel, clients_buffer);
-          }
-        }
+  RemoveClient(client.Id);
+}
+
+void ChannelComponent::OnClientResumed(RemoteChatClient &client,
+  RemoteChatClient &session) {
+  // Channels know their members by id, which the client takes over
+}
+
+void ChannelComponent::RemoveClient(uint64_t client_id) {
+  subscriptions_mutex_.lock();
+  subscriptions_.erase(client_id);
+  subscriptions_mutex_.unlock();
+
+  // Every shard removes the client from its channels and notifies the other
+  // clients in them. The tasks run after any request the client made before
+  // disconnecting.
+  for (auto &shard : shards_) {
+    ChannelShard *channel_shard = shard.get();
+    channel_shard->Post([this, channel_shard, client_id]() {
+      disconnectClient(*channel_shard, client_id);
+    });
+  }
+}
 
-        // Trigger the events
-        OnChannelLeft(*channel, *chat_user);
+ChannelShard &ChannelComponent::getShard(const std::string &channel_name) {
+  return *shards_[Utility::StringHash()(channel_name) % shards_.size()];
+}
+
+bool ChannelComponent::loadChannels() {
+  std::vector<StoredChannel> stored_channels;
+  if (!store_.Open(state_path_, stored_channels)) {
+    return false;
+  }
 
-        // Remove the client from the clients list
-        channel->Clients.erase(&client);
+  // Every shard gets one task with all of its channels, which runs once the
+  // shard is started
+  std::unordered_map<ChannelShard *,
+    std::shared_ptr<std::vector<StoredChannel>>> shard_channels;
+  for (auto &stored_channel : stored_channels) {
+    ChannelShard *shard = &getShard(stored_channel.Name);
+    std::shared_ptr<std::vector<StoredChannel>> &channels =
+      shard_channels[shard];
+    if (!channels) {
+      channels = std::make_shared<std::vector<StoredChannel>>();
+    }
+    channels->push_back(std::move(stored_channel));
+  }
+  for (auto &pair : shard_channels) {
+    ChannelShard *shard = pair.first;
+    std::shared_ptr<std::vector<StoredChannel>> channels = pair.second;
+    shard->Post([shard, channels]() {
+      for (auto &stored_channel : *channels) {
+        std::shared_ptr<ChatChannel> channel =
+          shard->Create(stored_channel.Name);
+        if (!channel) {
+          continue;
+        }
+        channel->IsStored = true;
+        channel->OperatorIdentities = std::move(stored_channel.Operators);
+        channel->BannedUsers = std::move(stored_channel.BannedUsers);
+      }
+    });
+  }
+  return true;
+}
 
-        // If there was nobody in the channel delete it
-        if (channel->Clients.empty()) {
-          channel->ClientsMutex.unlock();
-          channel->OperatorsMutex.lock();
-          channel->Operators.clear();
-          channel->OperatorsMutex.unlock();
-          channel->Enabled = false;
-          channel.reset();
+std::vector<StoredChannel> ChannelComponent::captureChannels() {
+  std::vector<StoredChannel> stored_channels;
+  size_t pending_shards = shards_.size();
+  std::mutex mutex;
+  std::condition_variable condition;
+
+  for (auto &shard : shards_) {
+    ChannelShard *channel_shard = shard.get();
+    channel_shard->Post([&, channel_shard]() {
+      std::vector<StoredChannel> shard_channels;
+      for (auto &channel : channel_shard->GetChannels()) {
+        if (!channel->IsStored) {
           continue;
         }
+        StoredChannel stored_channel;
+        stored_channel.Name = channel->Name;
+        stored_channel.Operators = channel->OperatorIdentities;
+        stored_channel.BannedUsers = channel->BannedUsers;
+        shard_channels.push_back(std::move(stored_channel));
       }
-      channel->ClientsMutex.unlock();
 
-      // Remove the client from the operators list if they're an operator
-      channel->OperatorsMutex.lock();
-      if (channel->Operators.find(&client)
-        != channel->Operators.end()) {
-        channel->Operators.erase(&client);
+      // The mutex and condition are gone once the waiter saw the last
+      // shard, so it is notified before they are let go of
+      mutex.lock();
+      for (auto &stored_channel : shard_channels) {
+        stored_channels.push_back(std::move(stored_channel));
       }
-      channel->OperatorsMutex.unlock();
-    }
+      pending_shards--;
+      condition.notify_one();
+      mutex.unlock();
+    });
   }
-  channels_mutex_.unlock();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  while (pending_shards > 0) {
+    condition.wait(lock);
+  }
+  return stored_channels;
 }
 
-ComponentType ChannelComponent::GetType() {
-  return kComponentType_Channel;
+void ChannelComponent::removeClient(ChannelShard &shard,
+  const std::shared_ptr<ChatChannel> &channel, uint64_t client_id) {
+  if (channel->IsStored && channel->BannedUsers.empty()
+    && channel->Clients.size() == 1 && channel->Clients.count(client_id)) {
+    channel->IsStored = false;
+    store_.Append(kChannelChange_Removed, channel->Name, std::string());
+  }
+  shard.RemoveClient(channel, client_id);
 }
 
-bool ChannelComponent::Handle(RemoteChatClient &client, uint16_t message_type,
-  TypedBuffer &buffer) {
-  if (message_type == kChannelMessageType_JoinChannel) {
-    std::string channel_name;
-    if (!buffer.ReadString(channel_name)) {
-      return false;
-    }
+void ChannelComponent::broadcast(ChatChannel &channel,
+  uint64_t source_client_id, ChannelMessageType message_type,
+  TypedBuffer &buffer, const ChatUser *sender) {
+  sendPresenceChanges(channel);
 
-    // Get user component
-    std::shared_ptr<UserComponent> user_component;
-    if (!server_->GetComponent(kComponentType_User, user_component)) {
-      // Internal error, disconnect client
-      return false;
-    }
+  // Frame the message once for every recipient
+  server_->Broadcast(getRecipients(channel, source_client_id, sender),
+    kComponentType_Channel, message_type, buffer);
+}
+
+void ChannelComponent::broadcast(ChatChannel &channel,
+  uint64_t source_client_id, TypedBuffer &buffer, PacketSet &packets,
+  const ChatUser *sender) {
+  sendPresenceChanges(channel);
+
+  server_->Broadcast(getRecipients(channel, source_client_id, sender),
+    buffer, packets);
+}
 
-    // Get the chat client
-    std::shared_ptr<ChatUser> chat_user;
-    if (!user_component->GetChatUser(client, chat_user)) {
-      // Internal error, disconnect client
-      return false;
+std::vector<uint64_t> ChannelComponent::getRecipients(ChatChannel &channel,
+  uint64_t source_client_id, const ChatUser *sender) {
+  std::vector<uint64_t> recipients;
+  recipients.reserve(channel.Clients.size());
+  for (auto &pair : channel.Clients) {
+    if (pair.first != source_client_id && pair.second->Enabled) {
+      recipients.push_back(pair.first);
     }
+  }
+  if (sender == nullptr) {
+    return recipients;
+  }
 
-    // Check if the user is logged in
-    if (!chat_user->Identified) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_NotIdentified);
-	    send_buffer.WriteString(channel_name);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_JoinChannel_Complete, send_buffer);
+  // Members get the message as members, and a client with more than one
+  // matching pattern gets it once
+  size_t member_count = recipients.size();
+  for (auto &subscription : channel.Subscribers) {
+    uint64_t client_id = subscription->ClientId;
+    if (client_id == source_client_id || !subscription->User->Enabled
+      || (!subscription->Sender.empty()
+        && subscription->Sender != sender->Username)
+      || channel.Clients.find(client_id) != channel.Clients.end()
+      || channel.BannedUsers.find(subscription->User->Identity)
+        != channel.BannedUsers.end()
+      || std::find(recipients.begin() + member_count, recipients.end(),
+        client_id) != recipients.end()) {
+      continue;
+    }
+    recipients.push_back(client_id);
+  }
+  return recipients;
+}
 
-      // Trigger events
-      OnJoinCompleted(kChannelMessageResult_NotIdentified, channel_name,
-        *chat_user);
+void ChannelComponent::sendHistory(ChannelShard &shard, ChatChannel &channel,
+  uint64_t client_id, uint64_t history_count) {
+  shard.PruneHistory();
+
+  ChannelHistory &history = channel.History;
+  size_t count = static_cast<size_t>(std::min<uint64_t>(history_count,
+    history.GetCount()));
+  size_t first = history.GetCount() - count;
+
+  std::chrono::steady_clock::time_point now =
+    std::chrono::steady_clock::now();
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteString(channel.Name);
+  send_buffer.WriteUInt64(count);
+  for (size_t i = first; i < history.GetCount(); i++) {
+    send_buffer.WriteUInt64(std::chrono::duration_cast<
+      std::chrono::milliseconds>(now - history.Get(i).Time).count());
+  }
+  server_->Send(client_id, kComponentType_Channel,
+    kChannelMessageType_History, send_buffer);
 
-      return true;
-    }
+  // The messages go out as they were framed, nothing is written again
+  for (size_t i = first; i < history.GetCount(); i++) {
+    server_->Send(client_id, history.Get(i).Packets);
+  }
+}
 
-    // Check if the channel name is valid
-    if (channel_name.empty() || channel_name[0] != '#') {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
-      send_buffer.WriteString(channel_name);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_JoinChannel_Complete, send_buffer);
+void ChannelComponent::pruneHistory(ChannelShard &shard) {
+  shard.PruneHistory();
+  shard.PostAfter(std::chrono::milliseconds(
+    JCHAT_CHAT_HISTORY_PRUNE_INTERVAL), [this, &shard]() {
+    pruneHistory(shard);
+  });
+}
 
-      // Trigger events
-      OnJoinCompleted(kChannelMessageResult_InvalidChannelName, channel_name,
-        *chat_user);
+void ChannelComponent::addPresenceChange(ChannelShard &shard,
+  const std::shared_ptr<ChatChannel> &channel, uint64_t client_id,
+  const std::shared_ptr<ChatUser> &user, bool is_joined) {
+  bool was_empty = channel->PresenceChanges.empty();
+  auto change = channel->PresenceChanges.find(client_id);
+  if (change == channel->PresenceChanges.end()) {
+    PresenceChange &new_change = channel->PresenceChanges[client_id];
+    new_change.User = user;
+    new_change.Left = !is_joined;
+    new_change.Joined = is_joined;
+    new_change.MemberLists = channel->MemberLists;
+  } else if (is_joined) {
+    change->second.Joined = true;
+    change->second.MemberLists = channel->MemberLists;
+  } else if (!change->second.Left
+    && change->second.MemberLists == channel->MemberLists) {
+    // Nobody knows about the join yet, so nobody has to hear about either
+    channel->PresenceChanges.erase(change);
+  } else {
+    change->second.Joined = false;
+    change->second.Left = true;
+  }
 
-      return true;
+  if (presence_interval_.count() == 0) {
+    sendPresenceChanges(*channel);
+    return;
+  }
+
+  // The first change after the last send starts the interval for the whole
+  // shard, every channel that changes until it ran out is sent with it
+  if (was_empty && !channel->PresenceChanges.empty()
+    && shard.AddPresenceChannel(channel)) {
+    ChannelShard *channel_shard = &shard;
+    shard.PostAfter(presence_interval_, [this, channel_shard]() {
+      sendPresenceChanges(*channel_shard);
+    });
+  }
+}
+
+void ChannelComponent::sendPresenceChanges(ChannelShard &shard) {
+  for (auto &channel : shard.TakePresenceChannels()) {
+    sendPresenceChanges(*channel);
+  }
+}
+
+void ChannelComponent::sendPresenceChanges(ChatChannel &channel) {
+  if (channel.PresenceChanges.empty()) {
+    return;
+  }
+  std::unordered_map<uint64_t, PresenceChange> changes;
+  changes.swap(channel.PresenceChanges);
+
+  std::vector<uint64_t> recipients;
+  std::vector<uint64_t> legacy_recipients;
+  for (auto &pair : channel.Clients) {
+    if (pair.second->Enabled) {
+      (pair.second->PresenceChanges ? recipients : legacy_recipients)
+        .push_back(pair.first);
     }
+  }
 
-    // Check if the channel exists
-    std::shared_ptr<ChatChannel> chat_channel;
-    channels_mutex_.lock();
-    for (auto &channel : channels_) {
-      if (channel->Enabled && channel->Name == channel_name) {
-        chat_channel = channel;
-        break;
+  // Clients that didn't ask for PresenceChanged get a message for every
+  // change, which doesn't go to the client that changed
+  std::vector<uint64_t> other_recipients;
+  for (auto &change : changes) {
+    if (legacy_recipients.empty()) {
+      break;
+    }
+    other_recipients.clear();
+    for (uint64_t client_id : legacy_recipients) {
+      if (client_id != change.first) {
+        other_recipients.push_back(client_id);
       }
     }
-    channels_mutex_.unlock();
-
-    if (!chat_channel) {
-      // Check if the channel name is too long
-      if (channel_name.size() - 1 > JCHAT_CHAT_CHANNEL_NAME_LENGTH) {
-        TypedBuffer send_buffer = server_->CreateBuffer();
-        send_buffer.WriteUInt16(kChannelMessageResult_ChannelNameTooLong);
-        send_buffer.WriteString(channel_name);
-        server_->Send(client, kComponentType_User,
-          kChannelMessageType_JoinChannel_Complete, send_buffer);
-
-        // Trigger events
-        OnJoinCompleted(kChannelMessageResult_ChannelNameTooLong, channel_name,
-          *chat_user);
-
-        return true;
-      }
 
-      // Create the channel and add the user to it
-      chat_channel = std::make_shared<ChatChannel>();
-      chat_channel->Enabled = true;
-      chat_channel->Name = channel_name;
-      chat_channel->Operators[&client] = chat_user;
-      chat_channel->Clients[&client] = chat_user;
+    ChatUser &user = *change.second.User;
+    if (change.second.Left) {
+      TypedBuffer send_buffer = server_->CreateBuffer();
+      send_buffer.WriteUInt16(kChannelMessageResult_UserLeft);
+      send_buffer.WriteString(channel.Name);
+      user.Interned->WriteName(send_buffer);
+      server_->Broadcast(other_recipients, kComponentType_Channel,
+        kChannelMessageType_LeaveChannel, send_buffer);
+    }
+    if (change.second.Joined) {
+      TypedBuffer send_buffer = server_->CreateBuffer();
+      send_buffer.WriteUInt16(kChannelMessageResult_UserJoined);
+      send_buffer.WriteString(channel.Name);
+      user.Interned->WriteName(send_buffer);
+      server_->Broadcast(other_recipients, kComponentType_Channel,
+        kChannelMessageType_JoinChannel, send_buffer);
+    }
+  }
+  if (recipients.empty()) {
+    return;
+  }
 
-      // Add the channel to the component
-      channels_mutex_.lock();
-      channels_.push_back(chat_channel);
-      channels_mutex_.unlock();
+  // The others get every change in as few messages as fit in frames, the
+  // leaves before the joins so a client that left and joined again ends up
+  // in the channel
+  std::vector<ChatUser *> left_users;
+  std::vector<ChatUser *> joined_users;
+  for (auto &change : changes) {
+    if (change.second.Left) {
+      left_users.push_back(change.second.User.get());
+    }
+    if (change.second.Joined) {
+      joined_users.push_back(change.second.User.get());
+    }
+  }
 
-      // Notify the client that the channel was created and that they are
-      // the operator operator and member of it
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_ChannelCreated);
-      send_buffer.WriteString(channel_name);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_JoinChannel_Complete, send_buffer);
+  size_t left_index = 0;
+  size_t joined_index = 0;
+  while (left_index < left_users.size()
+    || joined_index < joined_users.size()) {
+    size_t left_count = std::min<size_t>(left_users.size() - left_index,
+      JCHAT_CHAT_MEMBERS_PAGE_SIZE);
+    size_t joined_count = std::min<size_t>(joined_users.size() - joined_index,
+      JCHAT_CHAT_MEMBERS_PAGE_SIZE - left_count);
 
-      // Trigger the events
-      OnJoinCompleted(kChannelMessageResult_ChannelCreated, channel_name,
-        *chat_user);
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteString(channel.Name);
+    send_buffer.WriteUInt64(left_count);
+    for (size_t i = 0; i < left_count; i++, left_index++) {
+      left_users[left_index]->Interned->WriteName(send_buffer);
+    }
+    send_buffer.WriteUInt64(joined_count);
+    for (size_t i = 0; i < joined_count; i++, joined_index++) {
+      joined_users[joined_index]->Interned->WriteName(send_buffer);
+    }
+    server_->Broadcast(recipients, kComponentType_Channel,
+      kChannelMessageType_PresenceChanged, send_buffer);
+  }
+}
 
-      OnChannelCreated(*chat_channel);
-      OnChannelJoined(*chat_channel, *chat_user);
+uint64_t ChannelComponent::writeMembers(TypedBuffer &buffer,
+  ChatChannel &channel, uint64_t client_id, uint64_t cursor) {
+  channel.MemberLists++;
 
-      return true;
+  // Pick the members first, the count is written before them
+  std::vector<std::pair<const uint64_t, std::shared_ptr<ChatUser>> *> members;
+  members.reserve(JCHAT_CHAT_MEMBERS_PAGE_SIZE);
+  auto member = channel.Clients.lower_bound(cursor);
+  for (; member != channel.Clients.end()
+    && members.size() < JCHAT_CHAT_MEMBERS_PAGE_SIZE; ++member) {
+    if (member->first != client_id && member->second->Enabled) {
+      members.push_back(&*member);
     }
+  }
 
-    // Check if the user is already in the channel
-    chat_channel->ClientsMutex.lock();
-    if (chat_channel->Clients.find(&client) != chat_channel->Clients.end()) {
-      chat_channel->ClientsMutex.unlock();
+  buffer.WriteUInt64(members.size());
+  for (auto pair : members) {
+    pair->second->Interned->WriteName(buffer);
+    buffer.WriteBoolean(
+      channel.Operators.find(pair->first) != channel.Operators.end());
+  }
 
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_AlreadyInChannel);
-      send_buffer.WriteString(chat_channel->Name);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_JoinChannel_Complete, send_buffer);
+  if (member == channel.Clients.end()) {
+    return 0;
+  }
+  return members.back()->first + 1;
+}
 
-      // Trigger events
-      OnJoinCompleted(kChannelMessageResult_AlreadyInChannel,
-        chat_channel->Name, *chat_user);
+ComponentType ChannelComponent::GetType() {
+  return kComponentType_Channel;
+}
 
+bool ChannelComponent::Handle(RemoteChatClient &client, uint16_t message_type,
+  TypedBufferView &buffer) {
+  if (channel_router_ != nullptr) {
+    TypedBufferView request = buffer;
+    StringView channel_name;
+    if (request.ReadString(channel_name) && channel_router_->Forward(client,
+      message_type, channel_name, buffer)) {
       return true;
     }
-    chat_channel->ClientsMutex.unlock();
+  }
+  return dispatcher_.Dispatch(this, message_type, client, buffer);
+}
 
-    // Check if the user is banned
-    chat_channel->BannedUsersMutex.lock();
-    std::string chat_user_hostinfo = chat_user->Username + "@"
-      + chat_user->Hostname;
-    for (auto &banned_user : chat_channel->BannedUsers) {
-      if (banned_user == chat_user_hostinfo) {
-        chat_channel->BannedUsersMutex.unlock();
+bool ChannelComponent::SetShardCount(size_t shard_count) {
+  if (is_started_ || shard_count == 0) {
+    return false;
+  }
 
-        TypedBuffer send_buffer = server_->CreateBuffer();
-        send_buffer.WriteUInt16(kChannelMessageResult_BannedFromChannel);
-        send_buffer.WriteString(chat_channel->Name);
-        server_->Send(client, kComponentType_Channel,
-          kChannelMessageType_JoinChannel_Complete, send_buffer);
+  shards_.clear();
+  for (size_t i = 0; i < shard_count; i++) {
+    shards_.push_back(std::unique_ptr<ChannelShard>(new ChannelShard()));
+  }
+  return true;
+}
 
-        // Trigger events
-        OnJoinCompleted(kChannelMessageResult_BannedFromChannel,
-          chat_channel->Name, *chat_user);
+size_t ChannelComponent::GetShardCount() {
+  return shards_.size();
+}
 
-        return true;
-      }
-    }
-    chat_channel->BannedUsersMutex.unlock();
-
-    // Add the user to the channel
-    chat_channel->ClientsMutex.lock();
-    chat_channel->Clients[&client] = chat_user;
-    chat_channel->ClientsMutex.unlock();
-
-    // Notify the client that it joined the channel and give it a list of
-    // current clients
-    TypedBuffer client_buffer = server_->CreateBuffer();
-    client_buffer.WriteUInt16(kChannelMessageResult_Ok); // Channel joined
-    client_buffer.WriteString(chat_channel->Name);
-
-    chat_channel->OperatorsMutex.lock();
-    chat_channel->ClientsMutex.lock();
-    size_t client_count = 0;
-    for (auto &pair : chat_channel->Clients) {
-      if (pair.first != &client && pair.second->Enabled) {
-        client_count++;
-      }
-    }
-    client_buffer.WriteUInt64(client_count);
-    for (auto &pair : chat_channel->Clients) {
-      if (pair.first != &client && pair.second->Enabled) {
-        client_buffer.WriteString(pair.second->Username);
-        client_buffer.WriteString(pair.second->Hostname);
-        client_buffer.WriteBoolean(
-          chat_channel->Operators.find(pair.first)
-          != chat_channel->Operators.end());
-      }
-    }
-    chat_channel->ClientsMutex.unlock();
-    chat_channel->OperatorsMutex.unlock();
+bool ChannelComponent::SetShardCpus(const std::vector<int> &shard_cpus) {
+  if (is_started_) {
+    return false;
+  }
+  shard_cpus_ = shard_cpus;
+  return true;
+}
 
-    chat_channel->BannedUsersMutex.lock();
-    client_buffer.WriteUInt64(chat_channel->BannedUsers.size());
-    for (auto &banned_user : chat_channel->BannedUsers) {
-      client_buffer.WriteString(banned_user);
-    }
-    chat_channel->BannedUsersMutex.unlock();
+const std::vector<int> &ChannelComponent::GetShardCpus() {
+  return shard_cpus_;
+}
 
-    server_->Send(client, kComponentType_Channel,
-      kChannelMessageType_JoinChannel_Complete, client_buffer);
-
-    // Notify all clients in the channel that the user has joined
-    TypedBuffer clients_buffer = server_->CreateBuffer();
-    clients_buffer.WriteUInt16(kChannelMessageResult_UserJoined);
-    clients_buffer.WriteString(chat_channel->Name);
-    clients_buffer.WriteString(chat_user->Username);
-    clients_buffer.WriteString(chat_user->Hostname);
-
-    chat_channel->ClientsMutex.lock();
-    for (auto &pair : chat_channel->Clients) {
-      if (pair.first != &client && pair.second->Enabled) {
-        server_->Send(pair.first, kComponentType_Channel,
-          kChannelMessageType_JoinChannel, clients_buffer);
-      }
-    }
-    chat_channel->ClientsMutex.unlock();
+void ChannelComponent::SetChannelRouter(ChannelRouter *channel_router) {
+  channel_router_ = channel_router;
+}
 
-    // Trigger the events
-    OnJoinCompleted(kChannelMessageResult_Ok, chat_channel->Name, *chat_user);
-    OnChannelJoined(*chat_channel, *chat_user);
+bool ChannelComponent::SetPresenceInterval(
+  std::chrono::milliseconds presence_interval) {
+  if (is_started_ || presence_interval.count() < 0) {
+    return false;
+  }
+  presence_interval_ = presence_interval;
+  return true;
+}
 
-    return true;
-  } else if (message_type == kChannelMessageType_LeaveChannel) {
-    std::string channel_name;
-    if (!buffer.ReadString(channel_name)) {
-      return false;
-    }
+std::chrono::milliseconds ChannelComponent::GetPresenceInterval() {
+  return presence_interval_;
+}
 
-    // Get user component
-    std::shared_ptr<UserComponent> user_component;
-    if (!server_->GetComponent(kComponentType_User, user_component)) {
-      // Internal error, disconnect client
-      return false;
-    }
+bool ChannelComponent::SetStatePath(const std::string &state_path) {
+  if (is_started_) {
+    return false;
+  }
+  state_path_ = state_path;
+  return true;
+}
 
-    // Get the chat client
-    std::shared_ptr<ChatUser> chat_user;
-    if (!user_component->GetChatUser(client, chat_user)) {
-      // Internal error, disconnect client
-      return false;
-    }
+std::string ChannelComponent::GetStatePath() {
+  return state_path_;
+}
 
-    // Check if the user is logged in
-    if (!chat_user->Identified) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_NotIdentified);
-      send_buffer.WriteString(channel_name);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_LeaveChannel_Complete, send_buffer);
+bool ChannelComponent::SetSnapshotInterval(
+  std::chrono::seconds snapshot_interval) {
+  if (is_started_ || snapshot_interval.count() <= 0) {
+    return false;
+  }
+  snapshot_interval_ = snapshot_interval;
+  return true;
+}
 
-      // Trigger events
-      OnLeaveCompleted(kChannelMessageResult_NotIdentified, channel_name,
-        *chat_user);
+std::chrono::seconds ChannelComponent::GetSnapshotInterval() {
+  return snapshot_interval_;
+}
 
-      return true;
-    }
+bool ChannelComponent::SetHistoryLimits(size_t max_messages,
+  size_t max_channel_size, size_t max_server_size,
+  std::chrono::seconds max_age) {
+  if (is_started_ || max_age.count() < 0) {
+    return false;
+  }
+  history_limits_.MaxMessages = max_messages;
+  history_limits_.MaxChannelSize = max_channel_size;
+  history_limits_.MaxTotalSize = max_server_size;
+  history_limits_.MaxAge = max_age;
+  return true;
+}
 
-    // Check if the channel name is valid
-    if (channel_name.empty() || channel_name[0] != '#') {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
-      send_buffer.WriteString(channel_name);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_LeaveChannel_Complete, send_buffer);
+bool ChannelComponent::SetMessageTap(
+  std::shared_ptr<SharedRingWriter> message_tap) {
+  if (is_started_) {
+    return false;
+  }
+  message_tap_ = message_tap;
+  return true;
+}
 
-      // Trigger events
-      OnLeaveCompleted(kChannelMessageResult_InvalidChannelName, channel_name,
-        *chat_user);
+std::shared_ptr<SharedRingWriter> ChannelComponent::GetMessageTap() {
+  return message_tap_;
+}
 
-      return true;
-    }
+HistoryLimits ChannelComponent::GetHistoryLimits() {
+  return history_limits_;
+}
 
-    // Check if the channel exists
-    std::shared_ptr<ChatChannel> chat_channel;
-    channels_mutex_.lock();
-    for (auto &channel : channels_) {
-      if (channel->Enabled && channel->Name == channel_name) {
-        chat_channel = channel;
-        break;
-      }
-    }
-    channels_mutex_.unlock();
+bool ChannelComponent::handleJoinChannel(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
 
-    if (!chat_channel) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
-      send_buffer.WriteString(channel_name);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_LeaveChannel_Complete, send_buffer);
+  // The ban list can be large, clients only receive it on request. Older
+  // clients don't ask for it.
+  bool include_bans = false;
+  buffer.ReadBoolean(include_bans);
 
-      // Trigger events
-      OnLeaveCompleted(kChannelMessageResult_InvalidChannelName, channel_name,
-        *chat_user);
+  // Messages of the channel's history to be sent after joining
+  uint64_t history_count = 0;
+  buffer.ReadUInt64(history_count);
 
-      return true;
-    }
+  // Get user component
+  std::shared_ptr<UserComponent> user_component;
+  if (!server_->GetComponent(kComponentType_User, user_component)) {
+    // Internal error, disconnect client
+    return false;
+  }
 
-    // Check if the user is in the channel
-    chat_channel->ClientsMutex.lock();
-    if (chat_channel->Clients.find(&client) == chat_channel->Clients.end()) {
-      chat_channel->ClientsMutex.unlock();
+  // Get the chat client
+  std::shared_ptr<ChatUser> chat_user;
+  if (!user_component->GetChatUser(client, chat_user)) {
+    // Internal error, disconnect client
+    return false;
+  }
 
-      // Notify the client that they are not in the channel
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_NotInChannel);
-      send_buffer.WriteString(chat_channel->Name);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_LeaveChannel_Complete, send_buffer);
+  // Check if the user is logged in
+  if (!chat_user->Identified) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_NotIdentified);
+    send_buffer.WriteString(channel_name);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_JoinChannel_Complete, send_buffer);
 
-      // Trigger events
-      OnLeaveCompleted(kChannelMessageResult_NotInChannel, chat_channel->Name,
-        *chat_user);
+    // Trigger events
+    OnJoinCompleted(kChannelMessageResult_NotIdentified, channel_name,
+      *chat_user);
 
-      return true;
-    }
-    chat_channel->ClientsMutex.unlock();
-
-    // Notify all clients in that channel that the client left
-    TypedBuffer clients_buffer = server_->CreateBuffer();
-    clients_buffer.WriteUInt16(kChannelMessageResult_UserLeft);
-    clients_buffer.WriteString(chat_channel->Name);
-    clients_buffer.WriteString(chat_user->Username);
-    clients_buffer.WriteString(chat_user->Hostname);
-
-    chat_channel->ClientsMutex.lock();
-    for (auto &pair : chat_channel->Clients) {
-      if (pair.first != &client && pair.second->Enabled) {
-        server_->Send(pair.first, kComponentType_Channel,
-          kChannelMessageType_LeaveChannel, clients_buffer);
-      }
-    }
-    chat_channel->ClientsMutex.unlock();
+    return true;
+  }
 
-    // Notify the client that they left the channel
+  // Check if the channel name is valid
+  if (channel_name.empty() || channel_name[0] != '#') {
     TypedBuffer send_buffer = server_->CreateBuffer();
-    send_buffer.WriteUInt16(kChannelMessageResult_Ok);
-    send_buffer.WriteString(chat_channel->Name);
+    send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
+    send_buffer.WriteString(channel_name);
     server_->Send(client, kComponentType_Channel,
-      kChannelMessageType_LeaveChannel_Complete, send_buffer);
+      kChannelMessageType_JoinChannel_Complete, send_buffer);
 
     // Trigger events
-    OnLeaveCompleted(kChannelMessageResult_Ok, chat_channel->Name, *chat_user);
-    OnChannelLeft(*chat_channel, *chat_user);
+    OnJoinCompleted(kChannelMessageResult_InvalidChannelName, channel_name,
+      *chat_user);
+
+    return true;
+  }
 
-    // Remove the client from the clients list
-    chat_channel->Clients.erase(&client);
+  // Check if the channel name is too long, no channel with such a name can
+  // exist
+  if (channel_name.size() - 1 > JCHAT_CHAT_CHANNEL_NAME_LENGTH) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_ChannelNameTooLong);
+    send_buffer.WriteString(channel_name);
+    server_->Send(client, kComponentType_User,
+      kChannelMessageType_JoinChannel_Complete, send_buffer);
 
-    // Remove the client from the operators list if they're an operator
-    chat_channel->OperatorsMutex.lock();
-    if (chat_channel->Operators.find(&client)
-      != chat_channel->Operators.end()) {
-      chat_channel->Operators.erase(&client);
-    }
-    chat_channel->OperatorsMutex.unlock();
-
-    // If there was nobody in the channel delete it
-    chat_channel->ClientsMutex.lock();
-    if (chat_channel->Clients.empty()) {
-      chat_channel->ClientsMutex.unlock();
-      chat_channel->Enabled = false;
-      chat_channel.reset();
-    } else {
-      chat_channel->ClientsMutex.unlock();
-    }
+    // Trigger events
+    OnJoinCompleted(kChannelMessageResult_ChannelNameTooLong, channel_name,
+      *chat_user);
 
     return true;
-  } else if (message_type == kChannelMessageType_SendMessage) {
-    std::string channel_name;
-    if (!buffer.ReadString(channel_name)) {
-      return false;
-    }
+  }
 
-    std::string message;
-    if (!buffer.ReadString(message)) {
-      return false;
-    }
+  ChannelShard &shard = getShard(channel_name);
+  uint64_t client_id = client.Id;
+  shard.Post([this, &shard, client_id, chat_user, channel_name,
+    include_bans, history_count]() mutable {
+    joinChannel(shard, client_id, chat_user, channel_name, include_bans,
+      history_count);
+  });
 
-    // Get user component
-    std::shared_ptr<UserComponent> user_component;
-    if (!server_->GetComponent(kComponentType_User, user_component)) {
-      // Internal error, disconnect client
-      return false;
-    }
+  return true;
+}
 
-    // Get the chat client
-    std::shared_ptr<ChatUser> chat_user;
-    if (!user_component->GetChatUser(client, chat_user)) {
-      // Internal error, disconnect client
-      return false;
-    }
+void ChannelComponent::joinChannel(ChannelShard &shard, uint64_t client_id,
+  std::shared_ptr<ChatUser> &chat_user, std::string &channel_name,
+  bool include_bans, uint64_t history_count) {
+  // Check if the channel exists
+  std::shared_ptr<ChatChannel> chat_channel = shard.Find(channel_name);
+  if (!chat_channel) {
+    // Create the channel and add the user to it as its operator
+    chat_channel = shard.Create(channel_name);
+    chat_channel->Operators.insert(client_id);
+    shard.AddClient(chat_channel, client_id, chat_user);
+    if (store_.IsOpen()) {
+      chat_channel->OperatorIdentities.insert(chat_user->Identity);
+    }
+
+    // Notify the client that the channel was created and that they are
+    // the operator operator and member of it
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_ChannelCreated);
+    send_buffer.WriteString(channel_name);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_JoinChannel_Complete, send_buffer);
 
-    // Check if the user is logged in
-    if (!chat_user->Identified) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_NotIdentified);
-      send_buffer.WriteString(channel_name);
-      send_buffer.WriteString(message);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_SendMessage_Complete, send_buffer);
+    // Trigger the events
+    OnJoinCompleted(kChannelMessageResult_ChannelCreated, channel_name,
+      *chat_user);
 
-      // Trigger events
-      OnSendMessageCompleted(kChannelMessageResult_NotIdentified, channel_name,
-        message, *chat_user);
+    OnChannelCreated(*chat_channel);
+    OnChannelJoined(*chat_channel, *chat_user);
 
-      return true;
-    }
+    return;
+  }
 
-    // Check if the channel name is valid
-    if (channel_name.empty() || channel_name[0] != '#') {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
-      send_buffer.WriteString(channel_name);
-      send_buffer.WriteString(message);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_SendMessage_Complete, send_buffer);
+  // Check if the user is already in the channel
+  if (chat_channel->Clients.find(client_id) != chat_channel->Clients.end()) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_AlreadyInChannel);
+    send_buffer.WriteString(chat_channel->Name);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_JoinChannel_Complete, send_buffer);
 
-      // Trigger events
-      OnSendMessageCompleted(kChannelMessageResult_InvalidChannelName,
-        channel_name, message, *chat_user);
+    // Trigger events
+    OnJoinCompleted(kChannelMessageResult_AlreadyInChannel,
+      chat_channel->Name, *chat_user);
 
-      return true;
-    }
+    return;
+  }
 
-    // Check if the message is valid
-    if (message.empty()) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_InvalidMessage);
-      send_buffer.WriteString(channel_name);
-      send_buffer.WriteString(message);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_SendMessage_Complete, send_buffer);
+  // Check if the user is banned
+  if (chat_channel->BannedUsers.find(chat_user->Identity)
+    != chat_channel->BannedUsers.end()) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_BannedFromChannel);
+    send_buffer.WriteString(chat_channel->Name);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_JoinChannel_Complete, send_buffer);
 
-      // Trigger events
-      OnSendMessageCompleted(kChannelMessageResult_InvalidMessage,
-        channel_name, message, *chat_user);
+    // Trigger events
+    OnJoinCompleted(kChannelMessageResult_BannedFromChannel,
+      chat_channel->Name, *chat_user);
 
-      return true;
-    }
+    return;
+  }
 
-    if (message.size() > JCHAT_CHAT_MESSAGE_LENGTH) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_MessageTooLong);
-      send_buffer.WriteString(channel_name);
-      send_buffer.WriteString(message);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_SendMessage_Complete, send_buffer);
+  // Clients that don't read PresenceChanged don't skip members they already
+  // know about, so they are only sent joins that aren't in their list
+  if (!chat_user->PresenceChanges) {
+    sendPresenceChanges(*chat_channel);
+  }
 
-      // Trigger events
-      OnSendMessageCompleted(kChannelMessageResult_MessageTooLong,
-        channel_name, message, *chat_user);
+  // Add the user to the channel, stored channels remember their operators
+  shard.AddClient(chat_channel, client_id, chat_user);
+  if (chat_channel->OperatorIdentities.find(chat_user->Identity)
+    != chat_channel->OperatorIdentities.end()) {
+    chat_channel->Operators.insert(client_id);
+  }
 
-      return true;
-    }
+  // Notify the client that it joined the channel and give it the first page
+  // of current clients
+  TypedBuffer client_buffer = server_->CreateBuffer();
+  client_buffer.WriteUInt16(kChannelMessageResult_Ok); // Channel joined
+  client_buffer.WriteString(chat_channel->Name);
+  uint64_t next_cursor = writeMembers(client_buffer, *chat_channel, client_id,
+    0);
 
-    // Check if the channel exists
-    std::shared_ptr<ChatChannel> chat_channel;
-    channels_mutex_.lock();
-    for (auto &channel : channels_) {
-      if (channel->Enabled && channel->Name == channel_name) {
-        chat_channel = channel;
-        break;
-      }
+  if (include_bans) {
+    client_buffer.WriteUInt64(chat_channel->BannedUsers.size());
+    for (auto &banned_user : chat_channel->BannedUsers) {
+      client_buffer.WriteString(banned_user);
     }
-    channels_mutex_.unlock();
+  } else {
+    client_buffer.WriteUInt64(0);
+  }
 
-    if (!chat_channel) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
-      send_buffer.WriteString(channel_name);
-      send_buffer.WriteString(message);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_SendMessage_Complete, send_buffer);
+  // Older clients stop reading before these, they only see the first page
+  client_buffer.WriteUInt64(chat_channel->Clients.size() - 1);
+  client_buffer.WriteUInt64(next_cursor);
 
-      // Trigger events
-      OnSendMessageCompleted(kChannelMessageResult_InvalidChannelName,
-        channel_name, message, *chat_user);
+  server_->Send(client_id, kComponentType_Channel,
+    kChannelMessageType_JoinChannel_Complete, client_buffer);
+  if (history_count > 0) {
+    sendHistory(shard, *chat_channel, client_id, history_count);
+  }
 
-      return true;
-    }
+  // Notify all clients in the channel that the user has joined
+  addPresenceChange(shard, chat_channel, client_id, chat_user, true);
 
-    // Check if the user is in the channel
-    chat_channel->ClientsMutex.lock();
-    if (chat_channel->Clients.find(&client) == chat_channel->Clients.end()) {
-      chat_channel->ClientsMutex.unlock();
+  // Trigger the events
+  OnJoinCompleted(kChannelMessageResult_Ok, chat_channel->Name, *chat_user);
+  OnChannelJoined(*chat_channel, *chat_user);
+}
 
-      // Notify the client that they are not in the channel
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_NotInChannel);
-      send_buffer.WriteString(chat_channel->Name);
-      send_buffer.WriteString(message);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_SendMessage_Complete, send_buffer);
+bool ChannelComponent::handleLeaveChannel(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
 
-      // Trigger events
-      OnSendMessageCompleted(kChannelMessageResult_NotInChannel,
-        chat_channel->Name, message, *chat_user);
+  // Get user component
+  std::shared_ptr<UserComponent> user_component;
+  if (!server_->GetComponent(kComponentType_User, user_component)) {
+    // Internal error, disconnect client
+    return false;
+  }
 
-      return true;
-    }
-    chat_channel->ClientsMutex.unlock();
-
-    // Send the message to all the clients
-    TypedBuffer clients_buffer = server_->CreateBuffer();
-    clients_buffer.WriteUInt16(kChannelMessageResult_MessageSent);
-    clients_buffer.WriteString(chat_channel->Name);
-    clients_buffer.WriteString(chat_user->Username);
-    clients_buffer.WriteString(chat_user->Hostname);
-    clients_buffer.WriteString(message);
-
-    chat_channel->ClientsMutex.lock();
-    for (auto &pair : chat_channel->Clients) {
-      if (pair.first != &client && pair.second->Enabled) {
-        server_->Send(pair.first, kComponentType_Channel,
-          kChannelMessageType_SendMessage, clients_buffer);
-      }
-    }
-    chat_channel->ClientsMutex.unlock();
+  // Get the chat client
+  std::shared_ptr<ChatUser> chat_user;
+  if (!user_component->GetChatUser(client, chat_user)) {
+    // Internal error, disconnect client
+    return false;
+  }
 
-    // Tell the client that the message was sent
+  // Check if the user is logged in
+  if (!chat_user->Identified) {
     TypedBuffer send_buffer = server_->CreateBuffer();
-    send_buffer.WriteUInt16(kChannelMessageResult_Ok);
-    send_buffer.WriteString(chat_channel->Name);
-    send_buffer.WriteString(message);
+    send_buffer.WriteUInt16(kChannelMessageResult_NotIdentified);
+    send_buffer.WriteString(channel_name);
     server_->Send(client, kComponentType_Channel,
-      kChannelMessageType_SendMessage_Complete, send_buffer);
+      kChannelMessageType_LeaveChannel_Complete, send_buffer);
 
     // Trigger events
-    OnSendMessageCompleted(kChannelMessageResult_Ok, chat_channel->Name,
-      message, *chat_user);
-    OnChannelMessage(*chat_channel, *chat_user, message);
+    OnLeaveCompleted(kChannelMessageResult_NotIdentified, channel_name,
+      *chat_user);
 
     return true;
-  } else if (message_type == kChannelMessageType_OpUser) {
-    // TODO: Implement
-    return false;
-  } else if (message_type == kChannelMessageType_DeopUser) {
-    // TODO: Implement
-    return false;
-  } else if (message_type == kChannelMessageType_KickUser) {
-    std::string channel_name;
-    if (!buffer.ReadString(channel_name)) {
-      return false;
-    }
-
-    std::string target;
-    if (!buffer.ReadString(target)) {
-      return false;
-    }
+  }
 
-    // Get user component
-    std::shared_ptr<UserComponent> user_component;
-    if (!server_->GetComponent(kComponentType_User, user_component)) {
-      // Internal error, disconnect client
-      return false;
-    }
+  // Check if the channel name is valid
+  if (channel_name.empty() || channel_name[0] != '#') {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
+    send_buffer.WriteString(channel_name);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_LeaveChannel_Complete, send_buffer);
 
-    // Get the chat client
-    std::shared_ptr<ChatUser> chat_user;
-    if (!user_component->GetChatUser(client, chat_user)) {
-      // Internal error, disconnect client
-      return false;
-    }
+    // Trigger events
+    OnLeaveCompleted(kChannelMessageResult_InvalidChannelName, channel_name,
+      *chat_user);
 
-    // Check if the user is logged in
-    if (!chat_user->Identified) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_NotIdentified);
-      send_buffer.WriteString(channel_name);
-      send_buffer.WriteString(target);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_KickUser_Complete, send_buffer);
+    return true;
+  }
 
-      // Trigger events
-      OnKickUserCompleted(kChannelMessageResult_NotIdentified, channel_name,
-        target, *chat_user);
+  ChannelShard &shard = getShard(channel_name);
+  uint64_t client_id = client.Id;
+  shard.Post([this, &shard, client_id, chat_user, channel_name]() mutable {
+    leaveChannel(shard, client_id, chat_user, channel_name);
+  });
 
-      return true;
-    }
+  return true;
+}
 
-    // Check if the channel name is valid
-    if (channel_name.empty() || channel_name[0] != '#') {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
-      send_buffer.WriteString(channel_name);
-      send_buffer.WriteString(target);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_KickUser_Complete, send_buffer);
+void ChannelComponent::leaveChannel(ChannelShard &shard, uint64_t client_id,
+  std::shared_ptr<ChatUser> &chat_user, std::string &channel_name) {
+  // Check if the channel exists
+  std::shared_ptr<ChatChannel> chat_channel = shard.Find(channel_name);
+  if (!chat_channel) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
+    send_buffer.WriteString(channel_name);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_LeaveChannel_Complete, send_buffer);
 
-      // Trigger events
-      OnKickUserCompleted(kChannelMessageResult_InvalidChannelName,
-        channel_name, target, *chat_user);
+    // Trigger events
+    OnLeaveCompleted(kChannelMessageResult_InvalidChannelName, channel_name,
+      *chat_user);
 
-      return true;
-    }
+    return;
+  }
 
-    // Check if the target is valid
-    if (target.empty() || String::Contains(target, "#")) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_InvalidUsername);
-      send_buffer.WriteString(channel_name);
-      send_buffer.WriteString(target);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_KickUser_Complete, send_buffer);
+  // Check if the user is in the channel
+  if (chat_channel->Clients.find(client_id) == chat_channel->Clients.end()) {
+    // Notify the client that they are not in the channel
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_NotInChannel);
+    send_buffer.WriteString(chat_channel->Name);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_LeaveChannel_Complete, send_buffer);
 
-      // Trigger events
-      OnKickUserCompleted(kChannelMessageResult_InvalidUsername,
-        channel_name, target, *chat_user);
+    // Trigger events
+    OnLeaveCompleted(kChannelMessageResult_NotInChannel, chat_channel->Name,
+      *chat_user);
 
-      return true;
-    }
+    return;
+  }
 
-    // Check if the channel exists
-    std::shared_ptr<ChatChannel> chat_channel;
-    channels_mutex_.lock();
-    for (auto &channel : channels_) {
-      if (channel->Enabled && channel->Name == channel_name) {
-        chat_channel = channel;
-        break;
-      }
-    }
-    channels_mutex_.unlock();
+  // Notify the client that they left the channel
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt16(kChannelMessageResult_Ok);
+  send_buffer.WriteString(chat_channel->Name);
+  server_->Send(client_id, kComponentType_Channel,
+    kChannelMessageType_LeaveChannel_Complete, send_buffer);
+
+  // Trigger events
+  OnLeaveCompleted(kChannelMessageResult_Ok, chat_channel->Name, *chat_user);
+  OnChannelLeft(*chat_channel, *chat_user);
+
+  // Remove the client from the channel, if there was nobody else in the
+  // channel it is deleted. Otherwise the other clients are notified.
+  removeClient(shard, chat_channel, client_id);
+  if (!chat_channel->Clients.empty()) {
+    addPresenceChange(shard, chat_channel, client_id, chat_user, false);
+  }
+}
 
-    if (!chat_channel) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
-      send_buffer.WriteString(channel_name);
-      send_buffer.WriteString(target);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_KickUser_Complete, send_buffer);
+bool ChannelComponent::handleSendMessage(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
 
-      // Trigger events
-      OnKickUserCompleted(kChannelMessageResult_InvalidChannelName,
-        channel_name, target, *chat_user);
+  std::string message;
+  if (!buffer.ReadString(message)) {
+    return false;
+  }
 
-      return true;
-    }
+  // Get user component
+  std::shared_ptr<UserComponent> user_component;
+  if (!server_->GetComponent(kComponentType_User, user_component)) {
+    // Internal error, disconnect client
+    return false;
+  }
 
-    // Check if the user is in the channel
-    chat_channel->ClientsMutex.lock();
-    if (chat_channel->Clients.find(&client) == chat_channel->Clients.end()) {
-      chat_channel->ClientsMutex.unlock();
+  // Get the chat client
+  std::shared_ptr<ChatUser> chat_user;
+  if (!user_component->GetChatUser(client, chat_user)) {
+    // Internal error, disconnect client
+    return false;
+  }
 
-      // Notify the client that they are not in the channel
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_NotInChannel);
-      send_buffer.WriteString(chat_channel->Name);
-      send_buffer.WriteString(target);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_KickUser_Complete, send_buffer);
+  // Check if the user is logged in
+  if (!chat_user->Identified) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_NotIdentified);
+    send_buffer.WriteString(channel_name);
+    send_buffer.WriteString(message);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_SendMessage_Complete, send_buffer);
 
-      // Trigger events
-      OnKickUserCompleted(kChannelMessageResult_NotInChannel, chat_channel->Name,
-        target, *chat_user);
+    // Trigger events
+    OnSendMessageCompleted(kChannelMessageResult_NotIdentified, channel_name,
+      message, *chat_user);
 
-      return true;
-    }
-    chat_channel->ClientsMutex.unlock();
+    return true;
+  }
 
-    // Check if the user has permissions
-    chat_channel->OperatorsMutex.lock();
-    if (chat_channel->Operators.find(&client)
-      == chat_channel->Operators.end()) {
-      chat_channel->OperatorsMutex.unlock();
+  // Check if the channel name is valid
+  if (channel_name.empty() || channel_name[0] != '#') {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
+    send_buffer.WriteString(channel_name);
+    send_buffer.WriteString(message);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_SendMessage_Complete, send_buffer);
 
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_NotPermitted);
-      send_buffer.WriteString(chat_channel->Name);
-      send_buffer.WriteString(target);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_KickUser_Complete, send_buffer);
+    // Trigger events
+    OnSendMessageCompleted(kChannelMessageResult_InvalidChannelName,
+      channel_name, message, *chat_user);
 
-      // Trigger events
-      OnKickUserCompleted(kChannelMessageResult_NotPermitted,
-        chat_channel->Name, target, *chat_user);
+    return true;
+  }
 
-      return true;
-    }
-    chat_channel->OperatorsMutex.unlock();
+  // Check if the message is valid UTF-8, control characters are dropped
+  // from it before it is sent anywhere
+  if (!Utf8::Sanitize(message) || message.empty()) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_InvalidMessage);
+    send_buffer.WriteString(channel_name);
+    send_buffer.WriteString(message);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_SendMessage_Complete, send_buffer);
 
-    // Check if the user is trying to kick themself
-    if (target == chat_user->Username) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_CannotKickSelf);
-      send_buffer.WriteString(chat_channel->Name);
-      send_buffer.WriteString(target);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_KickUser_Complete, send_buffer);
+    // Trigger events
+    OnSendMessageCompleted(kChannelMessageResult_InvalidMessage,
+      channel_name, message, *chat_user);
 
-      // Trigger events
-      OnKickUserCompleted(kChannelMessageResult_CannotKickSelf,
-        chat_channel->Name, target, *chat_user);
+    return true;
+  }
 
-      return true;
-    }
+  if (message.size() > JCHAT_CHAT_MESSAGE_LENGTH) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_MessageTooLong);
+    send_buffer.WriteString(channel_name);
+    send_buffer.WriteString(message);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_SendMessage_Complete, send_buffer);
 
-    // Check if the target is in the channel
-    RemoteChatClient *kick_user_key = 0;
-    std::shared_ptr<ChatUser> kick_user;
-    chat_channel->ClientsMutex.lock();
-    for (auto pair : chat_channel->Clients) {
-      if (pair.second->Username == target) {
-        kick_user_key = pair.first;
-        kick_user = pair.second;
-        break;
-      }
-    }
-    chat_channel->ClientsMutex.unlock();
-
-    // Notify other clients
-    TypedBuffer clients_buffer = server_->CreateBuffer();
-    clients_buffer.WriteUInt16(kChannelMessageResult_UserKicked);
-    clients_buffer.WriteString(chat_channel->Name);
-    clients_buffer.WriteString(kick_user->Username);
-    clients_buffer.WriteString(kick_user->Hostname);
-
-    chat_channel->ClientsMutex.lock();
-    for (auto &pair : chat_channel->Clients) {
-      if (pair.first != &client && pair.second->Enabled) {
-        server_->Send(pair.first, kComponentType_Channel,
-          kChannelMessageType_KickUser, clients_buffer);
-      }
-    }
-    chat_channel->ClientsMutex.unlock();
+    // Trigger events
+    OnSendMessageCompleted(kChannelMessageResult_MessageTooLong,
+      channel_name, message, *chat_user);
+
+    return true;
+  }
+
+  ChannelShard &shard = getShard(channel_name);
+  uint64_t client_id = client.Id;
+  shard.Post([this, &shard, client_id, chat_user, channel_name,
+    message]() mutable {
+    sendMessage(shard, client_id, chat_user, channel_name, message);
+  });
+
+  return true;
+}
+
+void ChannelComponent::sendMessage(ChannelShard &shard, uint64_t client_id,
+  std::shared_ptr<ChatUser> &chat_user, std::string &channel_name,
+  std::string &message) {
+  // Check if the channel exists
+  std::shared_ptr<ChatChannel> chat_channel = shard.Find(channel_name);
+  if (!chat_channel) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
+    send_buffer.WriteString(channel_name);
+    send_buffer.WriteString(message);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_SendMessage_Complete, send_buffer);
 
-    // Tell the client that the user was banned
+    // Trigger events
+    OnSendMessageCompleted(kChannelMessageResult_InvalidChannelName,
+      channel_name, message, *chat_user);
+
+    return;
+  }
+
+  // Check if the user is in the channel
+  if (chat_channel->Clients.find(client_id) == chat_channel->Clients.end()) {
+    // Notify the client that they are not in the channel
     TypedBuffer send_buffer = server_->CreateBuffer();
-    send_buffer.WriteUInt16(kChannelMessageResult_Ok);
+    send_buffer.WriteUInt16(kChannelMessageResult_NotInChannel);
     send_buffer.WriteString(chat_channel->Name);
-    send_buffer.WriteString(target);
-    send_buffer.WriteString(kick_user->Username);
-    send_buffer.WriteString(kick_user->Hostname);
-    server_->Send(client, kComponentType_Channel,
-      kChannelMessageType_KickUser_Complete, send_buffer);
+    send_buffer.WriteString(message);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_SendMessage_Complete, send_buffer);
 
-    // Remove the client from channel client lists
-    chat_channel->OperatorsMutex.lock();
-    if (chat_channel->Operators.find(kick_user_key)
-      != chat_channel->Operators.end()) {
-      chat_channel->Operators.erase(kick_user_key);
-    }
-    chat_channel->OperatorsMutex.unlock();
+    // Trigger events
+    OnSendMessageCompleted(kChannelMessageResult_NotInChannel,
+      chat_channel->Name, message, *chat_user);
+
+    return;
+  }
 
-    chat_channel->ClientsMutex.lock();
-    if (chat_channel->Clients.find(kick_user_key)
-      != chat_channel->Clients.end()) {
-      chat_channel->Clients.erase(kick_user_key);
+  // Send the message to all the clients
+  TypedBuffer clients_buffer = server_->CreateBuffer();
+  clients_buffer.WriteUInt16(kChannelMessageResult_MessageSent);
+  clients_buffer.WriteString(chat_channel->Name);
+  chat_user->Interned->WriteName(clients_buffer);
+  clients_buffer.WriteString(message);
+
+  std::shared_ptr<Packet> tap_packet;
+  if (history_limits_.MaxMessages > 0) {
+    // Both formats are framed now, clients that join later may use either
+    PacketSet packets = server_->CreatePackets(kComponentType_Channel,
+      kChannelMessageType_SendMessage, clients_buffer);
+    broadcast(*chat_channel, client_id, clients_buffer, packets,
+      chat_user.get());
+    shard.AddHistory(chat_channel, packets);
+    tap_packet = packets.Packets[kWireFormat_Tagged];
+  } else {
+    broadcast(*chat_channel, client_id, kChannelMessageType_SendMessage,
+      clients_buffer, chat_user.get());
+  }
+  if (message_tap_) {
+    if (!tap_packet) {
+      tap_packet = server_->CreatePacket(kComponentType_Channel,
+        kChannelMessageType_SendMessage, clients_buffer);
     }
-    chat_channel->ClientsMutex.unlock();
+    message_tap_->Write(tap_packet->GetData(), tap_packet->GetSize());
+  }
+
+  // Tell the client that the message was sent
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt16(kChannelMessageResult_Ok);
+  send_buffer.WriteString(chat_channel->Name);
+  send_buffer.WriteString(message);
+  server_->Send(client_id, kComponentType_Channel,
+    kChannelMessageType_SendMessage_Complete, send_buffer);
+
+  // Trigger events
+  OnSendMessageCompleted(kChannelMessageResult_Ok, chat_channel->Name,
+    message, *chat_user);
+  OnChannelMessage(*chat_channel, *chat_user, message);
+}
+
+bool ChannelComponent::handleOpUser(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  // TODO: Implement
+  return false;
+}
+
+bool ChannelComponent::handleDeopUser(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  // TODO: Implement
+  return false;
+}
+
+bool ChannelComponent::handleKickUser(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
+
+  std::string target;
+  if (!buffer.ReadString(target)) {
+    return false;
+  }
+
+  // Get user component
+  std::shared_ptr<UserComponent> user_component;
+  if (!server_->GetComponent(kComponentType_User, user_component)) {
+    // Internal error, disconnect client
+    return false;
+  }
+
+  // Get the chat client
+  std::shared_ptr<ChatUser> chat_user;
+  if (!user_component->GetChatUser(client, chat_user)) {
+    // Internal error, disconnect client
+    return false;
+  }
+
+  // Check if the user is logged in
+  if (!chat_user->Identified) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_NotIdentified);
+    send_buffer.WriteString(channel_name);
+    send_buffer.WriteString(target);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_KickUser_Complete, send_buffer);
 
     // Trigger events
-    OnKickUserCompleted(kChannelMessageResult_Ok, chat_channel->Name,
+    OnKickUserCompleted(kChannelMessageResult_NotIdentified, channel_name,
       target, *chat_user);
-    OnChannelUserKicked(*chat_channel, *kick_user);
 
     return true;
-  } else if (message_type == kChannelMessageType_BanUser) {
-    std::string channel_name;
-    if (!buffer.ReadString(channel_name)) {
-      return false;
-    }
+  }
 
-    std::string target;
-    if (!buffer.ReadString(target)) {
-      return false;
-    }
+  // Check if the channel name is valid
+  if (channel_name.empty() || channel_name[0] != '#') {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
+    send_buffer.WriteString(channel_name);
+    send_buffer.WriteString(target);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_KickUser_Complete, send_buffer);
 
-    // Get user component
-    std::shared_ptr<UserComponent> user_component;
-    if (!server_->GetComponent(kComponentType_User, user_component)) {
-      // Internal error, disconnect client
-      return false;
-    }
+    // Trigger events
+    OnKickUserCompleted(kChannelMessageResult_InvalidChannelName,
+      channel_name, target, *chat_user);
 
-    // Get the chat client
-    std::shared_ptr<ChatUser> chat_user;
-    if (!user_component->GetChatUser(client, chat_user)) {
-      // Internal error, disconnect client
-      return false;
-    }
+    return true;
+  }
 
-    // Check if the user is logged in
-    if (!chat_user->Identified) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_NotIdentified);
-      send_buffer.WriteString(channel_name);
-      send_buffer.WriteString(target);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_BanUser_Complete, send_buffer);
+  // Check if the target is valid
+  if (target.empty() || String::Contains(target, "#")) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_InvalidUsername);
+    send_buffer.WriteString(channel_name);
+    send_buffer.WriteString(target);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_KickUser_Complete, send_buffer);
 
-      // Trigger events
-      OnBanUserCompleted(kChannelMessageResult_NotIdentified, channel_name,
-        target, *chat_user);
+    // Trigger events
+    OnKickUserCompleted(kChannelMessageResult_InvalidUsername,
+      channel_name, target, *chat_user);
 
-      return true;
-    }
+    return true;
+  }
 
-    // Check if the channel name is valid
-    if (channel_name.empty() || channel_name[0] != '#') {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
-      send_buffer.WriteString(channel_name);
-      send_buffer.WriteString(target);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_BanUser_Complete, send_buffer);
+  // Check if the user is trying to kick themself
+  if (target == chat_user->Username) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_CannotKickSelf);
+    send_buffer.WriteString(channel_name);
+    send_buffer.WriteString(target);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_KickUser_Complete, send_buffer);
 
-      // Trigger events
-      OnBanUserCompleted(kChannelMessageResult_InvalidChannelName,
-        channel_name, target, *chat_user);
+    // Trigger events
+    OnKickUserCompleted(kChannelMessageResult_CannotKickSelf,
+      channel_name, target, *chat_user);
 
-      return true;
-    }
+    return true;
+  }
 
-    // Check if the target is valid
-    if (target.empty() || String::Contains(target, "#")) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_InvalidUsername);
-      send_buffer.WriteString(channel_name);
-      send_buffer.WriteString(target);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_BanUser_Complete, send_buffer);
+  ChannelShard &shard = getShard(channel_name);
+  uint64_t client_id = client.Id;
+  shard.Post([this, &shard, client_id, chat_user, channel_name,
+    target]() mutable {
+    kickUser(shard, client_id, chat_user, channel_name, target);
+  });
 
-      // Trigger events
-      OnBanUserCompleted(kChannelMessageResult_InvalidUsername,
-        channel_name, target, *chat_user);
+  return true;
+}
 
-      return true;
-    }
+void ChannelComponent::kickUser(ChannelShard &shard, uint64_t client_id,
+  std::shared_ptr<ChatUser> &chat_user, std::string &channel_name,
+  std::string &target) {
+  // Check if the channel exists
+  std::shared_ptr<ChatChannel> chat_channel = shard.Find(channel_name);
+  if (!chat_channel) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
+    send_buffer.WriteString(channel_name);
+    send_buffer.WriteString(target);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_KickUser_Complete, send_buffer);
 
-    // Check if the channel exists
-    std::shared_ptr<ChatChannel> chat_channel;
-    channels_mutex_.lock();
-    for (auto &channel : channels_) {
-      if (channel->Enabled && channel->Name == channel_name) {
-        chat_channel = channel;
-        break;
-      }
-    }
-    channels_mutex_.unlock();
+    // Trigger events
+    OnKickUserCompleted(kChannelMessageResult_InvalidChannelName,
+      channel_name, target, *chat_user);
 
-    if (!chat_channel) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
-      send_buffer.WriteString(channel_name);
-      send_buffer.WriteString(target);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_BanUser_Complete, send_buffer);
+    return;
+  }
 
-      // Trigger events
-      OnBanUserCompleted(kChannelMessageResult_InvalidChannelName,
-        channel_name, target, *chat_user);
+  // Check if the user is in the channel
+  if (chat_channel->Clients.find(client_id) == chat_channel->Clients.end()) {
+    // Notify the client that they are not in the channel
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_NotInChannel);
+    send_buffer.WriteString(chat_channel->Name);
+    send_buffer.WriteString(target);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_KickUser_Complete, send_buffer);
 
-      return true;
-    }
+    // Trigger events
+    OnKickUserCompleted(kChannelMessageResult_NotInChannel, chat_channel->Name,
+      target, *chat_user);
 
-    // Check if the user is in the channel
-    chat_channel->ClientsMutex.lock();
-    if (chat_channel->Clients.find(&client) == chat_channel->Clients.end()) {
-      chat_channel->ClientsMutex.unlock();
+    return;
+  }
 
-      // Notify the client that they are not in the channel
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_NotInChannel);
-      send_buffer.WriteString(chat_channel->Name);
-      send_buffer.WriteString(target);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_BanUser_Complete, send_buffer);
+  // Check if the user has permissions
+  if (chat_channel->Operators.find(client_id)
+    == chat_channel->Operators.end()) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_NotPermitted);
+    send_buffer.WriteString(chat_channel->Name);
+    send_buffer.WriteString(target);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_KickUser_Complete, send_buffer);
 
-      // Trigger events
-      OnBanUserCompleted(kChannelMessageResult_NotInChannel, chat_channel->Name,
-        target, *chat_user);
+    // Trigger events
+    OnKickUserCompleted(kChannelMessageResult_NotPermitted,
+      chat_channel->Name, target, *chat_user);
 
-      return true;
-    }
-    chat_channel->ClientsMutex.unlock();
+    return;
+  }
+
+  // Check if the target is in the channel
+  uint64_t kick_user_key = 0;
+  std::shared_ptr<ChatUser> kick_user;
+  auto kick_username = chat_channel->Usernames.find(target);
+  if (kick_username != chat_channel->Usernames.end()) {
+    kick_user_key = kick_username->second;
+    kick_user = chat_channel->Clients[kick_user_key];
+  }
+  if (!kick_user) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_InvalidUsername);
+    send_buffer.WriteString(chat_channel->Name);
+    send_buffer.WriteString(target);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_KickUser_Complete, send_buffer);
 
-    // Check if the user has permissions
-    chat_channel->OperatorsMutex.lock();
-    if (chat_channel->Operators.find(&client)
-      == chat_channel->Operators.end()) {
-      chat_channel->OperatorsMutex.unlock();
+    // Trigger events
+    OnKickUserCompleted(kChannelMessageResult_InvalidUsername,
+      chat_channel->Name, target, *chat_user);
 
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_NotPermitted);
-      send_buffer.WriteString(chat_channel->Name);
-      send_buffer.WriteString(target);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_BanUser_Complete, send_buffer);
+    return;
+  }
 
-      // Trigger events
-      OnBanUserCompleted(kChannelMessageResult_NotPermitted,
-        chat_channel->Name, target, *chat_user);
+  // Notify other clients
+  TypedBuffer clients_buffer = server_->CreateBuffer();
+  clients_buffer.WriteUInt16(kChannelMessageResult_UserKicked);
+  clients_buffer.WriteString(chat_channel->Name);
+  kick_user->Interned->WriteName(clients_buffer);
+
+  broadcast(*chat_channel, client_id, kChannelMessageType_KickUser,
+    clients_buffer);
+
+  // Tell the client that the user was kicked
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt16(kChannelMessageResult_Ok);
+  send_buffer.WriteString(chat_channel->Name);
+  send_buffer.WriteString(target);
+  kick_user->Interned->WriteName(send_buffer);
+  server_->Send(client_id, kComponentType_Channel,
+    kChannelMessageType_KickUser_Complete, send_buffer);
+
+  // Remove the client from the channel
+  removeClient(shard, chat_channel, kick_user_key);
+
+  // Trigger events
+  OnKickUserCompleted(kChannelMessageResult_Ok, chat_channel->Name,
+    target, *chat_user);
+  OnChannelUserKicked(*chat_channel, *kick_user);
+}
 
-      return true;
-    }
-    chat_channel->OperatorsMutex.unlock();
+bool ChannelComponent::handleBanUser(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
 
-    // Check if the user is trying to ban themself
-    if (target == chat_user->Username) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_CannotBanSelf);
-      send_buffer.WriteString(chat_channel->Name);
-      send_buffer.WriteString(target);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_BanUser_Complete, send_buffer);
+  std::string target;
+  if (!buffer.ReadString(target)) {
+    return false;
+  }
 
-      // Trigger events
-      OnBanUserCompleted(kChannelMessageResult_CannotBanSelf,
-        chat_channel->Name, target, *chat_user);
+  // Get user component
+  std::shared_ptr<UserComponent> user_component;
+  if (!server_->GetComponent(kComponentType_User, user_component)) {
+    // Internal error, disconnect client
+    return false;
+  }
 
-      return true;
-    }
+  // Get the chat client
+  std::shared_ptr<ChatUser> chat_user;
+  if (!user_component->GetChatUser(client, chat_user)) {
+    // Internal error, disconnect client
+    return false;
+  }
 
-    // Check if the target is in the channel
-    RemoteChatClient *ban_user_key = 0;
-    std::shared_ptr<ChatUser> ban_user;
-    std::string target_string;
-    chat_channel->ClientsMutex.lock();
-    for (auto pair : chat_channel->Clients) {
-      if (pair.second->Username == target) {
-        ban_user_key = pair.first;
-        ban_user = pair.second;
-        target_string = pair.second->Username + "@" + pair.second->Hostname;
-        break;
-      }
-    }
-    chat_channel->ClientsMutex.unlock();
-    if (target_string.empty()) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kChannelMessageResult_InvalidUsername);
-      send_buffer.WriteString(channel_name);
-      send_buffer.WriteString(target);
-      server_->Send(client, kComponentType_Channel,
-        kChannelMessageType_BanUser_Complete, send_buffer);
+  // Check if the user is logged in
+  if (!chat_user->Identified) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_NotIdentified);
+    send_buffer.WriteString(channel_name);
+    send_buffer.WriteString(target);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_BanUser_Complete, send_buffer);
 
-      // Trigger events
-      OnBanUserCompleted(kChannelMessageResult_InvalidUsername,
-        channel_name, target, *chat_user);
+    // Trigger events
+    OnBanUserCompleted(kChannelMessageResult_NotIdentified, channel_name,
+      target, *chat_user);
 
-      return true;
-    }
+    return true;
+  }
 
-    // Check if the target is already banned
-    chat_channel->BannedUsersMutex.lock();
-    for (auto &banned_user : chat_channel->BannedUsers) {
-      if (banned_user == target) {
-        chat_channel->BannedUsersMutex.unlock();
+  // Check if the channel name is valid
+  if (channel_name.empty() || channel_name[0] != '#') {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
+    send_buffer.WriteString(channel_name);
+    send_buffer.WriteString(target);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_BanUser_Complete, send_buffer);
 
-        TypedBuffer send_buffer = server_->CreateBuffer();
-        send_buffer.WriteUInt16(kChannelMessageResult_AlreadyBanned);
-        send_buffer.WriteString(chat_channel->Name);
-        send_buffer.WriteString(target);
-        server_->Send(client, kComponentType_Channel,
-          kChannelMessageType_BanUser_Complete, send_buffer);
+    // Trigger events
+    OnBanUserCompleted(kChannelMessageResult_InvalidChannelName,
+      channel_name, target, *chat_user);
 
-        // Trigger events
-        OnBanUserCompleted(kChannelMessageResult_AlreadyBanned,
-          chat_channel->Name, target, *chat_user);
+    return true;
+  }
 
-        return true;
-      }
-    }
+  // Check if the target is valid
+  if (target.empty() || String::Contains(target, "#")) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_InvalidUsername);
+    send_buffer.WriteString(channel_name);
+    send_buffer.WriteString(target);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_BanUser_Complete, send_buffer);
 
-    // Ban the user
-    chat_channel->BannedUsers.push_back(target_string);
-    chat_channel->BannedUsersMutex.unlock();
-
-    // Notify other clients
-    TypedBuffer clients_buffer = server_->CreateBuffer();
-    clients_buffer.WriteUInt16(kChannelMessageResult_UserBanned);
-    clients_buffer.WriteString(chat_channel->Name);
-    clients_buffer.WriteString(ban_user->Username);
-    clients_buffer.WriteString(ban_user->Hostname);
-
-    chat_channel->ClientsMutex.lock();
-    for (auto &pair : chat_channel->Clients) {
-      if (pair.first != &client && pair.second->Enabled) {
-        server_->Send(pair.first, kComponentType_Channel,
-          kChannelMessageType_BanUser, clients_buffer);
-      }
-    }
-    chat_channel->ClientsMutex.unlock();
+    // Trigger events
+    OnBanUserCompleted(kChannelMessageResult_InvalidUsername,
+      channel_name, target, *chat_user);
+
+    return true;
+  }
 
-    // Tell the client that the user was banned
+  // Check if the user is trying to ban themself
+  if (target == chat_user->Username) {
     TypedBuffer send_buffer = server_->CreateBuffer();
-    send_buffer.WriteUInt16(kChannelMessageResult_Ok);
-    send_buffer.WriteString(chat_channel->Name);
+    send_buffer.WriteUInt16(kChannelMessageResult_CannotBanSelf);
+    send_buffer.WriteString(channel_name);
     send_buffer.WriteString(target);
-    send_buffer.WriteString(ban_user->Username);
-    send_buffer.WriteString(ban_user->Hostname);
     server_->Send(client, kComponentType_Channel,
       kChannelMessageType_BanUser_Complete, send_buffer);
 
-    // Remove the client from channel client lists
-    chat_channel->OperatorsMutex.lock();
-    if (chat_channel->Operators.find(ban_user_key)
-      != chat_channel->Operators.end()) {
-      chat_channel->Operators.erase(ban_user_key);
-    }
-    chat_channel->OperatorsMutex.unlock();
+    // Trigger events
+    OnBanUserCompleted(kChannelMessageResult_CannotBanSelf,
+      channel_name, target, *chat_user);
 
-    chat_channel->ClientsMutex.lock();
-    if (chat_channel->Clients.find(ban_user_key)
-      != chat_channel->Clients.end()) {
-      chat_channel->Clients.erase(ban_user_key);
-    }
-    chat_channel->ClientsMutex.unlock();
+    return true;
+  }
+
+  ChannelShard &shard = getShard(channel_name);
+  uint64_t client_id = client.Id;
+  shard.Post([this, &shard, client_id, chat_user, channel_name,
+    target]() mutable {
+    banUser(shard, client_id, chat_user, channel_name, target);
+  });
+
+  return true;
+}
+
+void ChannelComponent::banUser(ChannelShard &shard, uint64_t client_id,
+  std::shared_ptr<ChatUser> &chat_user, std::string &channel_name,
+  std::string &target) {
+  // Check if the channel exists
+  std::shared_ptr<ChatChannel> chat_channel = shard.Find(channel_name);
+  if (!chat_channel) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
+    send_buffer.WriteString(channel_name);
+    send_buffer.WriteString(target);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_BanUser_Complete, send_buffer);
+
+    // Trigger events
+    OnBanUserCompleted(kChannelMessageResult_InvalidChannelName,
+      channel_name, target, *chat_user);
+
+    return;
+  }
+
+  // Check if the user is in the channel
+  if (chat_channel->Clients.find(client_id) == chat_channel->Clients.end()) {
+    // Notify the client that they are not in the channel
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_NotInChannel);
+    send_buffer.WriteString(chat_channel->Name);
+    send_buffer.WriteString(target);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_BanUser_Complete, send_buffer);
 
     // Trigger events
-    OnBanUserCompleted(kChannelMessageResult_Ok, chat_channel->Name,
+    OnBanUserCompleted(kChannelMessageResult_NotInChannel, chat_channel->Name,
       target, *chat_user);
-    OnChannelUserBanned(*chat_channel, *ban_user);
+
+    return;
+  }
+
+  // Check if the user has permissions
+  if (chat_channel->Operators.find(client_id)
+    == chat_channel->Operators.end()) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_NotPermitted);
+    send_buffer.WriteString(chat_channel->Name);
+    send_buffer.WriteString(target);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_BanUser_Complete, send_buffer);
+
+    // Trigger events
+    OnBanUserCompleted(kChannelMessageResult_NotPermitted,
+      chat_channel->Name, target, *chat_user);
+
+    return;
+  }
+
+  // Check if the target is in the channel
+  uint64_t ban_user_key = 0;
+  std::shared_ptr<ChatUser> ban_user;
+  auto ban_username = chat_channel->Usernames.find(target);
+  if (ban_username != chat_channel->Usernames.end()) {
+    ban_user_key = ban_username->second;
+    ban_user = chat_channel->Clients[ban_user_key];
+  }
+  if (!ban_user) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_InvalidUsername);
+    send_buffer.WriteString(channel_name);
+    send_buffer.WriteString(target);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_BanUser_Complete, send_buffer);
+
+    // Trigger events
+    OnBanUserCompleted(kChannelMessageResult_InvalidUsername,
+      channel_name, target, *chat_user);
+
+    return;
+  }
+
+  // Ban the user, unless they are already banned
+  if (!chat_channel->BannedUsers.insert(ban_user->Identity).second) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_AlreadyBanned);
+    send_buffer.WriteString(chat_channel->Name);
+    send_buffer.WriteString(target);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_BanUser_Complete, send_buffer);
+
+    // Trigger events
+    OnBanUserCompleted(kChannelMessageResult_AlreadyBanned,
+      chat_channel->Name, target, *chat_user);
+
+    return;
+  }
+
+  // The first ban is what makes the channel worth storing
+  if (store_.IsOpen() && !chat_channel->IsStored) {
+    chat_channel->IsStored = true;
+    for (auto &identity : chat_channel->OperatorIdentities) {
+      store_.Append(kChannelChange_Created, chat_channel->Name, identity);
+    }
+  }
+  if (chat_channel->IsStored) {
+    store_.Append(kChannelChange_Banned, chat_channel->Name,
+      ban_user->Identity);
+  }
+
+  // Notify other clients
+  TypedBuffer clients_buffer = server_->CreateBuffer();
+  clients_buffer.WriteUInt16(kChannelMessageResult_UserBanned);
+  clients_buffer.WriteString(chat_channel->Name);
+  ban_user->Interned->WriteName(clients_buffer);
+
+  broadcast(*chat_channel, client_id, kChannelMessageType_BanUser,
+    clients_buffer);
+
+  // Tell the client that the user was banned
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt16(kChannelMessageResult_Ok);
+  send_buffer.WriteString(chat_channel->Name);
+  send_buffer.WriteString(target);
+  ban_user->Interned->WriteName(send_buffer);
+  server_->Send(client_id, kComponentType_Channel,
+    kChannelMessageType_BanUser_Complete, send_buffer);
+
+  // Remove the client from the channel
+  removeClient(shard, chat_channel, ban_user_key);
+
+  // Trigger events
+  OnBanUserCompleted(kChannelMessageResult_Ok, chat_channel->Name,
+    target, *chat_user);
+  OnChannelUserBanned(*chat_channel, *ban_user);
+}
+
+bool ChannelComponent::handleUnbanUser(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  // TODO: Implement
+  return false;
+}
+
+bool ChannelComponent::handleGetMembers(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  std::string channel_name;
+  if (!buffer.ReadString(channel_name)) {
+    return false;
+  }
+
+  uint64_t cursor = 0;
+  if (!buffer.ReadUInt64(cursor)) {
+    return false;
+  }
+
+  // Get user component
+  std::shared_ptr<UserComponent> user_component;
+  if (!server_->GetComponent(kComponentType_User, user_component)) {
+    // Internal error, disconnect client
+    return false;
+  }
+
+  // Get the chat client
+  std::shared_ptr<ChatUser> chat_user;
+  if (!user_component->GetChatUser(client, chat_user)) {
+    // Internal error, disconnect client
+    return false;
+  }
+
+  // Check if the user is logged in
+  if (!chat_user->Identified) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_NotIdentified);
+    send_buffer.WriteString(channel_name);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_GetMembers_Complete, send_buffer);
 
     return true;
-  } else if (message_type == kChannelMessageType_UnbanUser) {
-    // TODO: Implement
+  }
+
+  // Check if the channel name is valid
+  if (channel_name.empty() || channel_name[0] != '#') {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
+    send_buffer.WriteString(channel_name);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_GetMembers_Complete, send_buffer);
+
+    return true;
+  }
+
+  ChannelShard &shard = getShard(channel_name);
+  uint64_t client_id = client.Id;
+  shard.Post([this, &shard, client_id, chat_user, channel_name,
+    cursor]() mutable {
+    getMembers(shard, client_id, chat_user, channel_name, cursor);
+  });
+
+  return true;
+}
+
+void ChannelComponent::getMembers(ChannelShard &shard, uint64_t client_id,
+  std::shared_ptr<ChatUser> &chat_user, std::string &channel_name,
+  uint64_t cursor) {
+  // Check if the channel exists
+  std::shared_ptr<ChatChannel> chat_channel = shard.Find(channel_name);
+  if (!chat_channel) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_InvalidChannelName);
+    send_buffer.WriteString(channel_name);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_GetMembers_Complete, send_buffer);
+
+    return;
+  }
+
+  // Only members may list the channel
+  if (chat_channel->Clients.find(client_id) == chat_channel->Clients.end()) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kChannelMessageResult_NotInChannel);
+    send_buffer.WriteString(chat_channel->Name);
+    server_->Send(client_id, kComponentType_Channel,
+      kChannelMessageType_GetMembers_Complete, send_buffer);
+
+    return;
+  }
+
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt16(kChannelMessageResult_Ok);
+  send_buffer.WriteString(chat_channel->Name);
+  uint64_t next_cursor = writeMembers(send_buffer, *chat_channel, client_id,
+    cursor);
+  send_buffer.WriteUInt64(chat_channel->Clients.size() - 1);
+  send_buffer.WriteUInt64(next_cursor);
+  server_->Send(client_id, kComponentType_Channel,
+    kChannelMessageType_GetMembers_Complete, send_buffer);
+}
+
+bool ChannelComponent::handleSubscribe(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  std::string pattern;
+  if (!buffer.ReadString(pattern)) {
     return false;
   }
 
-  return false;
+  // Empty for messages from anybody
+  std::string sender;
+  if (!buffer.ReadString(sender)) {
+    return false;
+  }
+
+  // Get user component
+  std::shared_ptr<UserComponent> user_component;
+  if (!server_->GetComponent(kComponentType_User, user_component)) {
+    // Internal error, disconnect client
+    return false;
+  }
+
+  // Get the chat client
+  std::shared_ptr<ChatUser> chat_user;
+  if (!user_component->GetChatUser(client, chat_user)) {
+    // Internal error, disconnect client
+    return false;
+  }
+
+  // Check if the user is logged in
+  if (!chat_user->Identified) {
+    completeSubscribe(client, kChannelMessageResult_NotIdentified, pattern,
+      sender, *chat_user);
+    return true;
+  }
+
+  // Check if the pattern can match channel names
+  if (pattern.empty() || pattern[0] != '#') {
+    completeSubscribe(client, kChannelMessageResult_InvalidChannelName,
+      pattern, sender, *chat_user);
+    return true;
+  }
+  if (pattern.size() - 1 > JCHAT_CHAT_CHANNEL_NAME_LENGTH) {
+    completeSubscribe(client, kChannelMessageResult_ChannelNameTooLong,
+      pattern, sender, *chat_user);
+    return true;
+  }
+
+  // Check if the sender is valid
+  if (sender.size() > JCHAT_CHAT_USERNAME_LENGTH
+    || String::Contains(sender, "#")) {
+    completeSubscribe(client, kChannelMessageResult_InvalidUsername, pattern,
+      sender, *chat_user);
+    return true;
+  }
+
+  subscriptions_mutex_.lock();
+  std::set<std::string> &patterns = subscriptions_[client.Id];
+  ChannelMessageResult message_result = kChannelMessageResult_Ok;
+  if (patterns.find(pattern) != patterns.end()) {
+    message_result = kChannelMessageResult_AlreadySubscribed;
+  } else if (patterns.size() >= JCHAT_CHAT_MAX_SUBSCRIPTIONS) {
+    message_result = kChannelMessageResult_TooManySubscriptions;
+  } else {
+    patterns.insert(pattern);
+  }
+  subscriptions_mutex_.unlock();
+  if (message_result != kChannelMessageResult_Ok) {
+    completeSubscribe(client, message_result, pattern, sender, *chat_user);
+    return true;
+  }
+
+  // Every shard matches its channels, the messages that are posted to them
+  // after this are delivered
+  std::shared_ptr<ChannelSubscription> subscription =
+    std::make_shared<ChannelSubscription>();
+  subscription->ClientId = client.Id;
+  subscription->Pattern = pattern;
+  subscription->Sender = sender;
+  subscription->User = chat_user;
+  for (auto &shard : shards_) {
+    ChannelShard *channel_shard = shard.get();
+    std::shared_ptr<const ChannelSubscription> shard_subscription =
+      subscription;
+    channel_shard->Post([channel_shard, shard_subscription]() {
+      channel_shard->AddSubscription(shard_subscription);
+    });
+  }
+
+  completeSubscribe(client, kChannelMessageResult_Ok, pattern, sender,
+    *chat_user);
+  return true;
+}
+
+bool ChannelComponent::handleUnsubscribe(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  std::string pattern;
+  if (!buffer.ReadString(pattern)) {
+    return false;
+  }
+
+  // Get user component
+  std::shared_ptr<UserComponent> user_component;
+  if (!server_->GetComponent(kComponentType_User, user_component)) {
+    // Internal error, disconnect client
+    return false;
+  }
+
+  // Get the chat client
+  std::shared_ptr<ChatUser> chat_user;
+  if (!user_component->GetChatUser(client, chat_user)) {
+    // Internal error, disconnect client
+    return false;
+  }
+
+  // Check if the user is logged in
+  if (!chat_user->Identified) {
+    completeUnsubscribe(client, kChannelMessageResult_NotIdentified, pattern,
+      *chat_user);
+    return true;
+  }
+
+  subscriptions_mutex_.lock();
+  auto patterns = subscriptions_.find(client.Id);
+  bool is_subscribed = patterns != subscriptions_.end()
+    && patterns->second.erase(pattern) > 0;
+  if (is_subscribed && patterns->second.empty()) {
+    subscriptions_.erase(patterns);
+  }
+  subscriptions_mutex_.unlock();
+  if (!is_subscribed) {
+    completeUnsubscribe(client, kChannelMessageResult_NotSubscribed, pattern,
+      *chat_user);
+    return true;
+  }
+
+  uint64_t client_id = client.Id;
+  for (auto &shard : shards_) {
+    ChannelShard *channel_shard = shard.get();
+    channel_shard->Post([channel_shard, client_id, pattern]() {
+      channel_shard->RemoveSubscriptions(client_id, pattern);
+    });
+  }
+
+  completeUnsubscribe(client, kChannelMessageResult_Ok, pattern, *chat_user);
+  return true;
+}
+
+void ChannelComponent::completeSubscribe(RemoteChatClient &client,
+  ChannelMessageResult message_result, std::string &pattern,
+  std::string &sender, ChatUser &chat_user) {
+  if (server_->IsLocalClient(client.Id)) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(message_result);
+    send_buffer.WriteString(pattern);
+    send_buffer.WriteString(sender);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_Subscribe_Complete, send_buffer);
+  }
+
+  // Trigger events
+  OnSubscribeCompleted(message_result, pattern, sender, chat_user);
+}
+
+void ChannelComponent::completeUnsubscribe(RemoteChatClient &client,
+  ChannelMessageResult message_result, std::string &pattern,
+  ChatUser &chat_user) {
+  if (server_->IsLocalClient(client.Id)) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(message_result);
+    send_buffer.WriteString(pattern);
+    server_->Send(client, kComponentType_Channel,
+      kChannelMessageType_Unsubscribe_Complete, send_buffer);
+  }
+
+  // Trigger events
+  OnUnsubscribeCompleted(message_result, pattern, chat_user);
+}
+
+void ChannelComponent::disconnectClient(ChannelShard &shard,
+  uint64_t client_id) {
+  shard.RemoveSubscriptions(client_id, std::string());
+
+  // Notify all clients in participating channels that the client has
+  // disconnected
+  for (auto &channel : shard.GetClientChannels(client_id)) {
+    // Get the chat user
+    std::shared_ptr<ChatUser> chat_user = channel->Clients[client_id];
+
+    // Trigger the events
+    OnChannelLeft(*channel, *chat_user);
+
+    // Remove the client from the channel, if there was nobody else in the
+    // channel it is deleted. Otherwise the other clients are notified
+    // together with everybody else that left in the presence interval.
+    removeClient(shard, channel, client_id);
+    if (!channel->Clients.empty()) {
+      addPresenceChange(shard, channel, client_id, chat_user, false);
+    }
+  }
 }
 }
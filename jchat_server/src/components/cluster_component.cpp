@@ -0,0 +1,986 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#include "components/cluster_component.h"
+#include "chat_server.h"
+#include "protocol/protocol.h"
+#include "protocol/components/channel_message_result.h"
+#include "thread.hpp"
+#include <algorithm>
+
+namespace jchat {
+ClusterComponent::ClusterComponent() : server_(0), node_id_(0),
+  is_started_(false), next_claim_id_(1) {
+  dispatcher_.Register(kClusterMessageType_Hello,
+    &ClusterComponent::handleHello);
+  dispatcher_.Register(kClusterMessageType_ClaimUsername,
+    &ClusterComponent::handleClaimUsername);
+  dispatcher_.Register(kClusterMessageType_ClaimUsername_Complete,
+    &ClusterComponent::handleClaimUsernameComplete);
+  dispatcher_.Register(kClusterMessageType_UserOnline,
+    &ClusterComponent::handleUserOnline);
+  dispatcher_.Register(kClusterMessageType_UserOffline,
+    &ClusterComponent::handleUserOffline);
+  dispatcher_.Register(kClusterMessageType_ChannelRequest,
+    &ClusterComponent::handleChannelRequest);
+  dispatcher_.Register(kClusterMessageType_Relay,
+    &ClusterComponent::handleRelay);
+  dispatcher_.Register(kClusterMessageType_Heartbeat,
+    &ClusterComponent::handleHeartbeat);
+}
+
+ClusterComponent::~ClusterComponent() {
+  OnStop();
+}
+
+bool ClusterComponent::Initialize(ChatServer &server) {
+  if (node_id_ >= nodes_.size()) {
+    return false;
+  }
+  if (!server.GetComponent(kComponentType_User, user_component_)
+    || !server.GetComponent(kComponentType_Channel, channel_component_)) {
+    return false;
+  }
+  if (!server.SetNodeId(node_id_) || !server.SetClientRelay(this)) {
+    return false;
+  }
+  server_ = &server;
+  user_component_->SetUserDirectory(this);
+  channel_component_->SetChannelRouter(this);
+
+  peers_.clear();
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    std::unique_ptr<Peer> peer;
+    if (i != node_id_) {
+      peer.reset(new Peer());
+      peer->NodeId = static_cast<uint16_t>(i);
+      peer->Node = nodes_[i];
+    }
+    peers_.push_back(std::move(peer));
+  }
+  inbound_links_.assign(nodes_.size(), 0);
+
+  return true;
+}
+
+bool ClusterComponent::Shutdown() {
+  OnStop();
+  user_component_->SetUserDirectory(nullptr);
+  channel_component_->SetChannelRouter(nullptr);
+  server_->SetClientRelay(nullptr);
+  user_component_.reset();
+  channel_component_.reset();
+  peers_.clear();
+  server_ = 0;
+
+  return true;
+}
+
+bool ClusterComponent::OnStart() {
+  if (is_started_) {
+    return false;
+  }
+  for (auto &peer : peers_) {
+    if (peer) {
+      peer->IsRunning = true;
+      peer->Thread = std::thread(&ClusterComponent::linkLoop, this,
+        std::ref(*peer));
+    }
+  }
+  is_started_ = true;
+  return true;
+}
+
+bool ClusterComponent::OnStop() {
+  if (!is_started_) {
+    return false;
+  }
+  is_started_ = false;
+
+  // Closing a link also ends a send its thread may be waiting in
+  for (auto &peer : peers_) {
+    if (!peer) {
+      continue;
+    }
+    peer->Mutex.lock();
+    peer->IsRunning = false;
+    std::shared_ptr<TcpClient> link = peer->Link;
+    peer->Mutex.unlock();
+    peer->Condition.notify_one();
+    closeLink(link);
+    if (peer->Thread.joinable()) {
+      peer->Thread.join();
+    }
+    peer->Link.reset();
+    peer->Queue.clear();
+    peer->QueueSize = 0;
+  }
+
+  // Users of other nodes went away with the server's clients
+  links_mutex_.lock();
+  links_.clear();
+  inbound_links_.assign(nodes_.size(), 0);
+  links_mutex_.unlock();
+  local_users_mutex_.lock();
+  local_users_.clear();
+  local_users_mutex_.unlock();
+  remote_users_mutex_.lock();
+  remote_users_.clear();
+  remote_users_mutex_.unlock();
+  usernames_mutex_.lock();
+  usernames_.clear();
+  usernames_mutex_.unlock();
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    failClaims(static_cast<uint16_t>(i));
+  }
+
+  return true;
+}
+
+void ClusterComponent::OnClientConnected(RemoteChatClient &client) {
+
+}
+
+void ClusterComponent::OnClientDisconnected(RemoteChatClient &client) {
+  // Only the current link of a node takes its users with it, an older one
+  // may close after the node opened a new link
+  links_mutex_.lock();
+  auto link = links_.find(client.Id);
+  if (link == links_.end()) {
+    links_mutex_.unlock();
+    return;
+  }
+  uint16_t node_id = link->second;
+  links_.erase(link);
+  bool is_current = inbound_links_[node_id] == client.Id;
+  if (is_current) {
+    inbound_links_[node_id] = 0;
+  }
+  links_mutex_.unlock();
+
+  if (is_current) {
+    removeNode(node_id);
+    failClaims(node_id);
+  }
+}
+
+void ClusterComponent::OnClientResumed(RemoteChatClient &client,
+  RemoteChatClient &session) {
+  // Links never identify, and other nodes know users by their id, which the
+  // client takes over
+}
+
+ComponentType ClusterComponent::GetType() {
+  return kComponentType_Cluster;
+}
+
+bool ClusterComponent::Handle(RemoteChatClient &client,
+  uint16_t message_type, TypedBufferView &buffer) {
+  return dispatcher_.Dispatch(this, message_type, client, buffer);
+}
+
+size_t ClusterComponent::Relay(const std::vector<uint64_t> &client_ids,
+  ComponentType component_type, uint8_t message_type, TypedBuffer &buffer,
+  uint32_t request_id) {
+  // Group the clients by their node, every node gets one copy of the message
+  std::vector<std::vector<uint64_t>> node_clients(nodes_.size());
+  for (uint64_t client_id : client_ids) {
+    uint64_t node_id = client_id >> JCHAT_CHAT_NODE_ID_SHIFT;
+    if (node_id < nodes_.size() && node_id != node_id_) {
+      node_clients[(size_t)node_id].push_back(client_id);
+    }
+  }
+
+  std::basic_string<uint8_t> body(buffer.GetBuffer(), buffer.GetSize());
+  size_t relayed_count = 0;
+  for (size_t node_id = 0; node_id < node_clients.size(); node_id++) {
+    std::vector<uint64_t> &clients = node_clients[node_id];
+    for (size_t offset = 0; offset < clients.size();
+      offset += JCHAT_CLUSTER_RELAY_MAX_CLIENTS) {
+      size_t count = std::min<size_t>(clients.size() - offset,
+        JCHAT_CLUSTER_RELAY_MAX_CLIENTS);
+
+      TypedBuffer relay_buffer = server_->CreateBuffer();
+      relay_buffer.WriteUInt8(component_type);
+      relay_buffer.WriteUInt16(message_type);
+      relay_buffer.WriteBlob(body);
+      relay_buffer.WriteUInt32(static_cast<uint32_t>(count));
+      for (size_t i = offset; i < offset + count; i++) {
+        relay_buffer.WriteUInt64(clients[i]);
+      }
+      // Only replies to a request of the client carry its id
+      if (request_id != 0) {
+        relay_buffer.WriteUInt32(request_id);
+      }
+      if (send(static_cast<uint16_t>(node_id), kClusterMessageType_Relay,
+        relay_buffer)) {
+        relayed_count += count;
+      }
+    }
+  }
+  return relayed_count;
+}
+
+void ClusterComponent::Claim(uint64_t client_id, const std::string &username,
+  std::function<void(UserMessageResult)> on_claimed) {
+  uint16_t owner = getOwner(username.data(), username.size());
+  if (owner == node_id_) {
+    on_claimed(claimUsername(client_id, username));
+    return;
+  }
+
+  pending_claims_mutex_.lock();
+  uint64_t claim_id = next_claim_id_++;
+  PendingClaim &pending_claim = pending_claims_[claim_id];
+  pending_claim.NodeId = owner;
+  pending_claim.OnClaimed = on_claimed;
+  pending_claims_mutex_.unlock();
+
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt64(claim_id);
+  send_buffer.WriteUInt64(client_id);
+  send_buffer.WriteString(username);
+  if (send(owner, kClusterMessageType_ClaimUsername, send_buffer)) {
+    return;
+  }
+
+  // Nobody can tell whether the username is free while its owner is away,
+  // unless the link already failed the claim
+  pending_claims_mutex_.lock();
+  auto claim = pending_claims_.find(claim_id);
+  if (claim == pending_claims_.end()) {
+    pending_claims_mutex_.unlock();
+    return;
+  }
+  pending_claims_.erase(claim);
+  pending_claims_mutex_.unlock();
+  on_claimed(kUserMessageResult_Fail);
+}
+
+void ClusterComponent::Add(uint64_t client_id, ChatUser &user) {
+  LocalUser local_user;
+  local_user.Interned = user.Interned;
+  local_user.PresenceChanges = user.PresenceChanges;
+  local_users_mutex_.lock();
+  local_users_[client_id] = local_user;
+  local_users_mutex_.unlock();
+
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  writeUserOnline(send_buffer, client_id, *user.Interned,
+    user.PresenceChanges);
+  sendToAll(kClusterMessageType_UserOnline, send_buffer);
+}
+
+void ClusterComponent::Remove(uint64_t client_id,
+  const std::string &username) {
+  local_users_mutex_.lock();
+  local_users_.erase(client_id);
+  local_users_mutex_.unlock();
+
+  // The owner of the username releases it when it hears about this as well
+  if (getOwner(username.data(), username.size()) == node_id_) {
+    releaseUsername(client_id, username);
+  }
+
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt64(client_id);
+  send_buffer.WriteString(username);
+  sendToAll(kClusterMessageType_UserOffline, send_buffer);
+}
+
+bool ClusterComponent::Forward(RemoteChatClient &client,
+  uint16_t message_type, StringView &channel_name, TypedBufferView &buffer) {
+  // Requests of users from other nodes were forwarded here by them. Unknown
+  // message types drop the client like they always do.
+  if (!server_->IsLocalClient(client.Id)
+    || message_type >= kChannelMessageType_Max) {
+    return false;
+  }
+  // Subscriptions match channels of every node, so they are handled here and
+  // by every node that is linked when they are made
+  bool is_subscription = message_type == kChannelMessageType_Subscribe
+    || message_type == kChannelMessageType_Unsubscribe;
+  uint16_t owner = node_id_;
+  if (!is_subscription) {
+    owner = getOwner(channel_name.GetData(), channel_name.GetSize());
+    if (owner == node_id_) {
+      return false;
+    }
+  }
+
+  // Clients that didn't identify are only known to this server, which turns
+  // them away
+  std::shared_ptr<ChatUser> chat_user;
+  if (!user_component_->GetChatUser(client, chat_user)
+    || !chat_user->Identified) {
+    return false;
+  }
+
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt64(client.Id);
+  send_buffer.WriteUInt16(message_type);
+  send_buffer.WriteUInt8(client.ReceiveFormat);
+  send_buffer.WriteBlob(std::basic_string<uint8_t>(buffer.GetBuffer(),
+    buffer.GetSize()));
+  if (is_subscription) {
+    sendToAll(kClusterMessageType_ChannelRequest, send_buffer);
+    return false;
+  }
+  // The owner replies with the id of the request, if it has one
+  uint32_t request_id = RequestContext::GetRequestId(client.Id);
+  if (request_id != 0) {
+    send_buffer.WriteUInt32(request_id);
+  }
+  if (!send(owner, kClusterMessageType_ChannelRequest, send_buffer)) {
+    replyUnavailable(client, message_type, buffer);
+  }
+  return true;
+}
+
+bool ClusterComponent::SetNodes(uint16_t node_id,
+  const std::vector<ClusterNode> &nodes) {
+  if (server_ != 0 || node_id >= nodes.size()
+    || nodes.size() > (1 << (64 - JCHAT_CHAT_NODE_ID_SHIFT))) {
+    return false;
+  }
+  node_id_ = node_id;
+  nodes_ = nodes;
+  return true;
+}
+
+uint16_t ClusterComponent::GetNodeId() {
+  return node_id_;
+}
+
+void ClusterComponent::SetKey(const std::string &key) {
+  key_ = key;
+}
+
+bool ClusterComponent::handleHello(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  std::string key;
+  if (!buffer.ReadString(key)) {
+    return false;
+  }
+
+  uint16_t node_id = 0;
+  if (!buffer.ReadUInt16(node_id)) {
+    return false;
+  }
+
+  // Drop anybody who doesn't know the key, and links of nodes that can't be
+  // in this cluster
+  if (key != key_ || node_id >= nodes_.size() || node_id == node_id_) {
+    return false;
+  }
+
+  links_mutex_.lock();
+  if (links_.find(client.Id) != links_.end()) {
+    links_mutex_.unlock();
+    return false;
+  }
+  links_[client.Id] = node_id;
+  inbound_links_[node_id] = client.Id;
+  links_mutex_.unlock();
+
+  client.IsHandshakeCompleted = true;
+
+  // The node sends all of its users over the new link, it may have lost
+  // some while it was away
+  removeNode(node_id);
+
+  return true;
+}
+
+bool ClusterComponent::handleClaimUsername(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  uint16_t node_id = 0;
+  if (!getLinkNode(client, node_id)) {
+    return false;
+  }
+
+  uint64_t claim_id = 0;
+  if (!buffer.ReadUInt64(claim_id)) {
+    return false;
+  }
+
+  uint64_t client_id = 0;
+  if (!buffer.ReadUInt64(client_id)) {
+    return false;
+  }
+
+  std::string username;
+  if (!buffer.ReadString(username)) {
+    return false;
+  }
+
+  // Claims for clients of another node or for usernames this node doesn't
+  // own come from a node with a different list of nodes
+  UserMessageResult result = kUserMessageResult_Fail;
+  if ((client_id >> JCHAT_CHAT_NODE_ID_SHIFT) == node_id
+    && getOwner(username.data(), username.size()) == node_id_) {
+    result = claimUsername(client_id, username);
+  }
+
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt64(claim_id);
+  send_buffer.WriteUInt16(result);
+  send(node_id, kClusterMessageType_ClaimUsername_Complete, send_buffer);
+
+  return true;
+}
+
+bool ClusterComponent::handleClaimUsernameComplete(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  uint16_t node_id = 0;
+  if (!getLinkNode(client, node_id)) {
+    return false;
+  }
+
+  uint64_t claim_id = 0;
+  if (!buffer.ReadUInt64(claim_id)) {
+    return false;
+  }
+
+  uint16_t result = 0;
+  if (!buffer.ReadUInt16(result) || result >= kUserMessageResult_Max) {
+    return false;
+  }
+
+  pending_claims_mutex_.lock();
+  auto claim = pending_claims_.find(claim_id);
+  if (claim == pending_claims_.end() || claim->second.NodeId != node_id) {
+    pending_claims_mutex_.unlock();
+    return true;
+  }
+  std::function<void(UserMessageResult)> on_claimed =
+    claim->second.OnClaimed;
+  pending_claims_.erase(claim);
+  pending_claims_mutex_.unlock();
+
+  on_claimed(static_cast<UserMessageResult>(result));
+
+  return true;
+}
+
+bool ClusterComponent::handleUserOnline(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  uint16_t node_id = 0;
+  if (!getLinkNode(client, node_id)) {
+    return false;
+  }
+
+  uint64_t client_id = 0;
+  if (!buffer.ReadUInt64(client_id)) {
+    return false;
+  }
+
+  std::string username;
+  if (!buffer.ReadString(username)) {
+    return false;
+  }
+
+  std::string hostname;
+  if (!buffer.ReadString(hostname)) {
+    return false;
+  }
+
+  bool is_presence_changes = false;
+  buffer.ReadBoolean(is_presence_changes);
+
+  if ((client_id >> JCHAT_CHAT_NODE_ID_SHIFT) != node_id) {
+    return true;
+  }
+
+  // A restarted owner learns who holds its usernames from the nodes that
+  // link to it again
+  if (getOwner(username.data(), username.size()) == node_id_) {
+    claimUsername(client_id, username);
+  }
+  addRemoteUser(client_id, username, hostname, is_presence_changes);
+
+  return true;
+}
+
+bool ClusterComponent::handleUserOffline(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  uint16_t node_id = 0;
+  if (!getLinkNode(client, node_id)) {
+    return false;
+  }
+
+  uint64_t client_id = 0;
+  if (!buffer.ReadUInt64(client_id)) {
+    return false;
+  }
+
+  std::string username;
+  if (!buffer.ReadString(username)) {
+    return false;
+  }
+
+  if ((client_id >> JCHAT_CHAT_NODE_ID_SHIFT) != node_id) {
+    return true;
+  }
+
+  if (getOwner(username.data(), username.size()) == node_id_) {
+    releaseUsername(client_id, username);
+  }
+  removeRemoteUser(client_id);
+
+  return true;
+}
+
+bool ClusterComponent::handleChannelRequest(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  uint16_t node_id = 0;
+  if (!getLinkNode(client, node_id)) {
+    return false;
+  }
+
+  uint64_t client_id = 0;
+  if (!buffer.ReadUInt64(client_id)) {
+    return false;
+  }
+
+  uint16_t message_type = 0;
+  if (!buffer.ReadUInt16(message_type)) {
+    return false;
+  }
+
+  uint8_t format = 0;
+  if (!buffer.ReadUInt8(format) || format > kWireFormat_Compact) {
+    return false;
+  }
+
+  std::basic_string<uint8_t> body;
+  if (!buffer.ReadBlob(body)) {
+    return false;
+  }
+
+  uint32_t request_id = 0;
+  buffer.ReadUInt32(request_id);
+
+  // The user may have gone offline since it sent the request
+  remote_users_mutex_.lock();
+  auto remote_user = remote_users_.find(client_id);
+  if (remote_user == remote_users_.end()
+    || (client_id >> JCHAT_CHAT_NODE_ID_SHIFT) != node_id) {
+    remote_users_mutex_.unlock();
+    return true;
+  }
+  std::shared_ptr<RemoteUser> user = remote_user->second;
+  remote_users_mutex_.unlock();
+
+  // The body is still in the format of the client's own connection. A
+  // malformed request already passed the client's server, so it doesn't
+  // drop the link.
+  user->Client.ReceiveFormat = static_cast<WireFormat>(format);
+  TypedBufferView request(body.data(), body.size(),
+    buffer.IsFlippingEndian(), user->Client.ReceiveFormat);
+  RequestContext previous = RequestContext::SetCurrent(
+    RequestContext(client_id, request_id));
+  channel_component_->Handle(user->Client, message_type, request);
+  RequestContext::SetCurrent(previous);
+
+  return true;
+}
+
+bool ClusterComponent::handleRelay(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  uint16_t node_id = 0;
+  if (!getLinkNode(client, node_id)) {
+    return false;
+  }
+
+  uint8_t component_type = 0;
+  if (!buffer.ReadUInt8(component_type)
+    || component_type >= kComponentType_Max
+    || component_type == kComponentType_Cluster) {
+    return false;
+  }
+
+  uint16_t message_type = 0;
+  if (!buffer.ReadUInt16(message_type)) {
+    return false;
+  }
+
+  std::basic_string<uint8_t> body;
+  if (!buffer.ReadBlob(body)) {
+    return false;
+  }
+
+  uint32_t count = 0;
+  if (!buffer.ReadUInt32(count) || count > JCHAT_CLUSTER_RELAY_MAX_CLIENTS) {
+    return false;
+  }
+
+  // Only clients of this server, anything else would be relayed again
+  std::vector<uint64_t> client_ids;
+  client_ids.reserve(count);
+  for (uint32_t i = 0; i < count; i++) {
+    uint64_t client_id = 0;
+    if (!buffer.ReadUInt64(client_id)) {
+      return false;
+    }
+    if (server_->IsLocalClient(client_id)) {
+      client_ids.push_back(client_id);
+    }
+  }
+
+  // Replies to a request of the client may follow with the request's id
+  uint32_t request_id = 0;
+  buffer.ReadUInt32(request_id);
+
+  TypedBuffer message(body.data(), body.size(), buffer.IsFlippingEndian());
+  if (client_ids.size() == 1) {
+    RequestContext previous = RequestContext::SetCurrent(
+      RequestContext(client_ids[0], request_id));
+    server_->Send(client_ids[0], static_cast<ComponentType>(component_type),
+      static_cast<uint8_t>(message_type), message);
+    RequestContext::SetCurrent(previous);
+  } else {
+    server_->Broadcast(client_ids, static_cast<ComponentType>(component_type),
+      static_cast<uint8_t>(message_type), message);
+  }
+
+  return true;
+}
+
+uint16_t ClusterComponent::getOwner(const char *name, size_t size) {
+  // FNV-1a, every node has to pick the same owner whatever it was built with
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ static_cast<uint8_t>(name[i])) * 16777619u;
+  }
+  return static_cast<uint16_t>(hash % nodes_.size());
+}
+
+bool ClusterComponent::handleHeartbeat(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  uint16_t node_id = 0;
+  return getLinkNode(client, node_id);
+}
+
+bool ClusterComponent::getLinkNode(RemoteChatClient &client,
+  uint16_t &out_node_id) {
+  links_mutex_.lock();
+  auto link = links_.find(client.Id);
+  if (link == links_.end()) {
+    links_mutex_.unlock();
+    return false;
+  }
+  out_node_id = link->second;
+  links_mutex_.unlock();
+  return true;
+}
+
+bool ClusterComponent::send(uint16_t node_id,
+  ClusterMessageType message_type, TypedBuffer &buffer) {
+  if (node_id >= peers_.size() || !peers_[node_id]) {
+    return false;
+  }
+  Peer &peer = *peers_[node_id];
+  std::shared_ptr<Buffer> frame = createFrame(message_type, buffer);
+  peer.Mutex.lock();
+  if (!peer.IsLinked) {
+    peer.Mutex.unlock();
+    return false;
+  }
+
+  // A node that falls this far behind is dropped, it gets every user again
+  // once it is linked anew
+  if (peer.QueueSize + frame->GetSize() > JCHAT_CLUSTER_MAX_QUEUE_SIZE) {
+    std::shared_ptr<TcpClient> link = peer.Link;
+    peer.Mutex.unlock();
+    closeLink(link);
+    return false;
+  }
+  peer.QueueSize += frame->GetSize();
+  peer.Queue.push_back(frame);
+  bool was_empty = peer.Queue.size() == 1;
+  peer.Mutex.unlock();
+  if (was_empty) {
+    peer.Condition.notify_one();
+  }
+  return true;
+}
+
+std::shared_ptr<Buffer> ClusterComponent::createFrame(
+  ClusterMessageType message_type, TypedBuffer &buffer) {
+  std::shared_ptr<Buffer> frame = std::make_shared<Buffer>(
+    buffer.IsFlippingEndian());
+  frame->Reserve(sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint32_t)
+    + buffer.GetSize());
+  frame->Write<uint8_t>(kComponentType_Cluster);
+  frame->Write<uint16_t>(message_type);
+  frame->Write<uint32_t>(buffer.GetSize());
+  frame->WriteArray(buffer.GetBuffer(), buffer.GetSize());
+  return frame;
+}
+
+void ClusterComponent::sendToAll(ClusterMessageType message_type,
+  TypedBuffer &buffer) {
+  for (size_t node_id = 0; node_id < peers_.size(); node_id++) {
+    send(static_cast<uint16_t>(node_id), message_type, buffer);
+  }
+}
+
+void ClusterComponent::writeUserOnline(TypedBuffer &buffer,
+  uint64_t client_id, const ChatIdentity &identity, bool presence_changes) {
+  buffer.WriteUInt64(client_id);
+  identity.WriteName(buffer);
+  buffer.WriteBoolean(presence_changes);
+}
+
+void ClusterComponent::linkLoop(Peer &peer) {
+  Thread::SetName("jchat-link-" + std::to_string(peer.NodeId));
+  std::unique_lock<std::mutex> lock(peer.Mutex);
+  while (peer.IsRunning) {
+    if (!peer.IsLinked) {
+      lock.unlock();
+      bool is_linked = openLink(peer);
+      lock.lock();
+      if (!is_linked && peer.IsRunning) {
+        peer.Condition.wait_for(lock,
+          std::chrono::milliseconds(JCHAT_CLUSTER_RECONNECT_INTERVAL));
+      }
+      continue;
+    }
+    if (peer.Queue.empty()) {
+      if (peer.Condition.wait_for(lock, std::chrono::milliseconds(
+        JCHAT_CLUSTER_HEARTBEAT_INTERVAL)) == std::cv_status::timeout
+        && peer.IsLinked && peer.Queue.empty()) {
+        TypedBuffer heartbeat_buffer = server_->CreateBuffer();
+        peer.Queue.push_back(createFrame(kClusterMessageType_Heartbeat,
+          heartbeat_buffer));
+      }
+      continue;
+    }
+
+    // Write everything that is queued at once, sends keep queueing while
+    // this waits for the socket
+    std::deque<std::shared_ptr<Buffer>> frames;
+    frames.swap(peer.Queue);
+    peer.QueueSize = 0;
+    std::shared_ptr<TcpClient> link = peer.Link;
+    lock.unlock();
+    bool result = true;
+    for (size_t i = 0; result && i < frames.size(); i++) {
+      result = link->Send(*frames[i]);
+    }
+    if (!result) {
+      closeLink(link);
+    }
+    lock.lock();
+  }
+}
+
+bool ClusterComponent::openLink(Peer &peer) {
+  std::shared_ptr<TcpClient> link = std::make_shared<TcpClient>(
+    peer.Node.Hostname.c_str(), peer.Node.Port);
+  TcpClient *link_pointer = link.get();
+  Peer *peer_pointer = &peer;
+  link->OnDataReceived.Add([](StreamBuffer &stream) {
+    // The node answers over a link of its own
+    return stream.Skip(stream.GetSize());
+  });
+  link->OnDisconnected.Add([this, peer_pointer, link_pointer]() {
+    onLinkClosed(*peer_pointer, link_pointer);
+    return true;
+  });
+  if (!link->Connect()) {
+    return false;
+  }
+
+  TypedBuffer hello_buffer = server_->CreateBuffer();
+  hello_buffer.WriteString(key_);
+  hello_buffer.WriteUInt16(node_id_);
+
+  // The Hello and every user go first. Users that identify meanwhile are
+  // queued behind them, or were in the list already, which the node
+  // doesn't mind.
+  peer.Mutex.lock();
+  std::shared_ptr<TcpClient> old_link = peer.Link;
+  peer.Link = link;
+  peer.Queue.clear();
+  peer.QueueSize = 0;
+  peer.Queue.push_back(createFrame(kClusterMessageType_Hello, hello_buffer));
+  local_users_mutex_.lock();
+  for (auto &user : local_users_) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    writeUserOnline(send_buffer, user.first, *user.second.Interned,
+      user.second.PresenceChanges);
+    peer.Queue.push_back(createFrame(kClusterMessageType_UserOnline,
+      send_buffer));
+  }
+  local_users_mutex_.unlock();
+  peer.IsLinked = peer.IsRunning;
+  bool is_linked = peer.IsLinked;
+  peer.Mutex.unlock();
+
+  closeLink(old_link);
+  if (!is_linked) {
+    closeLink(link);
+    return false;
+  }
+  server_->GetLogger().Write(kLogLevel_Info, "cluster",
+    "Linked to node %u at %s:%u", peer.NodeId, peer.Node.Hostname.c_str(),
+    peer.Node.Port);
+  return true;
+}
+
+void ClusterComponent::closeLink(std::shared_ptr<TcpClient> &link) {
+  // Raises OnDisconnected if the link was still open, so it must not be
+  // called with the mutex of the peer held
+  if (link) {
+    link->Disconnect();
+  }
+}
+
+void ClusterComponent::onLinkClosed(Peer &peer, TcpClient *link) {
+  peer.Mutex.lock();
+  bool was_linked = peer.Link.get() == link && peer.IsLinked;
+  if (peer.Link.get() == link) {
+    peer.IsLinked = false;
+    peer.Queue.clear();
+    peer.QueueSize = 0;
+  }
+  peer.Mutex.unlock();
+  if (was_linked) {
+    server_->GetLogger().Write(kLogLevel_Warning, "cluster",
+      "Lost the link to node %u", peer.NodeId);
+  }
+  peer.Condition.notify_one();
+
+  // Answers to claims sent over the link may never come
+  failClaims(peer.NodeId);
+}
+
+UserMessageResult ClusterComponent::claimUsername(uint64_t client_id,
+  const std::string &username) {
+  usernames_mutex_.lock();
+  auto holder = usernames_.find(username);
+  if (holder != usernames_.end() && holder->second != client_id) {
+    usernames_mutex_.unlock();
+    return kUserMessageResult_UsernameInUse;
+  }
+  usernames_[username] = client_id;
+  usernames_mutex_.unlock();
+  return kUserMessageResult_Ok;
+}
+
+void ClusterComponent::releaseUsername(uint64_t client_id,
+  const std::string &username) {
+  usernames_mutex_.lock();
+  auto holder = usernames_.find(username);
+  if (holder != usernames_.end() && holder->second == client_id) {
+    usernames_.erase(holder);
+  }
+  usernames_mutex_.unlock();
+}
+
+void ClusterComponent::failClaims(uint16_t node_id) {
+  std::vector<std::function<void(UserMessageResult)>> failed_claims;
+  pending_claims_mutex_.lock();
+  for (auto claim = pending_claims_.begin();
+    claim != pending_claims_.end();) {
+    if (claim->second.NodeId == node_id) {
+      failed_claims.push_back(claim->second.OnClaimed);
+      claim = pending_claims_.erase(claim);
+    } else {
+      ++claim;
+    }
+  }
+  pending_claims_mutex_.unlock();
+
+  for (auto &on_claimed : failed_claims) {
+    on_claimed(kUserMessageResult_Fail);
+  }
+}
+
+void ClusterComponent::addRemoteUser(uint64_t client_id,
+  const std::string &username, const std::string &hostname,
+  bool is_presence_changes) {
+  remote_users_mutex_.lock();
+  if (remote_users_.find(client_id) != remote_users_.end()) {
+    remote_users_mutex_.unlock();
+    return;
+  }
+  std::shared_ptr<RemoteUser> user = std::make_shared<RemoteUser>();
+  user->Client.Id = client_id;
+  user->User = std::make_shared<ChatUser>();
+  user->User->Enabled = true;
+  server_->SetIdentity(*user->User, username, hostname);
+  user->User->PresenceChanges = is_presence_changes;
+  user->User->Identified = true;
+  remote_users_[client_id] = user;
+  remote_users_mutex_.unlock();
+
+  user_component_->AddRemoteUser(user->Client, user->User);
+}
+
+void ClusterComponent::removeRemoteUser(uint64_t client_id) {
+  remote_users_mutex_.lock();
+  auto remote_user = remote_users_.find(client_id);
+  if (remote_user == remote_users_.end()) {
+    remote_users_mutex_.unlock();
+    return;
+  }
+  std::shared_ptr<RemoteUser> user = remote_user->second;
+  remote_users_.erase(remote_user);
+  remote_users_mutex_.unlock();
+
+  user_component_->RemoveRemoteUser(user->Client);
+  channel_component_->RemoveClient(client_id);
+}
+
+void ClusterComponent::removeNode(uint16_t node_id) {
+  std::vector<uint64_t> client_ids;
+  remote_users_mutex_.lock();
+  for (auto &remote_user : remote_users_) {
+    if ((remote_user.first >> JCHAT_CHAT_NODE_ID_SHIFT) == node_id) {
+      client_ids.push_back(remote_user.first);
+    }
+  }
+  remote_users_mutex_.unlock();
+  for (uint64_t client_id : client_ids) {
+    removeRemoteUser(client_id);
+  }
+
+  usernames_mutex_.lock();
+  for (auto holder = usernames_.begin(); holder != usernames_.end();) {
+    if ((holder->second >> JCHAT_CHAT_NODE_ID_SHIFT) == node_id) {
+      holder = usernames_.erase(holder);
+    } else {
+      ++holder;
+    }
+  }
+  usernames_mutex_.unlock();
+}
+
+void ClusterComponent::replyUnavailable(RemoteChatClient &client,
+  uint16_t message_type, TypedBufferView &buffer) {
+  // Every reply starts like its request, with the channel name and the
+  // user or message the request was about if it has one
+  TypedBufferView request = buffer;
+  std::string channel_name;
+  std::string argument;
+  request.ReadString(channel_name);
+  bool has_argument = request.ReadString(argument);
+
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt16(kChannelMessageResult_Fail);
+  send_buffer.WriteString(channel_name);
+  if (has_argument) {
+    send_buffer.WriteString(argument);
+  }
+  server_->Send(client, kComponentType_Channel,
+    static_cast<uint8_t>(message_type + 1), send_buffer);
+}
+}
@@ -10,10 +10,20 @@
 #include "components/user_component.h"
 #include "chat_server.h"
 #include "protocol/protocol.h"
+#include "protocol/compression_type.h"
 #include "protocol/components/system_message_type.h"
 
 namespace jchat {
-SystemComponent::SystemComponent() {
+SystemComponent::SystemComponent() : server_(0),
+  is_compression_enabled_(true) {
+  dispatcher_.Register(kSystemMessageType_Hello,
+    &SystemComponent::handleHello);
+  dispatcher_.Register(kSystemMessageType_GetStats,
+    &SystemComponent::handleGetStats);
+  dispatcher_.Register(kSystemMessageType_Ping,
+    &SystemComponent::handlePing);
+  dispatcher_.Register(kSystemMessageType_Pong,
+    &SystemComponent::handlePong);
 }
 
 SystemComponent::~SystemComponent() {
@@ -45,48 +55,218 @@ void SystemComponent::OnClientDisconnected(RemoteChatClient &client) {
 
 }
 
+void SystemComponent::OnClientResumed(RemoteChatClient &client,
+  RemoteChatClient &session) {
+
+}
+
 ComponentType SystemComponent::GetType() {
   return kComponentType_System;
 }
 
 bool SystemComponent::Handle(RemoteChatClient &client, uint16_t message_type,
-  TypedBuffer &buffer) {
-  if (message_type == kSystemMessageType_Hello) {
-    std::string protocol_version;
-    if (!buffer.ReadString(protocol_version)
-      || protocol_version != JCHAT_CHAT_PROTOCOL_VERSION) {
-      return false;
-    }
+  TypedBufferView &buffer) {
+  return dispatcher_.Dispatch(this, message_type, client, buffer);
+}
 
-    if (!OnHelloCompleted(client)) {
-      return false;
-    }
+bool SystemComponent::handleHello(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  StringView protocol_version;
+  if (!buffer.ReadString(protocol_version)) {
+    return false;
+  }
 
-    // Get user component
-    std::shared_ptr<UserComponent> user_component;
-    if (!server_->GetComponent(kComponentType_User, user_component)) {
-      // Internal error, disconnect client
-      return false;
-    }
+  // The Hello is always tagged, the rest of the conversation uses the format
+  // of the protocol version the client asked for
+  WireFormat format;
+  if (protocol_version == JCHAT_CHAT_PROTOCOL_VERSION) {
+    format = kWireFormat_Compact;
+  } else if (protocol_version == JCHAT_CHAT_LEGACY_PROTOCOL_VERSION) {
+    format = kWireFormat_Tagged;
+  } else {
+    return false;
+  }
+  client.ReceiveFormat = format;
 
-    // Get the chat client
-    std::shared_ptr<ChatUser> chat_user;
-    if (!user_component->GetChatUser(client, chat_user)) {
-      // Internal error, disconnect client
-      return false;
+  // Older clients don't ask for compression at all
+  uint8_t compression_type = kCompressionType_None;
+  buffer.ReadUInt8(compression_type);
+  std::shared_ptr<ConnectionCompression> compression;
+  if (compression_type == kCompressionType_Deflate
+    && is_compression_enabled_) {
+    compression = std::make_shared<ConnectionCompression>();
+    if (!compression->Stream.Initialize()) {
+      compression.reset();
     }
+  }
+
+  // Nor for batching, which follows the compression type
+  bool is_batching = false;
+  buffer.ReadBoolean(is_batching);
+  is_batching = is_batching && server_->GetBatchWindow().count() > 0;
+
+  // And then whether joins and leaves may be sent as PresenceChanged
+  bool is_presence_changes = false;
+  buffer.ReadBoolean(is_presence_changes);
+
+  // Then whether the client answers pings
+  bool is_heartbeat = false;
+  buffer.ReadBoolean(is_heartbeat);
+
+  // Whether its frames may carry request ids
+  bool is_request_id = false;
+  buffer.ReadBoolean(is_request_id);
+
+  // Whether it wants a session to resume once it identified
+  bool is_resume = false;
+  buffer.ReadBoolean(is_resume);
+  is_resume = is_resume && server_->GetResumeGracePeriod().count() > 0;
+
+  // And last whether it understands Throttled
+  bool is_throttle = false;
+  buffer.ReadBoolean(is_throttle);
+
+  if (!OnHelloCompleted(client)) {
+    return false;
+  }
+
+  // Get user component
+  std::shared_ptr<UserComponent> user_component;
+  if (!server_->GetComponent(kComponentType_User, user_component)) {
+    // Internal error, disconnect client
+    return false;
+  }
+
+  // Get the chat client
+  std::shared_ptr<ChatUser> chat_user;
+  if (!user_component->GetChatUser(client, chat_user)) {
+    // Internal error, disconnect client
+    return false;
+  }
+
+  // Set as enabled
+  chat_user->PresenceChanges = is_presence_changes;
+  chat_user->Enabled = true;
+
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt16(kSystemMessageResult_Ok);
+  send_buffer.WriteUInt8(compression ? kCompressionType_Deflate
+    : kCompressionType_None);
+  send_buffer.WriteBoolean(is_batching);
+  send_buffer.WriteBoolean(is_presence_changes);
+  send_buffer.WriteBoolean(is_heartbeat);
+  send_buffer.WriteBoolean(is_request_id);
+  send_buffer.WriteBoolean(is_resume);
+  send_buffer.WriteBoolean(is_throttle);
+  server_->Send(client, kComponentType_System,
+    kSystemMessageType_Hello_Complete, send_buffer);
+  client.IsHeartbeatEnabled = is_heartbeat;
+  client.IsRequestIdEnabled = is_request_id;
+  client.IsResumeEnabled = is_resume;
+  client.IsThrottleEnabled = is_throttle;
+  client.IsHandshakeCompleted = true;
+  client.SendFormat = format;
+  std::atomic_store(&client.Compression, compression);
+  if (is_batching) {
+    std::atomic_store(&client.Batch,
+      std::make_shared<ConnectionBatch>(client.Id));
+  }
+
+	return true;
+}
+
+bool SystemComponent::handlePing(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  uint64_t ping_id = 0;
+  if (!buffer.ReadUInt64(ping_id)) {
+    return false;
+  }
 
-    // Set as enabled
-    chat_user->Enabled = true;
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt64(ping_id);
+  server_->Send(client, kComponentType_System, kSystemMessageType_Pong,
+    send_buffer);
+
+  return true;
+}
 
+bool SystemComponent::handlePong(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  // Receiving it was all the idle timer needed
+  uint64_t ping_id = 0;
+  return buffer.ReadUInt64(ping_id);
+}
+
+bool SystemComponent::handleGetStats(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  std::string stats_key;
+  if (!buffer.ReadString(stats_key)) {
+    return false;
+  }
+
+  if (stats_key_.empty() || stats_key != stats_key_) {
     TypedBuffer send_buffer = server_->CreateBuffer();
-    send_buffer.WriteUInt16(kSystemMessageResult_Ok);
+    send_buffer.WriteUInt16(kSystemMessageResult_NotPermitted);
     server_->Send(client, kComponentType_System,
-      kSystemMessageType_Hello_Complete, send_buffer);
+      kSystemMessageType_GetStats_Complete, send_buffer);
 
-	return true;
+    return true;
+  }
+
+  // The metrics are only summed up here, recording them costs nothing more
+  // while nobody asks for them
+  MetricsRegistry &metrics = server_->GetMetrics();
+  std::vector<std::pair<std::string, uint64_t>> counters;
+  for (size_t i = 0; i < kServerCounter_Max; i++) {
+    counters.push_back(std::make_pair(GetServerCounterName(i),
+      metrics.GetCounter(i)));
+  }
+  for (uint8_t component_type = 0; component_type < kComponentType_Max;
+    component_type++) {
+    for (uint16_t message_type = 0;
+      message_type < JCHAT_METRICS_MESSAGE_TYPES; message_type++) {
+      uint64_t frames = metrics.GetCounter(GetFrameCounter(component_type,
+        message_type));
+      if (frames != 0) {
+        counters.push_back(std::make_pair(std::string("frames_received.")
+          + GetComponentName(component_type) + "."
+          + std::to_string(message_type), frames));
+      }
+    }
   }
 
-  return false;
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt16(kSystemMessageResult_Ok);
+  send_buffer.WriteUInt64(counters.size());
+  for (auto &counter : counters) {
+    send_buffer.WriteString(counter.first);
+    send_buffer.WriteUInt64(counter.second);
+  }
+  send_buffer.WriteUInt64(kServerHistogram_Max);
+  for (size_t i = 0; i < kServerHistogram_Max; i++) {
+    HistogramSnapshot histogram = metrics.GetHistogram(i);
+    send_buffer.WriteString(GetServerHistogramName(i));
+    send_buffer.WriteUInt64(histogram.Count);
+    send_buffer.WriteUInt64(histogram.Sum);
+    send_buffer.WriteUInt64(histogram.GetPercentile(0.5));
+    send_buffer.WriteUInt64(histogram.GetPercentile(0.99));
+    send_buffer.WriteUInt64(histogram.Max);
+  }
+  server_->Send(client, kComponentType_System,
+    kSystemMessageType_GetStats_Complete, send_buffer);
+
+  return true;
+}
+
+void SystemComponent::SetCompressionEnabled(bool is_compression_enabled) {
+  is_compression_enabled_ = is_compression_enabled;
+}
+
+bool SystemComponent::IsCompressionEnabled() {
+  return is_compression_enabled_;
+}
+
+void SystemComponent::SetStatsKey(const std::string &stats_key) {
+  stats_key_ = stats_key;
 }
 }
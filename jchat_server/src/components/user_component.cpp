@@ -12,15 +12,27 @@
 #include "protocol/components/user_message_type.h"
 #include "utility.hpp"
 #include "string.hpp"
+#include "utf8.hpp"
 
 namespace jchat {
-UserComponent::UserComponent() {
+UserComponent::UserComponent()
+  : user_pool_(std::make_shared<ObjectPool<ChatUser>>()),
+  user_directory_(nullptr), hostname_key_(Utility::GetProcessKey()) {
+  dispatcher_.Register(kUserMessageType_Identify,
+    &UserComponent::handleIdentify);
+  dispatcher_.Register(kUserMessageType_SendMessage,
+    &UserComponent::handleSendMessage);
+  dispatcher_.Register(kUserMessageType_Resume,
+    &UserComponent::handleResume);
 }
 
 UserComponent::~UserComponent() {
   if (!users_.empty()) {
     users_.clear();
   }
+  if (!usernames_.empty()) {
+    usernames_.clear();
+  }
 }
 
 bool UserComponent::Initialize(ChatServer &server) {
@@ -38,6 +50,13 @@ bool UserComponent::Shutdown() {
   }
   users_mutex_.unlock();
 
+  usernames_mutex_.lock();
+  if (!usernames_.empty()) {
+    usernames_.clear();
+  }
+  claims_.clear();
+  usernames_mutex_.unlock();
+
   return true;
 }
 
@@ -53,13 +72,20 @@ bool UserComponent::OnStop() {
   }
   users_mutex_.unlock();
 
+  usernames_mutex_.lock();
+  if (!usernames_.empty()) {
+    usernames_.clear();
+  }
+  claims_.clear();
+  usernames_mutex_.unlock();
+
   return true;
 }
 
 void UserComponent::OnClientConnected(RemoteChatClient &client) {
   // Create a chat user class instance that we can use to store information
   // about the client
-  auto chat_user = std::make_shared<ChatUser>();
+  auto chat_user = user_pool_->CreateShared();
 
   // Store the user
   users_mutex_.lock();
@@ -68,27 +94,88 @@ void UserComponent::OnClientConnected(RemoteChatClient &client) {
 
   // Set as unidentified
   chat_user->Identified = false;
+  chat_user->PresenceChanges = false;
 
   // Give the client a guest username (which will prevent it from accessing
-  // anything until it has identified)
-  chat_user->Username = "guest-" + std::to_string(Utility::Random(100000,
-    999999));
-
-  // Set the IP address as the endpoint until the client identifies
-  chat_user->Hostname = client.Endpoint.GetAddressString();
+  // anything until it has identified), with the IP address as the endpoint
+  // until the client identifies
+  server_->SetIdentity(*chat_user, "guest-" + std::to_string(
+    Utility::Random(100000, 999999)), client.Endpoint.GetAddressString());
 }
 
 void UserComponent::OnClientDisconnected(RemoteChatClient &client) {
+  std::shared_ptr<ChatUser> user = removeUser(client);
+  if (user && user->Identified && user_directory_ != nullptr) {
+    user_directory_->Remove(client.Id, user->Username);
+  }
+}
+
+void UserComponent::OnClientResumed(RemoteChatClient &client,
+  RemoteChatClient &session) {
+  // The client's guest user is replaced by the session's, which keeps what
+  // the new Hello asked for
   users_mutex_.lock();
+  auto session_user = users_.find(&session);
+  if (session_user == users_.end()) {
+    users_mutex_.unlock();
+    return;
+  }
+  std::shared_ptr<ChatUser> chat_user = session_user->second;
+  users_.erase(session_user);
+  std::shared_ptr<ChatUser> &client_user = users_[&client];
+  if (client_user) {
+    chat_user->PresenceChanges = client_user->PresenceChanges;
+  }
+  client_user = chat_user;
+  users_mutex_.unlock();
 
-  std::shared_ptr<ChatUser> &user = users_[&client];
+  // Sent before anything the session missed
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt16(kUserMessageResult_Ok);
+  chat_user->Interned->WriteName(send_buffer);
+  server_->Send(client, kComponentType_User,
+    kUserMessageType_Resume_Complete, send_buffer);
+
+  // Trigger events
+  OnResumeCompleted(kUserMessageResult_Ok, *chat_user);
+}
+
+std::shared_ptr<ChatUser> UserComponent::removeUser(
+  RemoteChatClient &client) {
+  users_mutex_.lock();
+  auto user_pair = users_.find(&client);
+  if (user_pair == users_.end()) {
+    users_mutex_.unlock();
+    return nullptr;
+  }
+  std::shared_ptr<ChatUser> user = user_pair->second;
 
   // Set as disabled
   user->Enabled = false;
 
   // Delete user
-  users_.erase(&client);
+  users_.erase(user_pair);
   users_mutex_.unlock();
+
+  // Release the username if the client had identified with it, or the one
+  // it is still waiting for
+  usernames_mutex_.lock();
+  std::string username = user->Username;
+  auto claim = claims_.find(client.Id);
+  bool is_claiming = claim != claims_.end();
+  if (is_claiming) {
+    username = claim->second;
+    claims_.erase(claim);
+  }
+  if (user->Identified || is_claiming) {
+    auto identified_user = usernames_.find(username);
+    if (identified_user != usernames_.end()
+      && identified_user->second.ClientId == client.Id) {
+      usernames_.erase(identified_user);
+    }
+  }
+  usernames_mutex_.unlock();
+  return user;
 }
 
 ComponentType UserComponent::GetType() {
@@ -96,264 +183,373 @@ ComponentType UserComponent::GetType() {
 }
 
 bool UserComponent::Handle(RemoteChatClient &client, uint16_t message_type,
-  TypedBuffer &buffer) {
-  if (message_type == kUserMessageType_Identify) {
-    std::string username;
-    if (!buffer.ReadString(username)) {
-      return false;
-    }
+  TypedBufferView &buffer) {
+  return dispatcher_.Dispatch(this, message_type, client, buffer);
+}
 
-    // Get the chat user
-    users_mutex_.lock();
-    std::shared_ptr<ChatUser> chat_user = users_[&client];
-    users_mutex_.unlock();
+bool UserComponent::handleIdentify(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  std::string username;
+  if (!buffer.ReadString(username)) {
+    return false;
+  }
 
-    // Check if the username is valid
-    if (username.empty() || String::Contains(username, "#")) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kUserMessageResult_InvalidUsername);
-      send_buffer.WriteString(username);
-      server_->Send(client, kComponentType_User,
-        kUserMessageType_Identify_Complete, send_buffer);
+  // Get the chat user
+  users_mutex_.lock();
+  std::shared_ptr<ChatUser> chat_user = users_[&client];
+  users_mutex_.unlock();
 
-      // Trigger events
-      OnIdentifyCompleted(kUserMessageResult_InvalidUsername, username,
-        *chat_user);
+  // Check if the username is valid
+  if (username.empty() || String::Contains(username, "#")) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kUserMessageResult_InvalidUsername);
+    send_buffer.WriteString(username);
+    server_->Send(client, kComponentType_User,
+      kUserMessageType_Identify_Complete, send_buffer);
 
-      return true;
-    }
+    // Trigger events
+    OnIdentifyCompleted(kUserMessageResult_InvalidUsername, username,
+      *chat_user);
 
-    if (username.size() > JCHAT_CHAT_USERNAME_LENGTH) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kUserMessageResult_UsernameTooLong);
-      send_buffer.WriteString(username);
-      server_->Send(client, kComponentType_User,
-        kUserMessageType_Identify_Complete, send_buffer);
+    return true;
+  }
 
-      // Trigger events
-      OnIdentifyCompleted(kUserMessageResult_UsernameTooLong, username,
-        *chat_user);
+  if (username.size() > JCHAT_CHAT_USERNAME_LENGTH) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kUserMessageResult_UsernameTooLong);
+    send_buffer.WriteString(username);
+    server_->Send(client, kComponentType_User,
+      kUserMessageType_Identify_Complete, send_buffer);
 
-      return true;
-    }
+    // Trigger events
+    OnIdentifyCompleted(kUserMessageResult_UsernameTooLong, username,
+      *chat_user);
 
-    // Check if the client is already identified
-    if (chat_user && chat_user->Identified) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kUserMessageResult_AlreadyIdentified);
-      send_buffer.WriteString(username);
-      server_->Send(client, kComponentType_User,
-        kUserMessageType_Identify_Complete, send_buffer);
+    return true;
+  }
 
-      // Trigger events
-      OnIdentifyCompleted(kUserMessageResult_AlreadyIdentified, username,
-        *chat_user);
+  // Check if the client is already identified
+  if (chat_user && chat_user->Identified) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kUserMessageResult_AlreadyIdentified);
+    send_buffer.WriteString(username);
+    server_->Send(client, kComponentType_User,
+      kUserMessageType_Identify_Complete, send_buffer);
 
-      return true;
-    }
+    // Trigger events
+    OnIdentifyCompleted(kUserMessageResult_AlreadyIdentified, username,
+      *chat_user);
 
-    // Check if the username is in use
-    users_mutex_.lock();
-    for (auto &pair : users_) {
-      if (pair.second->Enabled && pair.second->Identified
-        && pair.second->Username == username) {
-        TypedBuffer send_buffer = server_->CreateBuffer();
-        send_buffer.WriteUInt16(kUserMessageResult_UsernameInUse);
-        send_buffer.WriteString(username);
-        server_->Send(client, kComponentType_User,
-          kUserMessageType_Identify_Complete, send_buffer);
-        users_mutex_.unlock();
-
-        // Trigger events
-        OnIdentifyCompleted(kUserMessageResult_UsernameInUse, username,
-          *chat_user);
-
-        return true;
-      }
-    }
-    users_mutex_.unlock();
+    return true;
+  }
 
-    // Set as identified and hash the hostname
-    chat_user->Identified = true;
-    chat_user->Username = username;
-    chat_user->Hostname = Utility::HashString(chat_user->Hostname.c_str(),
-      chat_user->Hostname.size());
+  // Check if the username is in use and reserve it if it isn't, both in one
+  // step so two clients can't identify with the same username. A client that
+  // still waits for another username is told it identified already.
+  usernames_mutex_.lock();
+  bool is_claiming = claims_.find(client.Id) != claims_.end();
+  if (is_claiming || usernames_.find(username) != usernames_.end()) {
+    usernames_mutex_.unlock();
 
+    UserMessageResult result = is_claiming
+      ? kUserMessageResult_AlreadyIdentified : kUserMessageResult_UsernameInUse;
     TypedBuffer send_buffer = server_->CreateBuffer();
-    send_buffer.WriteUInt16(kUserMessageResult_Ok);
-    send_buffer.WriteString(chat_user->Username);
-    send_buffer.WriteString(chat_user->Hostname);
+    send_buffer.WriteUInt16(result);
+    send_buffer.WriteString(username);
     server_->Send(client, kComponentType_User,
       kUserMessageType_Identify_Complete, send_buffer);
 
     // Trigger events
-    OnIdentifyCompleted(kUserMessageResult_Ok, username, *chat_user);
-    OnIdentified(*chat_user);
+    OnIdentifyCompleted(result, username, *chat_user);
 
     return true;
-  } else if (message_type == kUserMessageType_SendMessage) {
-    std::string username;
-    if (!buffer.ReadString(username)) {
-      return false;
-    }
+  }
+  IdentifiedUser &identified_user = usernames_[username];
+  identified_user.ClientId = client.Id;
+  identified_user.User = chat_user;
+  claims_[client.Id] = username;
+  usernames_mutex_.unlock();
+
+  // Other servers of a cluster may know the username, the directory decides
+  if (user_directory_ == nullptr) {
+    completeIdentify(client.Id, chat_user, username, kUserMessageResult_Ok);
+    return true;
+  }
+  // The claim may complete on another thread, the reply still answers the
+  // request
+  uint64_t client_id = client.Id;
+  RequestContext request = RequestContext::GetCurrent();
+  user_directory_->Claim(client_id, username,
+    [this, client_id, chat_user, username, request](
+    UserMessageResult result) mutable {
+    RequestContext previous = RequestContext::SetCurrent(request);
+    completeIdentify(client_id, chat_user, username, result);
+    RequestContext::SetCurrent(previous);
+  });
 
-    std::string message;
-    if (!buffer.ReadString(message)) {
-      return false;
+  return true;
+}
+
+void UserComponent::completeIdentify(uint64_t client_id,
+  std::shared_ptr<ChatUser> &chat_user, std::string &username,
+  UserMessageResult result) {
+  // The client may have disconnected while the directory was asked, the
+  // username was released with it then
+  usernames_mutex_.lock();
+  auto claim = claims_.find(client_id);
+  if (claim == claims_.end() || claim->second != username) {
+    usernames_mutex_.unlock();
+    if (result == kUserMessageResult_Ok && user_directory_ != nullptr) {
+      user_directory_->Remove(client_id, username);
     }
+    return;
+  }
+  claims_.erase(claim);
 
-    // Get the chat user
-    users_mutex_.lock();
-    std::shared_ptr<ChatUser> chat_user = users_[&client];
-    users_mutex_.unlock();
+  if (result != kUserMessageResult_Ok) {
+    usernames_.erase(username);
+    usernames_mutex_.unlock();
 
-    // Check if the client is not identified
-    if (chat_user && !chat_user->Identified) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kUserMessageResult_NotIdentified);
-      send_buffer.WriteString(username);
-      send_buffer.WriteString(message);
-      server_->Send(client, kComponentType_User,
-        kUserMessageType_SendMessage_Complete, send_buffer);
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(result);
+    send_buffer.WriteString(username);
+    server_->Send(client_id, kComponentType_User,
+      kUserMessageType_Identify_Complete, send_buffer);
 
-      // Trigger events
-      OnSendMessageCompleted(kUserMessageResult_NotIdentified, username,
-        message, *chat_user);
+    // Trigger events
+    OnIdentifyCompleted(result, username, *chat_user);
 
-      return true;
-    }
+    return;
+  }
 
-    // Check if the user is trying to message themself
-    if (chat_user->Username == username) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kUserMessageResult_CannotMessageSelf);
-      send_buffer.WriteString(username);
-      send_buffer.WriteString(message);
-      server_->Send(client, kComponentType_User,
-        kUserMessageType_SendMessage_Complete, send_buffer);
+  // Hash the hostname and set as identified, while the lock keeps a
+  // disconnect from releasing the username halfway
+  server_->SetIdentity(*chat_user, username, Utility::HashString(
+    chat_user->Hostname.c_str(), chat_user->Hostname.size(), hostname_key_));
+  chat_user->Identified = true;
 
-      // Trigger events
-      OnSendMessageCompleted(kUserMessageResult_CannotMessageSelf, username,
-        message, *chat_user);
+  // The other servers learn about the user before the client can ask them
+  // for anything, and before a disconnect removes it again
+  if (user_directory_ != nullptr) {
+    user_directory_->Add(client_id, *chat_user);
+  }
+  usernames_mutex_.unlock();
 
-      return true;
-    }
+  // Clients that asked for resume in their Hello are given a session token
+  std::string resume_token = server_->CreateSession(client_id);
 
-    // Check the username
-    if (username.empty() || String::Contains(username, "#")) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kUserMessageResult_InvalidUsername);
-      send_buffer.WriteString(username);
-      send_buffer.WriteString(message);
-      server_->Send(client, kComponentType_User,
-        kUserMessageType_SendMessage_Complete, send_buffer);
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt16(kUserMessageResult_Ok);
+  chat_user->Interned->WriteName(send_buffer);
+  if (!resume_token.empty()) {
+    send_buffer.WriteString(resume_token);
+  }
+  server_->Send(client_id, kComponentType_User,
+    kUserMessageType_Identify_Complete, send_buffer);
 
-      // Trigger events
-      OnSendMessageCompleted(kUserMessageResult_InvalidUsername, username,
-        message, *chat_user);
+  // Trigger events
+  OnIdentifyCompleted(kUserMessageResult_Ok, username, *chat_user);
+  OnIdentified(*chat_user);
+}
 
-      return true;
-    }
+bool UserComponent::handleSendMessage(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  std::string username;
+  if (!buffer.ReadString(username)) {
+    return false;
+  }
 
-    // Check if the user exists
-    RemoteChatClient *target_client = 0;
-    std::shared_ptr<ChatUser> target_user;
-    users_mutex_.lock();
-    for (auto &pair : users_) {
-      if (pair.second->Enabled && pair.second->Identified
-        && pair.second->Username == username) {
-        target_client = pair.first;
-        target_user = pair.second;
-      }
-    }
-    users_mutex_.unlock();
-    if (!target_user) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kUserMessageResult_InvalidUsername);
-      send_buffer.WriteString(username);
-      send_buffer.WriteString(message);
-      server_->Send(client, kComponentType_User,
-        kUserMessageType_SendMessage_Complete, send_buffer);
-
-      // Trigger events
-      OnSendMessageCompleted(kUserMessageResult_InvalidUsername, username,
-        message, *chat_user);
+  std::string message;
+  if (!buffer.ReadString(message)) {
+    return false;
+  }
 
-      return true;
-    }
+  // Get the chat user
+  users_mutex_.lock();
+  std::shared_ptr<ChatUser> chat_user = users_[&client];
+  users_mutex_.unlock();
 
-    // Check if the user is identified
-    if (!target_user->Identified) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kUserMessageResult_UserNotIdentified);
-      send_buffer.WriteString(username);
-      send_buffer.WriteString(message);
-      server_->Send(client, kComponentType_User,
-        kUserMessageType_SendMessage_Complete, send_buffer);
+  // Check if the client is not identified
+  if (chat_user && !chat_user->Identified) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kUserMessageResult_NotIdentified);
+    send_buffer.WriteString(username);
+    send_buffer.WriteString(message);
+    server_->Send(client, kComponentType_User,
+      kUserMessageType_SendMessage_Complete, send_buffer);
 
-      // Trigger events
-      OnSendMessageCompleted(kUserMessageResult_UserNotIdentified, username,
-        message, *chat_user);
+    // Trigger events
+    OnSendMessageCompleted(kUserMessageResult_NotIdentified, username,
+      message, *chat_user);
 
-      return true;
-    }
+    return true;
+  }
+
+  // Check if the user is trying to message themself
+  if (chat_user->Username == username) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kUserMessageResult_CannotMessageSelf);
+    send_buffer.WriteString(username);
+    send_buffer.WriteString(message);
+    server_->Send(client, kComponentType_User,
+      kUserMessageType_SendMessage_Complete, send_buffer);
 
-    // Check the message
-    if (message.empty()) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kUserMessageResult_InvalidMessage);
-      send_buffer.WriteString(username);
-      send_buffer.WriteString(message);
-      server_->Send(client, kComponentType_User,
-        kUserMessageType_SendMessage_Complete, send_buffer);
+    // Trigger events
+    OnSendMessageCompleted(kUserMessageResult_CannotMessageSelf, username,
+      message, *chat_user);
 
-      // Trigger events
-      OnSendMessageCompleted(kUserMessageResult_InvalidMessage, username,
-        message, *chat_user);
+    return true;
+  }
 
-      return true;
-    }
+  // Check the username
+  if (username.empty() || String::Contains(username, "#")) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kUserMessageResult_InvalidUsername);
+    send_buffer.WriteString(username);
+    send_buffer.WriteString(message);
+    server_->Send(client, kComponentType_User,
+      kUserMessageType_SendMessage_Complete, send_buffer);
 
-    if (message.size() > JCHAT_CHAT_MESSAGE_LENGTH) {
-      TypedBuffer send_buffer = server_->CreateBuffer();
-      send_buffer.WriteUInt16(kUserMessageResult_MessageTooLong);
-      send_buffer.WriteString(username);
-      send_buffer.WriteString(message);
-      server_->Send(client, kComponentType_User,
-        kUserMessageType_SendMessage_Complete, send_buffer);
+    // Trigger events
+    OnSendMessageCompleted(kUserMessageResult_InvalidUsername, username,
+      message, *chat_user);
 
-      // Trigger events
-      OnSendMessageCompleted(kUserMessageResult_MessageTooLong, username,
-        message, *chat_user);
+    return true;
+  }
 
-      return true;
-    }
+  // Check if the user exists
+  uint64_t target_client_id = 0;
+  std::shared_ptr<ChatUser> target_user;
+  usernames_mutex_.lock();
+  auto identified_user = usernames_.find(username);
+  if (identified_user != usernames_.end()) {
+    target_client_id = identified_user->second.ClientId;
+    target_user = identified_user->second.User;
+  }
+  usernames_mutex_.unlock();
+  if (!target_user || !target_user->Enabled) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kUserMessageResult_InvalidUsername);
+    send_buffer.WriteString(username);
+    send_buffer.WriteString(message);
+    server_->Send(client, kComponentType_User,
+      kUserMessageType_SendMessage_Complete, send_buffer);
 
-    // Send the message
-    TypedBuffer client_buffer = server_->CreateBuffer();
-    client_buffer.WriteUInt16(kUserMessageResult_MessageSent);
-    client_buffer.WriteString(chat_user->Username);
-    client_buffer.WriteString(chat_user->Hostname);
-    client_buffer.WriteString(message);
-    server_->Send(target_client, kComponentType_User,
-      kUserMessageType_SendMessage, client_buffer);
+    // Trigger events
+    OnSendMessageCompleted(kUserMessageResult_InvalidUsername, username,
+      message, *chat_user);
+
+    return true;
+  }
 
+  // Check if the user is identified
+  if (!target_user->Identified) {
     TypedBuffer send_buffer = server_->CreateBuffer();
-    send_buffer.WriteUInt16(kUserMessageResult_Ok);
+    send_buffer.WriteUInt16(kUserMessageResult_UserNotIdentified);
     send_buffer.WriteString(username);
     send_buffer.WriteString(message);
     server_->Send(client, kComponentType_User,
       kUserMessageType_SendMessage_Complete, send_buffer);
 
     // Trigger events
-    OnSendMessageCompleted(kUserMessageResult_Ok, username, message,
-      *chat_user);
-    OnMessage(*chat_user, *target_user, message);
+    OnSendMessageCompleted(kUserMessageResult_UserNotIdentified, username,
+      message, *chat_user);
+
+    return true;
+  }
+
+  // Check the message, which has to be valid UTF-8 and is sent on without
+  // control characters
+  if (!Utf8::Sanitize(message) || message.empty()) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kUserMessageResult_InvalidMessage);
+    send_buffer.WriteString(username);
+    send_buffer.WriteString(message);
+    server_->Send(client, kComponentType_User,
+      kUserMessageType_SendMessage_Complete, send_buffer);
+
+    // Trigger events
+    OnSendMessageCompleted(kUserMessageResult_InvalidMessage, username,
+      message, *chat_user);
+
+    return true;
+  }
+
+  if (message.size() > JCHAT_CHAT_MESSAGE_LENGTH) {
+    TypedBuffer send_buffer = server_->CreateBuffer();
+    send_buffer.WriteUInt16(kUserMessageResult_MessageTooLong);
+    send_buffer.WriteString(username);
+    send_buffer.WriteString(message);
+    server_->Send(client, kComponentType_User,
+      kUserMessageType_SendMessage_Complete, send_buffer);
+
+    // Trigger events
+    OnSendMessageCompleted(kUserMessageResult_MessageTooLong, username,
+      message, *chat_user);
 
     return true;
   }
 
-  return false;
+  // Send the message
+  TypedBuffer client_buffer = server_->CreateBuffer();
+  client_buffer.WriteUInt16(kUserMessageResult_MessageSent);
+  chat_user->Interned->WriteName(client_buffer);
+  client_buffer.WriteString(message);
+  server_->Send(target_client_id, kComponentType_User,
+    kUserMessageType_SendMessage, client_buffer);
+
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt16(kUserMessageResult_Ok);
+  send_buffer.WriteString(username);
+  send_buffer.WriteString(message);
+  server_->Send(client, kComponentType_User,
+    kUserMessageType_SendMessage_Complete, send_buffer);
+
+  // Trigger events
+  OnSendMessageCompleted(kUserMessageResult_Ok, username, message,
+    *chat_user);
+  OnMessage(*chat_user, *target_user, message);
+
+  return true;
+}
+
+bool UserComponent::handleResume(RemoteChatClient &client,
+  TypedBufferView &buffer) {
+  std::string resume_token;
+  if (!buffer.ReadString(resume_token)) {
+    return false;
+  }
+
+  // Get the chat user
+  users_mutex_.lock();
+  std::shared_ptr<ChatUser> chat_user = users_[&client];
+  users_mutex_.unlock();
+
+  // Only a client that has no username yet can take over a session
+  usernames_mutex_.lock();
+  bool is_claiming = claims_.find(client.Id) != claims_.end();
+  usernames_mutex_.unlock();
+  UserMessageResult result = kUserMessageResult_AlreadyIdentified;
+  if (!chat_user->Identified && !is_claiming) {
+    // The reply was sent by OnClientResumed if the session was resumed
+    ResumeResult resume_result = server_->ResumeSession(client,
+      resume_token);
+    if (resume_result == kResumeResult_Resumed) {
+      return true;
+    }
+    result = resume_result == kResumeResult_SessionInUse
+      ? kUserMessageResult_SessionInUse : kUserMessageResult_InvalidSession;
+  }
+
+  TypedBuffer send_buffer = server_->CreateBuffer();
+  send_buffer.WriteUInt16(result);
+  server_->Send(client, kComponentType_User,
+    kUserMessageType_Resume_Complete, send_buffer);
+
+  // Trigger events
+  OnResumeCompleted(result, *chat_user);
+
+  return true;
 }
 
 bool UserComponent::GetChatUser(RemoteChatClient &client,
@@ -367,4 +563,41 @@ bool UserComponent::GetChatUser(RemoteChatClient &client,
   users_mutex_.unlock();
   return true;
 }
+
+PoolStats UserComponent::GetUserPoolStats() {
+  return user_pool_->GetStats();
+}
+
+void UserComponent::SetUserDirectory(UserDirectory *user_directory) {
+  user_directory_ = user_directory;
+}
+
+void UserComponent::SetHostnameKey(const std::string &key) {
+  hostname_key_ = key.empty() ? Utility::GetProcessKey()
+    : Utility::Hash(key.data(), key.size());
+}
+
+bool UserComponent::AddRemoteUser(RemoteChatClient &client,
+  std::shared_ptr<ChatUser> &user) {
+  users_mutex_.lock();
+  users_[&client] = user;
+  users_mutex_.unlock();
+
+  // The user stays reachable through the channels it joins even if a local
+  // client took the username first
+  usernames_mutex_.lock();
+  if (usernames_.find(user->Username) != usernames_.end()) {
+    usernames_mutex_.unlock();
+    return false;
+  }
+  IdentifiedUser &identified_user = usernames_[user->Username];
+  identified_user.ClientId = client.Id;
+  identified_user.User = user;
+  usernames_mutex_.unlock();
+  return true;
+}
+
+void UserComponent::RemoveRemoteUser(RemoteChatClient &client) {
+  removeUser(client);
+}
 }
@@ -12,11 +12,128 @@
 #include "components/system_component.h"
 #include "components/user_component.h"
 #include "components/channel_component.h"
+#include "components/cluster_component.h"
+#include "string.hpp"
+#include "thread.hpp"
 #include <iostream>
 #include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <random>
 #include <thread>
 
+// Set by SIGINT and SIGTERM, the server is stopped so the log is written
+static volatile sig_atomic_t is_stopping = 0;
+
+static void OnStopSignal(int signal_number) {
+  is_stopping = 1;
+}
+
 // Program entrypoint
+static jchat::PollerType GetPollerType(std::string poller_name) {
+  if (poller_name == "select") {
+    return jchat::kPollerType_Select;
+  } else if (poller_name == "epoll") {
+    return jchat::kPollerType_Epoll;
+  } else if (poller_name == "kqueue") {
+    return jchat::kPollerType_Kqueue;
+  } else if (poller_name == "io_uring") {
+    return jchat::kPollerType_IoUring;
+  }
+  return jchat::kPollerType_Default;
+}
+
+static jchat::LogLevel GetLogLevel(std::string level_name) {
+  if (level_name == "debug") {
+    return jchat::kLogLevel_Debug;
+  } else if (level_name == "warning") {
+    return jchat::kLogLevel_Warning;
+  } else if (level_name == "error") {
+    return jchat::kLogLevel_Error;
+  } else if (level_name == "none") {
+    return jchat::kLogLevel_None;
+  }
+  return jchat::kLogLevel_Info;
+}
+
+static const char *GetPollerName(jchat::PollerType poller_type) {
+  if (poller_type == jchat::kPollerType_Select) {
+    return "select";
+  } else if (poller_type == jchat::kPollerType_Epoll) {
+    return "epoll";
+  } else if (poller_type == jchat::kPollerType_Kqueue) {
+    return "kqueue";
+  } else if (poller_type == jchat::kPollerType_IoUring) {
+    return "io_uring";
+  }
+  return "default";
+}
+
+// Nodes are given as host:port, separated by commas
+static bool GetClusterNodes(std::string nodes_string,
+  std::vector<jchat::ClusterNode> &out_nodes) {
+  for (auto &node_string : jchat::String::Split(nodes_string, ",")) {
+    size_t separator = node_string.rfind(':');
+    if (separator == std::string::npos) {
+      return false;
+    }
+    int32_t port = atoi(node_string.c_str() + separator + 1);
+    if (port <= 0 || port > 65535) {
+      return false;
+    }
+    jchat::ClusterNode node;
+    node.Hostname = node_string.substr(0, separator);
+    node.Port = static_cast<uint16_t>(port);
+    out_nodes.push_back(node);
+  }
+  return !out_nodes.empty();
+}
+
+// Reads the hostname key kept at the path, or makes one and keeps it there
+// if there is none yet, so bans of stored channels still match after a
+// restart
+static bool LoadHostnameKey(const std::string &path, std::string &out_key) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file != nullptr) {
+    char key[64];
+    size_t size = fread(key, 1, sizeof(key), file);
+    fclose(file);
+    out_key.assign(key, size);
+    return !out_key.empty();
+  }
+
+  std::random_device random;
+  out_key.clear();
+  for (int i = 0; i < 4; i++) {
+    out_key += jchat::String::Format("%08x", random());
+  }
+  file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool is_written = fwrite(out_key.data(), 1, out_key.size(), file)
+    == out_key.size();
+  return fclose(file) == 0 && is_written;
+}
+
+// Says how many events the limit held back since the last one it let through
+static bool LogClientEvent(jchat::Logger &logger, jchat::LogRateLimit &limit,
+  jchat::RemoteChatClient &client, const char *event_name) {
+  uint64_t suppressed_count = 0;
+  if (!logger.IsEnabled(jchat::kLogLevel_Info)
+    || !limit.Allow(suppressed_count)) {
+    return false;
+  }
+  std::string endpoint = client.Endpoint.ToString();
+  if (suppressed_count > 0) {
+    return logger.Write(jchat::kLogLevel_Info, "server",
+      "Client from %s %s (%llu more not logged)", endpoint.c_str(),
+      event_name, static_cast<unsigned long long>(suppressed_count));
+  }
+  return logger.Write(jchat::kLogLevel_Info, "server", "Client from %s %s",
+    endpoint.c_str(), event_name);
+}
+
 int main(int argc, char **argv) {
   std::cout << "jChatSystem - Server" << std::endl;
 
@@ -29,36 +146,267 @@ int main(int argc, char **argv) {
   jchat::ChatServer chat_server(
     command_line.GetString("ipaddress", "0.0.0.0").c_str(),
     command_line.GetInt32("port", 9998));
+  chat_server.SetPollerType(GetPollerType(
+    command_line.GetString("poller", "default")));
+  int32_t io_thread_count = command_line.GetInt32("iothreads", 1);
+  if (io_thread_count > 0) {
+    chat_server.SetIoThreadCount(static_cast<size_t>(io_thread_count));
+  }
+  // CPUs such as 0-3,8 the I/O threads are kept on in turn. Their clients
+  // and buffers are allocated on the NUMA node of their CPU.
+  std::string io_cpus = command_line.GetString("iocpus", "");
+  std::vector<int> cpus;
+  if (!io_cpus.empty()) {
+    if (!jchat::Thread::ParseCpuList(io_cpus, cpus)) {
+      std::cout << "Invalid I/O CPUs " << io_cpus << std::endl;
+      return -1;
+    }
+    chat_server.SetIoCpus(cpus);
+  }
+
+  // Limit how much output may pile up for a slow client, the queue has to
+  // drain to a quarter of the limit before a shedding client gets messages
+  // again
+  int32_t send_queue_size = command_line.GetInt32("sendqueuekb", 0);
+  if (send_queue_size > 0) {
+    size_t high_watermark = static_cast<size_t>(send_queue_size) * 1024;
+    chat_server.SetSendQueueLimits(high_watermark, high_watermark / 4);
+  }
+  if (command_line.GetString("sendpolicy", "disconnect") == "shed") {
+    chat_server.SetSendQueuePolicy(jchat::kSendQueuePolicy_Shed);
+  }
+
+  int32_t listen_backlog = command_line.GetInt32("backlog", 0);
+  if (listen_backlog > 0) {
+    chat_server.SetListenBacklog(listen_backlog);
+  }
+  if (command_line.GetInt32("nodelay", 1) == 0) {
+    chat_server.SetNoDelay(false);
+  }
+  chat_server.SetSocketBufferSizes(
+    command_line.GetInt32("sendbufferkb", 0) * 1024,
+    command_line.GetInt32("receivebufferkb", 0) * 1024);
+
+  // Services on this host can connect through a Unix domain socket here,
+  // saving the TCP stack
+  chat_server.SetLocalPath(command_line.GetString("localsocket", ""));
+
+  // Connections every address may open per second once it used up the
+  // burst, 0 doesn't limit them
+  int32_t connect_rate = command_line.GetInt32("connectrate", 0);
+  if (connect_rate > 0) {
+    chat_server.SetConnectionRateLimit(connect_rate,
+      command_line.GetInt32("connectburst", connect_rate));
+  }
+
+  // Milliseconds a client may stay quiet for before it is pinged, and
+  // dropped after as long again, 0 never drops quiet clients
+  int32_t idle_timeout = command_line.GetInt32("idletimeout",
+    JCHAT_CHAT_IDLE_TIMEOUT);
+  if (idle_timeout >= 0) {
+    chat_server.SetIdleTimeout(std::chrono::milliseconds(idle_timeout));
+  }
+
+  // Longest time in microseconds a message waits for others to be batched
+  // with, 0 turns batching off
+  int32_t batch_window = command_line.GetInt32("batchwindow",
+    JCHAT_CHAT_BATCH_WINDOW);
+  if (batch_window >= 0) {
+    chat_server.SetBatchWindow(std::chrono::microseconds(batch_window));
+  }
+
+  // Seconds the session of a client that asked for it is kept after its
+  // connection dropped, 0 lets no client resume
+  int32_t resume_grace = command_line.GetInt32("resumegrace",
+    JCHAT_CHAT_RESUME_GRACE_PERIOD);
+  if (resume_grace >= 0) {
+    chat_server.SetResumeGracePeriod(std::chrono::seconds(resume_grace));
+  }
+
+  // Messages a connection has handled in a row before the others get a
+  // turn, 0 handles everything it sent at once
+  int32_t receive_budget = command_line.GetInt32("receivebudget",
+    JCHAT_CHAT_RECEIVE_BUDGET);
+  if (receive_budget >= 0) {
+    chat_server.SetReceiveBudget(receive_budget);
+  }
+
+  // Messages every client may send per second once it used up the burst,
+  // 0 doesn't limit them
+  int32_t message_rate = command_line.GetInt32("messagerate", 0);
+  if (message_rate > 0) {
+    chat_server.SetMessageRateLimit(message_rate,
+      command_line.GetInt32("messageburst", message_rate));
+  }
 
   auto system_component = std::make_shared<jchat::SystemComponent>();
   auto user_component = std::make_shared<jchat::UserComponent>();
   auto channel_component = std::make_shared<jchat::ChannelComponent>();
 
+  if (command_line.GetString("compression", "deflate") == "none") {
+    system_component->SetCompressionEnabled(false);
+  }
+  system_component->SetStatsKey(command_line.GetString("statskey", ""));
+  // Hostnames are shown to other clients hashed with this key, which every
+  // node of a cluster has to be given. Without one a server that stores
+  // channels keeps a key of its own next to them, any other one picks a
+  // random key.
+  std::string hostname_key = command_line.GetString("hostnamekey", "");
+  std::string channel_state = command_line.GetString("channelstate", "");
+  if (hostname_key.empty()
+    && !command_line.GetString("clusternodes", "").empty()) {
+    std::cout << "Cluster nodes need the same -hostnamekey" << std::endl;
+    return -1;
+  }
+  if (hostname_key.empty() && !channel_state.empty()
+    && !LoadHostnameKey(channel_state + ".hostkey", hostname_key)) {
+    std::cout << "Failed to load the hostname key at " << channel_state
+              << ".hostkey" << std::endl;
+    return -1;
+  }
+  user_component->SetHostnameKey(hostname_key);
+  int32_t channel_shard_count = command_line.GetInt32("channelshards", 0);
+  if (channel_shard_count > 0) {
+    channel_component->SetShardCount(
+      static_cast<size_t>(channel_shard_count));
+  }
+  // CPUs the channel shards are kept on in turn, like -iocpus
+  std::string shard_cpus = command_line.GetString("shardcpus", "");
+  if (!shard_cpus.empty()) {
+    if (!jchat::Thread::ParseCpuList(shard_cpus, cpus)) {
+      std::cout << "Invalid shard CPUs " << shard_cpus << std::endl;
+      return -1;
+    }
+    channel_component->SetShardCpus(cpus);
+  }
+  // Milliseconds joins and leaves are collected for before channel members
+  // are told about them, 0 tells them right away
+  int32_t presence_interval = command_line.GetInt32("presenceinterval",
+    JCHAT_CHAT_PRESENCE_INTERVAL);
+  if (presence_interval >= 0) {
+    channel_component->SetPresenceInterval(
+      std::chrono::milliseconds(presence_interval));
+  }
+
+  // Path prefix of the files channels are kept in across restarts, and the
+  // seconds between snapshots of them
+  channel_component->SetStatePath(channel_state);
+  int32_t snapshot_interval = command_line.GetInt32("snapshotinterval", 0);
+  if (snapshot_interval > 0) {
+    channel_component->SetSnapshotInterval(
+      std::chrono::seconds(snapshot_interval));
+  }
+
+  // Messages every channel keeps for clients that join later, the kilobytes
+  // of them per channel and megabytes of them in all, and the seconds they
+  // are kept for. 0 messages keeps no history.
+  int32_t history_messages = command_line.GetInt32("historymessages",
+    JCHAT_CHAT_HISTORY_MESSAGES);
+  int32_t history_channel_kb = command_line.GetInt32("historychannelkb",
+    JCHAT_CHAT_HISTORY_CHANNEL_SIZE / 1024);
+  int32_t history_server_mb = command_line.GetInt32("historyservermb",
+    JCHAT_CHAT_HISTORY_SERVER_SIZE / (1024 * 1024));
+  int32_t history_age = command_line.GetInt32("historyage",
+    JCHAT_CHAT_HISTORY_MAX_AGE);
+  if (history_messages >= 0 && history_channel_kb >= 0
+    && history_server_mb >= 0 && history_age >= 0) {
+    channel_component->SetHistoryLimits(
+      static_cast<size_t>(history_messages),
+      static_cast<size_t>(history_channel_kb) * 1024,
+      static_cast<size_t>(history_server_mb) * 1024 * 1024,
+      std::chrono::seconds(history_age));
+  }
+
+  // A ring in shared memory every channel message is written to, such as
+  // /dev/shm/jchat.tap, for services on this host that tail all of them.
+  // Kilobytes of messages it holds before the oldest are overwritten.
+  std::string tap_path = command_line.GetString("tap", "");
+  if (!tap_path.empty()) {
+    auto message_tap = std::make_shared<jchat::SharedRingWriter>();
+    int32_t tap_size = command_line.GetInt32("tapkb", 4096);
+    if (tap_size <= 0 || !message_tap->Create(tap_path,
+      static_cast<size_t>(tap_size) * 1024)) {
+      std::cout << "Failed to create the tap " << tap_path << std::endl;
+      return -1;
+    }
+    channel_component->SetMessageTap(message_tap);
+  }
+
   chat_server.AddComponent(system_component);
   chat_server.AddComponent(user_component);
   chat_server.AddComponent(channel_component);
 
-  chat_server.OnClientConnected.Add([](jchat::RemoteChatClient &client) {
-    std::cout << "Client from "
-              << client.Endpoint.ToString()
-              << " connected"
+  // Every node of a cluster is started with the same list of nodes and its
+  // own place in it
+  std::string cluster_nodes = command_line.GetString("clusternodes", "");
+  if (!cluster_nodes.empty()) {
+    std::vector<jchat::ClusterNode> nodes;
+    auto cluster_component = std::make_shared<jchat::ClusterComponent>();
+    int32_t node_id = command_line.GetInt32("clusternode", 0);
+    if (!GetClusterNodes(cluster_nodes, nodes) || node_id < 0
+      || node_id > 65535
+      || !cluster_component->SetNodes(static_cast<uint16_t>(node_id), nodes)) {
+      std::cout << "Invalid cluster nodes " << cluster_nodes << std::endl;
+      return -1;
+    }
+    cluster_component->SetKey(command_line.GetString("clusterkey", ""));
+    if (!chat_server.AddComponent(cluster_component)) {
+      std::cout << "Failed to join the cluster" << std::endl;
+      return -1;
+    }
+    std::cout << "Cluster node " << node_id << " of " << nodes.size()
               << std::endl;
+  }
+
+  // Connects and disconnects are logged on the reactors, at most this many
+  // of each a second so a storm of them doesn't flood the log
+  jchat::Logger &logger = chat_server.GetLogger();
+  logger.SetPath(command_line.GetString("logfile", ""));
+  logger.SetLevel(GetLogLevel(command_line.GetString("loglevel", "info")));
+  int32_t log_rate = command_line.GetInt32("lograte", 100);
+  jchat::LogRateLimit connect_limit(log_rate > 0 ? log_rate : 0);
+  jchat::LogRateLimit disconnect_limit(log_rate > 0 ? log_rate : 0);
+
+  chat_server.OnClientConnected.Add([&](jchat::RemoteChatClient &client) {
+    LogClientEvent(logger, connect_limit, client, "connected");
     return true;
   });
-  chat_server.OnClientDisconnected.Add([](jchat::RemoteChatClient &client) {
-    std::cout << "Client from "
-              << client.Endpoint.ToString()
-              << " disconnected"
-              << std::endl;
+  chat_server.OnClientDisconnected.Add([&](jchat::RemoteChatClient &client) {
+    if (!LogClientEvent(logger, disconnect_limit, client, "disconnected")) {
+      return true;
+    }
+    std::shared_ptr<jchat::ConnectionCompression> compression =
+      std::atomic_load(&client.Compression);
+    if (compression && logger.IsEnabled(jchat::kLogLevel_Debug)) {
+      jchat::DeflateStats stats = compression->Stream.GetStats();
+      logger.Write(jchat::kLogLevel_Debug, "server",
+        "Compression: sent %llu -> %llu bytes in %lluus, "
+        "received %llu -> %llu bytes in %lluus",
+        static_cast<unsigned long long>(stats.CompressInputBytes),
+        static_cast<unsigned long long>(stats.CompressOutputBytes),
+        static_cast<unsigned long long>(stats.CompressNanoseconds / 1000),
+        static_cast<unsigned long long>(stats.DecompressInputBytes),
+        static_cast<unsigned long long>(stats.DecompressOutputBytes),
+        static_cast<unsigned long long>(stats.DecompressNanoseconds / 1000));
+    }
     return true;
   });
   if (chat_server.Start()) {
     std::cout << "Started listening on "
               << chat_server.GetListenEndpoint().ToString()
+              << " (" << GetPollerName(chat_server.GetPollerType()) << ", "
+              << chat_server.GetIoThreadCount() << " I/O threads)"
               << std::endl;
-    while (true) {
-      std::this_thread::sleep_for(std::chrono::seconds(1));
+    if (!chat_server.GetLocalPath().empty()) {
+      std::cout << "Started listening on " << chat_server.GetLocalPath()
+                << std::endl;
+    }
+    std::signal(SIGINT, OnStopSignal);
+    std::signal(SIGTERM, OnStopSignal);
+    while (!is_stopping) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
+    chat_server.Stop();
   } else {
     std::cout << "Failed to listen on "
               << chat_server.GetListenEndpoint().ToString()
@@ -0,0 +1,30 @@
+/*
+*   This file is part of the jChatSystem project.
+*
+*   This program is licensed under the GNU General
+*   Public License. To view the full license, check
+*   LICENSE in the project root.
+*/
+
+#include "request_context.h"
+
+namespace jchat {
+static thread_local RequestContext current_request;
+
+RequestContext RequestContext::GetCurrent() {
+  return current_request;
+}
+
+RequestContext RequestContext::SetCurrent(const RequestContext &request) {
+  RequestContext previous = current_request;
+  current_request = request;
+  return previous;
+}
+
+uint32_t RequestContext::GetRequestId(uint64_t client_id) {
+  if (current_request.ClientId != client_id) {
+    return 0;
+  }
+  return current_request.RequestId;
+}
+}
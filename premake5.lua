@@ -28,9 +28,13 @@ workspace "jchat"
 
 		filter "platforms:Unix32"
 			architecture "x32"
+			defines { "JCHAT_USE_ZLIB", "JCHAT_USE_IO_URING" }
+			links { "z" }
 
 		filter "platforms:Unix64"
 			architecture "x64"
+			defines { "JCHAT_USE_ZLIB", "JCHAT_USE_IO_URING" }
+			links { "z" }
 
 		configuration "Debug"
 			defines { "DEBUG" }
@@ -62,9 +66,91 @@ workspace "jchat"
 
 		filter "platforms:Unix32"
 			architecture "x32"
+			defines { "JCHAT_USE_ZLIB" }
+			links { "z" }
 
 		filter "platforms:Unix64"
 			architecture "x64"
+			defines { "JCHAT_USE_ZLIB" }
+			links { "z" }
+
+		configuration "Debug"
+			defines { "DEBUG" }
+			flags { "Symbols" }
+
+		configuration "Release"
+			defines { "NDEBUG" }
+			optimize "On"
+
+		configuration { "gmake" }
+			buildoptions { "-std=c++11" }
+			linkoptions { "-pthread" }
+
+	project "jchat_bench"
+		kind "ConsoleApp"
+		language "C++"
+		targetdir "build/%{cfg.buildcfg}"
+
+		includedirs { "jchat_lib/", "jchat_common/", "jchat_client/include/", "jchat_client/src/", "jchat_bench/include/" }
+		files { "jchat_lib/**", "jchat_common/**", "jchat_client/include/**", "jchat_client/src/**.cpp", "jchat_bench/include/**", "jchat_bench/src/**.cpp" }
+		removefiles { "jchat_client/src/main.cpp" }
+
+		filter "platforms:Win32"
+			architecture "x32"
+			links { "ws2_32" }
+
+		filter "platforms:Win64"
+			architecture "x64"
+			links { "ws2_32" }
+
+		filter "platforms:Unix32"
+			architecture "x32"
+			defines { "JCHAT_USE_ZLIB" }
+			links { "z" }
+
+		filter "platforms:Unix64"
+			architecture "x64"
+			defines { "JCHAT_USE_ZLIB" }
+			links { "z" }
+
+		configuration "Debug"
+			defines { "DEBUG" }
+			flags { "Symbols" }
+
+		configuration "Release"
+			defines { "NDEBUG" }
+			optimize "On"
+
+		configuration { "gmake" }
+			buildoptions { "-std=c++11" }
+			linkoptions { "-pthread" }
+
+	project "jchat_microbench"
+		kind "ConsoleApp"
+		language "C++"
+		targetdir "build/%{cfg.buildcfg}"
+
+		includedirs { "jchat_lib/", "jchat_common/", "jchat_server/include/", "jchat_server/src/", "jchat_microbench/include/" }
+		files { "jchat_lib/**", "jchat_common/**", "jchat_server/include/**", "jchat_server/src/**.cpp", "jchat_microbench/include/**", "jchat_microbench/src/**.cpp" }
+		removefiles { "jchat_server/src/main.cpp" }
+
+		filter "platforms:Win32"
+			architecture "x32"
+			links { "ws2_32" }
+
+		filter "platforms:Win64"
+			architecture "x64"
+			links { "ws2_32" }
+
+		filter "platforms:Unix32"
+			architecture "x32"
+			defines { "JCHAT_USE_ZLIB" }
+			links { "z" }
+
+		filter "platforms:Unix64"
+			architecture "x64"
+			defines { "JCHAT_USE_ZLIB" }
+			links { "z" }
 
 		configuration "Debug"
 			defines { "DEBUG" }